@@ -0,0 +1,57 @@
+/*~--------------------------------------------------------------------------~*
+ * Copyright (c) 2017 Triad National Security, LLC
+ * All rights reserved.
+ *~--------------------------------------------------------------------------~*/
+
+/*~--------------------------------------------------------------------------~*
+ *
+ * /@@@@@@@@  @@           @@@@@@   @@@@@@@@ @@@@@@@  @@      @@
+ * /@@/////  /@@          @@////@@ @@////// /@@////@@/@@     /@@
+ * /@@       /@@  @@@@@  @@    // /@@       /@@   /@@/@@     /@@
+ * /@@@@@@@  /@@ @@///@@/@@       /@@@@@@@@@/@@@@@@@ /@@@@@@@@@@
+ * /@@////   /@@/@@@@@@@/@@       ////////@@/@@////  /@@//////@@
+ * /@@       /@@/@@//// //@@    @@       /@@/@@      /@@     /@@
+ * /@@       @@@//@@@@@@ //@@@@@@  @@@@@@@@ /@@      /@@     /@@
+ * //       ///  //////   //////  ////////  //       //      //
+ *
+ *~--------------------------------------------------------------------------~*/
+
+/**
+ * @file main.cc
+ * @author Julien Loiseau
+ * @date April 2017
+ * @brief Main function, start MPI with Gasnet. Then launch fleCSI runtime.
+ */
+
+#include "cassert"
+
+//#include <flecsi.h>
+#include "flecsi/concurrency/thread_pool.h"
+#include "flecsi/execution/execution.h"
+
+#include "log.h"
+
+#include <mpi.h>
+#ifdef ENABLE_LEGION
+#include <legion.h>
+#endif
+
+int
+main(int argc, char * argv[]) {
+
+  int provided;
+
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+#ifdef ENABLE_LEGION
+  if(provided < MPI_THREAD_MULTIPLE)
+    printf("ERROR: Your implementation of MPI does not support "
+           "MPI_THREAD_MULTIPLE which is required for use of the "
+           "GASNet MPI conduit with the Legion-MPI Interop!\n");
+  assert(provided == MPI_THREAD_MULTIPLE);
+#endif
+
+  auto retval = flecsi::execution::context_t::instance().initialize(argc, argv);
+
+  MPI_Finalize();
+  return retval;
+}
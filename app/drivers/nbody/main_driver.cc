@@ -0,0 +1,204 @@
+/*~--------------------------------------------------------------------------~*
+ * Copyright (c) 2017 Triad National Security, LLC
+ * All rights reserved.
+ *~--------------------------------------------------------------------------~*/
+
+/*~--------------------------------------------------------------------------~*
+ *
+ * /@@@@@@@@  @@           @@@@@@   @@@@@@@@ @@@@@@@  @@      @@
+ * /@@/////  /@@          @@////@@ @@////// /@@////@@/@@     /@@
+ * /@@       /@@  @@@@@  @@    // /@@       /@@   /@@/@@     /@@
+ * /@@@@@@@  /@@ @@///@@/@@       /@@@@@@@@@/@@@@@@@ /@@@@@@@@@@
+ * /@@////   /@@/@@@@@@@/@@       ////////@@/@@////  /@@//////@@
+ * /@@       /@@/@@//// //@@    @@       /@@/@@      /@@     /@@
+ * /@@       @@@//@@@@@@ //@@@@@@  @@@@@@@@ /@@      /@@     /@@
+ * //       ///  //////   //////  ////////  //       //      //
+ *
+ *~--------------------------------------------------------------------------~*/
+
+/**
+ * @file main_driver.cc
+ * @brief N-body driver: the particles move by their gravitation alone.
+ * None of the SPH neighbor passes run, the tree range is not padded by
+ * the smoothing lengths, and the leapfrog is kick-drift-kick on the
+ * gravitational acceleration.
+ */
+
+#include <iostream>
+
+#include <mpi.h>
+#ifdef ENABLE_LEGION
+#include <legion.h>
+#endif
+#include <omp.h>
+
+#include "flecsi/data/data.h"
+#include "flecsi/data/data_client.h"
+#include "flecsi/execution/execution.h"
+
+#include "analysis.h"
+#include "bodies_system.h"
+#include "default_physics.h"
+#include "diagnostic.h"
+
+static std::string output_h5data_file; // = output_h5data_prefix + ".h5part"
+
+using namespace flecsph_log;
+
+void
+set_derived_params() {
+  using namespace param;
+
+  // filenames (this will change for multiple files output)
+  std::ostringstream oss;
+  oss << output_h5data_prefix << ".h5part";
+  output_h5data_file = oss.str();
+
+  // analysis: set output times
+  analysis::set_initial_time_iteration();
+
+  // set gravitational constant
+  fmm::gc = gravitational_constant;
+  if(not body_fields::has(body_fields::gravity))
+    log_fatal("the nbody driver requires the gravity particle fields, "
+              << "add them to BODY_FIELDS" << std::endl);
+  if((gravity_far_interval > 1 or gravity_far_tolerance > 0.) and
+     not body_fields::has(body_fields::gravity_far))
+    log_fatal("gravity_far_interval requires the gravity_far particle "
+              << "fields, add them to BODY_FIELDS" << std::endl);
+
+  // the timestep criterion is on the softening length
+  if(adaptive_timestep and not (gravity_softening_length > 0.))
+    log_fatal("adaptive_timestep in the nbody driver requires "
+              << "gravity_softening_length" << std::endl);
+  if(block_timesteps)
+    log_fatal("block_timesteps is not supported by the nbody driver"
+              << std::endl);
+}
+
+namespace flecsi {
+namespace execution {
+
+void
+mpi_init_task(const char * parameter_file) {
+  using namespace param;
+
+  int rank;
+  int size;
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  // set simulation parameters
+  param::mpi_read_params(parameter_file);
+  set_derived_params();
+
+  // read input file; the tree is built on the positions alone
+  body_system<double, gdimension> bs;
+  bs.read_bodies(initial_data_prefix, output_h5data_prefix, initial_iteration);
+  bs.setMacangle(param::fmm_macangle);
+  bs.setRangePadding(false);
+
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  do {
+    analysis::screen_output(rank);
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    if(physics::iteration == param::initial_iteration) {
+
+      log_one(trace) << "First iteration" << std::endl;
+      bs.update_iteration();
+      bs.apply_all(physics::reset_acceleration);
+      bs.apply_all(integration::save_velocityhalf);
+
+      log_one(trace) << "compute gravitation" << std::endl;
+      bs.gravitation();
+
+      if (adaptive_timestep) {
+        // Update timestep in the very beginning
+        log_one(trace) << "compute adaptive timestep" << std::endl;
+        bs.apply_all(physics::compute_dt_gravity);
+        bs.get_all(physics::set_adaptive_timestep);
+        log_one(trace) << ".done" << std::endl;
+      }
+    }
+    else { // not the initial iteration
+      log_one(trace) << "leapfrog: kick one" << std::endl;
+      bs.apply_all(integration::leapfrog_kick_v);
+      bs.apply_all(integration::save_velocityhalf);
+      log_one(trace) << "kick one: done" << std::endl;
+
+      log_one(trace) << "leapfrog: drift" << std::endl;
+      bs.apply_all(integration::leapfrog_drift);
+      log_one(trace) << "drift: done" << std::endl;
+
+      bs.update_iteration();
+
+      log_one(trace) << "leapfrog: kick two" << std::endl;
+      bs.gravitation();
+      bs.apply_all(integration::leapfrog_kick_v);
+      log_one(trace) << "kick two: done" << std::endl;
+    } // not initial iteration
+
+    // Compute and output scalar reductions and diagnostic
+    analysis::scalar_output(bs,rank);
+    analysis::h5data_output(bs, rank);
+    diagnostic::output(bs,rank);
+
+    // Check for nans
+    bs.apply_all(physics::check_nans);
+
+    if(adaptive_timestep) {
+      // Update timestep
+      log_one(trace) << "compute adaptive timestep" << std::endl;
+      bs.apply_all(physics::compute_dt_gravity);
+      bs.get_all(physics::set_adaptive_timestep);
+      log_one(trace) << ".done" << std::endl;
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    physics::advance_time();
+
+  } while(not physics::termination_criteria());
+} // mpi_init_task
+
+flecsi_register_mpi_task(mpi_init_task, flecsi::execution);
+
+void
+usage() {
+  log_one(warn) << "Usage: ./nbody_" << gdimension << "d "
+                    << "<parameter-file.par>" << std::endl;
+}
+
+bool
+check_conservation(const std::vector<analysis::e_conservation> & check) {
+  return analysis::check_conservation(check);
+}
+
+void
+specialization_tlt_init(int argc, char * argv[]) {
+  log_set_output_rank(0);
+
+  log_one(trace) << "In user specialization_driver" << std::endl;
+
+  // check options list: exactly one option is allowed
+  if(argc != 2) {
+    log_one(error) << "ERROR: parameter file not specified!" << std::endl;
+    usage();
+    return;
+  }
+
+  flecsi_execute_mpi_task(mpi_init_task, flecsi::execution, argv[1]);
+
+} // specialization driver
+
+void
+driver(int, char **) {
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  log_one(trace) << "In user driver" << std::endl;
+} // driver
+
+} // namespace execution
+} // namespace flecsi
@@ -70,8 +70,21 @@ set_derived_params() {
   // set equation of state
   eos::select();
 
+  // install the sph functions specialized for kernel, viscosity and EOS
+  physics::select();
+
   // set gravitational constant
   fmm::gc = gravitational_constant;
+  if(enable_fmm and not body_fields::has(body_fields::gravity))
+    log_fatal("enable_fmm requires the gravity particle fields, "
+              << "add them to BODY_FIELDS" << std::endl);
+  if((gravity_far_interval > 1 or gravity_far_tolerance > 0.) and
+     not body_fields::has(body_fields::gravity_far))
+    log_fatal("gravity_far_interval requires the gravity_far particle "
+              << "fields, add them to BODY_FIELDS" << std::endl);
+
+  if(block_timesteps and not adaptive_timestep)
+    log_fatal("block_timesteps requires adaptive_timestep" << std::endl);
 
   // set external force
   external_force::select(external_force_type);
@@ -122,7 +135,15 @@ mpi_init_task(const char * parameter_file) {
       }
 
       log_one(trace) << "compute density pressure cs" << std::endl;
-      bs.apply_in_smoothinglength(physics::compute_density_pressure_soundspeed);
+      if (sph_variable_h) {
+        bs.apply_in_search_radius(
+          physics::compute_density_smoothinglength_pressure_soundspeed,
+          sph_h_search_factor);
+        physics::check_smoothinglength();
+      }
+      else
+        bs.apply_in_smoothinglength(
+          physics::compute_density_pressure_soundspeed);
       bs.apply_all(integration::save_velocityhalf);
 
       if (sph_viscosity != visc_constant) {
@@ -133,15 +154,23 @@ mpi_init_task(const char * parameter_file) {
       // compute acceleration
       log_one(trace) << "compute rhs of evolution equations" << std::endl;
       bs.reset_ghosts();
-      bs.apply_in_smoothinglength(physics::compute_acceleration);
+      // du/dt shares the neighbors of the acceleration; de/dt cannot,
+      // since it needs the gravitational acceleration computed below
+      const bool fused_dudt =
+        evolve_internal_energy and not thermokinetic_formulation;
+      std::vector<physics::sph_pass> rhs = {physics::passes::acceleration()};
+      if (physics::iteration < relaxation_steps)
+        rhs.push_back(physics::passes::short_range_repulsion());
+      if (fused_dudt)
+        rhs.push_back(physics::passes::dudt());
+      bs.apply_in_smoothinglength_fused(rhs);
       if(param::enable_fmm){
         log_one(trace) << "compute gravitation" << std::endl;
-        bs.gravitation_fmm();
+        bs.gravitation();
       }
       if (physics::iteration < relaxation_steps) {
         log_one(trace) << "add relaxation terms" << std::endl;
         bs.apply_all(physics::add_drag_acceleration);
-        bs.apply_in_smoothinglength(physics::add_short_range_repulsion);
         log_one(trace) << "relaxation terms: done" << std::endl;
       }
 
@@ -150,7 +179,7 @@ mpi_init_task(const char * parameter_file) {
         bs.apply_all(physics::set_total_energy);
       }
 
-      if (adaptive_timestep) {
+      if (adaptive_timestep and not block_timesteps) {
         // Update timestep in the very beginning
         log_one(trace) << "compute adaptive timestep" << std::endl;
         bs.apply_all(physics::compute_dt);
@@ -163,7 +192,7 @@ mpi_init_task(const char * parameter_file) {
           // compute de/dt 
           for (int m=1; m<=pressure_updates_number;++m) { // 1 or 2 passes
             log_one(trace) << "compute dedt: pass " << m  << std::endl;
-            bs.apply_in_smoothinglength(physics::compute_dedt);
+            bs.apply_in_smoothinglength_fused(physics::passes::dedt());
             if (physics::iteration < relaxation_steps)
               bs.apply_all(physics::add_drag_dedt);
 
@@ -175,7 +204,8 @@ mpi_init_task(const char * parameter_file) {
           // or compute du/dt
           for (int m=1; m<=pressure_updates_number;++m) { // 1 or 2 passes
             log_one(trace) << "compute dudt: pass " << m  << std::endl;
-            bs.apply_in_smoothinglength(physics::compute_dudt);
+            if (m > 1 or not fused_dudt)
+              bs.apply_in_smoothinglength_fused(physics::passes::dudt());
             if (physics::iteration < relaxation_steps)
               bs.apply_all(physics::add_drag_dudt);
             bs.apply_all(physics::recompute_pressure_soundspeed);
@@ -187,6 +217,10 @@ mpi_init_task(const char * parameter_file) {
       log_one(trace) << "compute initial rhs terms: done" << std::endl;
     }
     else { // not the initial iteration
+      // with block timesteps, kick one applies to the particles starting
+      // a step, and the neighbor sums and kick two to those ending it
+      if (block_timesteps)
+        bs.set_active(integration::starts_step);
       log_one(trace) << "leapfrog: kick one" << std::endl;
       if (evolve_internal_energy) {
         if (thermokinetic_formulation)
@@ -199,15 +233,35 @@ mpi_init_task(const char * parameter_file) {
       log_one(trace) << "kick one: done" << std::endl;
 
       log_one(trace) << "leapfrog: drift" << std::endl;
+      bs.set_active(nullptr);
       bs.apply_all(integration::leapfrog_drift);
+      if (block_timesteps)
+        bs.apply_all(integration::predict_velocity);
       log_one(trace) << "drift: done" << std::endl;
 
+      // the divergence of this step, for the lagged switch of the next
+      // one: saved before update_iteration shares it with the ghosts
+      if (viscosity::lagged_switch())
+        bs.apply_all(viscosity::save_divergence);
       // sync velocities
       bs.update_iteration();
+      if (block_timesteps)
+        bs.set_active(integration::ends_step);
       log_one(trace) << "compute density pressure cs" << std::endl;
-      bs.apply_in_smoothinglength(physics::compute_density_pressure_soundspeed);
-
-      if (sph_viscosity != visc_constant) {
+      if (sph_variable_h) {
+        bs.apply_in_search_radius(
+          physics::compute_density_smoothinglength_pressure_soundspeed,
+          sph_h_search_factor);
+        physics::check_smoothinglength();
+      }
+      else
+        bs.apply_in_smoothinglength(
+          physics::compute_density_pressure_soundspeed);
+      if (physics::batched_eos())
+        bs.apply_all_batched(eos::compute_all);
+
+      // with the lagged switch, alpha is updated in the density pass
+      if (sph_viscosity != visc_constant and not viscosity::lagged_switch()) {
         log_one(trace) << "computing adaptive viscosity" << std::endl;
         bs.apply_in_smoothinglength(viscosity::compute_alpha);
       }
@@ -215,15 +269,24 @@ mpi_init_task(const char * parameter_file) {
       // compute acceleration
       log_one(trace) << "leapfrog: kick two (velocity)" << std::endl;
       bs.reset_ghosts();
-      bs.apply_in_smoothinglength(physics::compute_acceleration);
+      if (physics::iteration < relaxation_steps)
+        bs.apply_in_smoothinglength_fused(physics::passes::acceleration(),
+          physics::passes::short_range_repulsion());
+      else
+        bs.apply_in_smoothinglength_fused(physics::passes::acceleration());
       if(param::enable_fmm){
         log_one(trace) << "computing gravitation" << std::endl;
-        bs.gravitation_fmm();
+        if (block_timesteps) {
+          // the FMM computes the gravitation of all the particles
+          bs.set_active(nullptr);
+          bs.gravitation();
+          bs.set_active(integration::ends_step);
+        }
+        else
+          bs.gravitation();
       }
-      if (physics::iteration < relaxation_steps) {
+      if (physics::iteration < relaxation_steps)
         bs.apply_all(physics::add_drag_acceleration);
-        bs.apply_in_smoothinglength(physics::add_short_range_repulsion);
-      }
       bs.apply_all(integration::leapfrog_kick_v);
       log_one(trace) << "kick two (velocity): done" << std::endl;
 
@@ -235,11 +298,15 @@ mpi_init_task(const char * parameter_file) {
         if (thermokinetic_formulation) {
           for (int m=1; m<=pressure_updates_number;++m) { // 1 or 2 passes
             log_one(trace) << "compute dedt: pass " << m  << std::endl;
-            bs.apply_in_smoothinglength(physics::compute_dedt);
+            bs.apply_in_smoothinglength_fused(physics::passes::dedt());
             if (physics::iteration < relaxation_steps)
               bs.apply_all(physics::add_drag_dedt);
 
-            bs.apply_all(physics::recompute_pressure_soundspeed_thermokinetic);
+            if (physics::batched_eos())
+              bs.apply_all_batched(
+                physics::recompute_pressure_soundspeed_thermokinetic_batched);
+            else
+              bs.apply_all(physics::recompute_pressure_soundspeed_thermokinetic);
             if (m < pressure_updates_number)
               bs.reset_ghosts(); // skip syncing with the last pass
           }
@@ -249,11 +316,15 @@ mpi_init_task(const char * parameter_file) {
         else {
           for (int m=1; m<=pressure_updates_number;++m) { // 1 or 2 passes
             log_one(trace) << "compute dudt: pass " << m  << std::endl;
-            bs.apply_in_smoothinglength(physics::compute_dudt);
+            bs.apply_in_smoothinglength_fused(physics::passes::dudt());
             if (physics::iteration < relaxation_steps)
               bs.apply_all(physics::add_drag_dudt);
 
-            bs.apply_all(physics::recompute_pressure_soundspeed);
+            if (physics::batched_eos())
+              bs.apply_all_batched(
+                physics::recompute_pressure_soundspeed_batched);
+            else
+              bs.apply_all(physics::recompute_pressure_soundspeed);
             if (m < pressure_updates_number) 
               bs.reset_ghosts(); // skip syncing with the last pass
           }
@@ -261,13 +332,11 @@ mpi_init_task(const char * parameter_file) {
         }
         log_one(trace) << "kick two (energy): done" << std::endl;
       } // evolve internal energy
+      bs.set_active(nullptr);
     } // not initial iteration
 
-    if(sph_variable_h){
-      log_one(trace) << "updating smoothing length"<<std::endl;
-      bs.get_all(physics::compute_smoothinglength);
-      log_one(trace) << ".done" << std::endl;
-    }else if(sph_update_uniform_h){
+    // with sph_variable_h, h is solved for with the density
+    if(sph_update_uniform_h and not sph_variable_h){
       // The particles moved, compute new smoothing length
       log_one(trace) << "updating smoothing length"<<std::endl;
       bs.get_all(physics::compute_average_smoothinglength,bs.getNBodies());
@@ -286,8 +355,16 @@ mpi_init_task(const char * parameter_file) {
     if(adaptive_timestep) {
       // Update timestep
       log_one(trace) << "compute adaptive timestep" << std::endl;
-      bs.apply_all(physics::compute_dt);
-      bs.get_all(physics::set_adaptive_timestep);
+      if (block_timesteps) {
+        bs.set_active(integration::ends_step);
+        bs.apply_all(physics::compute_dt);
+        bs.set_active(nullptr);
+        bs.get_all(physics::set_block_timestep);
+      }
+      else {
+        bs.apply_all(physics::compute_dt);
+        bs.get_all(physics::set_adaptive_timestep);
+      }
       log_one(trace) << ".done" << std::endl;
     }
 
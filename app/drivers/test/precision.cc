@@ -0,0 +1,103 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <mpi.h>
+
+#include <log.h>
+#include "user.h"
+
+// Runs PRECISION_PROBLEM and keeps its scalar reductions under a name
+// tagged by the precision mode. The run with the single precision storage
+// of MIXED_PRECISION (the computation stays in double) then compares its
+// conserved quantities against the full double precision reference, which
+// must have been produced first (see test dependencies in CMakeLists.txt).
+
+namespace flecsi {
+namespace execution {
+void mpi_init_task(const char * parameter_file);
+}
+} // namespace flecsi
+
+using namespace flecsi;
+using namespace execution;
+
+#ifdef MIXED_PRECISION
+const std::string precision_tag = "mixed";
+#else
+const std::string precision_tag = "double";
+#endif
+
+const std::string problem = PRECISION_PROBLEM;
+
+std::string
+reductions_file(const std::string & tag) {
+  return "scalar_reductions_" + problem + "_" + tag + ".dat";
+}
+
+std::vector<std::vector<double>>
+read_reductions(const std::string & filename) {
+  std::vector<std::vector<double>> lines;
+  std::ifstream in(filename);
+  std::string line;
+  while(std::getline(in, line)) {
+    if(line.empty() or line[0] == '#')
+      continue;
+    std::istringstream iss(line);
+    std::vector<double> values;
+    double v;
+    while(iss >> v)
+      values.push_back(v);
+    lines.push_back(values);
+  }
+  return lines;
+}
+
+TEST(precision, conservation) {
+  MPI_Init(nullptr, nullptr);
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  mpi_init_task((problem + ".par").c_str());
+
+  if(rank == 0) {
+    ASSERT_EQ(0, std::rename("scalar_reductions.dat",
+                   reductions_file(precision_tag).c_str()));
+#ifdef MIXED_PRECISION
+    const auto ref = read_reductions(reductions_file("double"));
+    const auto mix = read_reductions(reductions_file("mixed"));
+    ASSERT_FALSE(ref.empty());
+    ASSERT_FALSE(mix.empty());
+
+    // columns: 1:iteration 2:time 3:timestep 4:mass 5:energy ... 8:momentum
+    const double tol = 1e-5;
+    const double mass = ref[0][3], energy = std::abs(ref[0][4]);
+    const double pscale = std::sqrt(2. * mass * energy);
+    double err_mass = 0., err_energy = 0., err_momentum = 0.;
+    // adaptive timesteps may end the runs at slightly different iterations
+    for(size_t i = 0; i < std::min(ref.size(), mix.size()); ++i) {
+      err_mass = std::max(err_mass, std::abs(mix[i][3] - ref[i][3]) / mass);
+      err_energy =
+        std::max(err_energy, std::abs(mix[i][4] - ref[i][4]) / energy);
+      for(size_t k = 7; k < 7 + gdimension; ++k)
+        err_momentum =
+          std::max(err_momentum, std::abs(mix[i][k] - ref[i][k]) / pscale);
+    }
+    std::cout << problem << ": max relative deviation from double precision"
+              << std::endl
+              << "  mass:     " << err_mass << std::endl
+              << "  energy:   " << err_energy << std::endl
+              << "  momentum: " << err_momentum << std::endl;
+    EXPECT_LT(err_mass, tol);
+    EXPECT_LT(err_energy, tol);
+    EXPECT_LT(err_momentum, tol);
+#endif
+  }
+  MPI_Finalize();
+}
@@ -15,6 +15,10 @@ include(CMakeDependentOption)
 option(ENABLE_UNIT_TESTS "Enable unit tests" ON)
 # enables debug messages from tree
 option(ENABLE_DEBUG_TREE "Enable debug tree" OFF)
+# stores selected particle fields in single precision
+option(ENABLE_MIXED_PRECISION "Enable mixed-precision particle storage" OFF)
+# evaluates the sph neighbor loops on SIMD lanes
+option(ENABLE_SPH_SIMD "Enable SIMD-batched sph passes" OFF)
 # TODO: get rid of this
 #option(ENABLE_DEBUG "Compile in DEBUG mode" OFF)
 # sets integrated log level (0 - none, X - ?)
@@ -22,6 +26,9 @@ set(LOG_STRIP_LEVEL 0 CACHE STRING "LOG Strip level")
 # integer width for keys
 set(KEY_INTEGER_TYPE "uint64_t" CACHE STRING "Type of integer used to generate keys")
 set_property(CACHE KEY_INTEGER_TYPE PROPERTY STRINGS "uint32_t" "uint64_t" "uint128_t")
+# order of the FMM expansions: 1 (monopole), 2 (quadrupole), 3 (octupole)
+set(FMM_ORDER 1 CACHE STRING "Order of the FMM expansions")
+set_property(CACHE FMM_ORDER PROPERTY STRINGS "1" "2" "3")
 
 # tentative; color output at building
 option(ENABLE_FORCE_COMPILE_COLORED "Forces build to use colorized output" ON)
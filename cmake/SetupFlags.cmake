@@ -8,6 +8,8 @@
 # more readable generator expressions
 #------------------------------------------------
 set(debug_tree "$<BOOL:${ENABLE_DEBUG_TREE}>")
+set(mixed_precision "$<BOOL:${ENABLE_MIXED_PRECISION}>")
+set(sph_simd "$<BOOL:${ENABLE_SPH_SIMD}>")
 set(build_debug "$<CONFIG:Debug>")
 set(build_release "$<CONFIG:Release>")
 set(unit_tests "$<BOOL:${ENABLE_UNIT_TESTS}>")
@@ -27,9 +29,16 @@ target_compile_definitions(flecsph::flags
     INTERFACE
         "LOG_STRIP_LEVEL=${LOG_STRIP_LEVEL}"
         "PARALLEL_IO"
+        "FMM_ORDER=${FMM_ORDER}"
         $<${debug_tree}:
           "ENABLE_DEBUG_TREE"
         >
+        $<${mixed_precision}:
+          "MIXED_PRECISION"
+        >
+        $<${sph_simd}:
+          "SPH_SIMD"
+        >
 )
 
 # compiler-specific flags
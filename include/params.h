@@ -141,6 +141,7 @@ typedef enum eos_type_keyword_enum{
   eos_polytropic,
   eos_wd,
   eos_ppt,
+  eos_tabulated,
   eos_no_eos
 } eos_type_keyword;
 
@@ -151,6 +152,32 @@ typedef enum sph_viscosity_keyword_enum {
   visc_cullen
 } sph_viscosity_keyword;
 
+// fmm_mac keywords
+typedef enum fmm_mac_keyword_enum {
+  mac_radius,
+  mac_bmax,
+  mac_relative
+} fmm_mac_keyword;
+
+// gravity_solver keywords
+typedef enum gravity_solver_keyword_enum {
+  solver_fmm,
+  solver_direct
+} gravity_solver_keyword;
+
+// gravity_softening keywords
+typedef enum gravity_softening_keyword_enum {
+  soft_none,
+  soft_plummer,
+  soft_spline
+} gravity_softening_keyword;
+
+// pm_assignment keywords
+typedef enum pm_assignment_keyword_enum {
+  pm_cic,
+  pm_tsc
+} pm_assignment_keyword;
+
 //////////////////////////////////////////////////////////////////////
 //
 // Parameters controlling timestepping and iterations
@@ -188,6 +215,18 @@ DECLARE_PARAM(double, timestep_cfl_factor, 0.25)
 DECLARE_PARAM(bool, adaptive_timestep, false)
 #endif
 
+//- individual power-of-two timesteps (requires adaptive_timestep):
+//  only the particles at the end of their step are updated
+#ifndef block_timesteps
+DECLARE_PARAM(bool, block_timesteps, false)
+#endif
+
+//- number of rungs below the base step: the smallest step is
+//  dt_base / 2^block_timesteps_max_rung
+#ifndef block_timesteps_max_rung
+DECLARE_PARAM(int64_t, block_timesteps_max_rung, 10)
+#endif
+
 //- number of passes when computing du/dt or de/dt 
 //  to accurately update the pressure (1 or 2)
 #ifndef pressure_updates_number
@@ -232,6 +271,29 @@ DECLARE_KEYWORD_PARAM(sph_kernel, wendland_c4)
 DECLARE_PARAM(double, sph_sinc_index, 4.0)
 #endif
 
+//- if true, evaluate the kernel and its gradient by interpolation
+//  in a table precomputed in kernels::select()
+#ifndef sph_kernel_tabulated
+DECLARE_PARAM(bool, sph_kernel_tabulated, false)
+#endif
+
+//- if true, passes with a pairwise form (acceleration, du/dt, de/dt)
+//  evaluate every pair of particles once and update both of them
+#ifndef sph_symmetric_pairs
+DECLARE_PARAM(bool, sph_symmetric_pairs, false)
+#endif
+
+//- if true, the kernel gradients of the neighbor pairs are computed once
+//  per step and shared by the viscosity switch, acceleration and energy
+//  passes, within a budget of sph_pair_cache_mb megabytes per rank
+#ifndef sph_pair_cache
+DECLARE_PARAM(bool, sph_pair_cache, false)
+#endif
+
+#ifndef sph_pair_cache_mb
+DECLARE_PARAM(double, sph_pair_cache_mb, 512.)
+#endif
+
 //- if true, recompute (uniform) smoothing length every timestep
 //  h = average { sph_eta (m/rho)^1/D } (Rosswog'09, eq.51)
 #ifndef sph_update_uniform_h
@@ -244,6 +306,12 @@ DECLARE_PARAM(bool, sph_update_uniform_h, false)
 DECLARE_PARAM(bool, sph_variable_h, false)
 #endif
 
+//- with sph_variable_h, the density pass solves for h and rho together
+//  among the candidate neighbors within sph_h_search_factor * h
+#ifndef sph_h_search_factor
+DECLARE_PARAM(double, sph_h_search_factor, 1.1)
+#endif
+
 //
 // Geometric parameters
 //
@@ -464,15 +532,23 @@ DECLARE_PARAM(double, wvt_radius, 1.0)
 //  * "polytropic"
 //  * "white dwarf"
 //  * "piecewise polytropic"
+//  * "tabulated": stellar collapse table from eos_tab_file_path
 #ifndef eos_type
 DECLARE_KEYWORD_PARAM(eos_type, eos_ideal)
 #endif
 
-// - file for tabulated EOS
+// - file for tabulated EOS (HDF5, see tools/dummyTabEOS)
 #ifndef eos_tab_file_path
 DECLARE_STRING_PARAM(eos_tab_file_path, ".")
 #endif
 
+//- if true, the EOS is evaluated in one batched sweep over the particles
+//  after the density pass and for the half-step pressure updates, rather
+//  than one particle at a time
+#ifndef eos_batched
+DECLARE_PARAM(bool, eos_batched, false)
+#endif
+
 //- polytropic index
 #ifndef poly_gamma
 DECLARE_PARAM(double, poly_gamma, 1.4)
@@ -529,6 +605,13 @@ DECLARE_PARAM(double, sph_viscosity_epsilon, 0.01)
   DECLARE_PARAM(double,sph_viscosity_delta,1.0)
 #endif
 
+//- in adaptive Cullen+10 viscosity: if true, alpha is updated in the
+//  density pass from the divergence of the neighbors at the previous
+//  step, which saves the separate viscosity traversal
+#ifndef sph_viscosity_lagged_switch
+  DECLARE_PARAM(bool,sph_viscosity_lagged_switch,false)
+#endif
+
 //
 // Gravity-related parameters
 //
@@ -537,16 +620,109 @@ DECLARE_PARAM(double, sph_viscosity_epsilon, 0.01)
 DECLARE_PARAM(bool, enable_fmm, false)
 #endif
 
+// - gravity solver (with enable_fmm); options:
+//   * fmm:    the tree, with the options below
+//     direct: direct summation over all the particles, for small systems
+//             or as a reference (see direct.h)
+#ifndef gravity_solver
+DECLARE_KEYWORD_PARAM(gravity_solver, solver_fmm)
+#endif
+
 //- mac'n'cheese acceptance criteria
 #ifndef fmm_macangle
 DECLARE_PARAM(double, fmm_macangle, 0.0)
 #endif
 
-//- maximum mass per cell
+// - multipole acceptance criterion, for cells of radius r (largest
+//   distance from the center of mass to the particles) at a distance d;
+//   options:
+//   * radius:   r_sink + r_source < fmm_macangle * d
+//     bmax:     the same with the distances from the centers of mass to
+//               the farthest corners of the cell boxes
+//     relative: G M_source (r_sink + r_source)^p / d^(p+2) smaller
+//               than fmm_mac_tolerance times the smallest gravitational
+//               acceleration of the sink at the last step, p = FMM_ORDER,
+//               and r_sink + r_source < fmm_macangle * d (radius criterion
+//               before any acceleration is known)
+#ifndef fmm_mac
+DECLARE_KEYWORD_PARAM(fmm_mac, mac_radius)
+#endif
+
+//- relative force error tolerated by the relative criterion
+#ifndef fmm_mac_tolerance
+DECLARE_PARAM(double, fmm_mac_tolerance, 0.005)
+#endif
+
+//- maximum mass per cell: heavier source cells are always opened (if > 0)
 #ifndef fmm_max_cell_mass
 DECLARE_PARAM(double, fmm_max_cell_mass, 0.)
 #endif
 
+//- exchange the locally essential trees before the FMM traversal, rather
+//  than requesting the remote cells during it
+#ifndef fmm_let
+DECLARE_PARAM(bool, fmm_let, false)
+#endif
+
+// - softening of the particle-particle gravity; options:
+//   * none:    point masses
+//     plummer: Plummer spheres, 1/sqrt(r^2 + eps^2)
+//     spline:  cubic spline density of support gravity_softening_length,
+//              Newtonian beyond it
+#ifndef gravity_softening
+DECLARE_KEYWORD_PARAM(gravity_softening, soft_none)
+#endif
+
+//- Plummer length eps, or support of the spline softening
+#ifndef gravity_softening_length
+DECLARE_PARAM(double, gravity_softening_length, 0.)
+#endif
+
+//- subcycling of the FMM gravity: the far field, erf(r/2r_s)/r, is
+//  recomputed every gravity_far_interval calls, and only the near field,
+//  within pm_cutoff * r_s, in between, with the far field extrapolated
+//  from its gradient
+#ifndef gravity_far_interval
+DECLARE_PARAM(int, gravity_far_interval, 1)
+#endif
+
+//- split scale r_s between the near and far fields, in units of the
+//  largest smoothing length at the refresh
+#ifndef gravity_far_split
+DECLARE_PARAM(double, gravity_far_split, 0.5)
+#endif
+
+//- refresh the far field before the interval when its extrapolated change
+//  exceeds this fraction of the acceleration of a particle (if > 0)
+#ifndef gravity_far_tolerance
+DECLARE_PARAM(double, gravity_far_tolerance, 0.)
+#endif
+
+//- TreePM: number of mesh points per dimension over the particles, a
+//  power of 2 of at least 8, or 0 for the tree alone. The mesh adds the
+//  long-range gravity; the tree keeps the short range, within
+//  pm_cutoff * r_s
+#ifndef pm_grid
+DECLARE_PARAM(int, pm_grid, 0)
+#endif
+
+// - mass assignment to the mesh and interpolation back; options:
+//   * cic: cloud in cell
+//     tsc: triangular shaped cloud
+#ifndef pm_assignment
+DECLARE_KEYWORD_PARAM(pm_assignment, pm_tsc)
+#endif
+
+//- split scale r_s between the long and short range, in mesh cells
+#ifndef pm_split
+DECLARE_PARAM(double, pm_split, 1.25)
+#endif
+
+//- range of the short-range forces, in units of r_s
+#ifndef pm_cutoff
+DECLARE_PARAM(double, pm_cutoff, 4.5)
+#endif
+
 //
 // Parameters for particle relaxation, used to relax configurations
 // by applying negative drag force against the direction of velocity
@@ -858,6 +1034,14 @@ set_param(const std::string & param_name, const std::string & param_value) {
   READ_BOOLEAN_PARAM(adaptive_timestep)
 #endif
 
+#ifndef block_timesteps
+  READ_BOOLEAN_PARAM(block_timesteps)
+#endif
+
+#ifndef block_timesteps_max_rung
+  READ_NUMERIC_PARAM(block_timesteps_max_rung)
+#endif
+
 # ifndef pressure_updates_number
   READ_NUMERIC_PARAM(pressure_updates_number)
 # endif
@@ -933,6 +1117,22 @@ set_param(const std::string & param_name, const std::string & param_value) {
   READ_NUMERIC_PARAM(sph_sinc_index)
 #endif
 
+#ifndef sph_kernel_tabulated
+  READ_BOOLEAN_PARAM(sph_kernel_tabulated)
+#endif
+
+#ifndef sph_symmetric_pairs
+  READ_BOOLEAN_PARAM(sph_symmetric_pairs)
+#endif
+
+#ifndef sph_pair_cache
+  READ_BOOLEAN_PARAM(sph_pair_cache)
+#endif
+
+#ifndef sph_pair_cache_mb
+  READ_NUMERIC_PARAM(sph_pair_cache_mb)
+#endif
+
 #ifndef sph_update_uniform_h
   READ_BOOLEAN_PARAM(sph_update_uniform_h)
 #endif
@@ -941,6 +1141,10 @@ set_param(const std::string & param_name, const std::string & param_value) {
   READ_BOOLEAN_PARAM(sph_variable_h)
 #endif
 
+#ifndef sph_h_search_factor
+  READ_NUMERIC_PARAM(sph_h_search_factor)
+#endif
+
   // geometric configuration  -----------------------------------------------
 #ifndef domain_type
   READ_NUMERIC_PARAM(domain_type)
@@ -1094,6 +1298,9 @@ set_param(const std::string & param_name, const std::string & param_value) {
          or boost::iequals(str_value, "piecewise_polytropic"))
       _eos_type = eos_ppt;
 
+    else if(boost::iequals(str_value, "tabulated"))
+      _eos_type = eos_tabulated;
+
     else if(boost::iequals(str_value, "no_eos")
          or boost::iequals(str_value, "none"))
       _eos_type = eos_no_eos;
@@ -1117,6 +1324,10 @@ set_param(const std::string & param_name, const std::string & param_value) {
   READ_STRING_PARAM(eos_tab_file_path)
 #endif
 
+#ifndef eos_batched
+  READ_BOOLEAN_PARAM(eos_batched)
+#endif
+
 #ifndef poly_gamma
   READ_NUMERIC_PARAM(poly_gamma)
 #endif
@@ -1183,16 +1394,174 @@ set_param(const std::string & param_name, const std::string & param_value) {
   READ_NUMERIC_PARAM(sph_viscosity_delta)
 # endif
 
+# ifndef sph_viscosity_lagged_switch
+  READ_BOOLEAN_PARAM(sph_viscosity_lagged_switch)
+# endif
+
   // gravity-related  -------------------------------------------------------
 
 #ifndef enable_fmm
   READ_BOOLEAN_PARAM(enable_fmm)
 #endif
 
+// parsing gravity_solver keywords
+  if (param_name == "gravity_solver") {
+#   ifndef gravity_solver
+    if (boost::iequals(str_value,"fmm"))
+      _gravity_solver =      solver_fmm;
+
+    else if (boost::iequals(str_value,"direct"))
+      _gravity_solver =      solver_direct;
+
+    else {
+      log_one(error)
+          << "ERROR: wrong value for gravity_solver parameter"
+          << std::endl;
+      exit(2);
+    }
+#   else
+    if (not boost::iequals(str_value,QUOTE(gravity_solver))) {
+      log_one(error)
+          << "ERROR: gravity_solver #define'd as \"" << QUOTE(gravity_solver)
+          << "\" but is reset to \"" << str_value << "\" in parameter file"
+          << std::endl;
+      exit(2);
+    }
+#   endif
+    unknown_param = false;
+  }
+
 #ifndef fmm_macangle
   READ_NUMERIC_PARAM(fmm_macangle)
 #endif
 
+// parsing fmm_mac keywords
+  if (param_name == "fmm_mac") {
+#   ifndef fmm_mac
+    if (boost::iequals(str_value,"radius"))
+      _fmm_mac =             mac_radius;
+
+    else if (boost::iequals(str_value,"bmax"))
+      _fmm_mac =             mac_bmax;
+
+    else if (boost::iequals(str_value,"relative"))
+      _fmm_mac =             mac_relative;
+
+    else {
+      log_one(error)
+          << "ERROR: wrong value for fmm_mac parameter"
+          << std::endl;
+      exit(2);
+    }
+#   else
+    if (not boost::iequals(str_value,QUOTE(fmm_mac))) {
+      log_one(error)
+          << "ERROR: fmm_mac #define'd as \"" << QUOTE(fmm_mac)
+          << "\" but is reset to \"" << str_value << "\" in parameter file"
+          << std::endl;
+      exit(2);
+    }
+#   endif
+    unknown_param = false;
+  }
+
+#ifndef fmm_mac_tolerance
+  READ_NUMERIC_PARAM(fmm_mac_tolerance)
+#endif
+
+#ifndef fmm_max_cell_mass
+  READ_NUMERIC_PARAM(fmm_max_cell_mass)
+#endif
+
+#ifndef fmm_let
+  READ_BOOLEAN_PARAM(fmm_let)
+#endif
+
+// parsing gravity_softening keywords
+  if (param_name == "gravity_softening") {
+#   ifndef gravity_softening
+    if (boost::iequals(str_value,"none"))
+      _gravity_softening =   soft_none;
+
+    else if (boost::iequals(str_value,"plummer"))
+      _gravity_softening =   soft_plummer;
+
+    else if (boost::iequals(str_value,"spline"))
+      _gravity_softening =   soft_spline;
+
+    else {
+      log_one(error)
+          << "ERROR: wrong value for gravity_softening parameter"
+          << std::endl;
+      exit(2);
+    }
+#   else
+    if (not boost::iequals(str_value,QUOTE(gravity_softening))) {
+      log_one(error)
+          << "ERROR: gravity_softening #define'd as \"" << QUOTE(gravity_softening)
+          << "\" but is reset to \"" << str_value << "\" in parameter file"
+          << std::endl;
+      exit(2);
+    }
+#   endif
+    unknown_param = false;
+  }
+
+#ifndef gravity_softening_length
+  READ_NUMERIC_PARAM(gravity_softening_length)
+#endif
+
+#ifndef gravity_far_interval
+  READ_NUMERIC_PARAM(gravity_far_interval)
+#endif
+
+#ifndef gravity_far_split
+  READ_NUMERIC_PARAM(gravity_far_split)
+#endif
+
+#ifndef gravity_far_tolerance
+  READ_NUMERIC_PARAM(gravity_far_tolerance)
+#endif
+
+#ifndef pm_grid
+  READ_NUMERIC_PARAM(pm_grid)
+#endif
+
+// parsing pm_assignment keywords
+  if (param_name == "pm_assignment") {
+#   ifndef pm_assignment
+    if (boost::iequals(str_value,"cic"))
+      _pm_assignment =       pm_cic;
+
+    else if (boost::iequals(str_value,"tsc"))
+      _pm_assignment =       pm_tsc;
+
+    else {
+      log_one(error)
+          << "ERROR: wrong value for pm_assignment parameter"
+          << std::endl;
+      exit(2);
+    }
+#   else
+    if (not boost::iequals(str_value,QUOTE(pm_assignment))) {
+      log_one(error)
+          << "ERROR: pm_assignment #define'd as \"" << QUOTE(pm_assignment)
+          << "\" but is reset to \"" << str_value << "\" in parameter file"
+          << std::endl;
+      exit(2);
+    }
+#   endif
+    unknown_param = false;
+  }
+
+#ifndef pm_split
+  READ_NUMERIC_PARAM(pm_split)
+#endif
+
+#ifndef pm_cutoff
+  READ_NUMERIC_PARAM(pm_cutoff)
+#endif
+
   // relaxation parameters  --------------------------------------------------
 #ifndef relaxation_steps
   READ_NUMERIC_PARAM(relaxation_steps)
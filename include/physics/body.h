@@ -28,6 +28,7 @@
 
 #define OUTPUT
 
+#include "body_fields.h"
 #include "space_vector.h"
 #include "tree_topology/tree_types.h"
 #include "user.h"
@@ -37,7 +38,15 @@ enum particle_type_t : int { NORMAL = 0, WALL = 1 };
 enum state_t : int { NONE = 0, STAR1 = 1, STAR2 = 2, POINTP = 3 };
 
 template<class KEY>
-class body_u : public flecsi::topology::entity<gdimension, type_t, KEY>
+class body_u : public flecsi::topology::entity<gdimension, type_t, KEY>,
+               public body_fields::gravity_u<body_fields::has(
+                 body_fields::gravity)>,
+               public body_fields::cullen_u<body_fields::has(
+                 body_fields::cullen)>,
+               public body_fields::thermo_u<body_fields::has(
+                 body_fields::thermo)>,
+               public body_fields::gravity_far_u<body_fields::has(
+                 body_fields::gravity_far)>
 {
 
   static const size_t dimension = gdimension;
@@ -45,11 +54,12 @@ class body_u : public flecsi::topology::entity<gdimension, type_t, KEY>
   using point_t = flecsi::space_vector_u<element_t, dimension>;
 
   using flecsi::topology::entity<gdimension, type_t, KEY>::mass_;
+  using reduced_t = body_fields::reduced_t;
 
 public:
   body_u()
     : flecsi::topology::entity<gdimension, type_t, KEY>(), type_(NORMAL),
-      state_(NONE){};
+      state_(NONE), rung_(0){};
 
   double getPressure() const {
     return pressure_;
@@ -57,18 +67,9 @@ public:
   double getSoundspeed() const {
     return soundspeed_;
   }
-  double getEntropy() const {
-    return entropy_;
-  }
-  double getElectronfraction() const {
-    return electronfraction_;
-  }
   double getDensity() const {
     return density_;
   }
-  double getTemperature() const {
-    return temperature_;
-  }
   point_t getVelocity() const {
     return velocity_;
   }
@@ -78,15 +79,9 @@ public:
   point_t getAcceleration() const {
     return acceleration_;
   }
-  point_t getGAcceleration() const {
-    return g_acceleration_;
-  }
   particle_type_t type() const {
     return type_;
   };
-  double getGPotential() const {
-    return g_potential_;
-  }
 
   point_t getLinMomentum() const {
     point_t res = {};
@@ -111,12 +106,6 @@ public:
   void setAcceleration(const point_t & acceleration) {
     acceleration_ = acceleration;
   }
-  void setGAcceleration(const point_t & g_acceleration) {
-    g_acceleration_ = g_acceleration;
-  }
-  void setGPotential(const double & g_potential) {
-    g_potential_ = g_potential;
-  }
   void setVelocity(const point_t & velocity) {
     velocity_ = velocity;
   }
@@ -124,23 +113,14 @@ public:
     velocityhalf_ = velocityhalf;
   }
   void setSoundspeed(const double & soundspeed) {
-    soundspeed_ = soundspeed;
+    soundspeed_ = static_cast<reduced_t>(soundspeed);
   }
   void setPressure(const double & pressure) {
     pressure_ = pressure;
   }
-  void setEntropy(const double & entropy) {
-    entropy_ = entropy;
-  }
-  void setElectronfraction(const double & electronfraction) {
-    electronfraction_ = electronfraction;
-  }
   void setDensity(const double & density) {
     density_ = density;
   }
-  void setTemperature(const double & temperature) {
-    temperature_ = temperature;
-  }
   void setDt(const double & dt) {
     dt_ = dt;
   }
@@ -156,13 +136,19 @@ public:
   void set_state(const int & state) {
     state_ = static_cast<state_t>(state);
   }
+  int getRung() const {
+    return rung_;
+  }
+  void setRung(const int & rung) {
+    rung_ = rung;
+  }
   // Dependent of the problem
   double getInternalenergy() const{return internalenergy_;}
   void setInternalenergy(double internalenergy)
       {internalenergy_=internalenergy;}
   double getTotalenergy() const{return totalenergy_;}
   void setTotalenergy(double totalenergy) {totalenergy_=totalenergy;}
-  void setDudt(double dudt){dudt_ = dudt;}
+  void setDudt(double dudt){dudt_ = static_cast<reduced_t>(dudt);}
   void setDedt(double dedt){dedt_ = dedt;}
   double getDudt(){return dudt_;}
   double getDedt(){return dedt_;}
@@ -170,29 +156,14 @@ public:
   void setAdiabatic(double adiabatic){adiabatic_ = adiabatic;}
   double getDadt() const{return dadt_;}
   void setDadt(double dadt){dadt_ = dadt;}
-  void setAlpha(double alpha){alpha_ = alpha;}
+  void setAlpha(double alpha){alpha_ = static_cast<reduced_t>(alpha);}
   double getAlpha() const{return alpha_;}
-  void setDivergenceV(double divergenceV){divergenceV_ = divergenceV;}
-  void setDdivvdt(double dDivVdt){dDivVdt_ = dDivVdt;}
-  double getDivergenceV() const{return divergenceV_;}
-  double getDdivvdt() const{return dDivVdt_;}
-  void setTrigger(double trigger){trigger_ = trigger;}
-  double getTrigger() const{return trigger_;}
-  void setXi(double xi){xi_ = xi;}
-  double getXi() const{return xi_;}
-  void setTraceSS(double traceSS){traceSS_ = traceSS;}
-  double getTraceSS() const{return traceSS_;}
-  void setGradV(double gradv){gradv_ = gradv;}
-  double getGradV() const{return gradv_;}
 
   void setNeighbors(const size_t& neighbors) { neighbors_ = neighbors;}
   size_t getNeighbors() const {return neighbors_;}
 
-  void setPressuremin(const double& pressuremin) { pressuremin_ = pressuremin;}
-  double getPressuremin() const{return pressuremin_;}
-
   void setSignalspeed(const double & signalspeed) {
-    signalspeed_ = signalspeed;
+    signalspeed_ = static_cast<reduced_t>(signalspeed);
   }
   double getSignalspeed() const {
     return signalspeed_;
@@ -209,8 +180,8 @@ public:
     os << " u: " << b.internalenergy_;
     os << " cs: " << b.soundspeed_;
     os << " a: " << b.acceleration_;
-    os << " ga: " << b.g_acceleration_;
-    os << "gpot: " << b.g_potential_;
+    os << " ga: " << b.getGAcceleration();
+    os << "gpot: " << b.getGPotential();
     os << " id: " << b.id_;
     os << " key: " << b.key_;
     os << " owner: " << b.owner_;
@@ -222,33 +193,23 @@ private:
   point_t velocity_;
   point_t velocityhalf_;
   point_t acceleration_;
-  point_t g_acceleration_;
-  double g_potential_;
   double density_;
   double pressure_;
-  double entropy_;
-  double electronfraction_;
-  double temperature_;
-  double soundspeed_;
   double internalenergy_;
   double totalenergy_;
-  double dudt_;
   double dedt_;
   double adiabatic_;
   double dadt_;
   double dt_;
-  double alpha_;
-  double divergenceV_;
-  double dDivVdt_;
-  double trigger_;
-  double xi_;
-  double traceSS_;
-  double gradv_;
-  particle_type_t type_;
   size_t neighbors_;
+  // grouped to avoid padding with single precision storage
+  reduced_t soundspeed_;
+  reduced_t dudt_;
+  reduced_t alpha_;
+  reduced_t signalspeed_;
+  particle_type_t type_;
   state_t state_;
-  double pressuremin_;
-  double signalspeed_;
+  int rung_; // block timestep: dt_base / 2^rung
 }; // class body
 
 #endif // body_h
@@ -0,0 +1,313 @@
+/*~--------------------------------------------------------------------------~*
+ * Copyright (c) 2017 Triad National Security, LLC
+ * All rights reserved.
+ *~--------------------------------------------------------------------------~*/
+
+/*~--------------------------------------------------------------------------~*
+ *
+ * /@@@@@@@@  @@           @@@@@@   @@@@@@@@ @@@@@@@  @@      @@
+ * /@@/////  /@@          @@////@@ @@////// /@@////@@/@@     /@@
+ * /@@       /@@  @@@@@  @@    // /@@       /@@   /@@/@@     /@@
+ * /@@@@@@@  /@@ @@///@@/@@       /@@@@@@@@@/@@@@@@@ /@@@@@@@@@@
+ * /@@////   /@@/@@@@@@@/@@       ////////@@/@@////  /@@//////@@
+ * /@@       /@@/@@//// //@@    @@       /@@/@@      /@@     /@@
+ * /@@       @@@//@@@@@@ //@@@@@@  @@@@@@@@ /@@      /@@     /@@
+ * //       ///  //////   //////  ////////  //       //      //
+ *
+ *~--------------------------------------------------------------------------~*/
+
+/**
+ * @file body_fields.h
+ * @brief Compile-time registry of optional particle field groups.
+ *
+ * A driver lists the groups it needs in the BODY_FIELDS macro, e.g.
+ * -DBODY_FIELDS="cullen|thermo" (see add_driver in app/drivers). Groups
+ * that are not listed are not stored in body_u: their setters are no-ops
+ * and their getters return zero. Since ghosts and sorted particles are
+ * exchanged as raw body records, the MPI volume shrinks accordingly.
+ * Without BODY_FIELDS, all groups are enabled but gravity_far, which only
+ * the drivers keeping the far field between refreshes list explicitly.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "space_vector.h"
+#include "user.h"
+
+namespace body_fields {
+
+enum group : unsigned {
+  none = 0,
+  gravity = 1 << 0, //- g_acceleration(old), g_potential
+  cullen = 1 << 1, //- divergenceV(Lag), dDivVdt, trigger, xi, traceSS, gradV
+  thermo = 1 << 2, //- entropy, electronfraction, temperature, pressuremin
+  gravity_far = 1 << 3, //- far field kept between refreshes, its gradient
+  all = gravity | cullen | thermo
+};
+
+#ifdef BODY_FIELDS
+static constexpr unsigned enabled = (BODY_FIELDS);
+#else
+static constexpr unsigned enabled = all;
+#endif
+
+/**
+ * @brief      True if all the groups in g are stored in the particles
+ */
+constexpr bool
+has(const unsigned g) {
+  return (enabled & g) == g;
+}
+
+/**
+ * @brief      Human readable list of the enabled groups, for logs
+ */
+inline std::string
+names() {
+  std::string s;
+  if(has(gravity))
+    s += "gravity ";
+  if(has(cullen))
+    s += "cullen ";
+  if(has(thermo))
+    s += "thermo ";
+  if(has(gravity_far))
+    s += "gravity_far ";
+  return s.empty() ? "none" : s;
+}
+
+using point_t = flecsi::space_vector_u<type_t, gdimension>;
+using sym_tensor_t =
+  flecsi::tensor_u<type_t, symmetry_type::symmetric, gdimension, gdimension>;
+
+//
+// Storage type of the particle fields which tolerate single precision
+// (sound speed, alpha, du/dt, signal speed). Positions and conserved
+// quantities always stay in type_t. Only the storage is reduced: the
+// accessors and the passes work in double.
+//
+#ifdef MIXED_PRECISION
+using reduced_t = float;
+#else
+using reduced_t = type_t;
+#endif
+
+//
+// Storage for each group, empty when the group is disabled
+//
+template<bool ENABLED>
+class gravity_u
+{
+public:
+  point_t getGAcceleration() const {
+    return g_acceleration_;
+  }
+  double getGPotential() const {
+    return g_potential_;
+  }
+  void setGAcceleration(const point_t & g_acceleration) {
+    g_acceleration_ = g_acceleration;
+  }
+  void setGPotential(const double & g_potential) {
+    g_potential_ = g_potential;
+  }
+  //- |g_acceleration| at the last FMM pass, for the relative opening
+  double getGAccelerationOld() const {
+    return g_acceleration_old_;
+  }
+  void setGAccelerationOld(const double & g_acceleration_old) {
+    g_acceleration_old_ = g_acceleration_old;
+  }
+
+protected:
+  point_t g_acceleration_;
+  double g_potential_;
+  double g_acceleration_old_ = 0.;
+}; // class gravity_u
+
+template<>
+class gravity_u<false>
+{
+public:
+  point_t getGAcceleration() const {
+    return point_t(0.0);
+  }
+  double getGPotential() const {
+    return 0.0;
+  }
+  void setGAcceleration(const point_t &) {}
+  void setGPotential(const double &) {}
+  double getGAccelerationOld() const {
+    return 0.0;
+  }
+  void setGAccelerationOld(const double &) {}
+}; // class gravity_u<false>
+
+template<bool ENABLED>
+class cullen_u
+{
+public:
+  void setDivergenceV(double divergenceV){divergenceV_ = divergenceV;}
+  void setDdivvdt(double dDivVdt){dDivVdt_ = dDivVdt;}
+  void setDivergenceVLag(double divergenceV){divergenceVLag_ = divergenceV;}
+  double getDivergenceV() const{return divergenceV_;}
+  double getDdivvdt() const{return dDivVdt_;}
+  double getDivergenceVLag() const{return divergenceVLag_;}
+  void setTrigger(double trigger){trigger_ = trigger;}
+  double getTrigger() const{return trigger_;}
+  void setXi(double xi){xi_ = xi;}
+  double getXi() const{return xi_;}
+  void setTraceSS(double traceSS){traceSS_ = traceSS;}
+  double getTraceSS() const{return traceSS_;}
+  void setGradV(double gradv){gradv_ = gradv;}
+  double getGradV() const{return gradv_;}
+
+protected:
+  double divergenceV_;
+  double dDivVdt_;
+  double divergenceVLag_; //- of the previous step, sph_viscosity_lagged_switch
+  double trigger_;
+  double xi_;
+  double traceSS_;
+  double gradv_;
+}; // class cullen_u
+
+template<>
+class cullen_u<false>
+{
+public:
+  void setDivergenceV(double){}
+  void setDdivvdt(double){}
+  void setDivergenceVLag(double){}
+  double getDivergenceV() const{return 0.0;}
+  double getDdivvdt() const{return 0.0;}
+  double getDivergenceVLag() const{return 0.0;}
+  void setTrigger(double){}
+  double getTrigger() const{return 0.0;}
+  void setXi(double){}
+  double getXi() const{return 0.0;}
+  void setTraceSS(double){}
+  double getTraceSS() const{return 0.0;}
+  void setGradV(double){}
+  double getGradV() const{return 0.0;}
+}; // class cullen_u<false>
+
+template<bool ENABLED>
+class thermo_u
+{
+public:
+  double getEntropy() const {
+    return entropy_;
+  }
+  double getElectronfraction() const {
+    return electronfraction_;
+  }
+  double getTemperature() const {
+    return temperature_;
+  }
+  void setEntropy(const double & entropy) {
+    entropy_ = entropy;
+  }
+  void setElectronfraction(const double & electronfraction) {
+    electronfraction_ = electronfraction;
+  }
+  void setTemperature(const double & temperature) {
+    temperature_ = temperature;
+  }
+  void setPressuremin(const double& pressuremin) { pressuremin_ = pressuremin;}
+  double getPressuremin() const{return pressuremin_;}
+
+protected:
+  double entropy_;
+  double electronfraction_;
+  double temperature_;
+  double pressuremin_;
+}; // class thermo_u
+
+template<>
+class thermo_u<false>
+{
+public:
+  double getEntropy() const {
+    return 0.0;
+  }
+  double getElectronfraction() const {
+    return 0.0;
+  }
+  double getTemperature() const {
+    return 0.0;
+  }
+  void setEntropy(const double &) {}
+  void setElectronfraction(const double &) {}
+  void setTemperature(const double &) {}
+  void setPressuremin(const double&) {}
+  double getPressuremin() const{return 0.0;}
+}; // class thermo_u<false>
+
+//
+// Far field of the gravity (gravity_far_interval): acceleration, potential
+// and gradient of the acceleration at the position of the last refresh
+//
+template<bool ENABLED>
+class gravity_far_u
+{
+public:
+  point_t getGAccelerationFar() const {
+    return g_acceleration_far_;
+  }
+  double getGPotentialFar() const {
+    return g_potential_far_;
+  }
+  const sym_tensor_t & getGGradientFar() const {
+    return g_gradient_far_;
+  }
+  point_t getGPositionFar() const {
+    return g_position_far_;
+  }
+  void setGAccelerationFar(const point_t & g_acceleration_far) {
+    g_acceleration_far_ = g_acceleration_far;
+  }
+  void setGPotentialFar(const double & g_potential_far) {
+    g_potential_far_ = g_potential_far;
+  }
+  void setGGradientFar(const sym_tensor_t & g_gradient_far) {
+    g_gradient_far_ = g_gradient_far;
+  }
+  void setGPositionFar(const point_t & g_position_far) {
+    g_position_far_ = g_position_far;
+  }
+
+protected:
+  point_t g_acceleration_far_;
+  double g_potential_far_;
+  sym_tensor_t g_gradient_far_;
+  point_t g_position_far_;
+}; // class gravity_far_u
+
+template<>
+class gravity_far_u<false>
+{
+public:
+  point_t getGAccelerationFar() const {
+    return point_t(0.0);
+  }
+  double getGPotentialFar() const {
+    return 0.0;
+  }
+  sym_tensor_t getGGradientFar() const {
+    sym_tensor_t g;
+    g = 0;
+    return g;
+  }
+  point_t getGPositionFar() const {
+    return point_t(0.0);
+  }
+  void setGAccelerationFar(const point_t &) {}
+  void setGPotentialFar(const double &) {}
+  void setGGradientFar(const sym_tensor_t &) {}
+  void setGPositionFar(const point_t &) {}
+}; // class gravity_far_u<false>
+
+} // namespace body_fields
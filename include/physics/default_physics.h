@@ -25,6 +25,7 @@
 
 #pragma once
 
+#include <algorithm>
 #include <vector>
 
 // Basic elements for the physics
@@ -37,11 +38,22 @@ double t_h5data_output = 0.0;
 double t_screen_output = 0.0;
 double t_scalar_output = 0.0;
 int64_t iteration = 0;
+// block timesteps: the iteration advances from tick to tick_next, in
+// units of dt_base / 2^block_timesteps_max_rung (see set_block_timestep)
+double dt_base = 0.0;
+int64_t tick = 0;
+int64_t tick_next = 0;
+// smoothing length solves since the last check_smoothinglength, and those
+// which did not converge
+int64_t h_solves = 0;
+int64_t h_unconverged = 0;
 } // namespace physics
 
 #include "eforce.h"
 #include "kernels.h"
+#include "pair_cache.h"
 #include "params.h"
+#include "scratch.h"
 #include "tree.h"
 #include "user.h"
 #include "utils.h"
@@ -52,6 +64,8 @@ int64_t iteration = 0;
 #include "viscosity.h"
 #include "tensor.h"
 #include "fmm.h"
+#include "sph_pass.h"
+#include "sph_simd.h"
 
 namespace physics {
 using namespace param;
@@ -115,21 +129,21 @@ compute_cofm(node * cofm, std::vector<body *> ents, std::vector<node *> nodes) {
   cofm->set_lap(lap);
   cofm->set_bmin(bmin);
   cofm->set_bmax(bmax);
-
+  fmm::compute_moments(cofm, ents, nodes);
 }
 
 /**
  * @brief      Subtracts mechanical energy from total energy
  *             to recover internal energy
- * @param      srch  The source's body holder
+ * @param      particle  The particle body
+ * @param      epot      Its external potential
  */
 void
-recover_internal_energy(body & particle) {
+recover_internal_energy(body & particle, const double epot) {
   const point_t pos = particle.coordinates(),
                 vel = particle.getVelocity();
   const double etot = particle.getTotalenergy(),
-               ekin = .5*flecsi::dot(vel, vel),
-               epot = external_force::potential(pos);
+               ekin = .5*flecsi::dot(vel, vel);
   const double eint = etot - ekin - epot;
   if (not (eint > 0)) {
     std::cerr << "ERROR: internal energy non-positive:" << std::endl
@@ -144,28 +158,144 @@ recover_internal_energy(body & particle) {
   particle.setInternalenergy(eint);
 } // recover_internal_energy
 
+void
+recover_internal_energy(body & particle) {
+  recover_internal_energy(particle,
+    external_force::potential(particle.coordinates()));
+}
+
+/**
+ * @brief      Recovers the internal energy of the particles, with their
+ *             external potential evaluated in one sweep
+ * @param      particles  The particle bodies
+ */
+void
+recover_internal_energy(std::vector<body *> & particles) {
+  scratch::frame scratch_;
+  external_force::batch x(scratch_, particles);
+  double * epot = scratch_.alloc<double>(simd::padded(x.n));
+  external_force::potential(x, epot);
+  for(size_t i = 0; i < x.n; ++i)
+    recover_internal_energy(*particles[i], epot[i]);
+}
+
+/**
+ * @brief      Computes maximum signal speed for the given particle
+ *
+ * @param      particle  The particle body
+ * @param      nbs       Vector of neighbor particles
+ */
+void
+compute_signalspeed(body & particle, std::vector<body *> & nbs) {
+  using namespace param;
+  using namespace kernels;
+  using namespace flecsi;
+  // this particle (index 'a')
+  const double c_a = particle.getSoundspeed();
+  const point_t pos_a = particle.coordinates(),
+                  v_a = particle.getVelocity();
+
+  // neighbor particles (index 'b')
+  const int n_nb = nbs.size();
+  scratch::frame scratch_;
+  double * c_a_ = scratch_.alloc<double>(n_nb);
+  point_t * pos_ = scratch_.alloc<point_t>(n_nb);
+  point_t * n_a_ = scratch_.alloc<point_t>(n_nb);
+  point_t * v_a_ = scratch_.alloc<point_t>(n_nb);
+
+  for(int b = 0; b < n_nb; ++b) {
+    const body * const nb = nbs[b];
+    const point_t pos_b  = nb->coordinates();
+    n_a_[b] = (pos_a - pos_b)/distance(pos_a, pos_b);
+    v_a_[b]   = v_a - nb->getVelocity();
+    c_a_[b]   = std::max(c_a, nb->getSoundspeed());
+  }
+
+  double vsig = 0.0;
+  for(int b = 0 ; b < n_nb; ++b){
+    vsig = std::max(vsig, c_a_[b] - std::min(dot(v_a_[b],n_a_[b]),0.0));
+  }
+
+  particle.setSignalspeed(vsig);
+} // compute_signalspeed
+
+/**
+ * @brief      Calculates total energy for every particle
+ *             NOTE: total energy does not include grav. energy
+ * @param      particle
+ */
+void
+set_total_energy(body & particle) {
+  const point_t pos = particle.coordinates(),
+                vel = particle.getVelocity();
+  const double eint = particle.getInternalenergy(),
+               ekin = .5*flecsi::dot(vel, vel),
+               epot = external_force::potential(pos);
+  particle.setTotalenergy(ekin + eint + epot);
+} // set_total_energy
+
+/**
+ * @brief      True if the EOS is left out of the density pass, for a
+ *             batched sweep over the particles after it (eos_batched).
+ *             The signal speed of the pass then uses the sound speeds of
+ *             the previous step; the first iteration keeps the EOS in the
+ *             pass, since its sound speeds are not set yet.
+ */
+inline bool
+batched_eos() {
+  return param::eos_batched and physics::iteration > param::initial_iteration;
+}
+
+//
+// Passes which loop over neighbors or call the EOS, specialized for the
+// kernel K, the artificial viscosity V and the equation of state E. The
+// kernel, viscosity and EOS calls are direct and can be inlined in the
+// neighbor loops; physics::select() installs one instantiation of each.
+//
+namespace specialized {
+
 /**
  * @brief      Using current internal energy and dudt,
  *             recompute pressure and soundspeed half-timestep ahead
  *
  * @param      particle  The particle body
  */
+template<param::eos_type_keyword E>
 void
 recompute_pressure_soundspeed(body& particle) {
   const double uint = particle.getInternalenergy();
   const double dudt = particle.getDudt();
   particle.setInternalenergy(uint + 0.5*dt*dudt);
-  eos::compute_pressure(particle);
-  eos::compute_soundspeed(particle);
+  eos::compute_pressure_soundspeed<E>(particle);
   particle.setInternalenergy(uint);
 }
 
+/**
+ * @brief      recompute_pressure_soundspeed of all the particles, with
+ *             the batched EOS
+ *
+ * @param      particles  The particle bodies
+ */
+template<param::eos_type_keyword E>
+void
+recompute_pressure_soundspeed_batched(std::vector<body *> & particles) {
+  if constexpr(E == param::eos_no_eos)
+    return;
+  scratch::frame scratch_;
+  eos::batch b(scratch_, particles);
+  for(size_t i = 0; i < b.n; ++i)
+    b.eps[i] += 0.5*dt*particles[i]->getDudt();
+  eos::eos_t<E>::compute_pressure_soundspeed(b);
+  b.scatter(particles, E == param::eos_tabulated);
+}
+
 /**
  * @brief      Using current total energy and dedt,
  *             recompute pressure and soundspeed half-timestep ahead
  *
  * @param      particle  The particle body
  */
+template<param::eos_type_keyword E>
 void
 recompute_pressure_soundspeed_thermokinetic(body& particle) {
   const double etot = particle.getTotalenergy();
@@ -176,11 +306,35 @@ recompute_pressure_soundspeed_thermokinetic(body& particle) {
   const point_t & a_a = particle.getAcceleration();
   const double v_dot_a = flecsi::dot(v_a, a_a);
   particle.setInternalenergy(uint + 0.5*dt*(dedt - v_dot_a));
-  eos::compute_pressure(particle);
-  eos::compute_soundspeed(particle);
+  eos::compute_pressure_soundspeed<E>(particle);
   particle.setInternalenergy(uint);
 }
 
+/**
+ * @brief      recompute_pressure_soundspeed_thermokinetic of all the
+ *             particles, with the batched EOS
+ *
+ * @param      particles  The particle bodies
+ */
+template<param::eos_type_keyword E>
+void
+recompute_pressure_soundspeed_thermokinetic_batched(
+  std::vector<body *> & particles) {
+  if constexpr(E == param::eos_no_eos)
+    return;
+  recover_internal_energy(particles);
+  scratch::frame scratch_;
+  eos::batch b(scratch_, particles);
+  for(size_t i = 0; i < b.n; ++i) {
+    body & particle = *particles[i];
+    const double v_dot_a =
+      flecsi::dot(particle.getVelocity(), particle.getAcceleration());
+    b.eps[i] += 0.5*dt*(particle.getDedt() - v_dot_a);
+  }
+  eos::eos_t<E>::compute_pressure_soundspeed(b);
+  b.scatter(particles, E == param::eos_tabulated);
+}
+
 /**
  * @brief      Computes the density in "vanilla sph" formulation
  *             [Rosswog'09, eq.(13)]:
@@ -190,6 +344,7 @@ recompute_pressure_soundspeed_thermokinetic(body& particle) {
  * @param      particle  The particle body
  * @param      nbs       Vector of neighbor particles
  */
+template<param::sph_kernel_keyword K, bool TAB = false>
 void
 compute_density(body & particle, std::vector<body *> & nbs) {
   using namespace kernels;
@@ -198,7 +353,10 @@ compute_density(body & particle, std::vector<body *> & nbs) {
   const int n_nb = nbs.size();
   mpi_assert(n_nb > 0);
 
-  double r_a_[n_nb], m_[n_nb], h_[n_nb];
+  scratch::frame scratch_;
+  double * r_a_ = scratch_.alloc<double>(n_nb);
+  double * m_ = scratch_.alloc<double>(n_nb);
+  double * h_ = scratch_.alloc<double>(n_nb);
   for(int b = 0; b < n_nb; ++b) {
     const body * const nb = nbs[b];
     m_[b] = nb->mass();
@@ -209,7 +367,7 @@ compute_density(body & particle, std::vector<body *> & nbs) {
 
   double rho_a = 0.0;
   for(int b = 0; b < n_nb; ++b) { // Vectorized
-    double Wab = sph_kernel_function(r_a_[b], .5 * (h_a + h_[b]));
+    double Wab = kernels::kernel_value<K, TAB>(r_a_[b], .5*(h_a + h_[b]));
     rho_a += m_[b] * Wab;
   } // for
   if(not(rho_a > 0)) {
@@ -228,48 +386,102 @@ compute_density(body & particle, std::vector<body *> & nbs) {
 } // compute_density
 
 /**
- * @brief      Computes maximum signal speed for the given particle
+ * @brief      Solves for the smoothing length and the density together
+ *             [Price'12, eqs.(10,11)], with Newton-Raphson iterations on
  *
- * @param      particle  The particle body
- * @param      nbs       Vector of neighbor particles
+ *             f(h_a) = sum_b m_b W_ab(r_ab, h_a) - m_a (eta k / h_a)^D
+ *
+ *             where eta k = sph_eta * kernel_width, consistent with
+ *             compute_smoothinglength. The neighbors are candidates found
+ *             with the search radius given as the radius of the particle.
+ *             If h_a grows beyond it, the particle keeps the larger h_a
+ *             and its density is not set: it must be searched again (see
+ *             body_system::apply_in_search_radius).
+ *
+ * @param      particle  The particle body, radius = search radius
+ * @param      nbs       Vector of candidate neighbor particles
  */
+template<param::sph_kernel_keyword K, bool TAB = false>
 void
-compute_signalspeed(body & particle, std::vector<body *> & nbs) {
-  using namespace param;
+compute_density_smoothinglength(body & particle, std::vector<body *> & nbs) {
   using namespace kernels;
-  using namespace flecsi;
-  // this particle (index 'a')
-  const double c_a = particle.getSoundspeed();
-  const point_t pos_a = particle.coordinates(),
-                  v_a = particle.getVelocity();
-
-  // neighbor particles (index 'b')
+  const double search = particle.radius();
+  const double m_a = particle.mass();
+  const double eta_k = sph_eta * kernel_width;
+  const point_t pos_a = particle.coordinates();
   const int n_nb = nbs.size();
-  double c_a_[n_nb];
-  point_t pos_[n_nb], n_a_[n_nb], v_a_[n_nb];
+  mpi_assert(n_nb > 0);
 
+  scratch::frame scratch_;
+  double * r_a_ = scratch_.alloc<double>(n_nb);
+  double * m_ = scratch_.alloc<double>(n_nb);
+  point_t * pos_ab_ = scratch_.alloc<point_t>(n_nb);
   for(int b = 0; b < n_nb; ++b) {
     const body * const nb = nbs[b];
-    const point_t pos_b  = nb->coordinates();
-    n_a_[b] = (pos_a - pos_b)/distance(pos_a, pos_b);
-    v_a_[b]   = v_a - nb->getVelocity();
-    c_a_[b]   = std::max(c_a, nb->getSoundspeed());
+    m_[b] = nb->mass();
+    pos_ab_[b] = pos_a - nb->coordinates();
+    r_a_[b] = flecsi::magnitude(pos_ab_[b]);
   }
 
-  double vsig = 0.0;
-  for(int b = 0 ; b < n_nb; ++b){
-    vsig = std::max(vsig, c_a_[b] - std::min(dot(v_a_[b],n_a_[b]),0.0));
+  double h_a = search / sph_h_search_factor, rho_a = 0.0;
+  bool converged = false;
+  for(int i = 0; i < 30; ++i) { // '30' hardcoded, converges in 2-4
+    // rho(h) and drho/dh, with dW/dh = -(D W + r dW/dr) / h
+    double drho_a = 0.0;
+    rho_a = 0.0;
+    for(int b = 0; b < n_nb; ++b) {
+      const double Wab = kernels::kernel_value<K, TAB>(r_a_[b], h_a);
+      const point_t DiWab =
+        kernels::kernel_gradient_value<K, TAB>(pos_ab_[b], h_a);
+      rho_a += m_[b] * Wab;
+      drho_a -= m_[b] * (gdimension * Wab + dot(DiWab, pos_ab_[b])) / h_a;
+    }
+    const double rho_h = m_a * std::pow(eta_k / h_a, gdimension);
+    const double f = rho_a - rho_h, df = drho_a + gdimension * rho_h / h_a;
+    if(std::abs(f) < 1e-8 * rho_h) { // '1e-8' hardcoded
+      converged = true;
+      break;
+    }
+    double h_new = df > 0 ? h_a - f / df
+                          : h_a * std::pow(rho_h / rho_a, 1. / gdimension);
+    h_a = std::min(std::max(h_new, .5 * h_a), 2. * h_a);
+    if(h_a > search)
+      break;
+  }
+  particle.set_radius(h_a);
+  if(h_a > search)
+    return;
+#pragma omp atomic
+  ++h_solves;
+  if(not converged) {
+#pragma omp atomic
+    ++h_unconverged;
   }
 
-  particle.setSignalspeed(vsig);
-} // compute_signalspeed
+  if(not(rho_a > 0)) {
+    std::cerr << "Density of a particle is not a positive number: "
+              << "rho = " << rho_a << ", id: " << particle.id() << std::endl;
+    assert(false);
+  }
+  particle.setDensity(rho_a);
+
+  // keep the neighbors within the new smoothing length
+  nbs.erase(std::remove_if(nbs.begin(), nbs.end(),
+              [&](const body * nb) {
+                return distance(pos_a, nb->coordinates()) >= h_a;
+              }),
+    nbs.end());
+  particle.setNeighbors(nbs.size());
+} // compute_density_smoothinglength
 
 /**
- * @brief      Compute divergence of the velocity field at this particle
+ * @brief      Compute divergence of the velocity field at this particle,
+ *             with h_ab = (h_a + h_b)/2, or h_a if OWN_H
  *
  * @param      particle  The particle body
  * @param      nbs       Vector of neighbor particles
  */
+template<param::sph_kernel_keyword K, bool TAB = false, bool OWN_H = false>
 void
 compute_divv(body & particle, std::vector<body *> & nbs) {
   using namespace kernels;
@@ -279,13 +491,18 @@ compute_divv(body & particle, std::vector<body *> & nbs) {
   const double h_a = particle.radius();
   const point_t & pos_a = particle.coordinates();
   const point_t &   v_a = particle.getVelocity();
+  // with OWN_H the neighbor list is the one of the h solve, not the one
+  // of the force passes
+  pair_cache::pair_t * const pairs =
+    OWN_H ? nullptr : pair_geometry.pairs(particle, nbs.size());
   for(int b = 0 ; b < nbs.size(); ++b){
     const body * const nb = nbs[b];
     const point_t & pos_b = nb->coordinates();
-    const double h_ab = .5*(h_a + nb->radius());
+    const double h_ab = OWN_H ? h_a : .5*(h_a + nb->radius());
     // const double h_b = nb->radius(); // DEBUG
     const double  m_b = nb->mass();
-    const point_t DiWab = sph_kernel_gradient(pos_a - pos_b,h_ab);
+    const point_t DiWab = pair_geometry.gradient(pairs, b, pos_a - pos_b,
+      h_ab, kernels::kernel_gradient_value<K, TAB>);
     //point_t DiWab = .5*(sph_kernel_gradient(pos_a - pos_b,h_a)   // DEBUG
     //                 +  sph_kernel_gradient(pos_a - pos_b,h_b));
     div_v += m_b*dot(v_a, DiWab);
@@ -306,33 +523,55 @@ compute_divv(body & particle, std::vector<body *> & nbs) {
  * @param      particle  The particle body
  * @param      nbs       Vector of neighbor particles
  */
+template<param::sph_kernel_keyword K, param::eos_type_keyword E,
+  bool TAB = false>
 void
 compute_density_pressure_soundspeed(body & particle,
   std::vector<body *> & nbs) {
-  compute_density(particle, nbs);
+#ifdef SPH_SIMD
+  batched::compute_density<K>(particle, nbs);
+#else
+  compute_density<K, TAB>(particle, nbs);
+#endif
   if (evolve_internal_energy and thermokinetic_formulation)
     recover_internal_energy(particle);
-  eos::compute_pressure(particle);
-  eos::compute_soundspeed(particle);
+  if (not batched_eos()) {
+    eos::compute_pressure_soundspeed<E>(particle);
+  }
   compute_signalspeed(particle, nbs);
-  if (sph_viscosity == visc_cullen)
-    compute_divv(particle,nbs);
+  if (sph_viscosity == visc_cullen) {
+    compute_divv<K, TAB>(particle,nbs);
+    if (viscosity::lagged_switch())
+      viscosity::compute_alpha_lagged(particle, nbs);
+  }
 }
 
 /**
- * @brief      Calculates total energy for every particle
- *             NOTE: total energy does not include grav. energy
- * @param      particle
+ * @brief      As compute_density_pressure_soundspeed, solving for the
+ *             smoothing length with the density (sph_variable_h)
+ *
+ * @param      particle  The particle body, radius = search radius
+ * @param      nbs       Vector of candidate neighbor particles
  */
+template<param::sph_kernel_keyword K, param::eos_type_keyword E,
+  bool TAB = false>
 void
-set_total_energy(body & particle) {
-  const point_t pos = particle.coordinates(),
-                vel = particle.getVelocity();
-  const double eint = particle.getInternalenergy(),
-               ekin = .5*flecsi::dot(vel, vel),
-               epot = external_force::potential(pos);
-  particle.setTotalenergy(ekin + eint + epot);
-} // set_total_energy
+compute_density_smoothinglength_pressure_soundspeed(body & particle,
+  std::vector<body *> & nbs) {
+  const double search = particle.radius();
+  compute_density_smoothinglength<K, TAB>(particle, nbs);
+  if(particle.radius() > search)
+    return;
+  if (evolve_internal_energy and thermokinetic_formulation)
+    recover_internal_energy(particle);
+  if (not batched_eos()) {
+    eos::compute_pressure_soundspeed<E>(particle);
+  }
+  compute_signalspeed(particle, nbs);
+  // the radius of the neighbors is their search radius or their new h
+  if (sph_viscosity == visc_cullen)
+    compute_divv<K, TAB, true>(particle, nbs);
+}
 
 /**
  * @brief      Calculates the hydro acceleration ("vanilla ice")
@@ -345,6 +584,8 @@ set_total_energy(body & particle) {
  * @param      particle  The particle body
  * @param      nbs       Vector of neighbor particles
  */
+template<param::sph_kernel_keyword K, param::sph_viscosity_keyword V,
+  bool TAB = false>
 void
 compute_acceleration(body & particle, std::vector<body *> & nbs) {
   using namespace param;
@@ -364,8 +605,18 @@ compute_acceleration(body & particle, std::vector<body *> & nbs) {
 
   // neighbor particles (index 'b')
   const int n_nb = nbs.size();
-  double rho_[n_nb],P_[n_nb],h_[n_nb],m_[n_nb],c_[n_nb],Pi_a_[n_nb],alpha_[n_nb];
-  point_t pos_[n_nb], v12_[n_nb], DiWa_[n_nb];
+  pair_cache::pair_t * const pairs = pair_geometry.pairs(particle, n_nb);
+  scratch::frame scratch_;
+  double * rho_ = scratch_.alloc<double>(n_nb);
+  double * P_ = scratch_.alloc<double>(n_nb);
+  double * h_ = scratch_.alloc<double>(n_nb);
+  double * m_ = scratch_.alloc<double>(n_nb);
+  double * c_ = scratch_.alloc<double>(n_nb);
+  double * Pi_a_ = scratch_.alloc<double>(n_nb);
+  double * alpha_ = scratch_.alloc<double>(n_nb);
+  point_t * pos_ = scratch_.alloc<point_t>(n_nb);
+  point_t * v12_ = scratch_.alloc<point_t>(n_nb);
+  point_t * DiWa_ = scratch_.alloc<point_t>(n_nb);
 
   for(int b = 0; b < n_nb; ++b) {
     const body * const nb = nbs[b];
@@ -388,8 +639,9 @@ compute_acceleration(body & particle, std::vector<body *> & nbs) {
               alpha_ab = .5*(alpha_a + alpha_[b]),
                 rho_ab = .5*(rho_a + rho_[b]),
                   c_ab = .5*(c_a + c_[b]);
-    Pi_a_[b] = sph_artificial_viscosity(alpha_ab, rho_ab, c_ab, mu_ab);
-    DiWa_[b] = sph_kernel_gradient(pos_ab,h_ab);
+    Pi_a_[b] = viscosity_function<V>(alpha_ab, rho_ab, c_ab, mu_ab);
+    DiWa_[b] = pair_geometry.gradient(pairs, b, pos_ab, h_ab,
+      kernels::kernel_gradient_value<K, TAB>);
     // DiWa_[b] = .5*(sph_kernel_gradient(pos_ab,h_a)   // DEBUG
     //             + sph_kernel_gradient(pos_ab,h_[b]));
   }
@@ -418,6 +670,8 @@ compute_acceleration(body & particle, std::vector<body *> & nbs) {
  * @param      particle  The particle body
  * @param      nbs       Vector of neighbor particles
  */
+template<param::sph_kernel_keyword K, param::sph_viscosity_keyword V,
+  bool TAB = false>
 void
 compute_dudt(body & particle, std::vector<body *> & nbs) {
   // Do not change internal energy in relaxation phase
@@ -440,9 +694,19 @@ compute_dudt(body & particle, std::vector<body *> & nbs) {
 
   // neighbor particles (index 'b')
   const int n_nb = nbs.size();
-  double rho_[n_nb],P_[n_nb],h_[n_nb],m_[n_nb],c_[n_nb],Pi_a_[n_nb],alpha_[n_nb];
-  double vab_dot_DiWa_[n_nb];
-  point_t pos_[n_nb], vel_[n_nb], v12_[n_nb];
+  pair_cache::pair_t * const pairs = pair_geometry.pairs(particle, n_nb);
+  scratch::frame scratch_;
+  double * rho_ = scratch_.alloc<double>(n_nb);
+  double * P_ = scratch_.alloc<double>(n_nb);
+  double * h_ = scratch_.alloc<double>(n_nb);
+  double * m_ = scratch_.alloc<double>(n_nb);
+  double * c_ = scratch_.alloc<double>(n_nb);
+  double * Pi_a_ = scratch_.alloc<double>(n_nb);
+  double * alpha_ = scratch_.alloc<double>(n_nb);
+  double * vab_dot_DiWa_ = scratch_.alloc<double>(n_nb);
+  point_t * pos_ = scratch_.alloc<point_t>(n_nb);
+  point_t * vel_ = scratch_.alloc<point_t>(n_nb);
+  point_t * v12_ = scratch_.alloc<point_t>(n_nb);
 
   for(int b = 0; b < n_nb; ++b) {
     const body * const nb = nbs[b];
@@ -467,8 +731,9 @@ compute_dudt(body & particle, std::vector<body *> & nbs) {
               alpha_ab = .5*(alpha_a + alpha_[b]),
                 rho_ab = .5*(rho_a + rho_[b]),
                   c_ab = .5*(c_a + c_[b]);
-    Pi_a_[b] = sph_artificial_viscosity(alpha_ab, rho_ab, c_ab, mu_ab);
-    point_t DiWab  = sph_kernel_gradient(pos_ab,h_ab);
+    Pi_a_[b] = viscosity_function<V>(alpha_ab, rho_ab, c_ab, mu_ab);
+    point_t DiWab = pair_geometry.gradient(pairs, b, pos_ab, h_ab,
+      kernels::kernel_gradient_value<K, TAB>);
     // point_t DiWab = .5*(sph_kernel_gradient(pos_ab,h_a)  // DEBUG
     //                  + sph_kernel_gradient(pos_ab,h_[b]));
     vab_dot_DiWa_[b] = dot(vel_ab, DiWab);
@@ -499,6 +764,8 @@ compute_dudt(body & particle, std::vector<body *> & nbs) {
  * @param      srch  The source's body holder
  * @param      nbsh  The neighbors' body holders
  */
+template<param::sph_kernel_keyword K, param::sph_viscosity_keyword V,
+  bool TAB = false>
 void
 compute_dedt(body & particle, std::vector<body *> & nbs) {
   using namespace viscosity;
@@ -518,9 +785,20 @@ compute_dedt(body & particle, std::vector<body *> & nbs) {
 
   // neighbor particles (index 'b')
   const int n_nb = nbs.size();
-  double rho_[n_nb],P_[n_nb],h_[n_nb],m_[n_nb],c_[n_nb],Pi_a_[n_nb],alpha_[n_nb];
-  double va_dot_DiWa_[n_nb], vb_dot_DiWa_[n_nb];
-  point_t pos_[n_nb], vel_[n_nb], v12_[n_nb];
+  pair_cache::pair_t * const pairs = pair_geometry.pairs(particle, n_nb);
+  scratch::frame scratch_;
+  double * rho_ = scratch_.alloc<double>(n_nb);
+  double * P_ = scratch_.alloc<double>(n_nb);
+  double * h_ = scratch_.alloc<double>(n_nb);
+  double * m_ = scratch_.alloc<double>(n_nb);
+  double * c_ = scratch_.alloc<double>(n_nb);
+  double * Pi_a_ = scratch_.alloc<double>(n_nb);
+  double * alpha_ = scratch_.alloc<double>(n_nb);
+  double * va_dot_DiWa_ = scratch_.alloc<double>(n_nb);
+  double * vb_dot_DiWa_ = scratch_.alloc<double>(n_nb);
+  point_t * pos_ = scratch_.alloc<point_t>(n_nb);
+  point_t * vel_ = scratch_.alloc<point_t>(n_nb);
+  point_t * v12_ = scratch_.alloc<point_t>(n_nb);
 
   for(int b = 0; b < n_nb; ++b) {
     const body * const nb = nbs[b];
@@ -545,8 +823,9 @@ compute_dedt(body & particle, std::vector<body *> & nbs) {
               alpha_ab = .5*(alpha_a + alpha_[b]),
                 rho_ab = .5*(rho_a + rho_[b]),
                   c_ab = .5*(c_a + c_[b]);
-    Pi_a_[b] = sph_artificial_viscosity(alpha_ab, rho_ab, c_ab, mu_ab);
-    point_t DiWab = sph_kernel_gradient(pos_ab,h_ab);
+    Pi_a_[b] = viscosity_function<V>(alpha_ab, rho_ab, c_ab, mu_ab);
+    point_t DiWab = pair_geometry.gradient(pairs, b, pos_ab, h_ab,
+      kernels::kernel_gradient_value<K, TAB>);
     // point_t DiWab = .5*(sph_kernel_gradient(pos_ab,h_a) // DEBUG
     //                  + sph_kernel_gradient(pos_ab,h_[b]));
     va_dot_DiWa_[b] = dot(vel_a, DiWab);
@@ -565,6 +844,300 @@ compute_dedt(body & particle, std::vector<body *> & nbs) {
 
 } // compute_dedt
 
+/**
+ * @brief      Kernel gradient D_i Wab and viscosity Pi_ab of a pair, for the
+ *             pairwise forms below. Pi_ab is symmetric in a and b, and
+ *             D_i Wba = -D_i Wab.
+ */
+template<param::sph_kernel_keyword K, param::sph_viscosity_keyword V,
+  bool TAB = false>
+void
+pair_gradient_viscosity(const body & a, const body & b, point_t & DiWab,
+  double & Pi_ab) {
+  using namespace viscosity;
+  const point_t pos_ab = a.coordinates() - b.coordinates();
+  const point_t v12_ab = a.getVelocityhalf() - b.getVelocityhalf();
+  const double h_ab = .5*(a.radius() + b.radius());
+  const double mu_ab = mu(h_ab, v12_ab, pos_ab),
+            alpha_ab = .5*(a.getAlpha() + b.getAlpha()),
+              rho_ab = .5*(a.getDensity() + b.getDensity()),
+                c_ab = .5*(a.getSoundspeed() + b.getSoundspeed());
+  Pi_ab = viscosity_function<V>(alpha_ab, rho_ab, c_ab, mu_ab);
+  DiWab = kernels::kernel_gradient_value<K, TAB>(pos_ab, h_ab);
+}
+
+/**
+ * @brief      Pairwise form of compute_acceleration: adds the terms of the
+ *             pair a-b to the sums of both particles, with equal and
+ *             opposite forces (see sph_pass.h)
+ */
+template<param::sph_kernel_keyword K, param::sph_viscosity_keyword V,
+  bool TAB = false>
+void
+acceleration_pair(const body & a, const body & b, pair_sums & sa,
+  pair_sums & sb) {
+  if(a.coordinates() == b.coordinates())
+    return;
+  point_t DiWab;
+  double Pi_ab;
+  pair_gradient_viscosity<K, V, TAB>(a, b, DiWab, Pi_ab);
+  const double Prho2_a = a.getPressure()/(a.getDensity()*a.getDensity()),
+               Prho2_b = b.getPressure()/(b.getDensity()*b.getDensity());
+  const point_t f = (Prho2_a + Prho2_b + Pi_ab) * DiWab;
+  sa.acceleration -= b.mass() * f;
+  sb.acceleration += a.mass() * f;
+} // acceleration_pair
+
+/**
+ * @brief      Pairwise form of compute_dudt
+ */
+template<param::sph_kernel_keyword K, param::sph_viscosity_keyword V,
+  bool TAB = false>
+void
+dudt_pair(const body & a, const body & b, pair_sums & sa, pair_sums & sb) {
+  if(iteration < relaxation_steps or a.coordinates() == b.coordinates())
+    return;
+  point_t DiWab;
+  double Pi_ab;
+  pair_gradient_viscosity<K, V, TAB>(a, b, DiWab, Pi_ab);
+  const double Prho2_a = a.getPressure()/(a.getDensity()*a.getDensity()),
+               Prho2_b = b.getPressure()/(b.getDensity()*b.getDensity());
+  // (v_b - v_a).D_i Wba = (v_a - v_b).D_i Wab
+  const double vab_dot_DiWab = dot(a.getVelocity() - b.getVelocity(), DiWab);
+  sa.dudt += b.mass() * (Prho2_a + .5*Pi_ab) * vab_dot_DiWab;
+  sb.dudt += a.mass() * (Prho2_b + .5*Pi_ab) * vab_dot_DiWab;
+} // dudt_pair
+
+/**
+ * @brief      Pairwise form of compute_dedt
+ */
+template<param::sph_kernel_keyword K, param::sph_viscosity_keyword V,
+  bool TAB = false>
+void
+dedt_pair(const body & a, const body & b, pair_sums & sa, pair_sums & sb) {
+  if(a.coordinates() == b.coordinates())
+    return;
+  point_t DiWab;
+  double Pi_ab;
+  pair_gradient_viscosity<K, V, TAB>(a, b, DiWab, Pi_ab);
+  const double Prho2_a = a.getPressure()/(a.getDensity()*a.getDensity()),
+               Prho2_b = b.getPressure()/(b.getDensity()*b.getDensity());
+  const double va_dot_DiWab = dot(a.getVelocity(), DiWab),
+               vb_dot_DiWab = dot(b.getVelocity(), DiWab);
+  // the bracket is the same for a and b, D_i Wba = -D_i Wab
+  const double de = Prho2_a*vb_dot_DiWab + Prho2_b*va_dot_DiWab
+                  + .5*Pi_ab*(va_dot_DiWab + vb_dot_DiWab);
+  sa.dedt -= b.mass() * de;
+  sb.dedt += a.mass() * de;
+} // dedt_pair
+
+} // namespace specialized
+
+/**
+ * @brief      Reports the particles whose smoothing length and density
+ *             did not converge in compute_density_smoothinglength since
+ *             the last call: they keep the last iterate. A warning is
+ *             issued for any of them, an error beyond 1% of the solves.
+ */
+void
+check_smoothinglength() {
+  int64_t n[2] = {h_solves, h_unconverged};
+  MPI_Allreduce(MPI_IN_PLACE, n, 2, MPI_INT64_T, MPI_SUM, MPI_COMM_WORLD);
+  h_solves = h_unconverged = 0;
+  if(n[1] == 0)
+    return;
+  log_one(warn) << n[1] << " of " << n[0] << " particles: smoothing length "
+                << "and density not converged" << std::endl;
+  if(n[1] > 1e-2 * n[0]) // '1e-2' hardcoded
+    log_fatal("smoothing length and density not converged for "
+              << n[1] << " of " << n[0] << " particles");
+} // check_smoothinglength
+
+// sph function types and pointers, installed by select()
+typedef void (*sph_function_t)(body &, std::vector<body *> &);
+typedef void (*particle_function_t)(body &);
+typedef void (*batch_function_t)(std::vector<body *> &);
+
+particle_function_t recompute_pressure_soundspeed = nullptr;
+particle_function_t recompute_pressure_soundspeed_thermokinetic = nullptr;
+batch_function_t recompute_pressure_soundspeed_batched = nullptr;
+batch_function_t recompute_pressure_soundspeed_thermokinetic_batched = nullptr;
+sph_function_t compute_density = nullptr;
+sph_function_t compute_divv = nullptr;
+sph_function_t compute_density_pressure_soundspeed = nullptr;
+sph_function_t compute_density_smoothinglength_pressure_soundspeed = nullptr;
+sph_function_t compute_acceleration = nullptr;
+sph_function_t compute_dudt = nullptr;
+sph_function_t compute_dedt = nullptr;
+
+// pairwise forms, for sph_symmetric_pairs (see sph_pass.h)
+sph_pass::pair_t acceleration_pair = nullptr;
+sph_pass::pair_t dudt_pair = nullptr;
+sph_pass::pair_t dedt_pair = nullptr;
+
+/**
+ * @brief      Calls f with std::integral_constant holding the selected
+ *             kernel, viscosity or EOS keyword. When the keyword is fixed
+ *             at compile time, only this value is instantiated.
+ */
+template<class F>
+void
+with_kernel(F && f) {
+#ifdef sph_kernel
+  f(std::integral_constant<param::sph_kernel_keyword, param::sph_kernel>());
+#else
+  using c = param::sph_kernel_keyword;
+  switch(param::sph_kernel) {
+    case(cubic_spline):
+      f(std::integral_constant<c, cubic_spline>());
+      break;
+    case(quintic_spline):
+      f(std::integral_constant<c, quintic_spline>());
+      break;
+    case(wendland_c2):
+      f(std::integral_constant<c, wendland_c2>());
+      break;
+    case(wendland_c4):
+      f(std::integral_constant<c, wendland_c4>());
+      break;
+    case(wendland_c6):
+      f(std::integral_constant<c, wendland_c6>());
+      break;
+    case(gaussian):
+      f(std::integral_constant<c, gaussian>());
+      break;
+    case(super_gaussian):
+      f(std::integral_constant<c, super_gaussian>());
+      break;
+    case(sinc_ker):
+      f(std::integral_constant<c, sinc_ker>());
+      break;
+    default:
+      log_fatal("Bad kernel parameter" << std::endl);
+  }
+#endif
+}
+
+template<class F>
+void
+with_viscosity(F && f) {
+#ifdef sph_viscosity
+  f(std::integral_constant<param::sph_viscosity_keyword,
+    param::sph_viscosity>());
+#else
+  using c = param::sph_viscosity_keyword;
+  switch(param::sph_viscosity) {
+    case(visc_constant):
+      f(std::integral_constant<c, visc_constant>());
+      break;
+    case(visc_cullen):
+      f(std::integral_constant<c, visc_cullen>());
+      break;
+    default:
+      log_fatal("Bad viscosity parameter" << std::endl);
+  }
+#endif
+}
+
+template<class F>
+void
+with_eos(F && f) {
+#ifdef eos_type
+  f(std::integral_constant<param::eos_type_keyword, param::eos_type>());
+#else
+  using c = param::eos_type_keyword;
+  switch(param::eos_type) {
+    case(eos_polytropic):
+      f(std::integral_constant<c, eos_polytropic>());
+      break;
+    case(eos_ideal):
+      f(std::integral_constant<c, eos_ideal>());
+      break;
+    case(eos_wd):
+      f(std::integral_constant<c, eos_wd>());
+      break;
+    case(eos_ppt):
+      f(std::integral_constant<c, eos_ppt>());
+      break;
+    case(eos_tabulated):
+      f(std::integral_constant<c, eos_tabulated>());
+      break;
+    case(eos_no_eos):
+      f(std::integral_constant<c, eos_no_eos>());
+      break;
+    default:
+      log_fatal("Undefined eos type" << std::endl);
+  }
+#endif
+}
+
+template<class F>
+void
+with_tabulation(F && f) {
+#ifdef sph_kernel_tabulated
+  f(std::bool_constant<param::sph_kernel_tabulated>());
+#else
+  if(param::sph_kernel_tabulated)
+    f(std::true_type());
+  else
+    f(std::false_type());
+#endif
+}
+
+/**
+ * @brief      Installs the specialized sph functions for the kernel,
+ *             viscosity and EOS given in the parameters. The choice is
+ *             made once: the inner loops contain no indirect calls.
+ *             The SIMD passes always use the analytic kernels.
+ */
+void
+select() {
+  with_kernel([](auto k) {
+    with_tabulation([](auto t) {
+      with_viscosity([](auto v) {
+        constexpr auto K = decltype(k)::value;
+        constexpr bool T = decltype(t)::value;
+        constexpr auto V = decltype(v)::value;
+        compute_divv = specialized::compute_divv<K, T>;
+#ifdef SPH_SIMD
+        compute_density = batched::compute_density<K>;
+        compute_acceleration = batched::compute_acceleration<K, V>;
+        compute_dudt = batched::compute_dudt<K, V>;
+        compute_dedt = batched::compute_dedt<K, V>;
+#else
+        compute_density = specialized::compute_density<K, T>;
+        compute_acceleration = specialized::compute_acceleration<K, V, T>;
+        compute_dudt = specialized::compute_dudt<K, V, T>;
+        compute_dedt = specialized::compute_dedt<K, V, T>;
+#endif
+        acceleration_pair = specialized::acceleration_pair<K, V, T>;
+        dudt_pair = specialized::dudt_pair<K, V, T>;
+        dedt_pair = specialized::dedt_pair<K, V, T>;
+      });
+      with_eos([](auto e) {
+        constexpr auto K = decltype(k)::value;
+        constexpr bool T = decltype(t)::value;
+        constexpr auto E = decltype(e)::value;
+        compute_density_pressure_soundspeed =
+          specialized::compute_density_pressure_soundspeed<K, E, T>;
+        compute_density_smoothinglength_pressure_soundspeed = specialized::
+          compute_density_smoothinglength_pressure_soundspeed<K, E, T>;
+      });
+    });
+  });
+  with_eos([](auto e) {
+    constexpr auto E = decltype(e)::value;
+    recompute_pressure_soundspeed =
+      specialized::recompute_pressure_soundspeed<E>;
+    recompute_pressure_soundspeed_thermokinetic =
+      specialized::recompute_pressure_soundspeed_thermokinetic<E>;
+    recompute_pressure_soundspeed_batched =
+      specialized::recompute_pressure_soundspeed_batched<E>;
+    recompute_pressure_soundspeed_thermokinetic_batched =
+      specialized::recompute_pressure_soundspeed_thermokinetic_batched<E>;
+  });
+} // select
+
 /**
  * @brief      Adds energy dissipation rate due to artificial
  *             particle relaxation drag force
@@ -694,6 +1267,32 @@ compute_dt(body & particle) {
   particle.setDt(dtmin);
 }
 
+/**
+ * @brief      Timestep of a particle moved by gravity alone, from its
+ *             acceleration over the softening length:
+ *             dt = C sqrt(eps/|a|), with C = timestep_cfl_factor
+ *
+ * @param      particle
+ */
+void
+compute_dt_gravity(body & particle) {
+  const double tiny = 1e-24;
+  const double acc = magnitude(particle.getGAcceleration());
+  particle.setDt(timestep_cfl_factor *
+                 sqrt(gravity_softening_length / (acc + tiny)));
+}
+
+/**
+ * @brief      Zeroes the hydrodynamic acceleration, for the particles moved
+ *             by gravity alone
+ *
+ * @param      particle
+ */
+void
+reset_acceleration(body & particle) {
+  particle.setAcceleration(0.0);
+}
+
 /**
  * @brief      Adds dissipative drag to acceleration
  *             (used in particles relaxation step)
@@ -753,6 +1352,82 @@ add_short_range_repulsion(body & particle, std::vector<body *> & nbs) {
   particle.setAcceleration(acc_a + acc_r);
 } // add_short_range_repulsion
 
+//
+// Data dependencies of the functions applied in the smoothing length,
+// for body_system::apply_in_smoothinglength_fused. They return the
+// functions installed by select(), which must be called first.
+//
+namespace passes {
+
+// fields read from the neighbors by the hydro force and energy passes
+const unsigned hydro_reads = field::geometry | field::velocityhalf |
+                             field::density | field::pressure |
+                             field::soundspeed | field::alpha;
+
+inline sph_pass
+density_pressure_soundspeed() {
+  return {"density_pressure_soundspeed", compute_density_pressure_soundspeed,
+    field::geometry | field::velocity | field::soundspeed,
+    field::density | field::pressure | field::soundspeed |
+      field::signalspeed | field::divergence | field::internalenergy |
+      (viscosity::lagged_switch() ? field::alpha : 0u)};
+}
+
+inline sph_pass
+alpha() {
+  return {"alpha", viscosity::compute_alpha,
+    field::geometry | field::velocity | field::density | field::soundspeed |
+      field::divergence,
+    field::alpha};
+}
+
+// set the fields from the sums of the pairwise forms
+inline void
+finalize_acceleration(body & particle, const pair_sums & s) {
+  particle.setAcceleration(
+    s.acceleration + external_force::acceleration(particle));
+  particle.setGAcceleration(0);
+  particle.setGPotential(0);
+}
+
+inline void
+finalize_dudt(body & particle, const pair_sums & s) {
+  particle.setDudt(iteration < relaxation_steps ? 0.0 : s.dudt);
+}
+
+inline void
+finalize_dedt(body & particle, const pair_sums & s) {
+  particle.setDedt(
+    s.dedt + dot(particle.getGAcceleration(), particle.getVelocity()));
+}
+
+inline sph_pass
+acceleration() {
+  return {"acceleration", compute_acceleration, hydro_reads,
+    field::acceleration | field::gravity, acceleration_pair,
+    finalize_acceleration};
+}
+
+inline sph_pass
+short_range_repulsion() {
+  return {"short_range_repulsion", add_short_range_repulsion,
+    field::geometry, field::acceleration};
+}
+
+inline sph_pass
+dudt() {
+  return {"dudt", compute_dudt, hydro_reads | field::velocity, field::dudt,
+    dudt_pair, finalize_dudt};
+}
+
+inline sph_pass
+dedt() {
+  return {"dedt", compute_dedt, hydro_reads | field::velocity, field::dedt,
+    dedt_pair, finalize_dedt};
+}
+
+} // namespace passes
+
 /**
  * @brief      Reduce adaptive timestep and set its value
  *
@@ -822,6 +1497,67 @@ set_adaptive_timestep(std::vector<body> & bodies) {
 
 }
 
+/**
+ * @brief      Block timesteps: sets the rung of the particles whose step
+ *             ends at tick_next from their dt (compute_dt), and advances
+ *             the timeline to the next end of step of any particle.
+ *
+ * When all the particles end their step, the timeline restarts and the
+ * base step is chosen so that the smallest dt fits on the last rung.
+ * Otherwise, a particle can move to a smaller step at any time, but to a
+ * larger one only one rung at a time and when the larger step is aligned.
+ *
+ * @param      bodies   Set of local bodies
+ */
+void
+set_block_timestep(std::vector<body> & bodies) {
+  using integration::step_ticks;
+  const int rmax = block_timesteps_max_rung;
+  const int64_t n_ticks = int64_t(1) << rmax;
+  int64_t now = tick_next;
+
+  if(now % n_ticks == 0) { // synchronization point
+    now = 0;
+    double dtmin = 1e24, dtmax = 0.0;
+    for(auto & b : bodies) {
+      dtmin = std::min(dtmin, b.getDt());
+      dtmax = std::max(dtmax, b.getDt());
+    }
+    mpi_utils::reduce_min(dtmin);
+    mpi_utils::reduce_max(dtmax);
+    double dt_new = std::min(dtmax, dtmin * n_ticks);
+    if(dt_base > 0.0)
+      dt_new = std::min(dt_new, 2.0 * dt_base);
+    dt_base = dt_new;
+  }
+
+  for(auto & b : bodies) {
+    if(now % step_ticks(b) != 0)
+      continue;
+    int rung = std::ceil(std::log2(dt_base / b.getDt()));
+    rung = std::min(std::max(rung, 0), rmax);
+    if(now > 0 and rung < b.getRung()) {
+      rung = b.getRung() - 1;
+      if(now % (int64_t(1) << (rmax - rung)) != 0)
+        rung = b.getRung();
+    }
+    b.setRung(rung);
+  }
+
+  // next end of step
+  uint64_t next = UINT64_MAX;
+  for(auto & b : bodies) {
+    const int64_t n = step_ticks(b);
+    next = std::min(next, uint64_t(now - now % n + n));
+  }
+  mpi_utils::reduce_min(next);
+
+  tick = now;
+  tick_next = next;
+  dt = (tick_next - tick) * dt_base / n_ticks;
+  totaltime_next = totaltime + dt;
+}
+
 void
 compute_smoothinglength(std::vector<body> & bodies) {
   if constexpr (gdimension == 1) {
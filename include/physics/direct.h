@@ -0,0 +1,108 @@
+/*~--------------------------------------------------------------------------~*
+ * Copyright (c) 2020 Triad National Security, LLC
+ * All rights reserved.
+ *~--------------------------------------------------------------------------~*/
+
+/*~--------------------------------------------------------------------------~*
+ *
+ * /@@@@@@@@  @@           @@@@@@   @@@@@@@@ @@@@@@@  @@      @@
+ * /@@/////  /@@          @@////@@ @@////// /@@////@@/@@     /@@
+ * /@@       /@@  @@@@@  @@    // /@@       /@@   /@@/@@     /@@
+ * /@@@@@@@  /@@ @@///@@/@@       /@@@@@@@@@/@@@@@@@ /@@@@@@@@@@
+ * /@@////   /@@/@@@@@@@/@@       ////////@@/@@////  /@@//////@@
+ * /@@       /@@/@@//// //@@    @@       /@@/@@      /@@     /@@
+ * /@@       @@@//@@@@@@ //@@@@@@  @@@@@@@@ /@@      /@@     /@@
+ * //       ///  //////   //////  ////////  //       //      //
+ *
+ *~--------------------------------------------------------------------------~*/
+
+/**
+ * @file direct.h
+ * @brief Gravity by direct summation over all the particles
+ *
+ * Every rank packs its particles in a block of coordinates and masses, and
+ * the blocks go around the ranks in a ring: at each of the P steps, a rank
+ * adds the gravitation of the block it holds on its particles while it
+ * sends the block to the next rank and receives the one of the previous
+ * rank. Each rank thus computes N/P x N interactions. The blocks are padded
+ * to the largest one with massless sources, for messages of a fixed size.
+ * The sources of a block are taken by tiles which stay in the cache while
+ * all the particles of the rank go over them, each with the SIMD kernel of
+ * the FMM (fmm::softened_p2p), softened as set by gravity_softening.
+ * Selected by gravity_solver = direct, for small systems, or as the
+ * reference of the FMM accuracy.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <mpi.h>
+#include <omp.h>
+#include <vector>
+
+#include "fmm.h"
+#include "params.h"
+#include "simd_types.h"
+#include "tree.h"
+
+namespace direct {
+using namespace param;
+
+// sources per tile: their coordinates and masses take 16 kB
+constexpr size_t tile = 512;
+
+/**
+ * @brief Gravitational acceleration and potential of all the particles of
+ *        all the ranks on the local ones, which they replace
+ */
+inline void
+gravitation(std::vector<body> & bodies) {
+  int rank, size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+  const size_t n = bodies.size();
+  unsigned long n_max = n;
+  MPI_Allreduce(
+    MPI_IN_PLACE, &n_max, 1, MPI_UNSIGNED_LONG, MPI_MAX, MPI_COMM_WORLD);
+  const size_t stride = simd::padded(n_max);
+  std::vector<double> block((gdimension + 1) * stride, 0.),
+    next(block.size());
+  for(size_t j = 0; j < n; ++j) {
+    for(unsigned short i = 0; i < gdimension; ++i)
+      block[i * stride + j] = bodies[j].coordinates()[i];
+    block[gdimension * stride + j] = bodies[j].mass();
+  }
+
+  std::vector<double> pot(n, 0.);
+  std::vector<point_t> acc(n, point_t(0.));
+  const int to = (rank + 1) % size, from = (rank + size - 1) % size;
+  for(int step = 0; step < size; ++step) {
+    MPI_Request requests[2];
+    const bool pass = step < size - 1;
+    if(pass) {
+      MPI_Irecv(next.data(), next.size(), MPI_DOUBLE, from, step,
+        MPI_COMM_WORLD, &requests[0]);
+      MPI_Isend(block.data(), block.size(), MPI_DOUBLE, to, step,
+        MPI_COMM_WORLD, &requests[1]);
+    }
+    for(size_t j0 = 0; j0 < stride; j0 += tile) {
+      const fmm::p2p_sources sources(
+        block.data(), stride, j0, std::min(tile, stride - j0));
+#pragma omp parallel for schedule(static)
+      for(size_t k = 0; k < n; ++k)
+        fmm::softened_p2p(pot[k], acc[k], bodies[k].coordinates(), sources);
+    }
+    if(pass) {
+      MPI_Waitall(2, requests, MPI_STATUSES_IGNORE);
+      block.swap(next);
+    }
+  }
+
+  for(size_t k = 0; k < n; ++k) {
+    bodies[k].setGPotential(pot[k]);
+    bodies[k].setGAcceleration(acc[k]);
+  }
+}
+
+} // namespace direct
@@ -19,181 +19,201 @@
 /**
  * @file eforce.h
  * @brief Namespace for the choice of external force and external potential
+ *
+ * Each external force is a term: its constants are read from the
+ * parameters in init(), and its acceleration and potential are templates
+ * over the coordinates, either doubles or simd::vdouble lanes. All known
+ * terms are composed into one object, 'forces', in which external_force_type
+ * only sets how many times each term is counted. The total acceleration
+ * and potential thus inline every term, with a branch on its count which
+ * is the same for all particles, and can be evaluated in one sweep over
+ * arrays of coordinates.
  */
 
 #ifndef _eforce_h_
 #define _eforce_h_
 
 #include <boost/algorithm/string.hpp>
+#include <tuple>
+#include <type_traits>
 
 #include "density_profiles.h"
 #include "params.h"
+#include "scratch.h"
+#include "simd_types.h"
 #include "tree.h"
 #define SQ(x) ((x) * (x))
 #define CU(x) ((x) * (x) * (x))
 
 namespace external_force {
 
-// acceleration and potential function types and pointers
-typedef double (*potential_t)(const point_t &);
-typedef point_t (*acceleration_t)(const body &);
-static std::vector<potential_t> vec_potentials;
-static std::vector<acceleration_t> vec_accelerations;
+// x^n: std::pow on doubles, simd::pow_n on lanes
+template<class T>
+inline T
+power(const T & x, const double n) {
+  if constexpr(std::is_same<T, double>::value)
+    return std::pow(x, n);
+  else
+    return simd::pow_n(x, n);
+}
+
+template<class T>
+inline T
+radius(const T * x) {
+  using std::sqrt;
+  T r = x[0] * x[0];
+  for(unsigned short i = 1; i < gdimension; ++i)
+    r += x[i] * x[i];
+  return sqrt(r);
+}
 
 /**
  * @brief      1D walls: steep power-law-like potentials
- * @param      rp  Point coordinates
  */
-template<int I = 0>
-double
-potential_square_well(const point_t & rp) {
-  using namespace param;
-  const static double box[3] = {.5 * box_length, .5 * box_width,
-    .5 * box_height},
-                      pw_n = extforce_wall_powerindex,
-                      pw_a = extforce_wall_steepness;
-
-  double phi = (((rp[I] < -box[I]) ? pow(-rp[I] - box[I], pw_n) : 0.0) +
-                 ((rp[I] > box[I]) ? pow(rp[I] - box[I], pw_n) : 0.0)) *
-               pw_a;
-  return phi;
-}
-potential_t potential_walls_x = potential_square_well<0>;
-potential_t potential_walls_y = potential_square_well<1>;
-potential_t potential_walls_z = potential_square_well<2>;
+template<int I>
+struct walls {
+  double box, pw_n, pw_a;
+
+  void init() {
+    using namespace param;
+    const double sizes[3] = {box_length, box_width, box_height};
+    box = .5 * sizes[I];
+    pw_n = extforce_wall_powerindex;
+    pw_a = extforce_wall_steepness;
+  }
 
-template<int I = 0>
-point_t
-acceleration_square_well(const body & particle) {
-  using namespace param;
-  point_t a = 0.0;
-  point_t rp = particle.coordinates();
-  const static double box[3] = {.5 * box_length, .5 * box_width,
-    .5 * box_height},
-                      pw_n = extforce_wall_powerindex,
-                      pw_a = extforce_wall_steepness;
-
-  a[I] = (((rp[I] < -box[I]) ? pow(-rp[I] - box[I], pw_n - 1) : 0.0) -
-           ((rp[I] > box[I]) ? pow(rp[I] - box[I], pw_n - 1) : 0.0)) *
-         pw_n * pw_a;
-  return a;
-}
-acceleration_t acceleration_walls_x = acceleration_square_well<0>;
-acceleration_t acceleration_walls_y = acceleration_square_well<1>;
-acceleration_t acceleration_walls_z = acceleration_square_well<2>;
+  template<class T>
+  void add_acceleration(const T * x, T * a) const {
+    if constexpr(I < gdimension) {
+      const T below = -x[I] - box, above = x[I] - box;
+      // one particle inside the box: no power to evaluate
+      if constexpr(std::is_same<T, double>::value)
+        if(below <= 0. and above <= 0.)
+          return;
+      a[I] += (simd::choose(below > 0., power(below, pw_n - 1), T(0.)) -
+                simd::choose(above > 0., power(above, pw_n - 1), T(0.))) *
+              pw_n * pw_a;
+    }
+  }
+
+  template<class T>
+  T potential(const T * x) const {
+    if constexpr(I < gdimension) {
+      const T below = -x[I] - box, above = x[I] - box;
+      if constexpr(std::is_same<T, double>::value)
+        if(below <= 0. and above <= 0.)
+          return 0.;
+      return (simd::choose(below > 0., power(below, pw_n), T(0.)) +
+               simd::choose(above > 0., power(above, pw_n), T(0.))) *
+             pw_a;
+    }
+    return T(0.);
+  }
+}; // struct walls
 
 /**
  * @brief      Round or spherical boundary wall
- * @param      particle  The particle being accelerated
  */
-point_t
-acceleration_spherical_wall(const body & particle) {
-  using namespace param;
-  point_t a = 0.0;
-  point_t rp = particle.coordinates();
-  const double pw_n = extforce_wall_powerindex;
-  const double pw_a = extforce_wall_steepness;
-  double r = rp[0] * rp[0];
-  for(unsigned short i = 1; i < gdimension; ++i)
-    r += rp[i] * rp[i];
-  r = sqrt(r);
-  if(r > sphere_radius) {
-    const double ar = pw_n * pw_a * pow(r - sphere_radius, pw_n - 1);
+struct spherical_wall {
+  double R, pw_n, pw_a;
+
+  void init() {
+    using namespace param;
+    R = sphere_radius;
+    pw_n = extforce_wall_powerindex;
+    pw_a = extforce_wall_steepness;
+  }
+
+  template<class T>
+  void add_acceleration(const T * x, T * a) const {
+    const T r = radius(x);
+    // one particle inside the wall: no power to evaluate
+    if constexpr(std::is_same<T, double>::value)
+      if(r <= R)
+        return;
+    const auto outside = r > R;
+    const T ar = pw_n * pw_a * power(r - R, pw_n - 1);
     for(unsigned short i = 0; i < gdimension; ++i)
-      a[i] = -rp[i] / r * ar;
+      a[i] += simd::choose(outside, -x[i] / r * ar, T(0.));
   }
-  return a;
-}
 
-double
-potential_spherical_wall(const point_t & rp) {
-  using namespace param;
-  double phi = 0.0;
-  const double pw_n = extforce_wall_powerindex;
-  const double pw_a = extforce_wall_steepness;
-  double r = rp[0] * rp[0];
-  for(unsigned short i = 1; i < gdimension; ++i)
-    r += rp[i] * rp[i];
-  r = sqrt(r);
-  if(r > sphere_radius)
-    phi = pw_a * pow(r - sphere_radius, pw_n);
-  return phi;
-}
+  template<class T>
+  T potential(const T * x) const {
+    const T r = radius(x);
+    if constexpr(std::is_same<T, double>::value)
+      if(r <= R)
+        return 0.;
+    return simd::choose(r > R, pw_a * power(r - R, pw_n), T(0.));
+  }
+}; // struct spherical_wall
 
 /**
  * @brief      External force support for parabolic
- *             sphericall-symmetric density
- * @param      particle  The particle being accelerated
+ *             sphericall-symmetric density, inside a spherical wall
  */
-point_t
-acceleration_spherical_density_support(const body & particle) {
-  using namespace param;
-  point_t a = 0.0;
-  static const double K0 = pressure_initial / pow(rho_initial, poly_gamma),
-                      rho0 = density_profiles::spherical_density_profile(0.);
-  point_t rp = particle.coordinates();
-  double r = rp[0] * rp[0];
-  for(unsigned short i = 1; i < gdimension; ++i)
-    r += rp[i] * rp[i];
-  r = sqrt(r);
-  const double x = r / sphere_radius;
-  if(x > 1e-12) {
-    double rho =
-      rho_initial / rho0 * density_profiles::spherical_density_profile(x);
-    double drhodr = rho_initial / (rho0 * sphere_radius) *
-                    density_profiles::spherical_drho_dr(x);
-    double a_r =
-      (rho > 0) ? (K0 * poly_gamma * pow(rho, poly_gamma - 2) * drhodr) : 0;
-    for(short int i = 0; i < gdimension; ++i)
-      a[i] = a_r * rp[i] / r;
+struct spherical_density_support {
+  double K0, rho0, R, gamma, rho_initial;
+  spherical_wall wall;
+
+  void init() {
+    using namespace param;
+    density_profiles::select();
+    K0 = pressure_initial / pow(param::rho_initial, poly_gamma);
+    rho0 = density_profiles::spherical_density_profile(0.);
+    R = sphere_radius;
+    gamma = poly_gamma;
+    rho_initial = param::rho_initial;
+    wall.init();
   }
-  return a + acceleration_spherical_wall(particle);
-}
 
-double
-potential_spherical_density_support(const point_t & rp) {
-  using namespace param;
-  static const double K0 = pressure_initial / pow(rho_initial, poly_gamma),
-                      rho0 = density_profiles::spherical_density_profile(0.);
-  double r = rp[0] * rp[0];
-  for(unsigned short i = 1; i < gdimension; ++i)
-    r += rp[i] * rp[i];
-  r = sqrt(r);
-  const double x = r / sphere_radius;
-  double rho =
-    rho_initial / rho0 * density_profiles::spherical_density_profile(x);
-  double phi =
-    (rho > 0)
-      ? (-K0 * poly_gamma * pow(rho, poly_gamma - 1.) / (poly_gamma - 1.))
-      : 0;
-  return phi + potential_spherical_wall(rp);
-}
+  template<class T>
+  void add_acceleration(const T * x, T * a) const {
+    const T r = radius(x), xr = r / R;
+    const T rho = rho_initial / rho0 *
+                  simd::map(density_profiles::spherical_density_profile, xr);
+    const T drhodr = rho_initial / (rho0 * R) *
+                     simd::map(density_profiles::spherical_drho_dr, xr);
+    const T a_r = simd::choose(
+      rho > 0., K0 * gamma * power(rho, gamma - 2) * drhodr, T(0.));
+    for(unsigned short i = 0; i < gdimension; ++i)
+      a[i] += simd::choose(xr > 1e-12, a_r * x[i] / r, T(0.));
+    wall.add_acceleration(x, a);
+  }
+
+  template<class T>
+  T potential(const T * x) const {
+    const T xr = radius(x) / R;
+    const T rho = rho_initial / rho0 *
+                  simd::map(density_profiles::spherical_density_profile, xr);
+    const T phi = simd::choose(rho > 0.,
+      -K0 * gamma * power(rho, gamma - 1.) / (gamma - 1.), T(0.));
+    return phi + wall.potential(x);
+  }
+}; // struct spherical_density_support
 
 /**
- * @brief      Add uniform constant gravity acceleration
+ * @brief      Uniform constant gravity acceleration
  * 	         in y-direction (or x-direction if number of
  * 	         dimensions == 1)
- * @param      particle  The particle being accelerated
  */
-point_t
-acceleration_gravity(const body & particle) {
-  static const double grav = param::gravity_acceleration_constant;
-  point_t acc = 0.0;
-  if(gdimension > 1)
-    acc[1] = -grav; // negative y-direction
-  else
-    acc[0] = -grav; // negative x-direction
-  return acc;
-}
+struct gravity {
+  static constexpr unsigned short up = gdimension > 1 ? 1 : 0;
+  double g;
 
-double
-potential_gravity(const point_t & rp) {
-  static const double grav = param::gravity_acceleration_constant;
-  double height = rp[0];
-  if(gdimension > 1)
-    height = rp[1];
-  return height * grav;
-}
+  void init() {
+    g = param::gravity_acceleration_constant;
+  }
+
+  template<class T>
+  void add_acceleration(const T * x, T * a) const {
+    a[up] -= g;
+  }
+
+  template<class T>
+  T potential(const T * x) const {
+    return x[up] * g;
+  }
+}; // struct gravity
 
 /**
  * @brief      2D airfoil in a wind tunnel
@@ -210,146 +230,313 @@ potential_gravity(const point_t & rp) {
  *  - airfoil_anchor_y:       the y-coordinate of the anchor;
  *  - airfoil_attack_angle:   angle of attack - rotation from initial position
  *                            which is parallel to the x-axis.
- *
- * @param      particle  The particle being accelerated
  */
-point_t
-acceleration_airfoil(const body & particle) {
-  using namespace param;
-  point_t a = 0.0;
-  assert(gdimension > 1);
-
-  point_t rp = particle.coordinates();
-  const double x1 = rp[0] - airfoil_anchor_x, y1 = rp[1] - airfoil_anchor_y,
-               alpha = airfoil_attack_angle * M_PI / 180.0,
-               pw_n = extforce_wall_powerindex, pw_a = extforce_wall_steepness;
-  const double x = x1 * cos(alpha) + y1 * sin(alpha),
-               y = -x1 * sin(alpha) + y1 * cos(alpha);
-
-  bool inside_bounding_box = std::abs(y) < 5.0 * airfoil_thickness &&
-                             x > -airfoil_size * 0.02 &&
-                             x < airfoil_size * 1.02;
-  double upper_surface =
-    airfoil_thickness * x * sqrt(airfoil_size * airfoil_size - x * x);
-  double camber_line = airfoil_camber * sin(M_PI * x / 2.);
-  double phi = SQ(upper_surface) - SQ(y - camber_line) + 0.002;
-  if(inside_bounding_box && phi > 0.0) {
-    double a0, a1;
-    a0 = pw_n * pw_a * pow(phi, pw_n - 1) *
-         (2. * (y - camber_line) *
-             (-airfoil_camber * M_PI / 2. * cos(M_PI / 2. * x)) -
-           airfoil_thickness * airfoil_thickness * 2 * x *
-             (airfoil_size * airfoil_size - 2 * x * x));
-    a1 = pw_n * pw_a * pow(phi, pw_n - 1) * 2. * (y - camber_line);
-    a[0] = a0 * cos(alpha) - a1 * sin(alpha);
-    a[1] = a0 * sin(alpha) + a1 * cos(alpha);
+struct airfoil {
+  double x0, y0, cos_alpha, sin_alpha, size, thickness, camber, pw_n, pw_a;
+
+  void init() {
+    using namespace param;
+    assert(gdimension > 1);
+    const double alpha = airfoil_attack_angle * M_PI / 180.0;
+    x0 = airfoil_anchor_x;
+    y0 = airfoil_anchor_y;
+    cos_alpha = cos(alpha);
+    sin_alpha = sin(alpha);
+    size = airfoil_size;
+    thickness = airfoil_thickness;
+    camber = airfoil_camber;
+    pw_n = extforce_wall_powerindex;
+    pw_a = extforce_wall_steepness;
   }
-  return a;
-}
 
-double
-potential_airfoil(const point_t & rp) {
-  using namespace param;
-  double phi = 0.0;
-  assert(gdimension > 1);
-
-  static const double alpha = airfoil_attack_angle * M_PI / 180.0,
-                      pw_n = extforce_wall_powerindex,
-                      pw_a = extforce_wall_steepness;
-  const double x1 = rp[0] - airfoil_anchor_x, y1 = rp[1] - airfoil_anchor_y;
-  const double x = x1 * cos(alpha) + y1 * sin(alpha),
-               y = -x1 * sin(alpha) + y1 * cos(alpha);
-
-  bool inside_bounding_box = std::abs(y) < 5.0 * airfoil_thickness &&
-                             x > -airfoil_size * 0.02 &&
-                             x < airfoil_size * 1.02;
-  double upper_surface =
-    airfoil_thickness * x * sqrt(airfoil_size * airfoil_size - x * x);
-  double camber_line = airfoil_camber * sin(M_PI * x / 2.);
-  double aux = SQ(upper_surface) - SQ(y - camber_line) + 0.002;
-  if(inside_bounding_box && aux > 0.0)
-    phi = pw_a * pow(aux, pw_n);
-  return phi;
-}
+  // coordinates in the frame of the airfoil, the height of its surface
+  // above the camber line, and whether it is worth checking
+  template<class T>
+  struct frame {
+    T x, y, camber_line, phi;
+    decltype(T(0.) > 0.) inside;
+  };
+
+  template<class T>
+  frame<T> airfoil_frame(const T * rp) const {
+    using std::abs;
+    using std::sin;
+    using std::sqrt;
+    frame<T> f;
+    const T x1 = rp[0] - x0, y1 = rp[1] - y0;
+    f.x = x1 * cos_alpha + y1 * sin_alpha;
+    f.y = -x1 * sin_alpha + y1 * cos_alpha;
+    const T upper_surface = thickness * f.x * sqrt(size * size - f.x * f.x);
+    f.camber_line = camber * sin(M_PI * f.x / 2.);
+    f.phi = SQ(upper_surface) - SQ(f.y - f.camber_line) + 0.002;
+    f.inside = abs(f.y) < 5.0 * thickness && f.x > -size * 0.02 &&
+               f.x < size * 1.02 && f.phi > 0.0;
+    return f;
+  }
+
+  template<class T>
+  void add_acceleration(const T * x, T * a) const {
+    if constexpr(gdimension > 1) {
+      using std::cos;
+      const frame<T> f = airfoil_frame(x);
+      const T dphi = pw_n * pw_a * power(f.phi, pw_n - 1);
+      const T a0 = dphi * (2. * (f.y - f.camber_line) *
+                              (-camber * M_PI / 2. * cos(M_PI / 2. * f.x)) -
+                            thickness * thickness * 2 * f.x *
+                              (size * size - 2 * f.x * f.x)),
+              a1 = dphi * 2. * (f.y - f.camber_line);
+      a[0] += simd::choose(f.inside, a0 * cos_alpha - a1 * sin_alpha, T(0.));
+      a[1] += simd::choose(f.inside, a0 * sin_alpha + a1 * cos_alpha, T(0.));
+    }
+  }
+
+  template<class T>
+  T potential(const T * x) const {
+    if constexpr(gdimension > 1) {
+      const frame<T> f = airfoil_frame(x);
+      return simd::choose(f.inside, pw_a * power(f.phi, pw_n), T(0.));
+    }
+    return T(0.);
+  }
+}; // struct airfoil
 
 /**
- * @brief      Add orbital gravitational and centrifugal acceleration
+ * @brief      Orbital gravitational and centrifugal acceleration
  *             in x-direction
- *
- * @param      particle  The particle being accelerated
  */
-point_t
-acceleration_orbit(const body & particle) {
-  using namespace param;
-  point_t rp = particle.coordinates();
+struct orbit {
+  double G, a_sp, m_ns, m_t;
+
+  void init() {
+    using namespace param;
+    G = gravitational_constant;
+    a_sp = orbital_separation;
+    m_ns = mass_neutron_star;
+    m_t = mass_neutron_star + mass_white_dwarf;
+  }
 
-  static const double grav = gravitational_constant, a_sp = orbital_separation,
-                      m_ns = mass_neutron_star, m_wd = mass_white_dwarf;
-  const double m_t = m_ns + m_wd;
+  template<class T>
+  void add_acceleration(const T * x, T * a) const {
+    using std::sqrt;
+    const T y = gdimension > 1 ? x[1] : T(0.), z = gdimension > 2 ? x[2] : T(0.);
+    T temp = SQ(x[0] - a_sp) + SQ(y) + SQ(z);
+    temp = CU(temp);
+    temp = sqrt(temp);
+    const T term1 = -G * m_ns / temp;
+    const double term2 = G * m_t / CU(a_sp);
+    a[0] += term1 * (x[0] - a_sp) + term2 * (x[0] - a_sp * m_ns / m_t);
+    if constexpr(gdimension > 1)
+      a[1] += term1 * y + term2 * y;
+    if constexpr(gdimension > 2)
+      a[2] += term1 * z;
+  }
 
-  point_t acc = 0.0;
+  template<class T>
+  T potential(const T * x) const {
+    using std::sqrt;
+    const T y = gdimension > 1 ? x[1] : T(0.), z = gdimension > 2 ? x[2] : T(0.);
+    const T term1 = -G * m_ns / sqrt(SQ(x[0] - a_sp) + SQ(y) + SQ(z));
+    const T term2 =
+      -0.5 * G * m_t / CU(a_sp) * (SQ(x[0] - a_sp * m_ns / m_t) + SQ(y));
+    return term1 + term2;
+  }
+}; // struct orbit
 
-  double temp = SQ(rp[0] - a_sp) + SQ(rp[1]) + SQ(rp[2]);
-  temp = CU(temp);
-  temp = sqrt(temp);
-  double term1 = -grav * m_ns / temp;
-  acc[0] += term1 * (rp[0] - a_sp);
-  acc[1] += term1 * rp[1];
-  acc[2] += term1 * rp[2];
-
-  double term2 = grav * m_t / CU(a_sp);
-  acc[0] += term2 * (rp[0] - a_sp * m_ns / m_t); // x-direction
-  acc[1] += term2 * rp[1];
-  return acc;
-}
+/**
+ * @brief      Constant potential shift
+ */
+struct poison {
+  double phi0;
 
-double
-potential_orbit(const point_t & rp) {
-  using namespace param;
-  assert(gdimension > 1);
-  double phi = 0.0;
-  static const double grav = gravitational_constant, a_sp = orbital_separation,
-                      m_ns = mass_neutron_star, m_wd = mass_white_dwarf;
-  const double m_t = m_ns + m_wd;
-  double term1 = sqrt(SQ(rp[0] - a_sp) + SQ(rp[1]) + SQ(rp[2]));
-  term1 = -grav * m_ns / term1;
-  double term2 = -0.5 * grav * m_t / CU(a_sp);
-  term2 = term2 * (SQ(rp[0] - a_sp * m_ns / m_t) + SQ(rp[1]));
-  phi = term1 + term2;
-  return phi;
-}
+  void init() {
+    phi0 = param::zero_potential_poison_value;
+  }
+
+  template<class T>
+  void add_acceleration(const T * x, T * a) const {}
+
+  template<class T>
+  T potential(const T * x) const {
+    return T(phi0);
+  }
+}; // struct poison
 
 /**
- * @brief      Constant potential shift
- * @param      rp  Point coordinates
+ * @brief      Sum of the terms F, each counted as many times as it was
+ *             selected
  */
-double
-potential_poison(const point_t & rp) {
-  return param::zero_potential_poison_value;
-}
+template<class... F>
+class composition
+{
+  template<class E>
+  struct counted : E {
+    unsigned count = 0;
+  };
+
+public:
+  void clear() {
+    terms_ = std::tuple<counted<F>...>();
+  }
+
+  //- counts the term E once more
+  template<class E>
+  void add() {
+    counted<E> & t = std::get<counted<E>>(terms_);
+    if(t.count++ == 0)
+      t.init();
+  }
+
+  template<class T>
+  void add_acceleration(const T * x, T * a) const {
+    std::apply(
+      [&](const auto &... t) {
+        (
+          [&] {
+            for(unsigned c = 0; c < t.count; ++c)
+              t.add_acceleration(x, a);
+          }(),
+          ...);
+      },
+      terms_);
+  }
+
+  template<class T>
+  T potential(const T * x) const {
+    T phi(0.);
+    std::apply(
+      [&](const auto &... t) {
+        (
+          [&] {
+            for(unsigned c = 0; c < t.count; ++c)
+              phi += t.potential(x);
+          }(),
+          ...);
+      },
+      terms_);
+    return phi;
+  }
+
+  point_t acceleration(const point_t & rp) const {
+    double x[gdimension], a[gdimension] = {};
+    for(unsigned short i = 0; i < gdimension; ++i)
+      x[i] = rp[i];
+    add_acceleration(x, a);
+    point_t acc = 0.0;
+    for(unsigned short i = 0; i < gdimension; ++i)
+      acc[i] = a[i];
+    return acc;
+  }
+
+  double potential(const point_t & rp) const {
+    double x[gdimension];
+    for(unsigned short i = 0; i < gdimension; ++i)
+      x[i] = rp[i];
+    return potential(x);
+  }
+
+  /**
+   * @brief      Adds the acceleration at n points, one sweep over arrays
+   *             padded to simd::padded(n)
+   *
+   * @param      x     Coordinates, one array per direction
+   * @param      a     Accelerations to add to, one array per direction
+   */
+  void acceleration(size_t n, double * const * x, double * const * a) const {
+    for(size_t j = 0; j < n; j += simd::width) {
+      simd::vdouble x_[gdimension], a_[gdimension];
+      for(unsigned short i = 0; i < gdimension; ++i) {
+        x_[i] = simd::load(x[i] + j);
+        a_[i] = simd::load(a[i] + j);
+      }
+      add_acceleration(x_, a_);
+      for(unsigned short i = 0; i < gdimension; ++i)
+        simd::store(a_[i], a[i] + j);
+    }
+  }
+
+  /**
+   * @brief      Potential at n points, one sweep over arrays padded to
+   *             simd::padded(n)
+   *
+   * @param      x     Coordinates, one array per direction
+   * @param      phi   Potentials
+   */
+  void potential(size_t n, double * const * x, double * phi) const {
+    for(size_t j = 0; j < n; j += simd::width) {
+      simd::vdouble x_[gdimension];
+      for(unsigned short i = 0; i < gdimension; ++i)
+        x_[i] = simd::load(x[i] + j);
+      simd::store(potential(x_), phi + j);
+    }
+  }
+
+private:
+  std::tuple<counted<F>...> terms_;
+}; // class composition
+
+typedef composition<walls<0>,
+  walls<1>,
+  walls<2>,
+  spherical_wall,
+  spherical_density_support,
+  gravity,
+  airfoil,
+  orbit,
+  poison>
+  composition_t;
+
+// the external forces, set by select()
+static composition_t forces;
 
 /**
  * @brief      Total external force at a point 'srch'
  * @param      particle  Accelerated particle
  */
-point_t
+inline point_t
 acceleration(const body & particle) {
-  point_t a = 0.0;
-  for(auto p : vec_accelerations)
-    a += (*p)(particle);
-  return a;
+  return forces.acceleration(particle.coordinates());
 }
 
 /**
  * @brief      Total external potential
  * @param      coords  Coordinates of where to compute the potential
  */
-double
+inline double
 potential(const point_t & coords) {
-  double phi = 0.0;
-  for(auto p : vec_potentials)
-    phi += (*p)(coords);
-  return phi;
+  return forces.potential(coords);
+}
+
+/**
+ * @brief      Coordinates of a batch of particles, one array per
+ *             direction, padded with zeros to simd::padded(n)
+ */
+struct batch {
+  batch(scratch::frame & f, const std::vector<body *> & particles)
+    : n(particles.size()) {
+    const size_t n_padded = simd::padded(n);
+    for(unsigned short i = 0; i < gdimension; ++i) {
+      x[i] = f.alloc<double>(n_padded);
+      std::fill(x[i] + n, x[i] + n_padded, 0.);
+    }
+    for(size_t j = 0; j < n; ++j) {
+      const point_t & rp = particles[j]->coordinates();
+      for(unsigned short i = 0; i < gdimension; ++i)
+        x[i][j] = rp[i];
+    }
+  }
+
+  size_t n;
+  double * x[gdimension];
+}; // struct batch
+
+/**
+ * @brief      External potential of the particles, in one sweep
+ * @param      b     Their coordinates
+ * @param      phi   Potentials, padded to simd::padded(b.n)
+ */
+inline void
+potential(const batch & b, double * phi) {
+  forces.potential(b.n, b.x, phi);
 }
 
 /**
@@ -359,8 +546,7 @@ potential(const point_t & coords) {
 void
 select(const std::string & efstr) {
 
-  vec_potentials.clear();
-  vec_accelerations.clear();
+  forces.clear();
 
   if(boost::iequals(efstr, "zero") or boost::iequals(efstr, "none"))
     return; // trivial case
@@ -374,47 +560,38 @@ select(const std::string & efstr) {
   boost::split(split_efstr, efstr, boost::is_any_of(","));
   for(auto it = split_efstr.begin(); it != split_efstr.end(); ++it) {
     if(boost::iequals(*it, "spherical wall")) {
-      vec_potentials.push_back(potential_spherical_wall);
-      vec_accelerations.push_back(acceleration_spherical_wall);
+      forces.add<spherical_wall>();
     }
     else if(boost::iequals(*it, "airfoil")) {
-      vec_potentials.push_back(potential_airfoil);
-      vec_accelerations.push_back(acceleration_airfoil);
+      forces.add<airfoil>();
     }
     else if(boost::iequals(*it, "spherical density support")) {
-      density_profiles::select();
-      vec_potentials.push_back(potential_spherical_density_support);
-      vec_accelerations.push_back(acceleration_spherical_density_support);
+      forces.add<spherical_density_support>();
     }
     else if(boost::iequals(*it, "gravity")) {
-      vec_potentials.push_back(potential_gravity);
-      vec_accelerations.push_back(acceleration_gravity);
+      forces.add<gravity>();
     }
     else if(boost::iequals(*it, "orbit")) {
-      vec_potentials.push_back(potential_orbit);
-      vec_accelerations.push_back(acceleration_orbit);
+      forces.add<orbit>();
     }
     else if(boost::iequals(it->substr(0, 6), "walls:")) {
       // parse in which directions to place the walls
       // this can be e.g. "walls:xyz" or "walls:y" etc.
-      const char * cxyz = it->substr(6).c_str();
-      char imx = min(3, (int)it->substr(6).length());
+      const std::string xyz = it->substr(6);
+      const int imx = min(3, (int)xyz.length());
       for(int i = 0; i < imx; ++i) {
-        switch(cxyz[i]) {
+        switch(xyz[i]) {
           case 'x':
           case 'X':
-            vec_potentials.push_back(potential_walls_x);
-            vec_accelerations.push_back(acceleration_walls_x);
+            forces.add<walls<0>>();
             break;
           case 'y':
           case 'Y':
-            vec_potentials.push_back(potential_walls_y);
-            vec_accelerations.push_back(acceleration_walls_y);
+            forces.add<walls<1>>();
             break;
           case 'z':
           case 'Z':
-            vec_potentials.push_back(potential_walls_z);
-            vec_accelerations.push_back(acceleration_walls_z);
+            forces.add<walls<2>>();
             break;
           default:
             log_fatal("ERROR: bad external_force_type" << std::endl);
@@ -424,7 +601,7 @@ select(const std::string & efstr) {
     }
     else if(boost::iequals(*it, "poison")) {
       // zero potential shift
-      vec_potentials.push_back(potential_poison);
+      forces.add<poison>();
     }
     else {
       log_fatal("ERROR: bad external_force_type" << std::endl);
@@ -453,4 +630,5 @@ acceleration_drag(const point_t & vel) {
 } // namespace external_force
 
 #undef SQ
+#undef CU
 #endif // _eforce_h_
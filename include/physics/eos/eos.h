@@ -24,9 +24,12 @@
 
 #pragma once
 
+#include <algorithm>
 #include <vector>
 
 #include "params.h"
+#include "scratch.h"
+#include "simd_types.h"
 #include "tree.h"
 #include "utils.h"
 #include <boost/algorithm/string.hpp>
@@ -37,6 +40,7 @@
 #endif
 
 #include "eos_consts.h"
+#include "eos_table.h"
 
 namespace eos {
 using namespace param;
@@ -51,6 +55,46 @@ constexpr double quartic(const double& x){
   return ((x) * (x) * (x) * (x));
 }
 
+/**
+ * @brief      Thermodynamic state of a batch of particles, in contiguous
+ *             arrays: the inputs of the batched EOS methods (density,
+ *             internal energy, Ye, adiabatic invariant, and temperature as
+ *             the first guess of the tabulated EOS), then their outputs
+ *             (pressure, sound speed, temperature). The arrays are padded
+ *             to the SIMD width with a harmless state.
+ */
+struct batch {
+  batch(scratch::frame & f, const std::vector<body *> & particles)
+    : n(particles.size()) {
+    const size_t n_padded = simd::padded(n);
+    for(double ** a : {&rho, &eps, &ye, &K, &T, &P, &cs}) {
+      *a = f.alloc<double>(n_padded);
+      std::fill(*a + n, *a + n_padded, 1.);
+    }
+    for(size_t i = 0; i < n; ++i) {
+      const body & b = *particles[i];
+      rho[i] = b.getDensity();
+      eps[i] = b.getInternalenergy();
+      ye[i] = b.getElectronfraction();
+      K[i] = b.getAdiabatic();
+      T[i] = b.getTemperature();
+    }
+  }
+
+  //- stores pressure and sound speed, and the temperature if it changed
+  void scatter(const std::vector<body *> & particles, bool temperature) {
+    for(size_t i = 0; i < n; ++i) {
+      particles[i]->setPressure(P[i]);
+      particles[i]->setSoundspeed(cs[i]);
+      if(temperature)
+        particles[i]->setTemperature(T[i]);
+    }
+  }
+
+  size_t n;
+  double *rho, *eps, *ye, *K, *T, *P, *cs;
+}; // struct batch
+
 template<param::eos_type_keyword>
 class eos_t{};
 
@@ -118,6 +162,26 @@ public:
     particle.setSoundspeed(soundspeed);
   }
 
+  /**
+  * @brief      Batched pressure and sound speed, from the density and the
+  *             adiabatic invariant: cs^2 = Gamma P/rho
+  *
+  * @param      b     the particles
+  */
+  static void
+  compute_pressure_soundspeed(batch & b) {
+    using namespace simd;
+    using std::exp;
+    using std::log;
+    using std::sqrt;
+    for(size_t i = 0; i < b.n; i += width) {
+      const vdouble rho = load(b.rho + i),
+                    P = load(b.K + i)*exp(poly_gamma*log(rho));
+      store(P, b.P + i);
+      store(sqrt(poly_gamma*P/rho), b.cs + i);
+    }
+  }
+
   /**
   * @brief      For polytropic equation of state, the temperature is
   *             decoupled from density or pressure, so this function does
@@ -182,6 +246,23 @@ public:
     particle.setSoundspeed(soundspeed);
   }
 
+  /**
+  * @brief      Batched pressure and sound speed, from the density and the
+  *             internal energy
+  *
+  * @param      b     the particles
+  */
+  static void
+  compute_pressure_soundspeed(batch & b) {
+    using namespace simd;
+    using std::sqrt;
+    for(size_t i = 0; i < b.n; i += width) {
+      const vdouble eps = load(b.eps + i);
+      store((poly_gamma - 1.)*load(b.rho + i)*eps, b.P + i);
+      store(sqrt(poly_gamma*(poly_gamma - 1.)*eps), b.cs + i);
+    }
+  }
+
   /**
   * @brief      Compute specific internal energy
   *             Uses adiabatic invariant and density
@@ -242,19 +323,27 @@ public:
     compute_internal_energy(particle);
   }
 
-  static inline double
-  pressure_given_rhoYe(double rho, double Ye) {
-    double x = cbrt(rho*Ye/B_wd_nm);
-    double x2 = square(x);
+  // on doubles, or on simd::vdouble lanes for the batched method
+  template<class T>
+  static inline T
+  pressure_given_rhoYe(const T & rho, const T & Ye) {
+    using std::asinh;
+    using std::cbrt;
+    using std::sqrt;
+    T x = cbrt(rho*Ye/B_wd_nm);
+    T x2 = x*x;
     return A_wd*(x*(2.*x2 - 3.)*sqrt(x2 + 1.) + 3.*asinh(x));
   }
 
-  static inline double
-  soundspeed_given_rhoYe(double rho, double Ye) {
-    double x = cbrt(rho*Ye/B_wd_nm);
-    double x2 = square(x);
-    double numer = (1. + x2)*(6.*x2 - 3.) + 3. + x2*(2.*x2 - 3.);
-    double denom = (1. + x2)*(6.*x2 + 1.) - 1. + x2*(2.*x2 + 1.);
+  template<class T>
+  static inline T
+  soundspeed_given_rhoYe(const T & rho, const T & Ye) {
+    using std::cbrt;
+    using std::sqrt;
+    T x = cbrt(rho*Ye/B_wd_nm);
+    T x2 = x*x;
+    T numer = (1. + x2)*(6.*x2 - 3.) + 3. + x2*(2.*x2 - 3.);
+    T denom = (1. + x2)*(6.*x2 + 1.) - 1. + x2*(2.*x2 + 1.);
     return sqrt(numer/(3.*denom)) * C_LIGHT_CGS;
   }
 
@@ -293,6 +382,21 @@ public:
     particle.setSoundspeed(cs);
   } // compute_soundspeed_wd
 
+  /**
+  * @brief      Batched pressure and sound speed, from the density and Ye
+  *
+  * @param      b     the particles
+  */
+  static void
+  compute_pressure_soundspeed(batch & b) {
+    using namespace simd;
+    for(size_t i = 0; i < b.n; i += width) {
+      const vdouble rho = load(b.rho + i), Ye = load(b.ye + i);
+      store(pressure_given_rhoYe(rho, Ye), b.P + i);
+      store(soundspeed_given_rhoYe(rho, Ye), b.cs + i);
+    }
+  }
+
   /**
   * @brief      Compute specific internal energy
   *             Uses piecewise-polytrope approximation
@@ -393,6 +497,29 @@ public:
     particle.setSoundspeed(soundspeed);
   }
 
+  /**
+  * @brief      Batched pressure and sound speed: the segment is selected
+  *             per lane, then P = K rho^Gamma and cs^2 = Gamma P/rho
+  *
+  * @param      b     the particles
+  */
+  static void
+  compute_pressure_soundspeed(batch & b) {
+    using namespace simd;
+    using std::exp;
+    using std::log;
+    using std::sqrt;
+    const double K2_K1 = pow(rho_thr, poly_gamma - poly_gamma2);
+    for(size_t i = 0; i < b.n; i += width) {
+      const vdouble rho = load(b.rho + i), K1 = load(b.K + i);
+      const vmask low = rho < rho_thr;
+      const vdouble gam = choose(low, vdouble(poly_gamma), vdouble(poly_gamma2)),
+                    P = choose(low, K1, K1*K2_K1)*exp(gam*log(rho));
+      store(P, b.P + i);
+      store(sqrt(gam*P/rho), b.cs + i);
+    }
+  }
+
   /**
   * @brief      Compute specific internal energy
   *             Uses adiabatic invariant and density
@@ -422,6 +549,107 @@ public:
 template<>
 double eos_t<param::eos_ppt>::rho_thr;
 
+/**
+* @brief      Tabulated equation of state (see eos_table.h), read from
+*             eos_tab_file_path. The table is in CGS with temperatures in
+*             MeV, as the particle fields then. The particle temperature
+*             also serves as the starting bracket of the next lookup.
+*/
+template<>
+class eos_t<param::eos_tabulated>{
+public:
+  static table & data() {
+    static table t;
+    return t;
+  }
+
+  static void read_data() {
+    data().load(eos_tab_file_path);
+  }
+
+  /**
+  * @brief      Temperature from the initial density, energy and Ye
+  *
+  * @param      particle
+  */
+  static void init(body & particle) {
+    compute_temperature(particle);
+  }
+
+  /**
+  * @brief      Pressure from density, internal energy and Ye; updates the
+  *             temperature
+  *
+  * @param      particle
+  */
+  static void
+  compute_pressure(body & particle) {
+    double T = particle.getTemperature(), P, cs;
+    data().evaluate(particle.getDensity(), particle.getInternalenergy(),
+      particle.getElectronfraction(), T, P, cs);
+    particle.setPressure(P);
+    particle.setTemperature(T);
+  }
+
+  /**
+  * @brief      Sound speed from density, internal energy and Ye
+  *
+  * @param      particle
+  */
+  static void
+  compute_soundspeed(body & particle) {
+    double T = particle.getTemperature(), P, cs;
+    data().evaluate(particle.getDensity(), particle.getInternalenergy(),
+      particle.getElectronfraction(), T, P, cs);
+    particle.setSoundspeed(cs);
+  }
+
+  /**
+  * @brief      Pressure, sound speed and temperature from one lookup
+  *
+  * @param      particle
+  */
+  static void
+  compute_pressure_soundspeed(body & particle) {
+    double T = particle.getTemperature(), P, cs;
+    data().evaluate(particle.getDensity(), particle.getInternalenergy(),
+      particle.getElectronfraction(), T, P, cs);
+    particle.setPressure(P);
+    particle.setSoundspeed(cs);
+    particle.setTemperature(T);
+  }
+
+  static void
+  compute_temperature(body & particle) {
+    double T = particle.getTemperature(), P, cs;
+    data().evaluate(particle.getDensity(), particle.getInternalenergy(),
+      particle.getElectronfraction(), T, P, cs);
+    particle.setTemperature(T);
+  }
+
+  /**
+  * @brief      Specific internal energy from density, temperature and Ye
+  *
+  * @param      particle
+  */
+  static void
+  compute_internal_energy(body & particle) {
+    particle.setInternalenergy(data().internal_energy(particle.getDensity(),
+      particle.getTemperature(), particle.getElectronfraction()));
+  }
+
+  /**
+  * @brief      Batched pressure, sound speed and temperature, from the
+  *             density, internal energy and Ye
+  *
+  * @param      b     the particles
+  */
+  static void
+  compute_pressure_soundspeed(batch & b) {
+    data().evaluate(b.n, b.rho, b.eps, b.ye, b.T, b.P, b.cs);
+  }
+}; // ...<eos_tabulated>
+
 template<>
 class eos_t<param::eos_no_eos>{
 public:
@@ -429,18 +657,59 @@ public:
   static void compute_pressure(body& particle){}
   static void compute_soundspeed(body& particle){}
   static void compute_internal_energy(body& particle){}
+  static void compute_pressure_soundspeed(batch & b){}
 };
 
+/**
+ * @brief      Pressure and sound speed of one particle from the EOS E; the
+ *             tabulated EOS gets both from a single table lookup
+ *
+ * @param      particle
+ */
+template<param::eos_type_keyword E>
+void
+compute_pressure_soundspeed(body & particle) {
+  if constexpr(E == param::eos_tabulated)
+    eos_t<E>::compute_pressure_soundspeed(particle);
+  else {
+    eos_t<E>::compute_pressure(particle);
+    eos_t<E>::compute_soundspeed(particle);
+  }
+}
+
+/**
+ * @brief      Pressure and sound speed of the particles, in one batched
+ *             call to the EOS E
+ *
+ * @param      particles  e.g. from body_system::apply_all_batched
+ */
+template<param::eos_type_keyword E>
+void
+compute_all_batched(std::vector<body *> & particles) {
+  if constexpr(E == param::eos_no_eos)
+    return;
+  scratch::frame scratch_;
+  batch b(scratch_, particles);
+  eos_t<E>::compute_pressure_soundspeed(b);
+  b.scatter(particles, E == param::eos_tabulated);
+}
+
 // eos function types and pointers
 typedef void (*compute_quantity_t)(body &);
 typedef void (*read_data_t)();
+typedef void (*compute_batch_t)(std::vector<body *> &);
 
+// with a compile-time eos_type, the pointers are set statically
 #ifdef eos_type
-#  define read_data            eos_t<eos_type>::read_data
-#  define init                 eos_t<eos_type>::init
-#  define compute_pressure     eos_t<eos_type>::compute_pressure
-#  define compute_soundspeed   eos_t<eos_type>::compute_soundspeed
-#  define compute_temperature  eos_t<eos_type>compute_temperature
+read_data_t read_data = nullptr;
+compute_quantity_t init = eos_t<param::eos_type>::init;
+compute_quantity_t compute_pressure = eos_t<param::eos_type>::compute_pressure;
+compute_quantity_t compute_soundspeed =
+  eos_t<param::eos_type>::compute_soundspeed;
+compute_quantity_t compute_temperature = nullptr;
+compute_quantity_t compute_internal_energy =
+  eos_t<param::eos_type>::compute_internal_energy;
+compute_batch_t compute_all = compute_all_batched<param::eos_type>;
 #else
 read_data_t read_data = nullptr;
 compute_quantity_t init = nullptr;
@@ -448,6 +717,7 @@ compute_quantity_t compute_pressure = nullptr;
 compute_quantity_t compute_soundspeed = nullptr;
 compute_quantity_t compute_temperature = nullptr;
 compute_quantity_t compute_internal_energy = nullptr;
+compute_batch_t compute_all = nullptr;
 #endif
 
 /**
@@ -458,6 +728,14 @@ void
 select() {
   using namespace param;
 
+  if((eos_type == eos_wd or eos_type == eos_tabulated)
+     and not body_fields::has(body_fields::thermo)) {
+    std::cerr << "eos_wd and eos_tabulated require the thermo particle fields, "
+              << "add them to BODY_FIELDS" << std::endl;
+    MPI_Finalize();
+    exit(0);
+  }
+
 #ifndef eos_type
   switch(eos_type){
     case(eos_polytropic):
@@ -465,30 +743,45 @@ select() {
       compute_pressure = eos_t<eos_polytropic>::compute_pressure;
       compute_soundspeed = eos_t<eos_polytropic>::compute_soundspeed;
       compute_internal_energy = eos_t<eos_polytropic>::compute_internal_energy;
+      compute_all = compute_all_batched<eos_polytropic>;
       break;
     case(eos_ideal):
       init = eos_t<eos_ideal>::init;
       compute_pressure = eos_t<eos_ideal>::compute_pressure;
       compute_soundspeed = eos_t<eos_ideal>::compute_soundspeed;
       compute_internal_energy = eos_t<eos_ideal>::compute_internal_energy;
+      compute_all = compute_all_batched<eos_ideal>;
       break;
     case(eos_wd):
       init = eos_t<eos_wd>::init;
       compute_pressure = eos_t<eos_wd>::compute_pressure;
       compute_soundspeed = eos_t<eos_wd>::compute_soundspeed;
       compute_internal_energy = eos_t<eos_wd>::compute_internal_energy;
+      compute_all = compute_all_batched<eos_wd>;
       break;
     case(eos_ppt):
       init = eos_t<eos_ppt>::init;
       compute_pressure = eos_t<eos_ppt>::compute_pressure;
       compute_soundspeed = eos_t<eos_ppt>::compute_soundspeed;
       compute_internal_energy = eos_t<eos_ppt>::compute_internal_energy;
+      compute_all = compute_all_batched<eos_ppt>;
+      break;
+    case(eos_tabulated):
+      read_data = eos_t<eos_tabulated>::read_data;
+      init = eos_t<eos_tabulated>::init;
+      compute_pressure = eos_t<eos_tabulated>::compute_pressure;
+      compute_soundspeed = eos_t<eos_tabulated>::compute_soundspeed;
+      compute_temperature = eos_t<eos_tabulated>::compute_temperature;
+      compute_internal_energy =
+        eos_t<eos_tabulated>::compute_internal_energy;
+      compute_all = compute_all_batched<eos_tabulated>;
       break;
     case(eos_no_eos):
       init = eos_t<eos_no_eos>::init;
       compute_pressure = eos_t<eos_no_eos>::compute_pressure;
       compute_soundspeed = eos_t<eos_no_eos>::compute_soundspeed;
       compute_internal_energy = eos_t<eos_no_eos>::compute_internal_energy;
+      compute_all = compute_all_batched<eos_no_eos>;
       break;
     default:
       std::cerr << "Undefined eos type" << std::endl;
@@ -496,6 +789,10 @@ select() {
       exit(0);
   }
 #endif // eos_type
+
+  // the table is read once, by all the ranks
+  if(eos_type == eos_tabulated)
+    eos_t<eos_tabulated>::read_data();
 } // select
 
 } // namespace eos
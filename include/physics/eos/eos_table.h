@@ -0,0 +1,341 @@
+/*~--------------------------------------------------------------------------~*
+ * Copyright (c) 2018 Triad National Security, LLC
+ * All rights reserved.
+ *~--------------------------------------------------------------------------~*/
+
+/*~--------------------------------------------------------------------------~*
+ *
+ * /@@@@@@@@  @@           @@@@@@   @@@@@@@@ @@@@@@@  @@      @@
+ * /@@/////  /@@          @@////@@ @@////// /@@////@@/@@     /@@
+ * /@@       /@@  @@@@@  @@    // /@@       /@@   /@@/@@     /@@
+ * /@@@@@@@  /@@ @@///@@/@@       /@@@@@@@@@/@@@@@@@ /@@@@@@@@@@
+ * /@@////   /@@/@@@@@@@/@@       ////////@@/@@////  /@@//////@@
+ * /@@       /@@/@@//// //@@    @@       /@@/@@      /@@     /@@
+ * /@@       @@@//@@@@@@ //@@@@@@  @@@@@@@@ /@@      /@@     /@@
+ * //       ///  //////   //////  ////////  //       //      //
+ *
+ *~--------------------------------------------------------------------------~*/
+
+/**
+ * @file eos_table.h
+ * @brief Reader and interpolator for tabulated equations of state in the
+ *        stellar collapse format (see tools/dummyTabEOS).
+ *
+ * The table holds log10(P), log10(eps + energy_shift) and cs^2 on a grid
+ * uniform in log10(rho), log10(T) and Ye, with rho varying fastest. It is
+ * read once per node, by the first rank, into an MPI shared memory window
+ * which the other ranks of the node map. cs^2 is stored as log10(cs^2), so
+ * that all quantities are interpolated trilinearly in log space.
+ *
+ * Lookups are by (rho, eps, Ye): the temperature is found by inverting the
+ * energy along the temperature axis, which is exact for the trilinear
+ * interpolant. The search starts from the bracket of the previous
+ * temperature of the particle, so that it usually takes no step at all.
+ * Outside of the table, the state is clamped to its edges.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <string>
+
+#include <hdf5.h>
+#include <mpi.h>
+
+#include "log.h"
+#include "scratch.h"
+
+namespace eos {
+
+class table
+{
+public:
+  table() = default;
+  table(const table &) = delete;
+  table & operator=(const table &) = delete;
+
+  /**
+   * @brief      Reads the table, once per node of comm. Collective.
+   */
+  void load(const std::string & filename, MPI_Comm comm = MPI_COMM_WORLD) {
+    free();
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node_);
+    int node_rank;
+    MPI_Comm_rank(node_, &node_rank);
+
+    // sizes and energy shift, from the node leader
+    double header[header_size] = {0., 0., 0., 0.};
+    hid_t file = -1;
+    if(node_rank == 0) {
+      file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+      if(file < 0 or not read(file, "pointsrho", &header[0]) or
+         not read(file, "pointstemp", &header[1]) or
+         not read(file, "pointsye", &header[2]) or
+         not read(file, "energy_shift", &header[3]))
+        header[0] = 0.;
+    }
+    MPI_Bcast(header, header_size, MPI_DOUBLE, 0, node_);
+    if(header[0] < 2 or header[1] < 2 or header[2] < 2) {
+      if(file >= 0)
+        H5Fclose(file);
+      MPI_Comm_free(&node_);
+      log_fatal("cannot read the EOS table \"" << filename << "\"");
+    }
+    n_rho_ = header[0];
+    n_t_ = header[1];
+    n_ye_ = header[2];
+    energy_shift_ = header[3];
+    const size_t n = n_rho_ * n_t_ * n_ye_;
+    const size_t size = n_rho_ + n_t_ + n_ye_ + 3 * n;
+
+    // one copy per node
+    double * base = nullptr;
+    MPI_Win_allocate_shared(node_rank == 0 ? size * sizeof(double) : 0,
+      sizeof(double), MPI_INFO_NULL, node_, &base, &win_);
+    if(node_rank != 0) {
+      MPI_Aint bytes;
+      int unit;
+      MPI_Win_shared_query(win_, 0, &bytes, &unit, &base);
+    }
+    logrho_ = base;
+    logtemp_ = logrho_ + n_rho_;
+    ye_ = logtemp_ + n_t_;
+    logpress_ = ye_ + n_ye_;
+    logenergy_ = logpress_ + n;
+    logcs2_ = logenergy_ + n;
+
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, win_);
+    int ok = 1;
+    if(node_rank == 0) {
+      ok = read(file, "logrho", logrho_) and read(file, "logtemp", logtemp_) and
+           read(file, "ye", ye_) and read(file, "logpress", logpress_) and
+           read(file, "logenergy", logenergy_) and read(file, "cs2", logcs2_);
+      for(size_t i = 0; i < n; ++i)
+        logcs2_[i] = std::log10(std::max(logcs2_[i], tiny));
+      H5Fclose(file);
+    }
+    MPI_Win_sync(win_);
+    MPI_Bcast(&ok, 1, MPI_INT, 0, node_);
+    MPI_Win_sync(win_);
+    MPI_Win_unlock_all(win_);
+    if(not ok) {
+      free();
+      log_fatal("missing datasets in the EOS table \"" << filename << "\"");
+    }
+
+    // the lookups assume uniform axes
+    if(not uniform(logrho_, n_rho_, lr0_, dlr_) or
+       not uniform(logtemp_, n_t_, lt0_, dlt_) or
+       not uniform(ye_, n_ye_, ye0_, dye_)) {
+      free();
+      log_fatal("the EOS table \"" << filename
+                << "\" is not uniform in log10(rho), log10(T) and Ye");
+    }
+  }
+
+  /**
+   * @brief      Releases the shared memory window. Collective; must be
+   *             called before MPI_Finalize, if at all.
+   */
+  void free() {
+    if(win_ == MPI_WIN_NULL)
+      return;
+    MPI_Win_free(&win_);
+    MPI_Comm_free(&node_);
+    logrho_ = nullptr;
+  }
+
+  bool loaded() const {
+    return logrho_ != nullptr;
+  }
+
+  /**
+   * @brief      Pressure, sound speed and temperature at (rho, eps, ye)
+   *
+   * @param      T     On input, the previous temperature, which gives the
+   *                   first bracket of the search (any if <= 0)
+   */
+  void evaluate(const double rho,
+    const double eps,
+    const double ye,
+    double & T,
+    double & P,
+    double & cs) const {
+    cell_t c;
+    locate(rho, eps, ye, T, c);
+    interpolate(c, T, P, cs);
+  }
+
+  /**
+   * @brief      evaluate() over arrays: the bracket searches first, then
+   *             the interpolations in a loop without branches
+   */
+  void evaluate(const size_t n,
+    const double * rho,
+    const double * eps,
+    const double * ye,
+    double * T,
+    double * P,
+    double * cs) const {
+    scratch::frame scratch_;
+    cell_t * c = scratch_.alloc<cell_t>(n);
+    for(size_t i = 0; i < n; ++i)
+      locate(rho[i], eps[i], ye[i], T[i], c[i]);
+#pragma omp simd
+    for(size_t i = 0; i < n; ++i)
+      interpolate(c[i], T[i], P[i], cs[i]);
+  }
+
+  /**
+   * @brief      Specific internal energy at (rho, T, ye)
+   */
+  double internal_energy(const double rho,
+    const double T,
+    const double ye) const {
+    size_t i, j, k;
+    double wr, wt, wy;
+    axis(std::log10(rho), lr0_, dlr_, n_rho_, i, wr);
+    axis(std::log10(T), lt0_, dlt_, n_t_, j, wt);
+    axis(ye, ye0_, dye_, n_ye_, k, wy);
+    const size_t base = k * n_t_ * n_rho_ + i;
+    const double le = (1. - wt) * column(logenergy_, base, j, wr, wy) +
+                      wt * column(logenergy_, base, j + 1, wr, wy);
+    return std::pow(10., le) - energy_shift_;
+  }
+
+  //- table bounds
+  double rho_min() const {
+    return std::pow(10., lr0_);
+  }
+  double rho_max() const {
+    return std::pow(10., lr0_ + (n_rho_ - 1) * dlr_);
+  }
+  double T_min() const {
+    return std::pow(10., lt0_);
+  }
+  double T_max() const {
+    return std::pow(10., lt0_ + (n_t_ - 1) * dlt_);
+  }
+
+private:
+  static constexpr int header_size = 4;
+  static constexpr double tiny = 1e-300;
+
+  //- position of a lookup in the table: first corner, weights and
+  //  log10(T)
+  struct cell_t {
+    size_t base;
+    double wr, wt, wy, lt;
+  };
+
+  static bool read(hid_t file, const char * name, double * data) {
+    if(H5Lexists(file, name, H5P_DEFAULT) <= 0)
+      return false;
+    const hid_t set = H5Dopen2(file, name, H5P_DEFAULT);
+    const herr_t status =
+      H5Dread(set, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, data);
+    H5Dclose(set);
+    return status >= 0;
+  }
+
+  static bool uniform(const double * x, size_t n, double & x0, double & dx) {
+    x0 = x[0];
+    dx = (x[n - 1] - x[0]) / (n - 1);
+    for(size_t i = 1; i < n - 1; ++i)
+      if(std::abs(x[i] - (x0 + i * dx)) > 1e-8 * std::abs(x[n - 1] - x0))
+        return false;
+    return dx > 0.;
+  }
+
+  //- cell and weight of x on a uniform axis, clamped to its ends
+  static void
+  axis(double x, double x0, double dx, size_t n, size_t & i, double & w) {
+    const double f = std::min(std::max((x - x0) / dx, 0.), double(n - 1));
+    i = std::min(size_t(f), n - 2);
+    w = f - i;
+  }
+
+  //- bilinear interpolation in (rho, ye) at temperature index j
+  double column(const double * q,
+    const size_t base,
+    const size_t j,
+    const double wr,
+    const double wy) const {
+    const size_t s = n_t_ * n_rho_, c = base + j * n_rho_;
+    return (1. - wy) * ((1. - wr) * q[c] + wr * q[c + 1]) +
+           wy * ((1. - wr) * q[c + s] + wr * q[c + s + 1]);
+  }
+
+  void locate(const double rho,
+    const double eps,
+    const double ye,
+    const double T,
+    cell_t & c) const {
+    size_t i, j, k;
+    axis(std::log10(rho), lr0_, dlr_, n_rho_, i, c.wr);
+    axis(ye, ye0_, dye_, n_ye_, k, c.wy);
+    double unused;
+    if(T > 0.)
+      axis(std::log10(T), lt0_, dlt_, n_t_, j, unused);
+    else
+      j = (n_t_ - 1) / 2;
+    const size_t base = k * n_t_ * n_rho_ + i;
+
+    // the energy is increasing with T: walk to the bracket of le
+    const double le = std::log10(std::max(eps + energy_shift_, tiny));
+    double e0 = column(logenergy_, base, j, c.wr, c.wy),
+           e1 = column(logenergy_, base, j + 1, c.wr, c.wy);
+    while(le < e0 and j > 0) {
+      --j;
+      e1 = e0;
+      e0 = column(logenergy_, base, j, c.wr, c.wy);
+    }
+    while(le > e1 and j < n_t_ - 2) {
+      ++j;
+      e0 = e1;
+      e1 = column(logenergy_, base, j + 1, c.wr, c.wy);
+    }
+    c.base = base + j * n_rho_;
+    c.wt = e1 > e0 ? std::min(std::max((le - e0) / (e1 - e0), 0.), 1.) : 0.;
+    c.lt = lt0_ + (j + c.wt) * dlt_;
+  }
+
+  //- trilinear interpolation from the cell, powers of 10 as exp
+  inline void
+  interpolate(const cell_t & c, double & T, double & P, double & cs) const {
+    const size_t r = 1, t = n_rho_, y = n_t_ * n_rho_;
+    const double w[8] = {(1. - c.wy) * (1. - c.wt) * (1. - c.wr),
+      (1. - c.wy) * (1. - c.wt) * c.wr, (1. - c.wy) * c.wt * (1. - c.wr),
+      (1. - c.wy) * c.wt * c.wr, c.wy * (1. - c.wt) * (1. - c.wr),
+      c.wy * (1. - c.wt) * c.wr, c.wy * c.wt * (1. - c.wr), c.wy * c.wt * c.wr};
+    const size_t o[8] = {0, r, t, t + r, y, y + r, y + t, y + t + r};
+    double lp = 0., lcs2 = 0.;
+    for(int k = 0; k < 8; ++k) {
+      lp += w[k] * logpress_[c.base + o[k]];
+      lcs2 += w[k] * logcs2_[c.base + o[k]];
+    }
+    T = std::exp(ln10 * c.lt);
+    P = std::exp(ln10 * lp);
+    cs = std::exp(.5 * ln10 * lcs2);
+  }
+
+  static constexpr double ln10 = 2.302585092994045684;
+
+  MPI_Comm node_ = MPI_COMM_NULL;
+  MPI_Win win_ = MPI_WIN_NULL;
+  size_t n_rho_ = 0, n_t_ = 0, n_ye_ = 0;
+  double energy_shift_ = 0.;
+  double lr0_ = 0., dlr_ = 1., lt0_ = 0., dlt_ = 1., ye0_ = 0., dye_ = 1.;
+  // in the shared window
+  double * logrho_ = nullptr;
+  double * logtemp_ = nullptr;
+  double * ye_ = nullptr;
+  double * logpress_ = nullptr;
+  double * logenergy_ = nullptr;
+  double * logcs2_ = nullptr;
+}; // class table
+
+} // namespace eos
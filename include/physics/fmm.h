@@ -19,17 +19,36 @@
 /**
  * @file fmm.h
  * @brief Functions used in the FMM computation
+ *
+ * The order of the expansions is set at build time by FMM_ORDER (1, 2 or
+ * 3), which selects the node type (see node.h and tree.h). At order p, the
+ * source cells carry their mass moments about their center of mass up to
+ * rank p: mass, quadrupole Q_ij = sum m d_i d_j and octupole
+ * H_ijk = sum m d_i d_j d_k (raw, not traceless; the dipole vanishes).
+ * The sink cells carry the potential pc, the acceleration fc and, from
+ * order 2, its derivatives dfcdr and dfcdrdr, up to rank p-1. A term of
+ * the sink expansion with n derivatives of the potential uses the source
+ * moments of rank m for n + m <= p + 1, so that the acceleration includes
+ * every moment of the source.
  */
 
 #pragma once
 
+#include <limits>
+#include <type_traits>
+
 #include "params.h"
+#include "scratch.h"
+#include "simd_types.h"
 #include "tree.h"
 
 namespace fmm {
 using namespace param;
 double gc = gravitational_constant;
 
+constexpr size_t order = FMM_ORDER;
+static_assert(order >= 1 and order <= 3, "FMM_ORDER must be 1, 2 or 3");
+
 /*
  * @brief Compute gravitation interaction between two points
  *        Returns the resulting gravitational acceleration
@@ -46,13 +65,120 @@ gravitation_p2p(double & gpot,
 }
 
 /*
- * @brief Compute the gravitation interaction between point and cell
+ * @brief Coordinates and masses of particle sources, in arrays padded to
+ *        the SIMD width with massless sources
+ */
+struct p2p_sources {
+  p2p_sources(scratch::frame & f, const std::vector<body *> & particles)
+    : n(particles.size()) {
+    const size_t n_padded = simd::padded(n);
+    for(unsigned short i = 0; i < gdimension; ++i) {
+      x[i] = f.alloc<double>(n_padded);
+      std::fill(x[i] + n, x[i] + n_padded, 0.);
+    }
+    m = f.alloc<double>(n_padded);
+    std::fill(m + n, m + n_padded, 0.);
+    for(size_t j = 0; j < n; ++j) {
+      const point_t & rp = particles[j]->coordinates();
+      for(unsigned short i = 0; i < gdimension; ++i)
+        x[i][j] = rp[i];
+      m[j] = particles[j]->mass();
+    }
+  }
+
+  // n sources from j0 of a block holding, one after the other, its
+  // coordinates and masses in arrays of the given stride
+  p2p_sources(double * block, size_t stride, size_t j0, size_t n_) : n(n_) {
+    for(unsigned short i = 0; i < gdimension; ++i)
+      x[i] = block + i * stride + j0;
+    m = block + gdimension * stride + j0;
+  }
+
+  size_t n;
+  double * x[gdimension];
+  double * m;
+}; // struct p2p_sources
+
+/*
+ * @brief Gravitation of all the particle sources on a point, added to its
+ *        potential and acceleration, with the softening S of length
+ *        gravity_softening_length. A source at the very position of the
+ *        point (the point itself) is masked out.
+ *        The spline softening is the potential of the cubic spline density
+ *        of support h (Hernquist & Katz 1989, as in Gadget-2), Newtonian
+ *        beyond h.
+ *        With SPLIT, only the short-range part of the TreePM split at the
+ *        scale rs is kept: the potential is multiplied by erfc(r/2rs).
  */
+template<gravity_softening_keyword S, bool SPLIT = false>
+inline void
+gravitation_p2p(double & gpot,
+  point_t & acc,
+  const point_t & local_coordinates,
+  const p2p_sources & sources,
+  const double rs = 0.) {
+  using namespace simd;
+  using std::erfc;
+  using std::exp;
+  using std::sqrt;
+  const double h = gravity_softening_length, h_inv = 1. / h;
+  vdouble pot(0.), a[gdimension];
+  for(unsigned short i = 0; i < gdimension; ++i)
+    a[i] = 0.;
+  for(size_t j = 0; j < sources.n; j += width) {
+    vdouble dx[gdimension], r2(0.);
+    for(unsigned short i = 0; i < gdimension; ++i) {
+      dx[i] = load(sources.x[i] + j) - local_coordinates[i];
+      r2 += dx[i] * dx[i];
+    }
+    const vmask self = r2 == 0.;
+    const vdouble m = choose(self, vdouble(0.), load(sources.m + j));
+    r2 = choose(self, vdouble(1.), r2);
+    const vdouble r2_split = r2; // unsoftened
+    if constexpr(S == soft_plummer)
+      r2 += h * h;
+    // phi: potential per unit mass, f: acceleration per unit mass and
+    // distance
+    const vdouble inv_r = 1. / sqrt(r2);
+    vdouble phi = inv_r, f = inv_r * inv_r * inv_r;
+    if constexpr(S == soft_spline) {
+      const vdouble u = r2 * inv_r * h_inv, u2 = u * u;
+      const double h_inv3 = h_inv * h_inv * h_inv;
+      const vmask inner = u < .5, outer = u >= 1.;
+      const vdouble phi_in = 2.8 - u2 * (16. / 3. + u2 * (6.4 * u - 9.6)),
+                    phi_mid = 3.2 - 1. / (15. * u) -
+                              u2 * (32. / 3. +
+                                     u * (-16. + u * (9.6 - 32. / 15. * u))),
+                    f_in = 32. / 3. + u2 * (32. * u - 38.4),
+                    f_mid = 64. / 3. - 48. * u + 38.4 * u2 -
+                            32. / 3. * u2 * u - 1. / (15. * u2 * u);
+      phi = choose(outer, phi, h_inv * choose(inner, phi_in, phi_mid));
+      f = choose(outer, f, h_inv3 * choose(inner, f_in, f_mid));
+    }
+    if constexpr(SPLIT) {
+      const vdouble v = .5 / rs * sqrt(r2_split), e = erfc(v);
+      phi *= e;
+      f *= e + M_2_SQRTPI * v * exp(-v * v);
+    }
+    pot += m * phi;
+    for(unsigned short i = 0; i < gdimension; ++i)
+      a[i] += m * f * dx[i];
+  }
+  gpot -= gc * reduce(pot);
+  for(unsigned short i = 0; i < gdimension; ++i)
+    acc[i] += gc * reduce(a[i]);
+}
+
+/*
+ * @brief Compute the gravitation interaction between point and cell,
+ *        from the moments of the cell up to FMM_ORDER
+ */
+template<class NODE>
 inline void 
 gravitation_fc(double & pc,
   point_t & fc,
   const point_t & local_coordinates,
-  const node * source) {
+  const NODE * source) {
   const point_t & dist_coordinates = source->coordinates();
   const double M = source->mass();
   double d = flecsi::distance(local_coordinates,dist_coordinates);
@@ -63,6 +189,42 @@ gravitation_fc(double & pc,
   for(int m = 0; m < gdimension; ++m) {
     fc[m] += -gc*M*r[m]/d3; // Monopole
   }
+
+  if constexpr(order >= 2) { // Quadrupole
+    const double d5 = d3*d*d, d7 = d5*d*d;
+    const auto & Q = source->quad();
+    point_t q = 0.0;
+    double trQ = 0., qrr = 0.;
+    for(size_t i = 0; i < gdimension; ++i) {
+      for(size_t j = 0; j < gdimension; ++j)
+        q[i] += Q(i, j)*r[j];
+      trQ += Q(i, i);
+      qrr += q[i]*r[i];
+    }
+    pc += -.5*gc*(3.*qrr/d5 - trQ/d3);
+    for(int m = 0; m < gdimension; ++m)
+      fc[m] += .5*gc*(-15.*r[m]*qrr/d7 + 3.*(trQ*r[m] + 2.*q[m])/d5);
+
+    if constexpr(order >= 3) { // Octupole
+      const double d9 = d7*d*d;
+      const auto & H = source->octo();
+      point_t h = 0.0, t = 0.0;
+      double hrrr = 0., tr = 0.;
+      for(size_t i = 0; i < gdimension; ++i) {
+        for(size_t j = 0; j < gdimension; ++j) {
+          t[i] += H(i, j, j);
+          for(size_t k = 0; k < gdimension; ++k)
+            h[i] += H(i, j, k)*r[j]*r[k];
+        }
+        hrrr += h[i]*r[i];
+        tr += t[i]*r[i];
+      }
+      pc += gc/6.*(-15.*hrrr/d7 + 9.*tr/d5);
+      for(int m = 0; m < gdimension; ++m)
+        fc[m] += -gc/6.*(105.*r[m]*hrrr/d9 - 45.*(h[m] + r[m]*tr)/d7 +
+                   9.*t[m]/d5);
+    }
+  }
 }
 
 /*
@@ -85,69 +247,445 @@ gravitation_fc(double & pc,
 }
 
 /*
- * @brief Taylor expansion up to first order using gravity 
- *        at the cell center of mass
+ * @brief Derivatives of the acceleration at the center of the cell 'sink',
+ *        from the moments of the source up to FMM_ORDER
  */
-void 
-interaction_c2p(body * sink, const node * source) {
+template<class NODE, class SOURCE>
+inline void
+gravitation_dfc(NODE * sink, const SOURCE * source) {
+  if constexpr(order >= 2) {
+    // the quadrupole of a cell enters the derivatives at order 3
+    constexpr bool quadrupole =
+      order >= 3 and not std::is_same<SOURCE, body>::value;
+    const point_t r = sink->coordinates() - source->coordinates();
+    const double M = source->mass();
+    const double d = flecsi::magnitude(r), d2 = d*d, d3 = d2*d, d5 = d3*d2,
+                 d7 = d5*d2, d9 = d7*d2;
+    point_t q = 0.0;
+    double trQ = 0., qrr = 0.;
+    if constexpr(quadrupole)
+      for(size_t i = 0; i < gdimension; ++i) {
+        for(size_t j = 0; j < gdimension; ++j)
+          q[i] += source->quad()(i, j)*r[j];
+        trQ += source->quad()(i, i);
+        qrr += q[i]*r[i];
+      }
+
+    auto & dfcdr = sink->dfcdr();
+    for(size_t i = 0; i < gdimension; ++i)
+      for(size_t j = 0; j <= i; ++j) {
+        const double delta = i == j;
+        double D = M*(3.*r[i]*r[j]/d5 - delta/d3);
+        if constexpr(quadrupole)
+          D += .5*(105.*r[i]*r[j]*qrr/d9 -
+                   15.*(delta*qrr + 2.*(r[j]*q[i] + r[i]*q[j]) +
+                         r[i]*r[j]*trQ)/d7 +
+                   3.*(delta*trQ + 2.*source->quad()(i, j))/d5);
+        dfcdr(i, j) += gc*D;
+      }
+
+    if constexpr(order >= 3) {
+      auto & dfcdrdr = sink->dfcdrdr();
+      for(size_t i = 0; i < gdimension; ++i)
+        for(size_t j = 0; j <= i; ++j)
+          for(size_t k = 0; k <= j; ++k) {
+            const double D = -15.*r[i]*r[j]*r[k]/d7 +
+                             3.*((i == j)*r[k] + (i == k)*r[j] +
+                                  (j == k)*r[i])/d5;
+            dfcdrdr(i, j, k) += gc*M*D;
+          }
+    }
+  }
+}
+
+/*
+ * @brief Taylor expansion up to FMM_ORDER-1 of the acceleration, using
+ *        gravity and its derivatives at the cell center of mass, added at
+ *        x to the potential and the acceleration
+ */
+template<class NODE>
+void
+evaluate_c2p(double & gpot,
+  point_t & gacc,
+  const point_t & x,
+  const NODE * source) {
   const double & pc  = source->pc();
   const point_t & fc = source->fc();
   point_t cofm_coordinates = source->coordinates();
 
-  point_t part_coordinates = sink->coordinates();
-  point_t r = part_coordinates - cofm_coordinates;
+  point_t r = x - cofm_coordinates;
   point_t grav = fc;
   double pot = pc;
 
   for(int i = 0 ; i < gdimension; ++i){
     pot += -r[i]*fc[i];
   }
-  sink->setGPotential(sink->getGPotential()+pot);
-  sink->setGAcceleration(grav+sink->getGAcceleration());
+  if constexpr(order >= 2) {
+    const auto & dfcdr = source->dfcdr();
+    for(size_t i = 0; i < gdimension; ++i)
+      for(size_t j = 0; j < gdimension; ++j) {
+        grav[i] += dfcdr(i, j)*r[j];
+        pot += -.5*r[i]*dfcdr(i, j)*r[j];
+      }
+  }
+  if constexpr(order >= 3) {
+    const auto & dfcdrdr = source->dfcdrdr();
+    for(size_t i = 0; i < gdimension; ++i)
+      for(size_t j = 0; j < gdimension; ++j)
+        for(size_t k = 0; k < gdimension; ++k) {
+          grav[i] += .5*dfcdrdr(i, j, k)*r[j]*r[k];
+          pot += -r[i]*dfcdrdr(i, j, k)*r[j]*r[k]/6.;
+        }
+  }
+  gpot += pot;
+  gacc += grav;
+}
+
+/*
+ * @brief Expansion of the cell source on the particle sink
+ */
+template<class NODE>
+void 
+interaction_c2p(body * sink, const NODE * source) {
+  double pot = sink->getGPotential();
+  point_t grav = sink->getGAcceleration();
+  evaluate_c2p(pot, grav, sink->coordinates(), source);
+  sink->setGPotential(pot);
+  sink->setGAcceleration(grav);
 }
 
 
 /**
- * @brief For all sub_entities, add gravitational force and potential of the
- *        node nd, using Taylor expansion coefficients stored in the node.
+ * @brief Bounds of the sinks of one rank, for the locally essential tree:
+ *        box of its particles, largest smoothing length and smallest last
+ *        acceleration
+ */
+struct mac_domain {
+  mac_domain() {}
+  mac_domain(const std::vector<body> & bodies) {
+    for(size_t i = 0; i < gdimension; ++i) {
+      lo[i] = std::numeric_limits<double>::max();
+      hi[i] = -std::numeric_limits<double>::max();
+    }
+    for(const body & b : bodies) {
+      for(size_t i = 0; i < gdimension; ++i) {
+        lo[i] = std::min(lo[i], b.coordinates()[i]);
+        hi[i] = std::max(hi[i], b.coordinates()[i]);
+      }
+      hmax = std::max(hmax, b.radius());
+      amin = std::min(amin, b.getGAccelerationOld());
+    }
+  }
+  // distance from p to the box
+  double distance(const point_t & p) const {
+    double d2 = 0.;
+    for(size_t i = 0; i < gdimension; ++i) {
+      const double e = std::max({lo[i] - p[i], 0., p[i] - hi[i]});
+      d2 += e * e;
+    }
+    return std::sqrt(d2);
+  }
+  point_t lo, hi;
+  double hmax = 0., amin = std::numeric_limits<double>::max();
+}; // struct mac_domain
+
+/**
+ * @brief Multipole acceptance criterion selected by fmm_mac, between a sink
+ *        and a source which are cells or particles (of radius zero)
+ */
+class mac_criterion
+{
+public:
+  using domain_t = mac_domain;
+
+  /**
+   * @brief With a TreePM split scale rs > 0, the pairs farther apart than
+   *        pm_cutoff * rs are accepted, for the mesh, and the cells within
+   *        that range are only accepted by particles (see short_range).
+   *        With expand, the pairs beyond the cutoff are accepted by the
+   *        criterion, for their expansions (see far_field).
+   */
+  mac_criterion(const double macangle,
+    const double rs = 0.,
+    const bool expand = false)
+    : macangle_(macangle), rcut_(pm_cutoff * rs), expand_(expand) {}
+
+  /**
+   * @brief True if no sink within the domain opens the source cell: the
+   *        traversal only opens a source against the sinks of smaller
+   *        radius, whose centers of mass are in the box
+   */
+  template<class NODE>
+  bool operator()(const mac_domain * domain, const NODE * source) const {
+    const double d = domain->distance(source->coordinates()),
+                 l = 2. * source->radius();
+    if(rcut_ > 0.) {
+      if(d - l <= rcut_)
+        return false;
+      if(not expand_)
+        return true;
+    }
+    if(fmm_max_cell_mass > 0. and source->mass() > fmm_max_cell_mass)
+      return false;
+    switch(fmm_mac) {
+      case mac_bmax: {
+        // the box of the sink reaches hmax/2 beyond its particles
+        const double b = std::sqrt(double(gdimension)) *
+                         (source->radius() + .5 * domain->hmax);
+        return b + bmax(source) < macangle_ * d;
+      }
+      case mac_relative:
+        if(domain->amin > 0.)
+          return l < macangle_ * d and gc * source->mass() *
+                                         simd::ipow<order>(l / d) <
+                                       fmm_mac_tolerance * domain->amin * d * d;
+        break;
+      default:
+        break;
+    }
+    return l < macangle_ * d;
+  }
+
+  template<class SINK, class SOURCE>
+  bool operator()(const SINK * sink, const SOURCE * source) const {
+    const double d =
+      flecsi::distance(sink->coordinates(), source->coordinates());
+    if(rcut_ > 0.) {
+      if(d - radius(sink) - radius(source) > rcut_) {
+        if(not expand_)
+          return true;
+      }
+      else if constexpr(not std::is_same<SINK, body>::value)
+        return false;
+    }
+    if constexpr(not std::is_same<SOURCE, body>::value)
+      if(fmm_max_cell_mass > 0. and source->mass() > fmm_max_cell_mass)
+        return false;
+    switch(fmm_mac) {
+      case mac_bmax:
+        return bmax(sink) + bmax(source) < macangle_ * d;
+      case mac_relative: {
+        // error of the expansions, against the last acceleration of the
+        // sink, within the opening angle; the sink expansion, one order
+        // below the source moments, sets the power of l/d
+        const double l = radius(sink) + radius(source), a = amin(sink);
+        if(a > 0.)
+          return l < macangle_ * d and gc * source->mass() *
+                               simd::ipow<order>(l / d) <
+                             fmm_mac_tolerance * a * d * d;
+        break; // no acceleration yet
+      }
+      default:
+        break;
+    }
+    return radius(sink) + radius(source) < macangle_ * d;
+  }
+
+private:
+  static double radius(const body *) {
+    return 0.;
+  }
+  template<class NODE>
+  static double radius(const NODE * n) {
+    return n->radius();
+  }
+  // distance from the center of mass to the farthest corner of the box
+  static double bmax(const body *) {
+    return 0.;
+  }
+  template<class NODE>
+  static double bmax(const NODE * n) {
+    double b2 = 0.;
+    for(size_t i = 0; i < gdimension; ++i) {
+      const double c = n->coordinates()[i],
+                   e = std::max(c - n->bmin()[i], n->bmax()[i] - c);
+      b2 += e * e;
+    }
+    return std::sqrt(b2);
+  }
+  static double amin(const body * b) {
+    return b->getGAccelerationOld();
+  }
+  template<class NODE>
+  static double amin(const NODE * n) {
+    return n->amin();
+  }
+
+  double macangle_, rcut_;
+  bool expand_;
+}; // class mac_criterion
+
+/**
+ * @brief Keep the magnitude of the gravitational acceleration for the
+ *        relative acceptance criterion of the next pass
+ */
+inline void
+save_acceleration(body & b) {
+  b.setGAccelerationOld(flecsi::magnitude(b.getGAcceleration()));
+}
+
+/**
+ * @brief For the contiguous sub_entities [first, last), add gravitational
+ *        force and potential of the node nd, using Taylor expansion
+ *        coefficients stored in the node.
  */
 void
-fmm_c2p(const node* nd, std::vector<body *> & sub_entities) {
-  for (int k = 0; k < sub_entities.size(); ++k) {
-    interaction_c2p(sub_entities[k], nd);
+fmm_c2p(const node* nd, body * first, body * last) {
+  for (body * b = first; b != last; ++b) {
+    interaction_c2p(b, nd);
+  }
+}
+
+/**
+ * @brief Particle sources on x, softened as set by gravity_softening
+ */
+inline void
+softened_p2p(double & pc,
+  point_t & acc,
+  const point_t & x,
+  const p2p_sources & sources) {
+  switch(gravity_softening) {
+    case soft_none:
+      gravitation_p2p<soft_none>(pc, acc, x, sources);
+      break;
+    case soft_plummer:
+      gravitation_p2p<soft_plummer>(pc, acc, x, sources);
+      break;
+    case soft_spline:
+      gravitation_p2p<soft_spline>(pc, acc, x, sources);
+      break;
   }
 }
 
 /**
- * @brief Particle-particle interactions between 'sources' and 'sinks'
+ * @brief Particle-particle interactions between 'sources' and 'sinks',
+ *        softened as set by gravity_softening
  */
 void 
 fmm_p2p(std::vector<body *> & sinks,
   const node * node_sources,
   const std::vector<body *> & particle_sources) {
+  scratch::frame scratch_;
+  const p2p_sources sources(scratch_, particle_sources);
   for (int i=0; i<sinks.size(); ++i) {
     body *p = sinks[i];
     double pc = p->getGPotential();
     point_t acc = p->getGAcceleration();
     if(node_sources != nullptr)
     gravitation_fc(pc, acc, p->coordinates(), node_sources);
-    for (int k = 0; k < particle_sources.size(); ++k) {
-      body *q = particle_sources[k];
-      if (q->id() == p->id())
-        continue;
-      acc+= gravitation_p2p(pc,p->coordinates(),q->coordinates(),q->mass());
-    } // for
+    if(sources.n > 0)
+      softened_p2p(pc, acc, p->coordinates(), sources);
     p->setGPotential(pc);
     p->setGAcceleration(acc);
   }
 }
 
+/**
+ * @brief Coefficients of the short-range kernel erfc(r/2rs)/r at the
+ *        distance d: B[0] is the kernel and B[n] = -(1/r d/dr) B[n-1]
+ */
+inline void
+split_kernel(const double d, const double rs, double (&B)[5]) {
+  const double a = .5 / rs, d2 = d * d,
+               g = M_2_SQRTPI * a * std::exp(-a * a * d2);
+  B[0] = std::erfc(a * d) / d;
+  B[1] = (B[0] + g) / d2;
+  B[2] = (3. * B[1] + 2. * a * a * g) / d2;
+  B[3] = (5. * B[2] + 4. * a * a * a * a * g) / d2;
+  B[4] = (7. * B[3] + 8. * a * a * a * a * a * a * g) / d2;
+}
+
+/**
+ * @brief Short-range gravity of the TreePM split at the scale rs (see
+ *        pm.h), as the interactions of traversal_fmm: the particles with
+ *        the split kernel, the cells within the cutoff as multipoles on
+ *        the particles. The pairs beyond the cutoff, which mac_criterion
+ *        accepts, are left to the mesh.
+ */
+class short_range
+{
+public:
+  short_range(const double rs) : rs_(rs), rcut_(pm_cutoff * rs) {}
+
+  void operator()(std::vector<body *> & sinks,
+    const node * node_sources,
+    const std::vector<body *> & particle_sources) const {
+    scratch::frame scratch_;
+    const p2p_sources sources(scratch_, particle_sources);
+    for(body * p : sinks) {
+      double pc = p->getGPotential();
+      point_t acc = p->getGAcceleration();
+      if(node_sources != nullptr)
+        cell(pc, acc, p->coordinates(), node_sources);
+      if(sources.n > 0) {
+        switch(gravity_softening) {
+          case soft_none:
+            gravitation_p2p<soft_none, true>(
+              pc, acc, p->coordinates(), sources, rs_);
+            break;
+          case soft_plummer:
+            gravitation_p2p<soft_plummer, true>(
+              pc, acc, p->coordinates(), sources, rs_);
+            break;
+          case soft_spline:
+            gravitation_p2p<soft_spline, true>(
+              pc, acc, p->coordinates(), sources, rs_);
+            break;
+        }
+      }
+      p->setGPotential(pc);
+      p->setGAcceleration(acc);
+    }
+  }
+
+  // the cells only accept the sources beyond the cutoff
+  void operator()(node *, const node *) const {}
+  void operator()(node *, const body *) const {}
+
+  /**
+   * @brief Cell within the cutoff on x, to the quadrupole of the split
+   *        kernel
+   */
+  template<class NODE>
+  void cell(double & pc,
+    point_t & acc,
+    const point_t & x,
+    const NODE * source) const {
+    const point_t dx = source->coordinates() - x;
+    const double d = flecsi::magnitude(dx);
+    if(d - source->radius() > rcut_)
+      return;
+    double B[5];
+    split_kernel(d, rs_, B);
+    const double M = source->mass();
+    pc -= gc * M * B[0];
+    acc += gc * M * B[1] * dx;
+    if constexpr(order >= 2) {
+      const auto & Q = source->quad();
+      point_t q = 0.0;
+      double trQ = 0., qrr = 0.;
+      for(size_t i = 0; i < gdimension; ++i) {
+        for(size_t j = 0; j < gdimension; ++j)
+          q[i] += Q(i, j) * dx[j];
+        trQ += Q(i, i);
+        qrr += q[i] * dx[i];
+      }
+      pc -= .5 * gc * (B[2] * qrr - B[1] * trQ);
+      acc += .5 * gc * ((B[3] * qrr - B[2] * trQ) * dx - 2. * B[2] * q);
+    }
+  }
+
+private:
+  double rs_, rcut_;
+}; // class short_range
+
 /**
  * @brief node-node interaction: update Taylor expansion coefficients
  */
 void
 taylor_c2c(node * sink, const node * source) {
   gravitation_fc(sink->pc(), sink->fc(), sink->coordinates(), source);
+  gravitation_dfc(sink, source);
 }
 
 /**
@@ -156,6 +694,263 @@ taylor_c2c(node * sink, const node * source) {
 void 
 taylor_p2c(node * sink, const body * source) {
   gravitation_fc(sink->pc(), sink->fc(), sink->coordinates(), source);
+  gravitation_dfc(sink, source);
+}
+
+/**
+ * @brief Start a far field, before a traversal with far_field
+ */
+inline void
+reset_far_field(body & b) {
+  b.setGAccelerationFar(0.0);
+  b.setGPotentialFar(0.);
+  flecsi::sym_tensor_rank2 g;
+  g = 0;
+  b.setGGradientFar(g);
+  b.setGPositionFar(b.coordinates());
+}
+
+/**
+ * @brief Gradient at x of the acceleration expanded in the cell source
+ */
+template<class NODE>
+void
+gradient_c2p(flecsi::sym_tensor_rank2 & g,
+  const point_t & x,
+  const NODE * source) {
+  if constexpr(order >= 2) {
+    const point_t r = x - source->coordinates();
+    for(size_t i = 0; i < gdimension; ++i)
+      for(size_t j = 0; j <= i; ++j) {
+        g(i, j) += source->dfcdr()(i, j);
+        if constexpr(order >= 3)
+          for(size_t k = 0; k < gdimension; ++k)
+            g(i, j) += source->dfcdrdr()(i, j, k)*r[k];
+      }
+  }
+}
+
+/**
+ * @brief Interactions of traversal_fmm at a refresh of the far field
+ *        (gravity_far_interval), for the split at the scale rs: the short
+ *        range, as short_range, into the acceleration of the particles, and
+ *        the long range, erf(r/2rs)/r, with its gradient, into their far
+ *        field. The pairs beyond the cutoff, which mac_criterion accepts,
+ *        are entirely long range.
+ */
+class far_field
+{
+public:
+  far_field(const double rs) : near_(rs), rs_(rs), rcut_(pm_cutoff * rs) {}
+
+  void operator()(std::vector<body *> & sinks,
+    const node * node_sources,
+    const std::vector<body *> & particle_sources) const {
+    near_(sinks, node_sources, particle_sources);
+    for(body * p : sinks) {
+      const point_t & x = p->coordinates();
+      double pc = p->getGPotentialFar();
+      point_t acc = p->getGAccelerationFar();
+      flecsi::sym_tensor_rank2 g = p->getGGradientFar();
+      if(node_sources != nullptr) {
+        gravitation_fc(pc, acc, x, node_sources);
+        const point_t dx = node_sources->coordinates() - x;
+        const double d = flecsi::magnitude(dx);
+        double B[5] = {0., 0., 0., 0., 0.};
+        if(d - node_sources->radius() <= rcut_) {
+          double ps = 0.;
+          point_t as = 0.0;
+          near_.cell(ps, as, x, node_sources);
+          pc -= ps;
+          acc -= as;
+          split_kernel(d, rs_, B);
+        }
+        add_gradient(g, dx, d, gc * node_sources->mass(), B);
+        if constexpr(order >= 2)
+          add_gradient_quadrupole(g, dx, d, node_sources->quad(), B);
+      }
+      for(const body * s : particle_sources) {
+        const point_t dx = s->coordinates() - x;
+        const double d = flecsi::magnitude(dx);
+        if(d == 0.)
+          continue;
+        double B[5];
+        split_kernel(d, rs_, B);
+        const double gm = gc * s->mass();
+        pc -= gm * (1. / d - B[0]);
+        acc += gm * (1. / (d * d * d) - B[1]) * dx;
+        add_gradient(g, dx, d, gm, B);
+      }
+      p->setGPotentialFar(pc);
+      p->setGAccelerationFar(acc);
+      p->setGGradientFar(g);
+    }
+  }
+
+  // beyond the cutoff, the expansions of the cells
+  void operator()(node * sink, const node * source) const {
+    taylor_c2c(sink, source);
+  }
+  void operator()(node * sink, const body * source) const {
+    taylor_p2c(sink, source);
+  }
+  void operator()(const node * nd, body * first, body * last) const {
+    for(body * b = first; b != last; ++b) {
+      double pot = b->getGPotentialFar();
+      point_t acc = b->getGAccelerationFar();
+      flecsi::sym_tensor_rank2 g = b->getGGradientFar();
+      evaluate_c2p(pot, acc, b->coordinates(), nd);
+      gradient_c2p(g, b->coordinates(), nd);
+      b->setGPotentialFar(pot);
+      b->setGAccelerationFar(acc);
+      b->setGGradientFar(g);
+    }
+  }
+
+private:
+  // gradient of the long-range acceleration of the mass gm at dx, with
+  // the short-range coefficients B
+  static void add_gradient(flecsi::sym_tensor_rank2 & g,
+    const point_t & dx,
+    const double d,
+    const double gm,
+    const double (&B)[5]) {
+    const double d3 = d * d * d, b1 = 1. / d3 - B[1],
+                 b2 = 3. / (d3 * d * d) - B[2];
+    for(size_t i = 0; i < gdimension; ++i)
+      for(size_t j = 0; j <= i; ++j)
+        g(i, j) += gm * (b2 * dx[i] * dx[j] - (i == j) * b1);
+  }
+
+  // the same for the quadrupole Q of a cell, as in gravitation_dfc with
+  // the long-range coefficients
+  static void add_gradient_quadrupole(flecsi::sym_tensor_rank2 & g,
+    const point_t & dx,
+    const double d,
+    const flecsi::sym_tensor_rank2 & Q,
+    const double (&B)[5]) {
+    const double d2 = d * d, d5 = d2 * d2 * d, d7 = d5 * d2, d9 = d7 * d2,
+                 b2 = 3. / d5 - B[2], b3 = 15. / d7 - B[3],
+                 b4 = 105. / d9 - B[4];
+    point_t q = 0.0;
+    double trQ = 0., qrr = 0.;
+    for(size_t i = 0; i < gdimension; ++i) {
+      for(size_t j = 0; j < gdimension; ++j)
+        q[i] += Q(i, j) * dx[j];
+      trQ += Q(i, i);
+      qrr += q[i] * dx[i];
+    }
+    for(size_t i = 0; i < gdimension; ++i)
+      for(size_t j = 0; j <= i; ++j) {
+        const double delta = i == j;
+        g(i, j) += .5 * gc *
+                   (b4 * qrr * dx[i] * dx[j] -
+                     b3 * (trQ * dx[i] * dx[j] +
+                            2. * (dx[i] * q[j] + dx[j] * q[i]) + delta * qrr) +
+                     b2 * (delta * trQ + 2. * Q(i, j)));
+      }
+  }
+
+  short_range near_;
+  double rs_, rcut_;
+}; // class far_field
+
+/**
+ * @brief Add the far field, extrapolated from the refresh position with
+ *        its gradient
+ */
+inline void
+add_far_field(body & b) {
+  const point_t dx = b.coordinates() - b.getGPositionFar();
+  const auto & g = b.getGGradientFar();
+  point_t acc = b.getGAccelerationFar();
+  double pot = b.getGPotentialFar() - flecsi::dot(acc, dx);
+  for(size_t i = 0; i < gdimension; ++i)
+    for(size_t j = 0; j < gdimension; ++j) {
+      acc[i] += g(i, j)*dx[j];
+      pot -= .5*dx[i]*g(i, j)*dx[j];
+    }
+  b.setGAcceleration(b.getGAcceleration() + acc);
+  b.setGPotential(b.getGPotential() + pot);
+}
+
+/**
+ * @brief Change of the far field since its refresh, extrapolated from its
+ *        gradient, relative to the last acceleration of the particle
+ */
+inline double
+far_field_change(const body & b) {
+  if(b.getGAccelerationOld() <= 0.)
+    return 0.;
+  const point_t dx = b.coordinates() - b.getGPositionFar();
+  const auto & g = b.getGGradientFar();
+  point_t da = 0.0;
+  for(size_t i = 0; i < gdimension; ++i)
+    for(size_t j = 0; j < gdimension; ++j)
+      da[i] += g(i, j)*dx[j];
+  return flecsi::magnitude(da) / b.getGAccelerationOld();
+}
+
+/**
+ * @brief Mass moments of the cell about its center of mass, from its
+ *        particles and sub-cells (P2M and M2M), the smallest last
+ *        acceleration of its particles, and a Taylor expansion reset for
+ *        the next traversal
+ */
+template<class NODE>
+void
+compute_moments(NODE * cofm,
+  const std::vector<body *> & ents,
+  const std::vector<NODE *> & nodes) {
+  cofm->pc() = 0;
+  cofm->fc() = 0;
+  cofm->set_affected(false);
+  double amin = std::numeric_limits<double>::max();
+  for(const body * ent : ents)
+    amin = std::min(amin, ent->getGAccelerationOld());
+  for(const NODE * n : nodes)
+    amin = std::min(amin, n->amin());
+  cofm->set_amin(amin);
+  if constexpr(order >= 2) {
+    cofm->dfcdr() = 0;
+    const point_t & c = cofm->coordinates();
+    auto & Q = cofm->quad();
+    Q = 0;
+    for(const body * ent : ents) {
+      const point_t d = ent->coordinates() - c;
+      for(size_t i = 0; i < gdimension; ++i)
+        for(size_t j = 0; j <= i; ++j)
+          Q(i, j) += ent->mass()*d[i]*d[j];
+    }
+    for(const NODE * n : nodes) {
+      const point_t d = n->coordinates() - c;
+      for(size_t i = 0; i < gdimension; ++i)
+        for(size_t j = 0; j <= i; ++j)
+          Q(i, j) += n->quad()(i, j) + n->mass()*d[i]*d[j];
+    }
+    if constexpr(order >= 3) {
+      cofm->dfcdrdr() = 0;
+      auto & H = cofm->octo();
+      H = 0;
+      for(const body * ent : ents) {
+        const point_t d = ent->coordinates() - c;
+        for(size_t i = 0; i < gdimension; ++i)
+          for(size_t j = 0; j <= i; ++j)
+            for(size_t k = 0; k <= j; ++k)
+              H(i, j, k) += ent->mass()*d[i]*d[j]*d[k];
+      }
+      for(const NODE * n : nodes) {
+        const point_t d = n->coordinates() - c;
+        const auto & Qn = n->quad();
+        for(size_t i = 0; i < gdimension; ++i)
+          for(size_t j = 0; j <= i; ++j)
+            for(size_t k = 0; k <= j; ++k)
+              H(i, j, k) += n->octo()(i, j, k) + Qn(i, j)*d[k] +
+                            Qn(i, k)*d[j] + Qn(j, k)*d[i] +
+                            n->mass()*d[i]*d[j]*d[k];
+      }
+    }
+  }
 }
 
 } // namespace fmm
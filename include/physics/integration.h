@@ -34,6 +34,65 @@
 namespace integration {
 using namespace param;
 
+/**
+ * @brief      Length of the block timestep of a particle, in ticks
+ */
+int64_t
+step_ticks(const body & particle) {
+  return int64_t(1) << (block_timesteps_max_rung - particle.getRung());
+}
+
+/**
+ * @brief      Timestep of a particle: its block timestep, or the global dt
+ */
+double
+particle_dt(const body & particle) {
+  if(not block_timesteps)
+    return physics::dt;
+  return physics::dt_base / (int64_t(1) << particle.getRung());
+}
+
+/**
+ * @brief      True if the step of the particle starts at tick (kick one)
+ */
+bool
+starts_step(const body & particle) {
+  return physics::tick % step_ticks(particle) == 0;
+}
+
+/**
+ * @brief      True if the step of the particle ends at tick_next: it is
+ *             active in this iteration (neighbor sums, kick two, new dt)
+ */
+bool
+ends_step(const body & particle) {
+  return physics::tick_next % step_ticks(particle) == 0;
+}
+
+/**
+ * @brief      After the drift, predicts the velocity of the inactive
+ *             particles at tick_next from their velocity at the middle of
+ *             their step. The positions need no prediction: all particles
+ *             drift with their half-step velocity. The active particles get
+ *             back their half-step velocity for kick two.
+ *
+ * @param      particle  The particle
+ */
+void
+predict_velocity(body & particle) {
+  if(ends_step(particle)) {
+    particle.setVelocity(particle.getVelocityhalf());
+    return;
+  }
+  const int64_t n = step_ticks(particle);
+  const double t_mid = physics::tick - physics::tick % n + .5 * n;
+  const double dt_tick =
+    physics::dt_base / (int64_t(1) << block_timesteps_max_rung);
+  particle.setVelocity(particle.getVelocityhalf() +
+    (physics::tick_next - t_mid) * dt_tick *
+    (particle.getAcceleration() + particle.getGAcceleration()));
+}
+
 /**
  * @brief      Integrate the internal energy variation, update internal energy
  *
@@ -66,7 +125,8 @@ void
 leapfrog_kick_v(body & source) {
   source.setVelocity(
     source.getVelocity() +
-    0.5 * physics::dt * (source.getAcceleration() + source.getGAcceleration()));
+    0.5 * particle_dt(source) *
+      (source.getAcceleration() + source.getGAcceleration()));
 }
 
 /**
@@ -80,7 +140,7 @@ leapfrog_kick_v(body & source) {
 void
 leapfrog_kick_u(body & source) {
   source.setInternalenergy(
-    source.getInternalenergy() + 0.5 * physics::dt * source.getDudt());
+    source.getInternalenergy() + 0.5 * particle_dt(source) * source.getDudt());
 }
 
 /**
@@ -94,19 +154,21 @@ leapfrog_kick_u(body & source) {
 void
 leapfrog_kick_e(body & source) {
   source.setTotalenergy(
-    source.getTotalenergy() + 0.5 * physics::dt * source.getDedt());
+    source.getTotalenergy() + 0.5 * particle_dt(source) * source.getDedt());
 }
 
 /**
  * @brief      Leapfrog: drift
  *             r^{n+1} = r^{n} + v^{n+1/2} * dt
+ *             With block timesteps, all the particles drift by the
+ *             global dt, with the half-step velocity of their own step.
  *
  * @param      srch  The source's body holder
  */
 void
 leapfrog_drift(body & source) {
   source.set_coordinates(
-    source.coordinates() + physics::dt * source.getVelocity());
+    source.coordinates() + physics::dt * source.getVelocityhalf());
 }
 
 }; // namespace integration
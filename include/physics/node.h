@@ -46,7 +46,7 @@ using sym_tensor_rank4 = flecsi::tensor_u<type_t,
   gdimension>;
 } // namespace flecsi
 
-template<class KEY, size_t FMM_ORDER>
+template<class KEY, size_t ORDER>
 class node_u : public flecsi::topology::cofm_u<gdimension, type_t, KEY>
 {
 
@@ -71,6 +71,7 @@ public:
     pc_ = 0;
     fc_ = 0;
     affected_ = false;
+    amin_ = 0;
   }
 
   node_u(const key_t & key)
@@ -78,6 +79,7 @@ public:
     pc_ = 0;
     fc_ = 0;
     affected_ = false;
+    amin_ = 0;
   }
 
   explicit node_u(const node_u & c)
@@ -85,6 +87,7 @@ public:
     pc_ = c.pc_;
     fc_ = c.fc_;
     affected_ = c.affected_;
+    amin_ = c.amin_;
   }
 
   const type_t & pc() const {
@@ -107,12 +110,20 @@ public:
   bool affected() const {
     return affected_;
   }
+  //! smallest gravitational acceleration of the entities at the last step
+  type_t amin() const {
+    return amin_;
+  }
+  void set_amin(const type_t & amin) {
+    amin_ = amin;
+  }
 
 private:
   type_t pc_;
   point_t fc_;
 
   bool affected_;
+  type_t amin_;
 
 }; // class node<KEY, 1>
 
@@ -139,6 +150,7 @@ public:
     fc_ = 0;
     dfcdr_ = 0;
     affected_ = false;
+    amin_ = 0;
   }
 
   node_u(const key_t & key)
@@ -148,6 +160,7 @@ public:
     fc_ = 0;
     dfcdr_ = 0;
     affected_ = false;
+    amin_ = 0;
   }
 
   explicit node_u(const node_u & c)
@@ -157,6 +170,7 @@ public:
     fc_ = c.fc_;
     dfcdr_ = c.dfcdr_;
     affected_ = c.affected_;
+    amin_ = c.amin_;
   }
 
   const sym_tensor_rank2 & quad() const {
@@ -193,6 +207,13 @@ public:
   bool affected() const {
     return affected_;
   }
+  //! smallest gravitational acceleration of the entities at the last step
+  type_t amin() const {
+    return amin_;
+  }
+  void set_amin(const type_t & amin) {
+    amin_ = amin;
+  }
 
 private:
   sym_tensor_rank2 Q_;
@@ -202,6 +223,7 @@ private:
   sym_tensor_rank2 dfcdr_;
 
   bool affected_;
+  type_t amin_;
 
 }; // class node<KEY, 2>
 
@@ -230,6 +252,7 @@ public:
     dfcdr_ = 0;
     dfcdrdr_ = 0;
     affected_ = false;
+    amin_ = 0;
   }
 
   node_u(const key_t & key)
@@ -241,6 +264,7 @@ public:
     dfcdr_ = 0;
     dfcdrdr_ = 0;
     affected_ = false;
+    amin_ = 0;
   }
 
   explicit node_u(const node_u & c)
@@ -252,6 +276,7 @@ public:
     dfcdr_ = c.dfcdr_;
     dfcdrdr_ = c.dfcdrdr_;
     affected_ = c.affected_;
+    amin_ = c.amin_;
   }
 
   const sym_tensor_rank3 & octo() const {
@@ -300,6 +325,13 @@ public:
   bool affected() const {
     return affected_;
   }
+  //! smallest gravitational acceleration of the entities at the last step
+  type_t amin() const {
+    return amin_;
+  }
+  void set_amin(const type_t & amin) {
+    amin_ = amin;
+  }
 
 private:
   sym_tensor_rank3 H_;
@@ -311,6 +343,7 @@ private:
   sym_tensor_rank3 dfcdrdr_;
 
   bool affected_;
+  type_t amin_;
 
 }; // class node<KEY, 3>
 
@@ -341,6 +374,7 @@ public:
     dfcdrdr_ = 0;
     dfcdrdrdr_ = 0;
     affected_ = false;
+    amin_ = 0;
   }
 
   node_u(const key_t & key)
@@ -354,6 +388,7 @@ public:
     dfcdrdr_ = 0;
     dfcdrdrdr_ = 0;
     affected_ = false;
+    amin_ = 0;
   }
 
   explicit node_u(const node_u & c)
@@ -367,6 +402,7 @@ public:
     dfcdrdr_ = c.dfcdrdr_;
     dfcdrdrdr_ = c.dfcdrdrdr_;
     affected_ = c.affected_;
+    amin_ = c.amin_;
   }
 
   const sym_tensor_rank4 & hexa() const {
@@ -427,6 +463,13 @@ public:
   bool affected() const {
     return affected_;
   }
+  //! smallest gravitational acceleration of the entities at the last step
+  type_t amin() const {
+    return amin_;
+  }
+  void set_amin(const type_t & amin) {
+    amin_ = amin;
+  }
 
 private:
   sym_tensor_rank4 X_;
@@ -440,5 +483,6 @@ private:
   sym_tensor_rank4 dfcdrdrdr_;
 
   bool affected_;
+  type_t amin_;
 
 }; // class node<KEY, 4>
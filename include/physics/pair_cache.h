@@ -0,0 +1,134 @@
+/*~--------------------------------------------------------------------------~*
+ * Copyright (c) 2017 Triad National Security, LLC
+ * All rights reserved.
+ *~--------------------------------------------------------------------------~*/
+
+/*~--------------------------------------------------------------------------~*
+ *
+ * /@@@@@@@@  @@           @@@@@@   @@@@@@@@ @@@@@@@  @@      @@
+ * /@@/////  /@@          @@////@@ @@////// /@@////@@/@@     /@@
+ * /@@       /@@  @@@@@  @@    // /@@       /@@   /@@/@@     /@@
+ * /@@@@@@@  /@@ @@///@@/@@       /@@@@@@@@@/@@@@@@@ /@@@@@@@@@@
+ * /@@////   /@@/@@@@@@@/@@       ////////@@/@@////  /@@//////@@
+ * /@@       /@@/@@//// //@@    @@       /@@/@@      /@@     /@@
+ * /@@       @@@//@@@@@@ //@@@@@@  @@@@@@@@ /@@      /@@     /@@
+ * //       ///  //////   //////  ////////  //       //      //
+ *
+ *~--------------------------------------------------------------------------~*/
+
+/**
+ * @file pair_cache.h
+ * @brief Kernel gradients of the neighbor pairs, shared by the passes of
+ *        one step (sph_pair_cache).
+ *
+ * Positions and smoothing lengths do not change between the viscosity
+ * switch, acceleration and energy passes of a step, so the kernel gradient
+ * of every pair can be computed once. The first pass to visit a particle
+ * reserves one slot per neighbor, in the order of its neighbor list;
+ * later passes read them. Each slot keeps the separation and the h_ab it
+ * was computed with, and is recomputed if they differ, so a stale or
+ * reordered entry only costs the evaluation it would have cost anyway.
+ * Particles which do not fit in sph_pair_cache_mb are not cached.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "params.h"
+#include "tree.h"
+
+namespace physics {
+
+class pair_cache
+{
+public:
+  struct pair_t {
+    point_t pos_ab;
+    double h_ab;
+    point_t DiWab;
+  };
+
+  /**
+   * @brief      Empties the cache, for the local particles starting at
+   *             first. Called when the particles have moved.
+   */
+  void reset(body * first, size_t n) {
+    first_ = param::sph_pair_cache ? first : nullptr;
+    entries_.assign(first_ ? n : 0, entry{0, 0});
+    pairs_.clear();
+    capacity_ = size_t(param::sph_pair_cache_mb * (1 << 20) / sizeof(pair_t));
+    hits_ = misses_ = 0;
+  }
+
+  /**
+   * @brief      Slots of the neighbors of particle, reserved on the first
+   *             call. nullptr if the cache is off, the particle is not
+   *             local, its neighbor count changed or the budget is spent.
+   */
+  pair_t * pairs(const body & particle, size_t n_nb) {
+    if(first_ == nullptr)
+      return nullptr;
+    const ptrdiff_t i = &particle - first_;
+    if(i < 0 or i >= ptrdiff_t(entries_.size()))
+      return nullptr;
+    entry & e = entries_[i];
+    if(e.count == 0) {
+      if(pairs_.size() + n_nb > capacity_)
+        return nullptr;
+      e.offset = pairs_.size();
+      e.count = n_nb;
+      pairs_.resize(pairs_.size() + n_nb, pair_t{0.0, -1., 0.0});
+    }
+    return e.count == n_nb ? &pairs_[e.offset] : nullptr;
+  }
+
+  /**
+   * @brief      Kernel gradient of pair b, from the slots returned by
+   *             pairs() if they hold it, else computed with GRADIENT
+   */
+  template<typename GRADIENT>
+  point_t gradient(pair_t * pairs,
+    const int b,
+    const point_t & pos_ab,
+    const double h_ab,
+    GRADIENT && kernel_gradient) {
+    if(pairs == nullptr)
+      return kernel_gradient(pos_ab, h_ab);
+    pair_t & p = pairs[b];
+    if(p.h_ab == h_ab and p.pos_ab == pos_ab) {
+      ++hits_;
+      return p.DiWab;
+    }
+    ++misses_;
+    p = {pos_ab, h_ab, kernel_gradient(pos_ab, h_ab)};
+    return p.DiWab;
+  }
+
+  //- gradients read from the cache, and computed into it
+  size_t hits() const {
+    return hits_;
+  }
+  size_t misses() const {
+    return misses_;
+  }
+  //- bytes held by the cached pairs
+  size_t bytes() const {
+    return pairs_.size() * sizeof(pair_t);
+  }
+
+private:
+  struct entry {
+    size_t offset, count;
+  };
+
+  body * first_ = nullptr;
+  std::vector<entry> entries_;
+  std::vector<pair_t> pairs_;
+  size_t capacity_ = 0;
+  size_t hits_ = 0, misses_ = 0;
+}; // class pair_cache
+
+pair_cache pair_geometry;
+
+} // namespace physics
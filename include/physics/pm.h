@@ -0,0 +1,515 @@
+/*~--------------------------------------------------------------------------~*
+ * Copyright (c) 2020 Triad National Security, LLC
+ * All rights reserved.
+ *~--------------------------------------------------------------------------~*/
+
+/*~--------------------------------------------------------------------------~*
+ *
+ * /@@@@@@@@  @@           @@@@@@   @@@@@@@@ @@@@@@@  @@      @@
+ * /@@/////  /@@          @@////@@ @@////// /@@////@@/@@     /@@
+ * /@@       /@@  @@@@@  @@    // /@@       /@@   /@@/@@     /@@
+ * /@@@@@@@  /@@ @@///@@/@@       /@@@@@@@@@/@@@@@@@ /@@@@@@@@@@
+ * /@@////   /@@/@@@@@@@/@@       ////////@@/@@////  /@@//////@@
+ * /@@       /@@/@@//// //@@    @@       /@@/@@      /@@     /@@
+ * /@@       @@@//@@@@@@ //@@@@@@  @@@@@@@@ /@@      /@@     /@@
+ * //       ///  //////   //////  ////////  //       //      //
+ *
+ *~--------------------------------------------------------------------------~*/
+
+/**
+ * @file pm.h
+ * @brief Long-range gravity of the TreePM split, on a particle mesh
+ *
+ * The potential of a particle is split at the scale r_s: the mesh computes
+ * -G m erf(r/2r_s)/r, the tree the rest, -G m erfc(r/2r_s)/r, within
+ * pm_cutoff * r_s (see fmm::short_range). The mesh has pm_grid points per
+ * dimension over the particles and r_s = pm_split cells. The masses are
+ * assigned to it by CIC or TSC (pm_assignment), convolved with the
+ * long-range kernel by FFT and the potential is interpolated back with the
+ * same weights; the accelerations are its 4-point finite differences.
+ * The mesh is padded to twice its size for isolated boundaries (Hockney &
+ * Eastwood 1988). The FFT are split in slabs of planes between the ranks:
+ * each rank transforms its planes along z, real to complex, and along y,
+ * the planes are transposed by an all-to-all and transformed along x. Only
+ * the half of the coefficients along z that the real density does not
+ * repeat is kept. The kernel, in the units of the cells, is deconvolved
+ * from the assignment and kept between the calls.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <complex>
+#include <mpi.h>
+#include <omp.h>
+#include <vector>
+
+#include "fmm.h"
+#include "log.h"
+#include "params.h"
+#include "tree.h"
+
+namespace pm {
+using namespace param;
+using complex_t = std::complex<double>;
+
+/**
+ * @brief In-place radix-2 FFT of n contiguous values, n a power of 2:
+ *        forward for sign = -1, backward (unnormalized) for sign = 1
+ */
+inline void
+fft(complex_t * a, const size_t n, const int sign) {
+  for(size_t i = 1, j = 0; i < n; ++i) {
+    size_t bit = n >> 1;
+    for(; j & bit; bit >>= 1)
+      j ^= bit;
+    j ^= bit;
+    if(i < j)
+      std::swap(a[i], a[j]);
+  }
+  for(size_t len = 2; len <= n; len <<= 1) {
+    const size_t half = len / 2;
+    for(size_t k = 0; k < half; ++k) {
+      const double angle = sign * M_PI * k / half;
+      const complex_t w(std::cos(angle), std::sin(angle));
+      for(size_t i = k; i < n; i += len) {
+        const complex_t t = w * a[i + half];
+        a[i + half] = a[i] - t;
+        a[i] += t;
+      }
+    }
+  }
+}
+
+/**
+ * @brief In-place FFT of n real values, n a power of 2 and at least 2,
+ *        stored as the n/2 complex values a[0, n/2): forward for sign = -1,
+ *        from the values to their n/2 + 1 first coefficients a[0, n/2],
+ *        the others being their conjugates; backward (unnormalized) for
+ *        sign = 1, from the coefficients to the values
+ */
+inline void
+rfft(complex_t * a, const size_t n, const int sign) {
+  const size_t h = n / 2;
+  // the even and odd values of the real sequence are the real and
+  // imaginary parts of the complex one; their coefficients are separated
+  // by the symmetry of those of real values, and combined with the twiddle
+  // factors
+  auto twiddle = [&](size_t k) {
+    const double angle = sign * 2. * M_PI * k / n;
+    return complex_t(std::cos(angle), std::sin(angle));
+  };
+  if(sign < 0) {
+    fft(a, h, -1);
+    const complex_t z0 = a[0];
+    a[0] = z0.real() + z0.imag();
+    a[h] = z0.real() - z0.imag();
+    for(size_t k = 1; 2 * k <= h; ++k) {
+      const complex_t zk = a[k], zm = a[h - k];
+      const complex_t e = .5 * (zk + std::conj(zm)),
+                      o = complex_t(0., -.5) * (zk - std::conj(zm)),
+                      wo = twiddle(k) * o;
+      a[k] = e + wo;
+      a[h - k] = std::conj(e - wo);
+    }
+  }
+  else {
+    // the factor 2 makes the values n times the original ones, as fft
+    auto combine = [&](const complex_t & xj, const complex_t & xm, size_t j) {
+      const complex_t e = .5 * (xj + std::conj(xm)),
+                      o = .5 * (xj - std::conj(xm)) * twiddle(j);
+      return 2. * (e + complex_t(0., 1.) * o);
+    };
+    for(size_t k = 0; 2 * k <= h; ++k) {
+      const complex_t xk = a[k], xm = a[h - k];
+      a[k] = combine(xk, xm, k);
+      if(k > 0 && 2 * k < h)
+        a[h - k] = combine(xm, xk, h - k);
+    }
+    fft(a, h, 1);
+  }
+}
+
+class mesh
+{
+  // mesh points kept between the particles and the edges, for the
+  // assignment and the finite differences
+  static constexpr int ghosts = 3;
+
+public:
+  /**
+   * @brief Long-range gravity of all the particles, added to the
+   *        acceleration and potential of the local ones
+   */
+  void solve(std::vector<body> & bodies) {
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank_);
+    MPI_Comm_size(MPI_COMM_WORLD, &size_);
+    setup_(bodies);
+    assign_(bodies);
+    forward_();
+    const size_t ntr = tr_.size();
+#pragma omp parallel for
+    for(size_t i = 0; i < ntr; ++i)
+      tr_[i] *= kernel_[i];
+    backward_();
+    interpolate_(bodies);
+  }
+
+  /**
+   * @brief Split scale r_s of the last solve
+   */
+  double split() const {
+    return pm_split * h_;
+  }
+
+private:
+  int begin_(const int r) const {
+    return static_cast<long>(m_) * r / size_;
+  }
+
+  // first mesh point and weights of the assignment at s, in cells
+  int stencil_(const double s, double * w) const {
+    if(pm_assignment == pm_cic) {
+      const int i = std::floor(s);
+      const double f = s - i;
+      w[0] = 1. - f;
+      w[1] = f;
+      return i;
+    }
+    const int i = std::floor(s + .5);
+    const double d = s - i;
+    w[0] = .5 * (.5 - d) * (.5 - d);
+    w[1] = .75 - d * d;
+    w[2] = .5 * (.5 + d) * (.5 + d);
+    return i - 1;
+  }
+
+  int points_() const {
+    return pm_assignment == pm_cic ? 2 : 3;
+  }
+
+  // Mesh over the box of all the particles, and the slabs of the ranks
+  void setup_(const std::vector<body> & bodies) {
+    if(pm_grid <= 2 * ghosts + 1 || (pm_grid & (pm_grid - 1)) != 0)
+      log_fatal("pm_grid must be a power of 2 larger than "
+                << 2 * ghosts + 1 << ", not " << pm_grid);
+    n_ = pm_grid;
+    m_ = 2 * n_;
+    mz_ = n_ + 1;
+    double lo[3] = {DBL_MAX, DBL_MAX, DBL_MAX},
+           hi[3] = {-DBL_MAX, -DBL_MAX, -DBL_MAX};
+    for(const body & b : bodies)
+      for(int d = 0; d < 3; ++d) {
+        lo[d] = std::min(lo[d], b.coordinates()[d]);
+        hi[d] = std::max(hi[d], b.coordinates()[d]);
+      }
+    MPI_Allreduce(MPI_IN_PLACE, lo, 3, MPI_DOUBLE, MPI_MIN, MPI_COMM_WORLD);
+    MPI_Allreduce(MPI_IN_PLACE, hi, 3, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    double extent = 0.;
+    for(int d = 0; d < 3; ++d)
+      extent = std::max(extent, hi[d] - lo[d]);
+    h_ = extent > 0. ? extent / (n_ - 2 * ghosts - 1) : 1.;
+    for(int d = 0; d < 3; ++d)
+      x0_[d] = lo[d] - ghosts * h_;
+    xb_ = begin_(rank_);
+    xe_ = begin_(rank_ + 1);
+    if(kernel_n_ != n_ || kernel_split_ != pm_split ||
+       kernel_assignment_ != pm_assignment || kernel_size_ != size_)
+      setup_kernel_();
+  }
+
+  // Long-range kernel in the units of the cells, transformed and divided
+  // by the window of the assignment and interpolation
+  void setup_kernel_() {
+    slab_.assign(static_cast<size_t>(xe_ - xb_) * m_ * mz_, 0.);
+    const double sigma = pm_split;
+#pragma omp parallel for
+    for(int x = xb_; x < xe_; ++x)
+      for(int y = 0; y < m_; ++y) {
+        double * row = real_(x - xb_, y);
+        for(int z = 0; z < m_; ++z) {
+          const double wx = std::min(x, m_ - x), wy = std::min(y, m_ - y),
+                       wz = std::min(z, m_ - z),
+                       r = std::sqrt(wx * wx + wy * wy + wz * wz);
+          row[z] =
+            r > 0. ? -std::erf(.5 * r / sigma) / r : -1. / (sigma * sqrt(M_PI));
+        }
+      }
+    forward_();
+    const int p = 2 * points_();
+    auto window = [&](int k) {
+      k = std::min(k, m_ - k);
+      if(k == 0)
+        return 1.;
+      const double a = M_PI * k / m_;
+      return std::pow(std::sin(a) / a, p);
+    };
+    const int yb = begin_(rank_), ye = begin_(rank_ + 1);
+    kernel_.resize(tr_.size());
+    const double norm = 1. / (static_cast<double>(m_) * m_ * m_);
+    for(int y = yb; y < ye; ++y)
+      for(int x = 0; x < m_; ++x)
+        for(int z = 0; z < mz_; ++z) {
+          const size_t i = (static_cast<size_t>(y - yb) * m_ + x) * mz_ + z;
+          kernel_[i] =
+            norm * tr_[i].real() / (window(x) * window(y) * window(z));
+        }
+    kernel_n_ = n_;
+    kernel_split_ = pm_split;
+    kernel_assignment_ = pm_assignment;
+    kernel_size_ = size_;
+  }
+
+  // Masses of the local particles on their planes, summed into the slabs
+  void assign_(const std::vector<body> & bodies) {
+    const int np = points_();
+    plo_ = n_;
+    phi_ = 0;
+    for(const body & b : bodies) {
+      double w[3];
+      const int i = stencil_((b.coordinates()[0] - x0_[0]) / h_, w);
+      plo_ = std::min(plo_, i);
+      phi_ = std::max(phi_, i + np);
+    }
+    if(plo_ >= phi_)
+      plo_ = phi_ = 0;
+    const size_t plane = static_cast<size_t>(n_) * n_;
+    std::vector<double> rho((phi_ - plo_) * plane, 0.);
+    for(const body & b : bodies) {
+      int i[3];
+      double w[3][3];
+      for(int d = 0; d < 3; ++d)
+        i[d] = stencil_((b.coordinates()[d] - x0_[d]) / h_, w[d]);
+      for(int a = 0; a < np; ++a)
+        for(int c = 0; c < np; ++c)
+          for(int e = 0; e < np; ++e)
+            rho[((i[0] + a - plo_) * n_ + i[1] + c) * n_ + i[2] + e] +=
+              b.mass() * w[0][a] * w[1][c] * w[2][e];
+    }
+
+    // planes of every rank, sent to the owners of their slabs
+    ranges_.resize(2 * size_);
+    const int range[2] = {plo_, phi_};
+    MPI_Allgather(
+      range, 2, MPI_INT, ranges_.data(), 2, MPI_INT, MPI_COMM_WORLD);
+    std::vector<int> scount(size_), sdispl(size_), rcount(size_),
+      rdispl(size_);
+    for(int r = 0; r < size_; ++r) {
+      const int first = std::max(plo_, begin_(r)),
+                last = std::min(phi_, begin_(r + 1));
+      scount[r] = std::max(0, last - first) * plane;
+      sdispl[r] = std::max(0, first - plo_) * plane;
+      const int rfirst = std::max(ranges_[2 * r], xb_),
+                rlast = std::min(ranges_[2 * r + 1], xe_);
+      rcount[r] = std::max(0, rlast - rfirst) * plane;
+      rdispl[r] = r == 0 ? 0 : rdispl[r - 1] + rcount[r - 1];
+    }
+    std::vector<double> recv(rdispl.back() + rcount.back());
+    MPI_Alltoallv(rho.data(), scount.data(), sdispl.data(), MPI_DOUBLE,
+      recv.data(), rcount.data(), rdispl.data(), MPI_DOUBLE, MPI_COMM_WORLD);
+
+    slab_.assign(static_cast<size_t>(xe_ - xb_) * m_ * mz_, 0.);
+    for(int r = 0; r < size_; ++r) {
+      const int rfirst = std::max(ranges_[2 * r], xb_);
+      for(int k = 0; k < rcount[r]; ++k) {
+        const int x = rfirst + k / plane, y = k / n_ % n_, z = k % n_;
+        real_(x - xb_, y)[z] += recv[rdispl[r] + k];
+      }
+    }
+  }
+
+  // real values of the row y of the local plane x of slab_, stored in its
+  // first m_ / 2 complex values
+  double * real_(const size_t x, const int y) {
+    return reinterpret_cast<double *>(&slab_[(x * m_ + y) * mz_]);
+  }
+
+  // slab_ along z and y, transposed into tr_ and along x
+  void forward_() {
+    const int nx = xe_ - xb_;
+#pragma omp parallel
+    {
+      std::vector<complex_t> line(m_);
+#pragma omp for collapse(2)
+      for(int x = 0; x < nx; ++x)
+        for(int y = 0; y < m_; ++y)
+          rfft(&slab_[(static_cast<size_t>(x) * m_ + y) * mz_], m_, -1);
+#pragma omp for collapse(2)
+      for(int x = 0; x < nx; ++x)
+        for(int z = 0; z < mz_; ++z)
+          along_(&slab_[static_cast<size_t>(x) * m_ * mz_ + z], line, -1);
+    }
+    transpose_(slab_, tr_);
+    const int ny = tr_.size() / (static_cast<size_t>(m_) * mz_);
+#pragma omp parallel
+    {
+      std::vector<complex_t> line(m_);
+#pragma omp for collapse(2)
+      for(int y = 0; y < ny; ++y)
+        for(int z = 0; z < mz_; ++z)
+          along_(&tr_[static_cast<size_t>(y) * m_ * mz_ + z], line, -1);
+    }
+  }
+
+  // the reverse of forward_
+  void backward_() {
+    const int ny = tr_.size() / (static_cast<size_t>(m_) * mz_);
+#pragma omp parallel
+    {
+      std::vector<complex_t> line(m_);
+#pragma omp for collapse(2)
+      for(int y = 0; y < ny; ++y)
+        for(int z = 0; z < mz_; ++z)
+          along_(&tr_[static_cast<size_t>(y) * m_ * mz_ + z], line, 1);
+    }
+    transpose_(tr_, slab_);
+    const int nx = xe_ - xb_;
+#pragma omp parallel
+    {
+      std::vector<complex_t> line(m_);
+#pragma omp for collapse(2)
+      for(int x = 0; x < nx; ++x)
+        for(int z = 0; z < mz_; ++z)
+          along_(&slab_[static_cast<size_t>(x) * m_ * mz_ + z], line, 1);
+#pragma omp for collapse(2)
+      for(int x = 0; x < nx; ++x)
+        for(int y = 0; y < m_; ++y)
+          rfft(&slab_[(static_cast<size_t>(x) * m_ + y) * mz_], m_, 1);
+    }
+  }
+
+  // FFT of the m_ values a[0], a[mz_], ... through a contiguous line
+  void along_(complex_t * a, std::vector<complex_t> & line, int sign) {
+    for(int i = 0; i < m_; ++i)
+      line[i] = a[static_cast<size_t>(i) * mz_];
+    fft(line.data(), m_, sign);
+    for(int i = 0; i < m_; ++i)
+      a[static_cast<size_t>(i) * mz_] = line[i];
+  }
+
+  // [planes][rows][z] of this rank to [rows][planes][z], the rows split
+  // between the ranks as the planes
+  void transpose_(const std::vector<complex_t> & in,
+    std::vector<complex_t> & out) {
+    const int np = in.size() / (static_cast<size_t>(m_) * mz_);
+    std::vector<complex_t> send(in.size());
+    std::vector<int> scount(size_), sdispl(size_), rcount(size_),
+      rdispl(size_);
+    size_t k = 0;
+    for(int r = 0; r < size_; ++r) {
+      sdispl[r] = 2 * k;
+      for(int p = 0; p < np; ++p)
+        for(int row = begin_(r); row < begin_(r + 1); ++row)
+          for(int z = 0; z < mz_; ++z)
+            send[k++] = in[(static_cast<size_t>(p) * m_ + row) * mz_ + z];
+      scount[r] = 2 * k - sdispl[r];
+    }
+    const int nrows = begin_(rank_ + 1) - begin_(rank_);
+    for(int r = 0; r < size_; ++r) {
+      rcount[r] = 2 * (begin_(r + 1) - begin_(r)) * nrows * mz_;
+      rdispl[r] = r == 0 ? 0 : rdispl[r - 1] + rcount[r - 1];
+    }
+    std::vector<complex_t> recv((rdispl.back() + rcount.back()) / 2);
+    MPI_Alltoallv(send.data(), scount.data(), sdispl.data(), MPI_DOUBLE,
+      recv.data(), rcount.data(), rdispl.data(), MPI_DOUBLE, MPI_COMM_WORLD);
+    out.resize(static_cast<size_t>(nrows) * m_ * mz_);
+    k = 0;
+    for(int r = 0; r < size_; ++r)
+      for(int p = begin_(r); p < begin_(r + 1); ++p)
+        for(int row = 0; row < nrows; ++row)
+          for(int z = 0; z < mz_; ++z)
+            out[(static_cast<size_t>(row) * m_ + p) * mz_ + z] = recv[k++];
+  }
+
+  // Potential on the planes of the local particles, from the owners of the
+  // slabs, interpolated with its finite differences
+  void interpolate_(std::vector<body> & bodies) {
+    const size_t plane = static_cast<size_t>(n_) * n_;
+    const double scale = fmm::gc / h_;
+    std::vector<int> scount(size_), sdispl(size_), rcount(size_),
+      rdispl(size_);
+    auto needed = [&](int r, int & first, int & last) {
+      first = std::max(0, ranges_[2 * r] - 2);
+      last = std::min(n_, ranges_[2 * r + 1] + 2);
+      if(ranges_[2 * r] >= ranges_[2 * r + 1])
+        first = last = 0;
+    };
+    std::vector<double> send;
+    for(int r = 0; r < size_; ++r) {
+      int first, last;
+      needed(r, first, last);
+      first = std::max(first, xb_);
+      last = std::min(last, xe_);
+      sdispl[r] = send.size();
+      for(int x = first; x < last; ++x)
+        for(int y = 0; y < n_; ++y) {
+          const double * row = real_(x - xb_, y);
+          for(int z = 0; z < n_; ++z)
+            send.push_back(scale * row[z]);
+        }
+      scount[r] = send.size() - sdispl[r];
+    }
+    int qlo, qhi;
+    needed(rank_, qlo, qhi);
+    for(int r = 0; r < size_; ++r) {
+      const int first = std::max(qlo, begin_(r)),
+                last = std::min(qhi, begin_(r + 1));
+      rcount[r] = std::max(0, last - first) * plane;
+      rdispl[r] = std::max(0, first - qlo) * plane;
+    }
+    std::vector<double> phi((qhi - qlo) * plane);
+    MPI_Alltoallv(send.data(), scount.data(), sdispl.data(), MPI_DOUBLE,
+      phi.data(), rcount.data(), rdispl.data(), MPI_DOUBLE, MPI_COMM_WORLD);
+
+    auto at = [&](int x, int y, int z) {
+      return phi[((x - qlo) * n_ + y) * n_ + z];
+    };
+    const int np = points_();
+    const double self = fmm::gc / (split() * std::sqrt(M_PI));
+#pragma omp parallel for
+    for(size_t k = 0; k < bodies.size(); ++k) {
+      body & b = bodies[k];
+      int i[3];
+      double w[3][3];
+      for(int d = 0; d < 3; ++d)
+        i[d] = stencil_((b.coordinates()[d] - x0_[d]) / h_, w[d]);
+      double pot = 0.;
+      point_t acc = 0.;
+      for(int a = 0; a < np; ++a)
+        for(int c = 0; c < np; ++c)
+          for(int e = 0; e < np; ++e) {
+            const int x = i[0] + a, y = i[1] + c, z = i[2] + e;
+            const double wt = w[0][a] * w[1][c] * w[2][e];
+            pot += wt * at(x, y, z);
+            const double g[3][4] = {
+              {at(x - 2, y, z), at(x - 1, y, z), at(x + 1, y, z),
+                at(x + 2, y, z)},
+              {at(x, y - 2, z), at(x, y - 1, z), at(x, y + 1, z),
+                at(x, y + 2, z)},
+              {at(x, y, z - 2), at(x, y, z - 1), at(x, y, z + 1),
+                at(x, y, z + 2)}};
+            for(int d = 0; d < 3; ++d)
+              acc[d] -= wt *
+                        (2. / 3. * (g[d][2] - g[d][1]) -
+                          1. / 12. * (g[d][3] - g[d][0])) /
+                        h_;
+          }
+      // without the particle's own long-range potential
+      b.setGPotential(b.getGPotential() + pot + self * b.mass());
+      b.setGAcceleration(b.getGAcceleration() + acc);
+    }
+  }
+
+  int rank_ = 0, size_ = 1;
+  int n_ = 0, m_ = 0, mz_ = 0, xb_ = 0, xe_ = 0, plo_ = 0, phi_ = 0;
+  double h_ = 1., x0_[3] = {0., 0., 0.};
+  std::vector<int> ranges_;
+  std::vector<complex_t> slab_, tr_;
+  std::vector<double> kernel_;
+  int kernel_n_ = 0, kernel_assignment_ = -1, kernel_size_ = 0;
+  double kernel_split_ = 0.;
+}; // class mesh
+
+} // namespace pm
@@ -0,0 +1,137 @@
+/*~--------------------------------------------------------------------------~*
+ * Copyright (c) 2017 Triad National Security, LLC
+ * All rights reserved.
+ *~--------------------------------------------------------------------------~*/
+
+/*~--------------------------------------------------------------------------~*
+ *
+ * /@@@@@@@@  @@           @@@@@@   @@@@@@@@ @@@@@@@  @@      @@
+ * /@@/////  /@@          @@////@@ @@////// /@@////@@/@@     /@@
+ * /@@       /@@  @@@@@  @@    // /@@       /@@   /@@/@@     /@@
+ * /@@@@@@@  /@@ @@///@@/@@       /@@@@@@@@@/@@@@@@@ /@@@@@@@@@@
+ * /@@////   /@@/@@@@@@@/@@       ////////@@/@@////  /@@//////@@
+ * /@@       /@@/@@//// //@@    @@       /@@/@@      /@@     /@@
+ * /@@       @@@//@@@@@@ //@@@@@@  @@@@@@@@ /@@      /@@     /@@
+ * //       ///  //////   //////  ////////  //       //      //
+ *
+ *~--------------------------------------------------------------------------~*/
+
+/**
+ * @file simd_types.h
+ * @brief SIMD lanes of doubles, shared by the batched sph passes and the
+ *        batched equations of state.
+ *
+ * vdouble is std::experimental::native_simd<double>, whose <cmath>
+ * overloads (exp, log, sqrt, cbrt...) are found by argument-dependent
+ * lookup. Without <experimental/simd> (or with DISABLE_SIMD), it is a
+ * plain double and the same code runs on scalars.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+
+#if __has_include(<experimental/simd>) and not defined(DISABLE_SIMD)
+#include <experimental/simd>
+#define FLECSPH_HAS_STDX_SIMD
+#endif
+
+namespace simd {
+
+#ifdef FLECSPH_HAS_STDX_SIMD
+namespace stdx = std::experimental;
+using vdouble = stdx::native_simd<double>;
+using vmask = vdouble::mask_type;
+
+inline vdouble
+load(const double * p) {
+  return vdouble(p, stdx::element_aligned);
+}
+inline void
+store(const vdouble & v, double * p) {
+  v.copy_to(p, stdx::element_aligned);
+}
+inline double
+reduce(const vdouble & v) {
+  return stdx::reduce(v);
+}
+inline vdouble
+choose(const vmask & m, const vdouble & a, const vdouble & b) {
+  vdouble r = b;
+  stdx::where(m, r) = a;
+  return r;
+}
+// a scalar function, lane by lane
+template<class F>
+inline vdouble
+map(F && f, const vdouble & x) {
+  return vdouble([&](auto i) { return f(x[i]); });
+}
+#else
+using vdouble = double;
+using vmask = bool;
+
+inline vdouble
+load(const double * p) {
+  return *p;
+}
+inline void
+store(const vdouble & v, double * p) {
+  *p = v;
+}
+inline double
+reduce(const vdouble & v) {
+  return v;
+}
+#endif
+
+// scalar overloads, also used for the scalar fallback
+inline double
+choose(const bool m, const double a, const double b) {
+  return m ? a : b;
+}
+template<class F>
+inline double
+map(F && f, const double x) {
+  return f(x);
+}
+
+// number of doubles per vector register
+constexpr size_t width = sizeof(vdouble) / sizeof(double);
+
+// number of lanes needed for n neighbors
+inline size_t
+padded(const size_t n) {
+  return (n + width - 1) / width * width;
+}
+
+// h^n for a compile-time n
+template<int N, class T>
+inline T
+ipow(const T & h) {
+  T r = h;
+  for(int i = 1; i < N; ++i)
+    r *= h;
+  return r;
+}
+
+// x^n for x > 0; repeated squaring when n is integral, as it usually is
+// for the sinc kernel index
+template<class T>
+inline T
+pow_n(const T & x, const double n) {
+  using std::exp;
+  using std::log;
+  if(n != std::floor(n) or n < 0.)
+    return exp(n * log(x));
+  T r(1.), p = x;
+  for(long k = static_cast<long>(n); k > 0; k >>= 1) {
+    if(k & 1)
+      r *= p;
+    p *= p;
+  }
+  return r;
+}
+
+} // namespace simd
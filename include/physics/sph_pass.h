@@ -0,0 +1,149 @@
+/*~--------------------------------------------------------------------------~*
+ * Copyright (c) 2017 Triad National Security, LLC
+ * All rights reserved.
+ *~--------------------------------------------------------------------------~*/
+
+/*~--------------------------------------------------------------------------~*
+ *
+ * /@@@@@@@@  @@           @@@@@@   @@@@@@@@ @@@@@@@  @@      @@
+ * /@@/////  /@@          @@////@@ @@////// /@@////@@/@@     /@@
+ * /@@       /@@  @@@@@  @@    // /@@       /@@   /@@/@@     /@@
+ * /@@@@@@@  /@@ @@///@@/@@       /@@@@@@@@@/@@@@@@@ /@@@@@@@@@@
+ * /@@////   /@@/@@@@@@@/@@       ////////@@/@@////  /@@//////@@
+ * /@@       /@@/@@//// //@@    @@       /@@/@@      /@@     /@@
+ * /@@       @@@//@@@@@@ //@@@@@@  @@@@@@@@ /@@      /@@     /@@
+ * //       ///  //////   //////  ////////  //       //      //
+ *
+ *~--------------------------------------------------------------------------~*/
+
+/**
+ * @file sph_pass.h
+ * @brief Data dependencies of the functions applied in the smoothing length.
+ *
+ * An sph_pass pairs a function with the particle fields it reads from the
+ * neighbors and the fields it writes on the particle. Within one tree
+ * traversal, the passes are applied in order to each particle, but the
+ * particles are visited in arbitrary order and the ghosts are not updated.
+ * Two passes can therefore share a traversal only if neither reads from
+ * the neighbors a field that the other one writes.
+ * See body_system::apply_in_smoothinglength_fused.
+ *
+ * A pass may also have a pairwise form, used with sph_symmetric_pairs:
+ * each pair of neighbors is evaluated once, on the particle with the
+ * larger smoothing length, and adds its terms to the pair_sums of both
+ * particles. Sums of ghosts are returned to their owners, then the
+ * finalize function sets the fields of each particle.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "params.h"
+#include "tree.h"
+
+namespace physics {
+
+//
+// Particle fields, as seen by the dependency analysis
+//
+namespace field {
+enum : unsigned {
+  position = 1 << 0,
+  smoothinglength = 1 << 1,
+  mass = 1 << 2,
+  velocity = 1 << 3,
+  velocityhalf = 1 << 4,
+  density = 1 << 5,
+  pressure = 1 << 6,
+  soundspeed = 1 << 7,
+  signalspeed = 1 << 8,
+  internalenergy = 1 << 9,
+  alpha = 1 << 10,
+  divergence = 1 << 11, //- divergenceV, dDivVdt
+  acceleration = 1 << 12,
+  gravity = 1 << 13, //- g_acceleration, g_potential
+  dudt = 1 << 14,
+  dedt = 1 << 15,
+  geometry = position | smoothinglength | mass
+};
+} // namespace field
+
+//
+// Per-particle sums of the pairwise passes
+//
+struct pair_sums {
+  point_t acceleration = 0.0;
+  double dudt = 0.0;
+  double dedt = 0.0;
+
+  pair_sums & operator+=(const pair_sums & o) {
+    acceleration += o.acceleration;
+    dudt += o.dudt;
+    dedt += o.dedt;
+    return *this;
+  }
+};
+
+struct sph_pass {
+  typedef void (*function_t)(body &, std::vector<body *> &);
+  typedef void (*pair_t)(const body &, const body &, pair_sums &, pair_sums &);
+  typedef void (*finalize_t)(body &, const pair_sums &);
+
+  const char * name;
+  function_t function;
+  unsigned reads; //- fields read from the neighbors
+  unsigned writes; //- fields written on the particle
+  pair_t pair = nullptr; //- pairwise form, optional
+  finalize_t finalize = nullptr;
+
+  bool symmetric() const {
+    return param::sph_symmetric_pairs and pair != nullptr;
+  }
+};
+
+/**
+ * @brief      True if the pair a-b is evaluated on the side of particle a:
+ *             the one with the larger smoothing length, which always has
+ *             the other in its neighbor list, or the lower id on ties
+ */
+inline bool
+owns_pair(const body & a, const body & b) {
+  if(a.radius() != b.radius())
+    return a.radius() > b.radius();
+  if(a.id() != b.id())
+    return a.id() < b.id();
+  return &a < &b; // periodic copies
+}
+
+/**
+ * @brief      True if passes a and b can run in the same traversal. The
+ *             fields of a symmetric pass are only set after the traversal,
+ *             so no other pass of the traversal may write them.
+ */
+inline bool
+can_fuse(const sph_pass & a, const sph_pass & b) {
+  if((a.symmetric() or b.symmetric()) and (a.writes & b.writes))
+    return false;
+  return not(a.reads & b.writes) and not(b.reads & a.writes);
+}
+
+/**
+ * @brief      Splits a sequence of passes into consecutive groups which
+ *             can each run in a single traversal
+ */
+inline std::vector<std::vector<sph_pass>>
+fuse(const std::vector<sph_pass> & passes) {
+  std::vector<std::vector<sph_pass>> groups;
+  for(const sph_pass & p : passes) {
+    bool fits = not groups.empty();
+    for(size_t i = 0; fits and i < groups.back().size(); ++i)
+      fits = can_fuse(groups.back()[i], p);
+    if(not fits)
+      groups.emplace_back();
+    groups.back().push_back(p);
+  }
+  return groups;
+}
+
+} // namespace physics
@@ -0,0 +1,517 @@
+/*~--------------------------------------------------------------------------~*
+ * Copyright (c) 2017 Triad National Security, LLC
+ * All rights reserved.
+ *~--------------------------------------------------------------------------~*/
+
+/*~--------------------------------------------------------------------------~*
+ *
+ * /@@@@@@@@  @@           @@@@@@   @@@@@@@@ @@@@@@@  @@      @@
+ * /@@/////  /@@          @@////@@ @@////// /@@////@@/@@     /@@
+ * /@@       /@@  @@@@@  @@    // /@@       /@@   /@@/@@     /@@
+ * /@@@@@@@  /@@ @@///@@/@@       /@@@@@@@@@/@@@@@@@ /@@@@@@@@@@
+ * /@@////   /@@/@@@@@@@/@@       ////////@@/@@////  /@@//////@@
+ * /@@       /@@/@@//// //@@    @@       /@@/@@      /@@     /@@
+ * /@@       @@@//@@@@@@ //@@@@@@  @@@@@@@@ /@@      /@@     /@@
+ * //       ///  //////   //////  ////////  //       //      //
+ *
+ *~--------------------------------------------------------------------------~*/
+
+/**
+ * @file sph_simd.h
+ * @brief SIMD-batched density, acceleration and energy-rate passes.
+ *
+ * Neighbor fields are gathered into structure-of-arrays lanes, padded to
+ * the SIMD width, and the kernel, gradient and viscosity terms are
+ * evaluated on simd::vdouble (see simd_types.h), which falls back to
+ * scalar doubles without std::experimental::simd.
+ * The passes are installed by physics::select() when SPH_SIMD is defined.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <vector>
+
+#include "eforce.h"
+#include "kernels.h"
+#include "params.h"
+#include "scratch.h"
+#include "simd_types.h"
+#include "tree.h"
+#include "user.h"
+
+namespace simd {
+
+/**
+ * @brief      Kernel W(r,h), generic in the value type so that it can be
+ *             evaluated on vdouble lanes or on scalars. Matches
+ *             kernels::kernel<K,D>.
+ */
+template<param::sph_kernel_keyword K, int D, class T>
+inline T
+kernel(const T & r, const T & h) {
+  using namespace param;
+  using std::exp;
+  using std::pow;
+  using std::sin;
+  T zero(0.);
+  if constexpr(K == cubic_spline) {
+    const T rh = 2. * r / h;
+    const T a = 1.0 - 1.5 * rh * rh + .75 * rh * rh * rh;
+    const T b = .25 * (2. - rh) * (2. - rh) * (2. - rh);
+    const T w = choose(rh < 1., a, choose(rh < 2., b, zero));
+    return w * (kernels::cubic_spline_sigma[D - 1] / ipow<D>(h));
+  }
+  else if constexpr(K == gaussian) {
+    const T rh = 3. * r / h;
+    const T w = kernels::gaussian_sigma[D - 1] / ipow<D>(h) * exp(-rh * rh);
+    return choose(rh <= 3., w, zero);
+  }
+  else if constexpr(K == quintic_spline) {
+    const T rh = 3. * r / h;
+    const T a = 3. - rh, b = 2. - rh, c = 1. - rh;
+    const T a5 = a * a * a * a * a, b5 = b * b * b * b * b,
+            c5 = c * c * c * c * c;
+    T w = choose(rh < 3., a5, zero);
+    w += choose(rh < 2., -6. * b5, zero);
+    w += choose(rh < 1., 15. * c5, zero);
+    return w * (kernels::quintic_spline_sigma[D - 1] / ipow<D>(h));
+  }
+  else if constexpr(K == wendland_c2) {
+    const T q = r / h, q1 = 1. - q, q2 = q1 * q1;
+    T w;
+    if constexpr(D == 1)
+      w = q2 * q1 * (3. * q + 1.);
+    else
+      w = q2 * q2 * (4. * q + 1.);
+    return choose(q < 1., w * (kernels::wendland_c2_sigma[D - 1] / ipow<D>(h)),
+      zero);
+  }
+  else if constexpr(K == wendland_c4) {
+    const T q = r / h, q1 = 1. - q, q2 = q1 * q1;
+    T w;
+    if constexpr(D == 1)
+      w = q2 * q2 * q1 * (1. + q * (5. + q * 8.));
+    else
+      w = q2 * q2 * q2 * (1. + q * (6. + q * 35. / 3.));
+    return choose(q < 1., w * (kernels::wendland_c4_sigma[D - 1] / ipow<D>(h)),
+      zero);
+  }
+  else if constexpr(K == wendland_c6) {
+    const T q = r / h, q1 = 1. - q, q2 = q1 * q1, q4 = q2 * q2;
+    T w;
+    if constexpr(D == 1)
+      w = q4 * q2 * q1 * (1. + q * (7. + q * (19. + q * 21.)));
+    else
+      w = q4 * q4 * (1. + q * (8. + q * (25. + q * 32.)));
+    return choose(q < 1., w * (kernels::wendland_c6_sigma[D - 1] / ipow<D>(h)),
+      zero);
+  }
+  else if constexpr(K == super_gaussian) {
+    const T rh = 3. * r / h, rh2 = rh * rh;
+    const T w = kernels::super_gaussian_sigma[D - 1] / ipow<D>(h) *
+                exp(-rh2) * (D / 2.0 + 1. - rh2);
+    return choose(rh < 3., w, zero);
+  }
+  else if constexpr(K == sinc_ker) {
+    const double eps = 1e-24, eps_root4 = sqrt(sqrt(eps));
+    const T rh = r / h;
+    const T x = M_PI * rh;
+    const T x2 = x * x;
+    const T xs = choose(x > eps_root4, x, T(1.));
+    T sinc = choose(x > eps_root4, sin(xs) / xs,
+      choose(x > eps, 1. + x2 * (.05 * x2 - 1.) / 6., T(1.)));
+    const T w = kernels::sinc_sigma[D - 1] / ipow<D>(h) *
+                pow_n(choose(rh < 1., sinc, T(1.)), sph_sinc_index);
+    return choose(rh < 1., w, zero);
+  }
+}
+
+/**
+ * @brief      Radial kernel gradient factor (dW/dr)/r, so that the
+ *             gradient is this factor times r_ab. Matches
+ *             kernels::kernel_gradient<K,D>.
+ */
+template<param::sph_kernel_keyword K, int D, class T>
+inline T
+kernel_gradient(const T & r, const T & h) {
+  using namespace param;
+  using kernels::TINY;
+  using std::cos;
+  using std::exp;
+  using std::sin;
+  T zero(0.);
+  const T rinv = 1. / (r + TINY);
+  if constexpr(K == cubic_spline) {
+    const T rh = 2. * r / h;
+    const T a = -3.0 * rh + 9. / 4. * rh * rh;
+    const T b = -.75 * (2. - rh) * (2. - rh);
+    const T dw = choose(rh < 1., a, choose(rh < 2., b, zero));
+    return dw * (2. * kernels::cubic_spline_sigma[D - 1] / ipow<D + 1>(h)) *
+           rinv;
+  }
+  else if constexpr(K == gaussian) {
+    const T rh = 3. * r / h;
+    const T dw = -2. * rh * exp(-rh * rh);
+    return choose(rh < 3.,
+      dw * (3. * kernels::gaussian_sigma[D - 1] / ipow<D + 1>(h)) * rinv,
+      zero);
+  }
+  else if constexpr(K == quintic_spline) {
+    const T rh = 3. * r / h;
+    const T a = 3. - rh, b = 2. - rh, c = 1. - rh;
+    T dw = choose(rh < 3., -5. * a * a * a * a, zero);
+    dw += choose(rh < 2., 30. * b * b * b * b, zero);
+    dw += choose(rh < 1., -75. * c * c * c * c, zero);
+    return dw * (3. * kernels::quintic_spline_sigma[D - 1] / ipow<D + 1>(h)) *
+           rinv;
+  }
+  else if constexpr(K == wendland_c2) {
+    const T q = r / h, q1 = 1. - q, q2 = q1 * q1;
+    T dw;
+    if constexpr(D == 1)
+      dw = -12. * q * q2 * (kernels::wendland_c2_sigma[0] / (h * h));
+    else
+      dw = -20. * q * q2 * q1 *
+           (kernels::wendland_c2_sigma[D - 1] / ipow<D + 1>(h));
+    return choose(q < 1., dw * rinv, zero);
+  }
+  else if constexpr(K == wendland_c4) {
+    const T q = r / h, q1 = 1. - q, q2 = q1 * q1;
+    T dw;
+    if constexpr(D == 1)
+      dw = -q * q2 * q2 * (1. + 4. * q);
+    else
+      dw = -4. / 3. * q * q2 * q2 * q1 * (1. + 5. * q);
+    return choose(q < 1.,
+      dw * (14. * kernels::wendland_c4_sigma[D - 1] / ipow<D + 1>(h)) * rinv,
+      zero);
+  }
+  else if constexpr(K == wendland_c6) {
+    const T q = r / h, q1 = 1. - q, q2 = q1 * q1, q3 = q2 * q1;
+    T dw;
+    if constexpr(D == 1)
+      dw = -6. * q * q3 * q3 * (3. + q * (18. + q * 35.));
+    else
+      dw = -22. * q * q2 * q2 * q3 * (1. + q * (7. + q * 16.));
+    return choose(q < 1.,
+      dw * (kernels::wendland_c6_sigma[D - 1] / ipow<D + 1>(h)) * rinv, zero);
+  }
+  else if constexpr(K == super_gaussian) {
+    const T rh = 3. * r / h;
+    const T dw = exp(-rh * rh) * (2. * rh * rh * rh - (D + 4.) * rh);
+    return choose(rh < 3.,
+      dw * (3. * kernels::super_gaussian_sigma[D - 1] / ipow<D + 1>(h)) *
+        rinv,
+      zero);
+  }
+  else if constexpr(K == sinc_ker) {
+    const double eps = 1e-24, eps_root4 = sqrt(sqrt(eps));
+    const double n = sph_sinc_index;
+    const T rh = r / h;
+    const T x = M_PI * rh;
+    const T x2 = x * x;
+    const T xs = choose(x > eps_root4, x, T(1.));
+    const T sinc = sin(xs) / xs, cosx = cos(xs) / xs;
+    const T spow = pow_n(choose(sinc > 0., sinc, T(1.)), n - 1.);
+    const T dw = choose(x > eps_root4, -n * spow * M_PI * (sinc / xs - cosx),
+      choose(x > eps,
+        -n * x / 3. * M_PI * (1. - .5 * x2 * (.2 - (n - 1.) / 18.)), zero));
+    return choose(rh < 1.,
+      dw * (kernels::sinc_sigma[D - 1] / ipow<D + 1>(h)) * rinv, zero);
+  }
+}
+
+/**
+ * @brief      mu_ab of the artificial viscosity on lanes, see viscosity::mu
+ */
+template<class T>
+inline T
+mu(const T & h_ab, const T & v_dot_r, const T & r2) {
+  using namespace param;
+  const T result =
+    h_ab * v_dot_r / (r2 + sph_viscosity_epsilon * h_ab * h_ab + kernels::TINY);
+  return choose(v_dot_r < 0., result, T(0.));
+}
+
+/**
+ * @brief      Artificial viscosity Pi_ab on lanes, see
+ *             viscosity::viscosity_function
+ */
+template<param::sph_viscosity_keyword V, class T>
+inline T
+viscosity_function(const T & alpha_ab,
+  const T & rho_ab,
+  const T & c_ab,
+  const T & mu_ab) {
+  using namespace param;
+  if constexpr(V == visc_constant)
+    return (-sph_viscosity_alpha * c_ab + sph_viscosity_beta * mu_ab) * mu_ab /
+           rho_ab;
+  else
+    return -alpha_ab * (c_ab - 2.0 * mu_ab) * mu_ab / rho_ab;
+}
+
+/**
+ * @brief      Structure-of-arrays copy of the neighbor fields, padded to
+ *             the SIMD width, in aligned arrays of a scratch frame.
+ */
+struct neighbors_soa {
+  size_t n = 0;
+  double *x[gdimension], *v[gdimension], *v12[gdimension];
+  double *m, *h, *rho, *P, *c, *alpha;
+
+  /**
+   * @brief  Gathers the neighbors of particle a. Padding lanes sit on a
+   *         with zero mass and do not contribute to any sum. Velocities
+   *         and thermodynamics are only copied for the HYDRO passes.
+   */
+  template<bool HYDRO>
+  void gather(scratch::frame & f, const body & a,
+    const std::vector<body *> & nbs) {
+    const size_t n_nb = nbs.size();
+    n = padded(n_nb);
+    for(size_t d = 0; d < gdimension; ++d) {
+      x[d] = f.alloc<double>(n);
+      if constexpr(HYDRO) {
+        v[d] = f.alloc<double>(n);
+        v12[d] = f.alloc<double>(n);
+      }
+    }
+    m = f.alloc<double>(n);
+    h = f.alloc<double>(n);
+    if constexpr(HYDRO) {
+      rho = f.alloc<double>(n);
+      P = f.alloc<double>(n);
+      c = f.alloc<double>(n);
+      alpha = f.alloc<double>(n);
+    }
+    for(size_t b = 0; b < n; ++b) {
+      const body & nb = b < n_nb ? *nbs[b] : a;
+      const point_t & pos_b = nb.coordinates();
+      for(size_t d = 0; d < gdimension; ++d)
+        x[d][b] = pos_b[d];
+      m[b] = b < n_nb ? nb.mass() : 0.;
+      h[b] = nb.radius();
+      if constexpr(HYDRO) {
+        const point_t vel_b = nb.getVelocity(), v12_b = nb.getVelocityhalf();
+        for(size_t d = 0; d < gdimension; ++d) {
+          v[d][b] = vel_b[d];
+          v12[d][b] = v12_b[d];
+        }
+        rho[b] = nb.getDensity();
+        P[b] = nb.getPressure();
+        c[b] = nb.getSoundspeed();
+        alpha[b] = nb.getAlpha();
+      }
+    }
+  }
+}; // struct neighbors_soa
+
+} // namespace simd
+
+namespace physics {
+
+//
+// SIMD-batched versions of the physics::specialized passes
+//
+namespace batched {
+
+/**
+ * @brief      Density, see specialized::compute_density
+ */
+template<param::sph_kernel_keyword K>
+void
+compute_density(body & particle, std::vector<body *> & nbs) {
+  using simd::load;
+  using simd::vdouble;
+  const double h_a = particle.radius();
+  const point_t pos_a = particle.coordinates();
+  mpi_assert(nbs.size() > 0);
+
+  scratch::frame scratch_;
+  simd::neighbors_soa soa;
+  soa.gather<false>(scratch_, particle, nbs);
+
+  vdouble rho(0.);
+  for(size_t b = 0; b < soa.n; b += simd::width) {
+    vdouble r2(0.);
+    for(size_t d = 0; d < gdimension; ++d) {
+      const vdouble dx = pos_a[d] - load(&soa.x[d][b]);
+      r2 += dx * dx;
+    }
+    using std::sqrt;
+    const vdouble h_ab = .5 * (h_a + load(&soa.h[b]));
+    rho += load(&soa.m[b]) * simd::kernel<K, gdimension>(sqrt(r2), h_ab);
+  }
+  const double rho_a = simd::reduce(rho);
+  if(not(rho_a > 0)) {
+    std::cout << "Density of a particle is not a positive number: "
+              << "rho = " << rho_a << std::endl;
+    std::cout << "Failed particle id: " << particle.id() << std::endl;
+    std::cerr << "particle position: " << particle.coordinates() << std::endl;
+    std::cerr << "particle velocity: " << particle.getVelocity() << std::endl;
+    std::cerr << "smoothing length:  " << particle.radius() << std::endl;
+    assert(false);
+  }
+  particle.setDensity(rho_a);
+} // compute_density
+
+/**
+ * @brief      Hydro acceleration, see specialized::compute_acceleration
+ */
+template<param::sph_kernel_keyword K, param::sph_viscosity_keyword V>
+void
+compute_acceleration(body & particle, std::vector<body *> & nbs) {
+  using simd::choose;
+  using simd::load;
+  using simd::vdouble;
+  const double h_a = particle.radius(), rho_a = particle.getDensity(),
+               P_a = particle.getPressure(), c_a = particle.getSoundspeed(),
+               alpha_a = particle.getAlpha();
+  const point_t pos_a = particle.coordinates(),
+                v12_a = particle.getVelocityhalf();
+
+  scratch::frame scratch_;
+  simd::neighbors_soa soa;
+  soa.gather<true>(scratch_, particle, nbs);
+
+  const double Prho2_a = P_a / (rho_a * rho_a);
+  vdouble acc[gdimension];
+  for(size_t d = 0; d < gdimension; ++d)
+    acc[d] = 0.;
+  for(size_t b = 0; b < soa.n; b += simd::width) {
+    vdouble dx[gdimension];
+    vdouble r2(0.), v_dot_r(0.);
+    for(size_t d = 0; d < gdimension; ++d) {
+      dx[d] = pos_a[d] - load(&soa.x[d][b]);
+      r2 += dx[d] * dx[d];
+      v_dot_r += (v12_a[d] - load(&soa.v12[d][b])) * dx[d];
+    }
+    using std::sqrt;
+    const vdouble rho_b = load(&soa.rho[b]);
+    const vdouble h_ab = .5 * (h_a + load(&soa.h[b]));
+    const vdouble mu_ab = simd::mu(h_ab, v_dot_r, r2);
+    const vdouble Pi_ab = simd::viscosity_function<V>(
+      .5 * (alpha_a + load(&soa.alpha[b])), .5 * (rho_a + rho_b),
+      .5 * (c_a + load(&soa.c[b])), mu_ab);
+    const vdouble DiW = simd::kernel_gradient<K, gdimension>(sqrt(r2), h_ab);
+    // if same particle, m_b->0
+    const vdouble m_b = choose(r2 > 0., load(&soa.m[b]), vdouble(0.));
+    const vdouble Prho2_b = load(&soa.P[b]) / (rho_b * rho_b);
+    const vdouble coef = -m_b * (Prho2_a + Prho2_b + Pi_ab) * DiW;
+    for(size_t d = 0; d < gdimension; ++d)
+      acc[d] += coef * dx[d];
+  }
+  point_t acc_a;
+  for(size_t d = 0; d < gdimension; ++d)
+    acc_a[d] = simd::reduce(acc[d]);
+  acc_a += external_force::acceleration(particle);
+  particle.setAcceleration(acc_a);
+  particle.setGAcceleration(0);
+  particle.setGPotential(0);
+} // compute_acceleration
+
+/**
+ * @brief      Internal energy rate, see specialized::compute_dudt
+ */
+template<param::sph_kernel_keyword K, param::sph_viscosity_keyword V>
+void
+compute_dudt(body & particle, std::vector<body *> & nbs) {
+  // Do not change internal energy in relaxation phase
+  if(iteration < param::relaxation_steps) {
+    particle.setDudt(0.0);
+    return;
+  }
+  using simd::choose;
+  using simd::load;
+  using simd::vdouble;
+  const double h_a = particle.radius(), rho_a = particle.getDensity(),
+               P_a = particle.getPressure(), c_a = particle.getSoundspeed(),
+               alpha_a = particle.getAlpha();
+  const point_t pos_a = particle.coordinates(),
+                vel_a = particle.getVelocity(),
+                v12_a = particle.getVelocityhalf();
+
+  scratch::frame scratch_;
+  simd::neighbors_soa soa;
+  soa.gather<true>(scratch_, particle, nbs);
+
+  vdouble dudt_pressure(0.), dudt_visc(0.);
+  for(size_t b = 0; b < soa.n; b += simd::width) {
+    vdouble r2(0.), v12_dot_r(0.), vel_dot_r(0.);
+    for(size_t d = 0; d < gdimension; ++d) {
+      const vdouble dx = pos_a[d] - load(&soa.x[d][b]);
+      r2 += dx * dx;
+      v12_dot_r += (v12_a[d] - load(&soa.v12[d][b])) * dx;
+      vel_dot_r += (vel_a[d] - load(&soa.v[d][b])) * dx;
+    }
+    using std::sqrt;
+    const vdouble h_ab = .5 * (h_a + load(&soa.h[b]));
+    const vdouble mu_ab = simd::mu(h_ab, v12_dot_r, r2);
+    const vdouble Pi_ab = simd::viscosity_function<V>(
+      .5 * (alpha_a + load(&soa.alpha[b])), .5 * (rho_a + load(&soa.rho[b])),
+      .5 * (c_a + load(&soa.c[b])), mu_ab);
+    const vdouble DiW = simd::kernel_gradient<K, gdimension>(sqrt(r2), h_ab);
+    const vdouble m_b = choose(r2 > 0., load(&soa.m[b]), vdouble(0.));
+    const vdouble mvdW = m_b * vel_dot_r * DiW;
+    dudt_pressure += mvdW;
+    dudt_visc += mvdW * Pi_ab;
+  }
+  const double dudt = P_a / (rho_a * rho_a) * simd::reduce(dudt_pressure) +
+                      .5 * simd::reduce(dudt_visc);
+  particle.setDudt(dudt);
+} // compute_dudt
+
+/**
+ * @brief      Total energy rate, see specialized::compute_dedt
+ */
+template<param::sph_kernel_keyword K, param::sph_viscosity_keyword V>
+void
+compute_dedt(body & particle, std::vector<body *> & nbs) {
+  using simd::choose;
+  using simd::load;
+  using simd::vdouble;
+  const double h_a = particle.radius(), rho_a = particle.getDensity(),
+               P_a = particle.getPressure(), c_a = particle.getSoundspeed(),
+               alpha_a = particle.getAlpha();
+  const point_t pos_a = particle.coordinates(),
+                vel_a = particle.getVelocity(),
+                v12_a = particle.getVelocityhalf(),
+                ga_a = particle.getGAcceleration();
+  const double gv = flecsi::dot(ga_a, vel_a);
+
+  scratch::frame scratch_;
+  simd::neighbors_soa soa;
+  soa.gather<true>(scratch_, particle, nbs);
+
+  const double Prho2_a = P_a / (rho_a * rho_a);
+  vdouble dedt(0.);
+  for(size_t b = 0; b < soa.n; b += simd::width) {
+    vdouble r2(0.), v12_dot_r(0.), va_dot_r(0.), vb_dot_r(0.);
+    for(size_t d = 0; d < gdimension; ++d) {
+      const vdouble dx = pos_a[d] - load(&soa.x[d][b]);
+      r2 += dx * dx;
+      v12_dot_r += (v12_a[d] - load(&soa.v12[d][b])) * dx;
+      va_dot_r += vel_a[d] * dx;
+      vb_dot_r += load(&soa.v[d][b]) * dx;
+    }
+    using std::sqrt;
+    const vdouble rho_b = load(&soa.rho[b]);
+    const vdouble h_ab = .5 * (h_a + load(&soa.h[b]));
+    const vdouble mu_ab = simd::mu(h_ab, v12_dot_r, r2);
+    const vdouble Pi_ab = simd::viscosity_function<V>(
+      .5 * (alpha_a + load(&soa.alpha[b])), .5 * (rho_a + rho_b),
+      .5 * (c_a + load(&soa.c[b])), mu_ab);
+    const vdouble DiW = simd::kernel_gradient<K, gdimension>(sqrt(r2), h_ab);
+    const vdouble m_b = choose(r2 > 0., load(&soa.m[b]), vdouble(0.));
+    const vdouble Prho2_b = load(&soa.P[b]) / (rho_b * rho_b);
+    const vdouble va_dW = va_dot_r * DiW, vb_dW = vb_dot_r * DiW;
+    dedt -= m_b * (Prho2_a * vb_dW + va_dW * Prho2_b +
+                    .5 * Pi_ab * (vb_dW + va_dW));
+  }
+  particle.setDedt(simd::reduce(dedt) + gv);
+} // compute_dedt
+
+} // namespace batched
+} // namespace physics
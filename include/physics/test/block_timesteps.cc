@@ -0,0 +1,111 @@
+#include "gtest/gtest.h"
+
+#include <cmath>
+#include <iostream>
+#include <mpi.h>
+
+#include "default_physics.h"
+
+using namespace std;
+using namespace flecsi;
+using namespace topology;
+
+namespace flecsi {
+namespace execution {
+void
+driver(int, char **) {}
+} // namespace execution
+} // namespace flecsi
+
+// Block timesteps on independent harmonic oscillators, a few of them much
+// stiffer than the others: the kick-drift-kick sequence of the drivers
+// must stay accurate while evaluating far fewer accelerations than with
+// the global timestep.
+
+const size_t n_particles = 1000;
+const size_t n_stiff = 10;
+const double final_time = 2.;
+
+double
+stiffness(const body & b) {
+  return b.id() < n_stiff ? 1.e4 : 1.;
+}
+
+void
+accelerate(body & b) {
+  b.setAcceleration(-stiffness(b) * b.coordinates());
+}
+
+void
+set_dt(body & b) {
+  b.setDt(.02 / std::sqrt(stiffness(b)));
+}
+
+double
+energy(const body & b) {
+  const point_t x = b.coordinates(), v = b.getVelocity();
+  return .5 * (dot(v, v) + stiffness(b) * dot(x, x));
+}
+
+TEST(block_timesteps, oscillators) {
+  MPI_Init(nullptr, nullptr);
+  param::_adaptive_timestep = true;
+  param::_block_timesteps = true;
+
+  std::vector<body> bodies(n_particles);
+  std::vector<double> e0(n_particles);
+  for(size_t i = 0; i < n_particles; ++i) {
+    body & b = bodies[i];
+    b.set_id(i);
+    point_t x = 0.0;
+    x[0] = 1. + .001 * i;
+    b.set_coordinates(x);
+    b.setVelocity(0.0);
+    b.setGAcceleration(0.0);
+    accelerate(b);
+    set_dt(b);
+    e0[i] = energy(b);
+  }
+  physics::set_block_timestep(bodies);
+  EXPECT_EQ(bodies[0].getRung(), 7); // dt_base / 100 rounded to 2^-7
+  EXPECT_EQ(bodies[n_stiff].getRung(), 0);
+
+  // driver sequence, counting the acceleration evaluations
+  size_t n_evaluations = 0, n_iterations = 0;
+  while(physics::totaltime < final_time) {
+    for(auto & b : bodies)
+      if(integration::starts_step(b)) {
+        integration::leapfrog_kick_v(b);
+        integration::save_velocityhalf(b);
+      }
+    for(auto & b : bodies) {
+      integration::leapfrog_drift(b);
+      integration::predict_velocity(b);
+    }
+    for(auto & b : bodies)
+      if(integration::ends_step(b)) {
+        accelerate(b);
+        integration::leapfrog_kick_v(b);
+        set_dt(b);
+        ++n_evaluations;
+      }
+    physics::set_block_timestep(bodies);
+    physics::totaltime = physics::totaltime_next;
+    ++n_iterations;
+  }
+
+  // all the particles are synchronized at the end of the base steps
+  EXPECT_EQ(physics::tick, 0);
+  double err = 0.;
+  for(size_t i = 0; i < n_particles; ++i)
+    err = std::max(err, std::abs(energy(bodies[i]) - e0[i]) / e0[i]);
+  const size_t n_global = n_particles * n_iterations;
+  std::cout << "iterations: " << n_iterations
+            << ", evaluations: " << n_evaluations << " (global dt: "
+            << n_global << "), max energy error: " << err << std::endl;
+  EXPECT_LT(err, 1e-3);
+  EXPECT_LT(10 * n_evaluations, n_global);
+
+  param::_block_timesteps = false;
+  MPI_Finalize();
+}
@@ -0,0 +1,158 @@
+#include "gtest/gtest.h"
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <mpi.h>
+#include <random>
+
+#include "default_physics.h"
+
+using namespace std;
+using namespace flecsi;
+using namespace topology;
+
+namespace flecsi {
+namespace execution {
+void
+driver(int, char **) {}
+} // namespace execution
+} // namespace flecsi
+
+// External forces composed from external_force_type: the acceleration must
+// be minus the gradient of the potential, and the sweeps over arrays must
+// match the particles taken one at a time.
+
+const size_t n_points = 2001; // not a multiple of the SIMD width
+
+std::vector<point_t>
+random_points() {
+  std::mt19937 gen(0);
+  std::uniform_real_distribution<double> u(-1.5, 1.5);
+  std::vector<point_t> points(n_points);
+  for(point_t & p : points)
+    for(size_t d = 0; d < gdimension; ++d)
+      p[d] = u(gen);
+  return points;
+}
+
+// minus the gradient of the potential, by central differences
+point_t
+minus_gradient(const point_t & p) {
+  const double dx = 1e-6;
+  point_t g = 0.0;
+  for(size_t d = 0; d < gdimension; ++d) {
+    point_t l = p, r = p;
+    l[d] -= dx;
+    r[d] += dx;
+    g[d] = (external_force::potential(l) - external_force::potential(r)) /
+           (2. * dx);
+  }
+  return g;
+}
+
+TEST(eforce, composition) {
+  MPI_Init(nullptr, nullptr);
+  param::_box_length = 2.;
+  param::_sphere_radius = .9;
+  param::_extforce_wall_steepness = 1e3;
+  param::_poly_gamma = 2.;
+  param::_orbital_separation = 3.;
+  param::_mass_neutron_star = 1.;
+  param::_mass_white_dwarf = .5;
+  param::_zero_potential_poison_value = .25;
+  strcpy(param::_density_profile, "parabolic");
+
+  std::vector<point_t> points = random_points();
+  std::vector<body> bodies(n_points);
+  std::vector<body *> particles;
+  for(size_t j = 0; j < n_points; ++j) {
+    bodies[j].set_coordinates(points[j]);
+    particles.push_back(&bodies[j]);
+  }
+
+  for(const char * efstr : {"walls:xyz", "spherical wall",
+        "spherical density support", "gravity", "airfoil", "orbit",
+        "walls:xy,spherical density support,gravity,poison"}) {
+    if(gdimension == 1 and strcmp(efstr, "airfoil") == 0)
+      continue; // a 2D profile
+    external_force::select(efstr);
+
+    // one at a time
+    std::vector<point_t> a(n_points);
+    std::vector<double> phi(n_points);
+    for(size_t j = 0; j < n_points; ++j) {
+      a[j] = external_force::acceleration(bodies[j]);
+      phi[j] = external_force::potential(points[j]);
+    }
+
+    // in one sweep
+    scratch::frame scratch_;
+    external_force::batch x(scratch_, particles);
+    const size_t n_padded = simd::padded(n_points);
+    double * phi_b = scratch_.alloc<double>(n_padded);
+    double * a_b[gdimension];
+    for(size_t d = 0; d < gdimension; ++d) {
+      a_b[d] = scratch_.alloc<double>(n_padded);
+      std::fill(a_b[d], a_b[d] + n_padded, 0.);
+    }
+    external_force::forces.acceleration(x.n, x.x, a_b);
+    external_force::potential(x, phi_b);
+
+    double err = 0., err_grad = 0., a_max = 0.;
+    size_t forced = 0;
+    for(size_t j = 0; j < n_points; ++j) {
+      const double scale = std::max(1., magnitude(a[j]));
+      const point_t g = minus_gradient(points[j]);
+      for(size_t d = 0; d < gdimension; ++d) {
+        err = std::max(err, std::abs(a_b[d][j] - a[j][d]) / scale);
+        err_grad = std::max(err_grad, std::abs(g[d] - a[j][d]) / scale);
+      }
+      err = std::max(err,
+        std::abs(phi_b[j] - phi[j]) / std::max(1., std::abs(phi[j])));
+      a_max = std::max(a_max, magnitude(a[j]));
+      forced += magnitude(a[j]) > 0.;
+    }
+    std::cout << efstr << ": " << forced << " of " << n_points
+              << " points forced; errors " << err << ", " << err_grad
+              << std::endl;
+    EXPECT_GT(forced, 0u) << efstr;
+    EXPECT_LT(err, 1e-12) << efstr;
+    EXPECT_LT(err_grad, 1e-5) << efstr;
+  }
+
+  // terms are counted as many times as they are listed
+  external_force::select("walls:x");
+  std::vector<double> once;
+  for(const point_t & p : points)
+    once.push_back(external_force::potential(p));
+  external_force::select("walls:xx");
+  for(size_t j = 0; j < n_points; ++j)
+    EXPECT_EQ(external_force::potential(points[j]), 2. * once[j]) << j;
+
+  external_force::select("none");
+  for(size_t j = 0; j < n_points; ++j) {
+    EXPECT_EQ(external_force::potential(points[j]), 0.);
+    EXPECT_EQ(magnitude(external_force::acceleration(bodies[j])), 0.);
+  }
+
+  // internal energy recovered with the potential of the sweep
+  external_force::select("spherical density support,gravity");
+  std::vector<body> batched = bodies;
+  for(size_t j = 0; j < n_points; ++j) {
+    bodies[j].setVelocity(point_t(.1));
+    bodies[j].setTotalenergy(
+      1e6 + external_force::potential(points[j]) + .5 * gdimension * .01);
+    batched[j] = bodies[j];
+    particles[j] = &batched[j];
+    physics::recover_internal_energy(bodies[j]);
+  }
+  physics::recover_internal_energy(particles);
+  for(size_t j = 0; j < n_points; ++j)
+    EXPECT_NEAR(batched[j].getInternalenergy(),
+      bodies[j].getInternalenergy(), 1e-9)
+      << j;
+
+  external_force::select("none");
+  MPI_Finalize();
+}
@@ -0,0 +1,124 @@
+#include "gtest/gtest.h"
+
+#include <cmath>
+#include <iostream>
+#include <mpi.h>
+#include <random>
+
+#include "default_physics.h"
+
+using namespace std;
+using namespace flecsi;
+using namespace topology;
+
+namespace flecsi {
+namespace execution {
+void
+driver(int, char **) {}
+} // namespace execution
+} // namespace flecsi
+
+// Batched EOS (eos_batched): for every analytic EOS, the sweep over the
+// particles and the half-step pressure updates must match the EOS called
+// one particle at a time, up to the round-off of the rewritten formulas.
+
+const size_t n_particles = 10003; // not a multiple of the SIMD width
+
+std::vector<body>
+random_particles(param::eos_type_keyword e) {
+  std::mt19937 gen(e);
+  std::uniform_real_distribution<double> u(0., 1.);
+  std::vector<body> bodies(n_particles);
+  for(body & b : bodies) {
+    // densities on both sides of the ppt threshold, or of a white dwarf
+    const double rho = e == param::eos_wd ? std::pow(10., 3. + 6. * u(gen))
+                                          : std::pow(10., -2. + 4. * u(gen));
+    b.setDensity(rho);
+    b.setInternalenergy(.1 + u(gen));
+    b.setElectronfraction(.4 + .1 * u(gen));
+    b.setPressure(.1 + u(gen));
+    b.setVelocity(point_t(u(gen)));
+    b.setAcceleration(point_t(u(gen) - .5));
+    b.setDudt(u(gen) - .5);
+    b.setDedt(u(gen) - .5);
+    eos::init(b);
+    b.setTotalenergy(
+      b.getInternalenergy() + .5 * dot(b.getVelocity(), b.getVelocity()));
+  }
+  return bodies;
+}
+
+std::vector<body *>
+pointers(std::vector<body> & bodies) {
+  std::vector<body *> p;
+  for(body & b : bodies)
+    p.push_back(&b);
+  return p;
+}
+
+double
+max_error(const std::vector<body> & a, const std::vector<body> & b) {
+  double err = 0.;
+  for(size_t i = 0; i < a.size(); ++i) {
+    err = std::max(err,
+      std::abs(a[i].getPressure() - b[i].getPressure()) / b[i].getPressure());
+    err = std::max(err, std::abs(a[i].getSoundspeed() - b[i].getSoundspeed()) /
+                          b[i].getSoundspeed());
+    err = std::max(err, std::abs(a[i].getInternalenergy() -
+                                 b[i].getInternalenergy()));
+  }
+  return err;
+}
+
+TEST(eos_batch, analytic) {
+  MPI_Init(nullptr, nullptr);
+  param::_ppt_density_thr = 1.;
+  param::_poly_gamma2 = 2.5;
+  physics::dt = 1e-2;
+  std::cout << "SIMD width: " << simd::width << std::endl;
+
+  for(auto e : {param::eos_polytropic, param::eos_ideal, param::eos_wd,
+        param::eos_ppt}) {
+    param::_eos_type = e;
+    eos::select();
+    physics::select();
+    std::vector<body> scalar = random_particles(e), batched = scalar;
+    std::vector<body *> p = pointers(batched);
+
+    // sweep after the density pass
+    for(body & b : scalar) {
+      eos::compute_pressure(b);
+      eos::compute_soundspeed(b);
+    }
+    eos::compute_all(p);
+    const double err = max_error(batched, scalar);
+
+    // half-step updates, both energy formulations
+    for(body & b : scalar)
+      physics::recompute_pressure_soundspeed(b);
+    physics::recompute_pressure_soundspeed_batched(p);
+    const double err_u = max_error(batched, scalar);
+    for(body & b : scalar)
+      physics::recompute_pressure_soundspeed_thermokinetic(b);
+    physics::recompute_pressure_soundspeed_thermokinetic_batched(p);
+    const double err_e = max_error(batched, scalar);
+
+    std::cout << "eos " << e << ": relative errors " << err << ", " << err_u
+              << ", " << err_e << std::endl;
+    EXPECT_LT(err, 1e-13) << e;
+    EXPECT_LT(err_u, 1e-13) << e;
+    EXPECT_LT(err_e, 1e-13) << e;
+  }
+
+  // with eos_batched, the density pass leaves the EOS to the sweep after
+  // the first iteration
+  param::_eos_batched = true;
+  physics::iteration = param::initial_iteration;
+  EXPECT_FALSE(physics::batched_eos());
+  physics::iteration = param::initial_iteration + 1;
+  EXPECT_TRUE(physics::batched_eos());
+  param::_eos_batched = false;
+
+  param::_eos_type = param::eos_ideal;
+  MPI_Finalize();
+}
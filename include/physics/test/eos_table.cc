@@ -0,0 +1,184 @@
+#include "gtest/gtest.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mpi.h>
+#include <random>
+#include <stdexcept>
+
+#include "default_physics.h"
+
+using namespace std;
+using namespace flecsi;
+using namespace topology;
+
+namespace flecsi {
+namespace execution {
+void
+driver(int, char **) {}
+} // namespace execution
+} // namespace flecsi
+
+// Tabulated EOS: an ideal gas table, written as tools/dummyTabEOS does,
+// must give back the analytic ideal gas. Its log P, log eps and log cs^2
+// are linear in log rho and log T, so the interpolation is exact to
+// round-off. A table that cannot be read is an error.
+
+const double gamma_ = 5. / 3.;
+const char * filename = "eos_table_test.h5";
+const double lr[2] = {-4., 2.}, lt[2] = {-3., 1.}, ye[2] = {0., .55};
+
+double
+eps_given_T(double T) {
+  return T * MEV / (MP * (gamma_ - 1.));
+}
+
+void
+write_dataset(hid_t file, const char * name, const std::vector<double> & v) {
+  const hsize_t size = v.size();
+  const hid_t space = H5Screate_simple(1, &size, nullptr);
+  const hid_t set = H5Dcreate2(file, name, H5T_NATIVE_DOUBLE, space,
+    H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+  H5Dwrite(set, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, v.data());
+  H5Dclose(set);
+  H5Sclose(space);
+}
+
+void
+write_table(size_t n_rho, size_t n_t, size_t n_ye) {
+  std::vector<double> lrho(n_rho), ltemp(n_t), y(n_ye);
+  for(size_t i = 0; i < n_rho; ++i)
+    lrho[i] = lr[0] + (lr[1] - lr[0]) * i / (n_rho - 1);
+  for(size_t j = 0; j < n_t; ++j)
+    ltemp[j] = lt[0] + (lt[1] - lt[0]) * j / (n_t - 1);
+  for(size_t k = 0; k < n_ye; ++k)
+    y[k] = ye[0] + (ye[1] - ye[0]) * k / (n_ye - 1);
+  std::vector<double> lp, le, cs2;
+  for(size_t k = 0; k < n_ye; ++k)
+    for(size_t j = 0; j < n_t; ++j)
+      for(size_t i = 0; i < n_rho; ++i) {
+        const double eps = eps_given_T(std::pow(10., ltemp[j]));
+        lp.push_back(std::log10((gamma_ - 1.) * std::pow(10., lrho[i]) * eps));
+        le.push_back(std::log10(eps));
+        cs2.push_back(gamma_ * (gamma_ - 1.) * eps);
+      }
+  const hid_t file =
+    H5Fcreate(filename, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+  write_dataset(file, "pointsrho", {double(n_rho)});
+  write_dataset(file, "pointstemp", {double(n_t)});
+  write_dataset(file, "pointsye", {double(n_ye)});
+  write_dataset(file, "energy_shift", {0.});
+  write_dataset(file, "logrho", lrho);
+  write_dataset(file, "logtemp", ltemp);
+  write_dataset(file, "ye", y);
+  write_dataset(file, "logpress", lp);
+  write_dataset(file, "logenergy", le);
+  write_dataset(file, "cs2", cs2);
+  H5Fclose(file);
+}
+
+TEST(eos_table, ideal_gas) {
+  MPI_Init(nullptr, nullptr);
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  if(rank == 0)
+    write_table(31, 23, 7);
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  param::_eos_type = param::eos_tabulated;
+  strcpy(param::_eos_tab_file_path, filename);
+  eos::select();
+  eos::table & table = eos::eos_t<param::eos_tabulated>::data();
+  ASSERT_TRUE(table.loaded());
+  EXPECT_NEAR(table.rho_min(), 1e-4, 1e-16);
+  EXPECT_NEAR(table.T_max(), 10., 1e-12);
+
+  // random states within the table, with and without a good first bracket
+  const size_t n = 1000;
+  std::mt19937 gen(rank);
+  std::uniform_real_distribution<double> u(0., 1.);
+  std::vector<double> rho(n), eps(n), y(n), T(n), P(n), cs(n);
+  std::vector<double> T_far(n);
+  for(size_t i = 0; i < n; ++i) {
+    rho[i] = std::pow(10., lr[0] + (lr[1] - lr[0]) * u(gen));
+    const double T_i = std::pow(10., lt[0] + (lt[1] - lt[0]) * u(gen));
+    eps[i] = eps_given_T(T_i);
+    y[i] = ye[0] + (ye[1] - ye[0]) * u(gen);
+    T[i] = T_i * (1. + .01 * u(gen));
+    T_far[i] = i % 2 ? 0. : 10. * T_i;
+  }
+  table.evaluate(n, rho.data(), eps.data(), y.data(), T.data(), P.data(),
+    cs.data());
+  double err_P = 0., err_cs = 0., err_T = 0., err_eps = 0.;
+  for(size_t i = 0; i < n; ++i) {
+    const double P_a = (gamma_ - 1.) * rho[i] * eps[i],
+                 cs_a = std::sqrt(gamma_ * (gamma_ - 1.) * eps[i]),
+                 T_a = eps[i] * MP * (gamma_ - 1.) / MEV;
+    err_P = std::max(err_P, std::abs(P[i] - P_a) / P_a);
+    err_cs = std::max(err_cs, std::abs(cs[i] - cs_a) / cs_a);
+    err_T = std::max(err_T, std::abs(T[i] - T_a) / T_a);
+    err_eps = std::max(err_eps,
+      std::abs(table.internal_energy(rho[i], T[i], y[i]) - eps[i]) / eps[i]);
+
+    // same state from the scalar lookup, whatever the first bracket
+    double T_s = T_far[i], P_s, cs_s;
+    table.evaluate(rho[i], eps[i], y[i], T_s, P_s, cs_s);
+    EXPECT_EQ(P_s, P[i]) << i;
+    EXPECT_EQ(cs_s, cs[i]) << i;
+    EXPECT_EQ(T_s, T[i]) << i;
+  }
+  std::cout << "relative errors: P " << err_P << ", cs " << err_cs << ", T "
+            << err_T << ", eps(T) " << err_eps << std::endl;
+  EXPECT_LT(err_P, 1e-12);
+  EXPECT_LT(err_cs, 1e-12);
+  EXPECT_LT(err_T, 1e-12);
+  EXPECT_LT(err_eps, 1e-12);
+
+  // particles, one at a time, from a single lookup and batched
+  std::vector<body> bodies(n), fused(n), batched(n);
+  for(size_t i = 0; i < n; ++i) {
+    body & b = bodies[i];
+    b.setDensity(rho[i]);
+    b.setInternalenergy(eps[i]);
+    b.setElectronfraction(y[i]);
+    b.setTemperature(0.);
+    eos::init(b);
+    batched[i] = fused[i] = b;
+    eos::compute_pressure(b);
+    eos::compute_soundspeed(b);
+    eos::compute_pressure_soundspeed<param::eos_tabulated>(fused[i]);
+  }
+  std::vector<body *> pointers;
+  for(body & b : batched)
+    pointers.push_back(&b);
+  eos::compute_all(pointers);
+  for(size_t i = 0; i < n; ++i) {
+    EXPECT_EQ(batched[i].getPressure(), bodies[i].getPressure()) << i;
+    EXPECT_EQ(batched[i].getSoundspeed(), bodies[i].getSoundspeed()) << i;
+    EXPECT_EQ(batched[i].getTemperature(), bodies[i].getTemperature()) << i;
+    EXPECT_EQ(fused[i].getPressure(), bodies[i].getPressure()) << i;
+    EXPECT_EQ(fused[i].getSoundspeed(), bodies[i].getSoundspeed()) << i;
+    EXPECT_EQ(fused[i].getTemperature(), bodies[i].getTemperature()) << i;
+    EXPECT_EQ(bodies[i].getPressure(), P[i]) << i;
+  }
+
+  // clamped to the edges outside of the table
+  double T_out = 0., P_out, cs_out;
+  table.evaluate(1e6, eps_given_T(100.), .3, T_out, P_out, cs_out);
+  EXPECT_NEAR(T_out, 10., 1e-12);
+  EXPECT_TRUE(std::isfinite(P_out) and std::isfinite(cs_out));
+
+  table.free();
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  // a missing table is an error
+  eos::table missing;
+  EXPECT_THROW(missing.load("eos_table_missing.h5"), std::runtime_error);
+  EXPECT_FALSE(missing.loaded());
+  if(rank == 0)
+    std::remove(filename);
+  param::_eos_type = param::eos_ideal;
+  MPI_Finalize();
+}
@@ -0,0 +1,150 @@
+#include "gtest/gtest.h"
+
+#include <cmath>
+#include <iostream>
+#include <mpi.h>
+#include <random>
+
+#include "default_physics.h"
+#include "fmm.h"
+
+using namespace std;
+using namespace flecsi;
+using namespace topology;
+
+namespace flecsi {
+namespace execution {
+void
+driver(int, char **) {}
+} // namespace execution
+} // namespace flecsi
+
+// Batched particle-particle gravity: without softening it must match the
+// pairs taken one at a time, skipping the sink itself; with softening, the
+// acceleration must be minus the gradient of the potential and become
+// Newtonian beyond the spline support.
+
+const size_t n_sources = 1003; // not a multiple of the SIMD width
+
+std::vector<body>
+random_sources() {
+  std::mt19937 gen(3);
+  std::uniform_real_distribution<double> u(-1., 1.);
+  std::vector<body> bodies(n_sources);
+  for(body & b : bodies) {
+    point_t x;
+    for(size_t d = 0; d < gdimension; ++d)
+      x[d] = u(gen);
+    b.set_coordinates(x);
+    b.set_mass(1. + .5 * u(gen));
+  }
+  return bodies;
+}
+
+template<param::gravity_softening_keyword S>
+void
+batched(const point_t & x,
+  const fmm::p2p_sources & s,
+  double & pot,
+  point_t & acc) {
+  pot = 0.;
+  acc = 0.0;
+  fmm::gravitation_p2p<S>(pot, acc, x, s);
+}
+
+TEST(fmm, p2p) {
+  MPI_Init(nullptr, nullptr);
+  fmm::gc = 2.;
+  std::vector<body> bodies = random_sources();
+  std::vector<body *> p;
+  for(body & b : bodies)
+    p.push_back(&b);
+  scratch::frame scratch_;
+  const fmm::p2p_sources sources(scratch_, p);
+
+  // point masses, against the scalar pairs
+  double err_pot = 0., err_acc = 0.;
+  for(body & b : bodies) {
+    double pot_s = 0.;
+    point_t acc_s = 0.0;
+    for(body * q : p)
+      if(q != &b)
+        acc_s += fmm::gravitation_p2p(
+          pot_s, b.coordinates(), q->coordinates(), q->mass());
+    double pot;
+    point_t acc;
+    batched<param::soft_none>(b.coordinates(), sources, pot, acc);
+    err_pot = std::max(err_pot, std::abs(pot - pot_s) / std::abs(pot_s));
+    err_acc = std::max(err_acc, magnitude(acc - acc_s) / magnitude(acc_s));
+  }
+  std::cout << "SIMD width " << simd::width << ": relative errors "
+            << err_pot << ", " << err_acc << std::endl;
+  EXPECT_LT(err_pot, 1e-12);
+  EXPECT_LT(err_acc, 1e-12);
+
+  // Plummer spheres, against the closed form
+  param::_gravity_softening_length = .1;
+  const double e2 = .01;
+  err_pot = err_acc = 0.;
+  for(body & b : bodies) {
+    double pot_s = 0.;
+    point_t acc_s = 0.0;
+    for(body * q : p) {
+      if(q == &b)
+        continue;
+      const point_t dx = q->coordinates() - b.coordinates();
+      const double r2 = dot(dx, dx) + e2;
+      pot_s -= fmm::gc * q->mass() / std::sqrt(r2);
+      acc_s += fmm::gc * q->mass() / (r2 * std::sqrt(r2)) * dx;
+    }
+    double pot;
+    point_t acc;
+    batched<param::soft_plummer>(b.coordinates(), sources, pot, acc);
+    err_pot = std::max(err_pot, std::abs(pot - pot_s) / std::abs(pot_s));
+    err_acc = std::max(err_acc, magnitude(acc - acc_s) / magnitude(acc_s));
+  }
+  EXPECT_LT(err_pot, 1e-12);
+  EXPECT_LT(err_acc, 1e-12);
+
+  // spline: one unit source, along a line through the support
+  param::_gravity_softening_length = .2;
+  body source;
+  source.set_coordinates(point_t{});
+  source.set_mass(1.);
+  std::vector<body *> one = {&source};
+  const fmm::p2p_sources s1(scratch_, one);
+  const double dr = 1e-6;
+  double err_grad = 0.;
+  for(double r = .01; r < .4; r += .0123) {
+    point_t x{}, xp{}, xm{};
+    x[0] = r;
+    xp[0] = r + dr;
+    xm[0] = r - dr;
+    double pot, pot_p, pot_m;
+    point_t acc, acc_p;
+    batched<param::soft_spline>(x, s1, pot, acc);
+    batched<param::soft_spline>(xp, s1, pot_p, acc_p);
+    batched<param::soft_spline>(xm, s1, pot_m, acc_p);
+    err_grad = std::max(
+      err_grad, std::abs(acc[0] + (pot_p - pot_m) / (2. * dr)) / std::abs(acc[0]));
+    if(r >= .2) {
+      EXPECT_NEAR(pot, -fmm::gc / r, 1e-12 / r) << r;
+      EXPECT_NEAR(acc[0], -fmm::gc / (r * r), 1e-12 / (r * r)) << r;
+    }
+    else {
+      EXPECT_GT(pot, -fmm::gc / r) << r;
+      EXPECT_GT(acc[0], -fmm::gc / (r * r)) << r;
+    }
+  }
+  std::cout << "spline softening: relative gradient error " << err_grad
+            << std::endl;
+  EXPECT_LT(err_grad, 1e-6);
+  // finite at the center of the source: -2.8 G m / h
+  double pot;
+  point_t acc;
+  batched<param::soft_spline>(point_t{1e-12, 0., 0.}, s1, pot, acc);
+  EXPECT_NEAR(pot, -2.8 * fmm::gc / .2, 1e-9);
+
+  param::_gravity_softening_length = 0.;
+  MPI_Finalize();
+}
@@ -0,0 +1,79 @@
+#include "gtest/gtest.h"
+
+#include <cmath>
+#include <iostream>
+#include <mpi.h>
+#include <random>
+
+#include "kernels.h"
+#include "params.h"
+
+using namespace std;
+using namespace flecsi;
+using namespace topology;
+using namespace kernels;
+
+namespace flecsi {
+namespace execution {
+void
+driver(int, char **) {}
+} // namespace execution
+} // namespace flecsi
+
+// Accuracy of the tabulated kernels against the analytic forms,
+// for the dimension this test is compiled with (see CMakeLists.txt)
+
+const size_t n_samples = 1 << 16;
+
+const char * kernel_names[] = {"cubic_spline", "quintic_spline", "wendland_c2",
+  "wendland_c4", "wendland_c6", "gaussian", "super_gaussian", "sinc_ker"};
+
+template<param::sph_kernel_keyword K>
+void
+check_table() {
+  param::_sph_kernel = K;
+  param::_sph_kernel_tabulated = true;
+  kernels::select();
+
+  // random separations within the support, for h ~ 1
+  std::mt19937 gen(12345);
+  std::uniform_real_distribution<double> u(-1., 1.);
+  std::vector<point_t> p(n_samples);
+  std::vector<double> h(n_samples);
+  for(size_t i = 0; i < n_samples; ++i) {
+    for(size_t d = 0; d < gdimension; ++d)
+      p[i][d] = u(gen) / std::sqrt(gdimension);
+    h[i] = 1. + .1 * u(gen);
+  }
+
+  // errors relative to the maximum of |W| and |dW/dr|
+  double w_max = 0., dw_max = 0., err_w = 0., err_dw = 0.;
+  for(size_t i = 0; i < n_samples; ++i) {
+    const double r = magnitude(p[i]);
+    const double w = kernel<K, gdimension>(r, h[i]);
+    const point_t dw = kernel_gradient<K, gdimension>(p[i], h[i]);
+    w_max = std::max(w_max, std::abs(w));
+    dw_max = std::max(dw_max, magnitude(dw));
+    err_w = std::max(err_w, std::abs(sph_kernel_function(r, h[i]) - w));
+    err_dw = std::max(err_dw, magnitude(sph_kernel_gradient(p[i], h[i]) - dw));
+  }
+  err_w /= w_max;
+  err_dw /= dw_max;
+
+  std::cout << gdimension << "D " << kernel_names[K] << ": error W "
+            << err_w << ", dW " << err_dw << std::endl;
+  EXPECT_LT(err_w, 1e-7) << kernel_names[K];
+  EXPECT_LT(err_dw, 1e-6) << kernel_names[K];
+}
+
+TEST(kernel_table, accuracy) {
+  check_table<param::cubic_spline>();
+  check_table<param::quintic_spline>();
+  check_table<param::wendland_c2>();
+  check_table<param::wendland_c4>();
+  check_table<param::wendland_c6>();
+  check_table<param::gaussian>();
+  check_table<param::super_gaussian>();
+  check_table<param::sinc_ker>();
+  param::_sph_kernel_tabulated = false;
+}
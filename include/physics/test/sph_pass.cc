@@ -0,0 +1,59 @@
+#include "gtest/gtest.h"
+
+#include <iostream>
+#include <mpi.h>
+
+#include "default_physics.h"
+
+using namespace std;
+using namespace flecsi;
+using namespace topology;
+
+namespace flecsi {
+namespace execution {
+void
+driver(int, char **) {}
+} // namespace execution
+} // namespace flecsi
+
+// Fusion of the passes applied in the smoothing length, as used by the
+// hydro and newtonian drivers
+
+std::vector<size_t>
+group_sizes(const std::vector<physics::sph_pass> & passes) {
+  std::vector<size_t> sizes;
+  for(const auto & g : physics::fuse(passes))
+    sizes.push_back(g.size());
+  return sizes;
+}
+
+TEST(sph_pass, fusion) {
+  using namespace physics::passes;
+  kernels::select();
+  physics::select();
+
+  // acceleration, relaxation and energy rates share one traversal
+  EXPECT_EQ(group_sizes({acceleration(), short_range_repulsion(), dudt()}),
+    std::vector<size_t>({3}));
+  EXPECT_EQ(group_sizes({acceleration(), dedt()}), std::vector<size_t>({2}));
+
+  // alpha reads the divergence of the neighbors, the acceleration their
+  // alpha: each needs updated ghosts
+  EXPECT_EQ(group_sizes({density_pressure_soundspeed(), alpha(),
+              acceleration()}),
+    std::vector<size_t>({1, 1, 1}));
+
+  // the second energy pass needs the pressure of the neighbors after
+  // the first one, but not after the density
+  EXPECT_FALSE(physics::can_fuse(density_pressure_soundspeed(), dudt()));
+  EXPECT_TRUE(physics::can_fuse(dudt(), dudt()));
+
+  // in symmetric mode the acceleration is only set after the traversal,
+  // the repulsion must add to it in the next one
+  param::_sph_symmetric_pairs = true;
+  EXPECT_EQ(group_sizes({acceleration(), short_range_repulsion(), dudt()}),
+    std::vector<size_t>({1, 2}));
+  EXPECT_EQ(group_sizes({acceleration(), dudt(), dedt()}),
+    std::vector<size_t>({3}));
+  param::_sph_symmetric_pairs = false;
+}
@@ -0,0 +1,166 @@
+#include "gtest/gtest.h"
+
+#include <cmath>
+#include <iostream>
+#include <mpi.h>
+#include <random>
+
+#include "default_physics.h"
+
+using namespace std;
+using namespace flecsi;
+using namespace topology;
+
+namespace flecsi {
+namespace execution {
+void
+driver(int, char **) {}
+} // namespace execution
+} // namespace flecsi
+
+// Compares the SIMD-batched sph passes against the scalar specialized ones
+// for every kernel.
+
+const double tol = 1e-10;
+const size_t n_particles = 1000;
+
+// relative difference, with an absolute floor at scale
+double
+rel_diff(const double a, const double b, const double scale) {
+  return std::abs(a - b) / (std::abs(b) + scale);
+}
+
+const char *
+kernel_name(const param::sph_kernel_keyword k) {
+  static const char * names[] = {"cubic_spline", "quintic_spline",
+    "wendland_c2", "wendland_c4", "wendland_c6", "gaussian", "super_gaussian",
+    "sinc_ker"};
+  return names[k];
+}
+
+// particles on a jittered lattice with random velocities and
+// thermodynamics; neighbors within the kernel support
+struct cloud {
+  std::vector<body> bodies;
+  std::vector<std::vector<body *>> nbs;
+
+  cloud() {
+    std::mt19937 gen(12345);
+    std::uniform_real_distribution<double> u(-.5, .5);
+    const size_t side = std::ceil(std::pow(n_particles, 1. / gdimension));
+    const double dx = 1. / side, h = 1.6 * dx;
+    bodies.resize(n_particles);
+    for(size_t i = 0; i < n_particles; ++i) {
+      point_t pos, vel, v12;
+      size_t idx = i;
+      for(size_t d = 0; d < gdimension; ++d) {
+        pos[d] = (idx % side + .5 + .2 * u(gen)) * dx;
+        vel[d] = u(gen);
+        v12[d] = vel[d] + .1 * u(gen);
+        idx /= side;
+      }
+      body & b = bodies[i];
+      b.set_coordinates(pos);
+      b.set_mass(1. / n_particles);
+      b.set_radius(h * (1. + .1 * u(gen)));
+      b.setVelocity(vel);
+      b.setVelocityhalf(v12);
+      b.setDensity(1. + .2 * u(gen));
+      b.setPressure(1. + .2 * u(gen));
+      b.setSoundspeed(1. + .2 * u(gen));
+      b.setAlpha(.5 + .5 * u(gen));
+    }
+  }
+
+  void find_neighbors() {
+    nbs.assign(n_particles, {});
+    for(size_t i = 0; i < n_particles; ++i)
+      for(size_t j = 0; j < n_particles; ++j) {
+        const double h_ij = .5 * (bodies[i].radius() + bodies[j].radius());
+        if(distance(bodies[i].coordinates(), bodies[j].coordinates()) <
+           kernels::kernel_width * h_ij)
+          nbs[i].push_back(&bodies[j]);
+      }
+  }
+};
+
+TEST(sph_simd, kernels) {
+  using namespace param;
+  for(int k = cubic_spline; k <= sinc_ker; ++k) {
+    _sph_kernel = static_cast<sph_kernel_keyword>(k);
+    kernels::select();
+    physics::with_kernel([](auto kc) {
+      constexpr auto K = decltype(kc)::value;
+      const double h = 1.;
+      const size_t n = simd::padded(400);
+      std::vector<double> r(n), w(n), dw(n);
+      for(size_t i = 0; i < n; ++i)
+        r[i] = i * kernels::kernel_width * h / 390.;
+      for(size_t i = 0; i < n; i += simd::width) {
+        const simd::vdouble ri = simd::load(&r[i]);
+        simd::store(simd::kernel<K, gdimension>(ri, simd::vdouble(h)), &w[i]);
+        simd::store(
+          simd::kernel_gradient<K, gdimension>(ri, simd::vdouble(h)), &dw[i]);
+      }
+      const double scale = kernels::kernel<K, gdimension>(0., h);
+      for(size_t i = 0; i < n; ++i) {
+        point_t p = 0.;
+        p[0] = r[i];
+        const double w_ref = kernels::kernel<K, gdimension>(r[i], h);
+        const double dw_ref = kernels::kernel_gradient<K, gdimension>(p, h)[0];
+        ASSERT_LT(rel_diff(w[i], w_ref, scale), tol)
+          << kernel_name(K) << " at r = " << r[i];
+        ASSERT_LT(rel_diff(dw[i] * r[i], dw_ref, scale), tol)
+          << kernel_name(K) << " gradient at r = " << r[i];
+      }
+    });
+  }
+}
+
+TEST(sph_simd, passes) {
+  using namespace param;
+  cloud c;
+  std::cout << "SIMD width: " << simd::width << " doubles" << std::endl;
+  for(int v = visc_constant; v <= visc_cullen; ++v)
+    for(int k = cubic_spline; k <= sinc_ker; ++k) {
+      _sph_kernel = static_cast<sph_kernel_keyword>(k);
+      _sph_viscosity = static_cast<sph_viscosity_keyword>(v);
+      kernels::select();
+      c.find_neighbors();
+      physics::with_kernel([&](auto kc) {
+        physics::with_viscosity([&](auto vc) {
+          constexpr auto K = decltype(kc)::value;
+          constexpr auto V = decltype(vc)::value;
+          double err_rho = 0., err_acc = 0., err_dudt = 0., err_dedt = 0.;
+          for(size_t i = 0; i < n_particles; ++i) {
+            body a = c.bodies[i], b = c.bodies[i];
+            physics::specialized::compute_density<K>(a, c.nbs[i]);
+            physics::batched::compute_density<K>(b, c.nbs[i]);
+            err_rho = std::max(err_rho,
+              rel_diff(b.getDensity(), a.getDensity(), 0.));
+
+            physics::specialized::compute_acceleration<K, V>(a, c.nbs[i]);
+            physics::batched::compute_acceleration<K, V>(b, c.nbs[i]);
+            for(size_t d = 0; d < gdimension; ++d)
+              err_acc = std::max(err_acc,
+                rel_diff(b.getAcceleration()[d], a.getAcceleration()[d],
+                  magnitude(a.getAcceleration())));
+
+            physics::specialized::compute_dudt<K, V>(a, c.nbs[i]);
+            physics::batched::compute_dudt<K, V>(b, c.nbs[i]);
+            err_dudt = std::max(err_dudt,
+              rel_diff(b.getDudt(), a.getDudt(), std::abs(a.getDudt())));
+
+            physics::specialized::compute_dedt<K, V>(a, c.nbs[i]);
+            physics::batched::compute_dedt<K, V>(b, c.nbs[i]);
+            err_dedt = std::max(err_dedt,
+              rel_diff(b.getDedt(), a.getDedt(), std::abs(a.getDedt())));
+          }
+          EXPECT_LT(err_rho, tol) << kernel_name(K);
+          EXPECT_LT(err_acc, tol) << kernel_name(K);
+          EXPECT_LT(err_dudt, tol) << kernel_name(K);
+          EXPECT_LT(err_dedt, tol) << kernel_name(K);
+        });
+      });
+    }
+}
@@ -28,6 +28,9 @@
 #include <vector>
 #include <boost/algorithm/string.hpp>
 
+#include "pair_cache.h"
+#include "scratch.h"
+
 #define SQ(x) ((x)*(x))
 #define QU(x) ((x)*(x)*(x)*(x))
 
@@ -187,9 +190,13 @@ initialize_alpha(
  * @param      srch       The source particle
  * @param      nbsh       The neighbor particle
  *
+ * @tparam     LAGGED     use the divergence of the neighbors at the
+ *                        previous step (sph_viscosity_lagged_switch)
+ *
  * @return     limiter to reduce unwanted dissipation
  *
  */
+template<bool LAGGED = false>
 inline double
 compute_xi(
   body& particle,
@@ -212,15 +219,25 @@ compute_xi(
 
   // neighbor particles (index 'b')
   const int n_nb = nbs.size();
-  double h_[n_nb], m_[n_nb], divV_[n_nb];
-  point_t pos_[n_nb], v_[n_nb], v_a_[n_nb], DiWa_[n_nb];
+  // shared with the force passes, which use the same kernel unless it is
+  // tabulated
+  physics::pair_cache::pair_t * const pairs = sph_kernel_tabulated
+    ? nullptr : physics::pair_geometry.pairs(particle, n_nb);
+  scratch::frame scratch_;
+  double * h_ = scratch_.alloc<double>(n_nb);
+  double * m_ = scratch_.alloc<double>(n_nb);
+  double * divV_ = scratch_.alloc<double>(n_nb);
+  point_t * pos_ = scratch_.alloc<point_t>(n_nb);
+  point_t * v_ = scratch_.alloc<point_t>(n_nb);
+  point_t * v_a_ = scratch_.alloc<point_t>(n_nb);
+  point_t * DiWa_ = scratch_.alloc<point_t>(n_nb);
 
   for(int b = 0; b < n_nb; ++b) {
     const body * const nb = nbs[b];
     pos_[b]  = nb->coordinates();
     v_[b]    = nb->getVelocity();
     h_[b]    = nb->radius();
-    divV_[b] = nb->getDivergenceV();
+    divV_[b] = LAGGED ? nb->getDivergenceVLag() : nb->getDivergenceV();
     m_[b]    = nb->mass();
   }
 
@@ -230,7 +247,8 @@ compute_xi(
     point_t pos_ab = pos_a - pos_[b];
     double h_ab = .5*(h_a + h_[b]);
     v_a_[b]  = v_a - v_[b];
-    DiWa_[b] = sph_kernel_gradient(pos_ab,h_ab);
+    DiWa_[b] = physics::pair_geometry.gradient(pairs, b, pos_ab, h_ab,
+      sph_kernel_gradient);
 
     double Wab =  sph_kernel_function(flecsi::distance(pos_a, pos_[b]),h_ab);
     R_a += signnum_c(divV_[b])*m_[b]*Wab;
@@ -277,6 +295,7 @@ compute_xi(
  * @return     Trigger for  viscosity
  *
  */
+template<bool LAGGED = false>
 inline double
 A_trigger( body& particle,
   std::vector<body*>& nbs,
@@ -293,7 +312,7 @@ A_trigger( body& particle,
   ///result = std::max(-DivV_a_old,0.0); // DEBUG
   result = std::max(-dDivVdt,0.0);
 
-  xi = compute_xi(particle,nbs);
+  xi = compute_xi<LAGGED>(particle,nbs);
   particle.setXi(xi);
   particle.setTrigger(result);
   result = xi*result;
@@ -307,12 +326,16 @@ A_trigger( body& particle,
  * @param      srch       The source particle
  * @param      nbsh       The neighbor particle
  *
+ * @tparam     LAGGED     use the divergence of the neighbors at the
+ *                        previous step (sph_viscosity_lagged_switch)
+ *
  * @return
  *
  * @uses       sph_viscosity_alpha_max  global parameter
  */
+template<bool LAGGED>
 void
-compute_alpha(body & particle, std::vector<body *> & nbs) {
+update_alpha(body & particle, std::vector<body *> & nbs) {
   using namespace param;
   using namespace kernels;
   using namespace flecsi;
@@ -326,8 +349,15 @@ compute_alpha(body & particle, std::vector<body *> & nbs) {
 
   // neighbor particles (index 'b')
   const int n_nb = nbs.size();
-  double h_[n_nb], m_[n_nb], c_a_[n_nb], rho_[n_nb];
-  point_t pos_[n_nb], n_a_[n_nb], v_a_[n_nb], DiWab;
+  scratch::frame scratch_;
+  double * h_ = scratch_.alloc<double>(n_nb);
+  double * m_ = scratch_.alloc<double>(n_nb);
+  double * c_a_ = scratch_.alloc<double>(n_nb);
+  double * rho_ = scratch_.alloc<double>(n_nb);
+  point_t * pos_ = scratch_.alloc<point_t>(n_nb);
+  point_t * n_a_ = scratch_.alloc<point_t>(n_nb);
+  point_t * v_a_ = scratch_.alloc<point_t>(n_nb);
+  point_t DiWab;
 
   for(int b = 0; b < n_nb; ++b) {
     const body * const nb = nbs[b];
@@ -347,7 +377,7 @@ compute_alpha(body & particle, std::vector<body *> & nbs) {
   }
 
   double div_v = particle.getDivergenceV();
-  double Atrig = A_trigger(particle, nbs, div_v);
+  double Atrig = A_trigger<LAGGED>(particle, nbs, div_v);
   double alpha_loc = sph_viscosity_alpha_max 
                    * Atrig / (sph_viscosity_delta*SQ(vsig/h_a) + Atrig);
 
@@ -360,7 +390,49 @@ compute_alpha(body & particle, std::vector<body *> & nbs) {
     particle.setAlpha(alpha_a*exp(-dalphadt*physics::dt));
   }
 
-} // compute_alpha
+} // update_alpha
+
+/**
+ * @brief      Viscosity switch, in its own traversal after the density pass
+ */
+void
+compute_alpha(body & particle, std::vector<body *> & nbs) {
+  update_alpha<false>(particle, nbs);
+}
+
+/**
+ * @brief      Viscosity switch within the density pass, after the
+ *             divergence of the particle: the neighbors may or may not
+ *             have been updated yet, so their divergence is the one saved
+ *             by save_divergence at the previous step. Their soundspeed is
+ *             either, as in compute_signalspeed.
+ */
+void
+compute_alpha_lagged(body & particle, std::vector<body *> & nbs) {
+  update_alpha<true>(particle, nbs);
+}
+
+/**
+ * @brief      Saves the divergence before the density pass overwrites it,
+ *             for compute_alpha_lagged
+ */
+void
+save_divergence(body & particle) {
+  particle.setDivergenceVLag(particle.getDivergenceV());
+}
+
+/**
+ * @brief      True if the viscosity switch runs in the density pass. The
+ *             first iteration has no previous divergence, and the density
+ *             pass of sph_variable_h sees unconverged neighbor h.
+ */
+inline bool
+lagged_switch() {
+  return param::sph_viscosity == param::visc_cullen and
+         param::sph_viscosity_lagged_switch and
+         physics::iteration > param::initial_iteration and
+         not param::sph_variable_h;
+}
 
 
 #ifdef sph_viscosity
@@ -373,6 +445,10 @@ compute_alpha(body & particle, std::vector<body *> & nbs) {
  * @brief Viscosity selector
  */
 void select() {
+  if(param::sph_viscosity == param::visc_cullen and
+     not body_fields::has(body_fields::cullen))
+    log_fatal("visc_cullen requires the cullen particle fields, "
+              << "add them to BODY_FIELDS" << std::endl);
 #ifndef sph_viscosity
   using namespace param;
   switch(sph_viscosity) {
@@ -0,0 +1,214 @@
+/*~--------------------------------------------------------------------------~*
+ * Copyright (c) 2017 Triad National Security, LLC
+ * All rights reserved.
+ *~--------------------------------------------------------------------------~*/
+
+/*~--------------------------------------------------------------------------~*
+ *
+ * /@@@@@@@@  @@           @@@@@@   @@@@@@@@ @@@@@@@  @@      @@
+ * /@@/////  /@@          @@////@@ @@////// /@@////@@/@@     /@@
+ * /@@       /@@  @@@@@  @@    // /@@       /@@   /@@/@@     /@@
+ * /@@@@@@@  /@@ @@///@@/@@       /@@@@@@@@@/@@@@@@@ /@@@@@@@@@@
+ * /@@////   /@@/@@@@@@@/@@       ////////@@/@@////  /@@//////@@
+ * /@@       /@@/@@//// //@@    @@       /@@/@@      /@@     /@@
+ * /@@       @@@//@@@@@@ //@@@@@@  @@@@@@@@ /@@      /@@     /@@
+ * //       ///  //////   //////  ////////  //       //      //
+ *
+ *~--------------------------------------------------------------------------~*/
+
+/**
+ * @file scratch.h
+ * @brief Per-thread scratch memory for the tree traversals and the physics
+ *        functions.
+ *
+ * Two facilities, both reused from one call to the next, so that no heap
+ * allocation happens once they have grown to the largest neighborhood:
+ *
+ * - scratch::frame hands out aligned arrays from a thread-local bump
+ *   arena, freed all at once when the frame goes out of scope. It
+ *   replaces the arrays sized by the number of neighbors on the stack.
+ * - scratch::vectors<T> leases std::vectors from a thread-local pool.
+ *   They are returned cleared but keep their capacity, and serve as
+ *   neighbor lists and traversal stacks.
+ *
+ * Both are stacks: frames and leases must be released in the reverse
+ * order of their creation, which scoping guarantees.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace scratch {
+
+//- alignment of the arrays, one cache line or one AVX-512 register
+constexpr size_t alignment = 64;
+
+/**
+ * @brief Bump allocator over a list of blocks. When a block is full, the
+ *        allocation moves to the next one, allocated if needed; once
+ *        everything is released, the blocks are merged into one so that
+ *        the next use fits.
+ */
+class arena
+{
+public:
+  struct mark_t {
+    size_t block, offset;
+  };
+
+  arena() = default;
+  arena(const arena &) = delete;
+  arena & operator=(const arena &) = delete;
+
+  void * allocate(size_t bytes) {
+    bytes = (bytes + alignment - 1) / alignment * alignment;
+    while(cur_.block < blocks_.size() and
+          cur_.offset + bytes > blocks_[cur_.block].size) {
+      ++cur_.block;
+      cur_.offset = 0;
+    }
+    if(cur_.block == blocks_.size()) {
+      const size_t last = blocks_.empty() ? 0 : blocks_.back().size;
+      blocks_.push_back(block(std::max({bytes, 2 * last, min_block})));
+    }
+    void * p = blocks_[cur_.block].data.get() + cur_.offset;
+    cur_.offset += bytes;
+    return p;
+  }
+
+  mark_t mark() const {
+    return cur_;
+  }
+
+  void release(const mark_t & m) {
+    cur_ = m;
+    if(cur_.block == 0 and cur_.offset == 0 and blocks_.size() > 1) {
+      size_t total = 0;
+      for(const block & b : blocks_)
+        total += b.size;
+      blocks_.clear();
+      blocks_.push_back(block(total));
+    }
+  }
+
+  //- bytes held by the arena
+  size_t capacity() const {
+    size_t total = 0;
+    for(const block & b : blocks_)
+      total += b.size;
+    return total;
+  }
+
+private:
+  static constexpr size_t min_block = 1 << 16;
+
+  struct aligned_delete {
+    void operator()(char * p) const {
+      ::operator delete[](p, std::align_val_t(alignment));
+    }
+  };
+
+  struct block {
+    explicit block(size_t s)
+      : data(static_cast<char *>(
+               ::operator new[](s, std::align_val_t(alignment)))),
+        size(s) {}
+    std::unique_ptr<char[], aligned_delete> data;
+    size_t size;
+  };
+
+  std::vector<block> blocks_;
+  mark_t cur_ = {0, 0};
+}; // class arena
+
+inline arena &
+thread_arena() {
+  static thread_local arena a;
+  return a;
+}
+
+/**
+ * @brief Scope of scratch arrays: every array obtained from the frame is
+ *        released with it. Typical use, in place of double m_[n_nb]:
+ *
+ *        scratch::frame f;
+ *        double * m_ = f.alloc<double>(n_nb);
+ */
+class frame
+{
+public:
+  frame() : arena_(thread_arena()), mark_(arena_.mark()) {}
+  ~frame() {
+    arena_.release(mark_);
+  }
+  frame(const frame &) = delete;
+  frame & operator=(const frame &) = delete;
+
+  //- uninitialized for trivial types, as the arrays it replaces
+  template<typename T>
+  T * alloc(size_t n) {
+    static_assert(std::is_trivially_destructible<T>::value,
+      "scratch arrays are released without destruction");
+    T * p = static_cast<T *>(arena_.allocate(n * sizeof(T)));
+    std::uninitialized_default_construct_n(p, n);
+    return p;
+  }
+
+private:
+  arena & arena_;
+  arena::mark_t mark_;
+}; // class frame
+
+/**
+ * @brief Lease of n cleared vectors from the thread-local pool of vectors
+ *        of T, returned to the pool with their capacity on destruction
+ */
+template<typename T>
+class vectors
+{
+public:
+  explicit vectors(size_t n = 1)
+    : pool_(pool()), first_(pool_.used), n_(n) {
+    pool_.used += n;
+    if(pool_.vectors.size() < pool_.used)
+      pool_.vectors.resize(pool_.used);
+    for(size_t i = first_; i < pool_.used; ++i)
+      pool_.vectors[i].clear();
+  }
+  ~vectors() {
+    pool_.used = first_;
+  }
+  vectors(const vectors &) = delete;
+  vectors & operator=(const vectors &) = delete;
+
+  std::vector<T> & operator[](size_t i) {
+    return pool_.vectors[first_ + i];
+  }
+  size_t size() const {
+    return n_;
+  }
+
+private:
+  //- a deque, growing it keeps the vectors of the outer leases in place
+  struct pool_t {
+    std::deque<std::vector<T>> vectors;
+    size_t used = 0;
+  };
+
+  static pool_t & pool() {
+    static thread_local pool_t p;
+    return p;
+  }
+
+  pool_t & pool_;
+  size_t first_, n_;
+}; // class vectors
+
+} // namespace scratch
@@ -48,6 +48,11 @@ using key_type_t = uint64_t;
 // using key_type_t = uint128_t;
 #endif
 
+// order of the FMM expansions (see fmm.h)
+#ifndef FMM_ORDER
+#define FMM_ORDER 1
+#endif
+
 namespace flecsi {
 namespace execution {
 void specialization_driver(int argc, char * argv[]);
@@ -66,7 +71,7 @@ public:
   using point_t = flecsi::space_vector_u<element_t, dimension>;
   using geometry_t = flecsi::topology::tree_geometry<element_t, gdimension>;
   using entity_t = body_u<key_t>;
-  using cofm_t = node_u<key_t,1>; 
+  using cofm_t = node_u<key_t, FMM_ORDER>;
 }; // class tree_policy
 
 using tree_topology_t = flecsi::topology::tree_topology<tree_policy>;
@@ -0,0 +1,75 @@
+#include "gtest/gtest.h"
+
+#include <cstdint>
+#include <iostream>
+#include <log.h>
+
+#include "scratch.h"
+
+namespace flecsi {
+namespace execution {
+void
+driver(int, char **) {}
+} // namespace execution
+} // namespace flecsi
+
+// one neighborhood: nested frames and leases, as in a traversal calling a
+// physics function
+size_t
+neighborhood(size_t n_nb) {
+  scratch::vectors<int *> lists(3);
+  for(size_t i = 0; i < n_nb; ++i)
+    lists[i % 3].push_back(nullptr);
+  scratch::frame f;
+  double * a = f.alloc<double>(n_nb);
+  size_t misaligned = reinterpret_cast<std::uintptr_t>(a) % scratch::alignment;
+  {
+    scratch::frame g;
+    for(int k = 0; k < 4; ++k) {
+      double * b = g.alloc<double>(n_nb + k);
+      misaligned += reinterpret_cast<std::uintptr_t>(b) % scratch::alignment;
+      b[n_nb + k - 1] = 1.;
+    }
+  }
+  a[n_nb - 1] = 1.;
+  return misaligned;
+}
+
+TEST(scratch, frames) {
+  scratch::arena & arena = scratch::thread_arena();
+  // growing neighborhoods spill over several blocks, merged on release
+  for(size_t n = 1; n < 100000; n *= 3)
+    EXPECT_EQ(neighborhood(n), 0);
+  const size_t capacity = arena.capacity();
+  std::cout << "arena capacity: " << capacity << " bytes" << std::endl;
+  // then no more growth
+  for(size_t n = 1; n < 100000; n *= 3)
+    neighborhood(n);
+  EXPECT_EQ(arena.capacity(), capacity);
+  EXPECT_EQ(arena.mark().block, 0);
+  EXPECT_EQ(arena.mark().offset, 0);
+}
+
+TEST(scratch, vectors) {
+  const int * data;
+  {
+    scratch::vectors<int> outer;
+    outer[0].assign(1000, 7);
+    data = outer[0].data();
+    std::vector<int> * v = &outer[0];
+    {
+      // growing the pool keeps the outer lease in place
+      scratch::vectors<int> inner(100);
+      for(size_t i = 0; i < inner.size(); ++i)
+        inner[i].push_back(i);
+      EXPECT_EQ(&outer[0], v);
+    }
+    EXPECT_EQ(outer[0].size(), 1000);
+  }
+  // leased again, cleared but with its storage
+  scratch::vectors<int> again;
+  EXPECT_TRUE(again[0].empty());
+  EXPECT_GE(again[0].capacity(), 1000);
+  again[0].push_back(1);
+  EXPECT_EQ(again[0].data(), data);
+}
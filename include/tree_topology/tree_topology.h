@@ -40,6 +40,7 @@
 #include <set>
 #include <stack>
 #include <thread>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 
@@ -47,6 +48,7 @@
 
 #include "log.h"
 
+#include "scratch.h"
 #include "space_vector.h"
 
 //#include "hashtable.h"
@@ -190,17 +192,18 @@ public:
    */
   template<typename FUNC, typename... ARGS>
   void traversal(hcell_t * cell, FUNC && func, ARGS &&... args) {
-    std::stack<hcell_t *> stk;
-    stk.push(cell);
+    scratch::vectors<hcell_t *> lease;
+    std::vector<hcell_t *> & stk = lease[0];
+    stk.push_back(cell);
     while(!stk.empty()) {
-      hcell_t * cur = stk.top();
-      stk.pop();
+      hcell_t * cur = stk.back();
+      stk.pop_back();
       if(func(cur, std::forward<ARGS>(args)...)) {
         hcell_t * daughters[nchildren_] = {nullptr};
         int children = 0;
         daughters_(cur, daughters, children);
         for(int i = 0; i < children; ++i) {
-          stk.push(daughters[i]);
+          stk.push_back(daughters[i]);
         } // for
       } // if
     } // while
@@ -211,6 +214,17 @@ public:
   */
   template<typename EF, typename... ARGS>
   void traversal_sph(EF && ef, ARGS &&... args) {
+    traversal_sph_if([](const entity_t &) { return true; },
+      std::forward<EF>(ef), std::forward<ARGS>(args)...);
+  }
+
+  /**
+   * @brief Apply a function EF to the local entities for which PRED is
+   * true. The neighbors are only searched for the groups of entities
+   * containing at least one of them.
+   */
+  template<typename PRED, typename EF, typename... ARGS>
+  void traversal_sph_if(PRED && pred, EF && ef, ARGS &&... args) {
     log_one(trace) << "Traversal SPH" << std::endl;
     double start = omp_get_wtime();
     int rank, size;
@@ -243,7 +257,6 @@ public:
     request_keys.resize(size);
     std::vector<hcell_t *> * queue = new std::vector<hcell_t *>();
     std::vector<hcell_t *> * new_queue = new std::vector<hcell_t *>();
-    std::vector<std::vector<entity_t *>> neighbors;
     hcell_t* daughters[nchildren_];
     int children;
 
@@ -285,32 +298,44 @@ public:
       bool rank_request = false;
 
       hcell_t * cur = &(htable_.find(curkey)->second);
-      std::vector<entity_t *> cur_entities;
+      // per-thread storage of the group and its neighbor lists, reused
+      // from one cell to the next
+      scratch::vectors<entity_t *> cur_lease;
+      std::vector<entity_t *> & cur_entities = cur_lease[0];
 
       cofm_t * cur_node = nullptr;
 
       if(cur->is_node()) {
-        traversal(
-          cur,
-          [&](hcell_t * cell, std::vector<entity_t *> & ce) {
-            if(cell->is_node()) {
-              return true;
-            }
-            else {
-              if(!cell->is_shared())
-                ce.push_back(get_entity(cell));
-            }
-            return false;
-          },
-          cur_entities); // lambda
+#ifdef _DEBUG_TREE_
+        assert(!cur->is_shared());
+#endif
         cur_node = get_node(cur);
+        for(int k = cur_node->first_entity(); k < cur_node->last_entity(); ++k)
+          if(pred(entities_[k]))
+            cur_entities.push_back(&entities_[k]);
       }
       else {
-        cur_entities.push_back(get_entity(cur));
+        if(pred(*get_entity(cur)))
+          cur_entities.push_back(get_entity(cur));
       } // if
+      if(cur_entities.empty())
+        continue;
+
+      // The box of the node is padded by half the radius of its entities;
+      // pad it to their full radius so that the box test below keeps the
+      // neighbors of entities with a larger radius than their neighbors
+      point_t cur_bmin, cur_bmax;
+      if(cur_node != nullptr) {
+        element_t pad = 0;
+        for(auto * e : cur_entities)
+          pad = std::max(pad, e->radius() / 2.);
+        for(size_t d = 0; d < dimension; ++d) {
+          cur_bmin[d] = cur_node->bmin()[d] - pad;
+          cur_bmax[d] = cur_node->bmax()[d] + pad;
+        }
+      }
 
-      neighbors.clear();
-      neighbors.resize(cur_entities.size());
+      scratch::vectors<entity_t *> neighbors(cur_entities.size());
       queue->clear();
       queue->push_back(root());
 
@@ -325,7 +350,7 @@ public:
             // Check if node concerned
             if(cur_node != nullptr) {
               if(!geometry_t::intersects_box_box(
-                   c->bmin(), c->bmax(), cur_node->bmin(), cur_node->bmax())) {
+                   c->bmin(), c->bmax(), cur_bmin, cur_bmax)) {
                 continue;
               }
             } // if
@@ -441,17 +466,131 @@ public:
                    << std::endl;
   } // traversal_sph
 
+  /**
+   * @brief Send to the other ranks the locally essential tree (LET) of
+   * this one: the local cells that the sinks of their domains may open.
+   * The bounds of the domains (MAC::domain_t, built from the local
+   * entities) are gathered first; a local node is opened for a rank
+   * unless f_mac(domain, node) accepts it for all the sinks of that
+   * domain. The children of the opened nodes are exchanged in one
+   * all-to-all and added to the tree: traversal_fmm then only requests
+   * the cells this estimate missed.
+   */
+  template<typename MAC>
+  void exchange_let(MAC && f_mac) {
+    log_one(trace) << "Exchange LET" << std::endl;
+    double start = omp_get_wtime();
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    if(size == 1)
+      return;
+
+    using domain_t = typename std::decay_t<MAC>::domain_t;
+    std::vector<domain_t> domains(size);
+    const domain_t local(entities_);
+    MPI_Allgather(&local, sizeof(domain_t), MPI_BYTE, domains.data(),
+      sizeof(domain_t), MPI_BYTE, MPI_COMM_WORLD);
+
+    // Local branches: the other ranks got them in share_nodes_
+    std::vector<hcell_t *> branches;
+    traversal(
+      root(),
+      [&](hcell_t * cell, std::vector<hcell_t *> & b) {
+        if(!cell->iam_owner())
+          return false;
+        if(cell->is_shared())
+          return true;
+        if(cell->is_node())
+          b.push_back(cell);
+        return false;
+      } // lambda
+      ,
+      branches);
+
+    // Children of the opened nodes, parents first
+    std::vector<std::vector<share_node_t>> nodes(size);
+    std::vector<std::vector<share_entity_t>> entities(size);
+#pragma omp parallel for schedule(dynamic)
+    for(int r = 0; r < size; ++r) {
+      if(r == rank)
+        continue;
+      hcell_t * daughters[nchildren_];
+      int children;
+      for(hcell_t * branch : branches)
+        traversal(branch, [&](hcell_t * cell) {
+          if(cell->is_entity() || f_mac(&domains[r], get_node(cell)))
+            return false;
+          daughters_(cell, daughters, children);
+          for(int k = 0; k < children; ++k) {
+            if(daughters[k]->is_node())
+              nodes[r].emplace_back(rank, daughters[k]->key(),
+                *get_node(daughters[k]), daughters[k]->nchildren());
+            else
+              entities[r].emplace_back(
+                rank, daughters[k]->key(), *get_entity(daughters[k]));
+          } // for
+          return true;
+        });
+    } // for
+
+    std::vector<share_node_t> recv_nodes;
+    std::vector<share_entity_t> recv_entities;
+    alltoallv_(nodes, recv_nodes);
+    alltoallv_(entities, recv_entities);
+
+    // Add the cells the tree does not have yet, in the order of the
+    // senders' traversals
+    size_t added = 0;
+    for(const share_node_t & n : recv_nodes) {
+      key_t pkey = n.key;
+      pkey.pop();
+      if(htable_.find(n.key) == htable_.end() &&
+         htable_.find(pkey) != htable_.end()) {
+        insert_node_(n);
+        ++added;
+      }
+    } // for
+    for(const share_entity_t & e : recv_entities) {
+      key_t pkey = e.key;
+      pkey.pop();
+      if(htable_.find(e.key) == htable_.end() &&
+         htable_.find(pkey) != htable_.end()) {
+        insert_entity_(e);
+        ++added;
+      }
+    } // for
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    log_one(trace) << std::fixed << std::setprecision(3)
+                   << "Exchange LET.done: " << omp_get_wtime() - start << "s"
+                   << " cells: " << added << std::endl;
+  }
+
   /**
    * @brief Fast Multipole Method Traversal.
    * Perform a tree traversal and update the missing neighbors.
+   * A pair of cells (or a cell and an entity) interacts through the
+   * expansions when f_mac(sink, source) accepts it; a remote node is only
+   * requested when it has to be opened.
+   * The pairs of each level of the traversal are split between the OpenMP
+   * threads, which record the interactions found in their own lists. The
+   * interactions are evaluated once the traversal is done, sorted by sink
+   * then source key: each sink is handled by a single thread and sums its
+   * terms in the same order whatever the number of threads or the arrival
+   * of the remote cells.
    */
-  template<typename C2C, typename P2C, typename P2P, typename C2P>
-  void traversal_fmm(const double MAC,
+  template<typename MAC,
+    typename C2C,
+    typename P2C,
+    typename P2P,
+    typename C2P>
+  void traversal_fmm(MAC && f_mac,
     C2C && t_c2c,
     P2C && t_p2c,
     P2P && f_p2p,
     C2P && f_c2p) {
-    log_one(trace) << "Traversal FMM (" << MAC << ")" << std::endl;
+    log_one(trace) << "Traversal FMM" << std::endl;
     double start = omp_get_wtime();
     int rank, size;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
@@ -463,15 +602,20 @@ public:
     using interaction_t = std::pair<key_t, key_t>;
     std::vector<interaction_t> * queue = new std::vector<interaction_t>();
     std::vector<interaction_t> * new_queue = new std::vector<interaction_t>();
-    std::vector<interaction_t> p2p;
-    std::vector<entity_t *> subs;
-    std::vector<entity_t *> neighbors;
-    hcell_t * daughters[nchildren_];
-    int children;
-    double lost_time;
+    // sink node and source cell (c2c, p2c), sink entity and source node
+    // (m2p), pairs to compute particle by particle (p2p)
+    std::vector<interaction_t> c2c, m2p, p2p;
+
+    // Interactions found by each thread during one level of the traversal
+    struct thread_lists_t {
+      std::vector<interaction_t> queue, c2c, m2p, p2p;
+      std::vector<key_t> empty, subtree;
+    };
+    std::vector<thread_lists_t> lists(omp_get_max_threads());
 
     std::vector<std::vector<key_t>> request_keys;
     request_keys.resize(size);
+    fmm_requested_ = 0;
 
     queue->emplace_back(key_t::root(), key_t::root());
     while(not queue->empty()) {
@@ -479,26 +623,30 @@ public:
       if(size > 1)
         check_comms_();
 
-      bool rank_request = false;
+#pragma omp parallel
+      {
+        thread_lists_t & l = lists[omp_get_thread_num()];
+        hcell_t * daughters[nchildren_];
+        int children;
+        double lost_time;
 
-      new_queue->clear();
-      for(int i = 0; i < queue->size(); ++i) {
+#pragma omp for schedule(static)
+        for(int i = 0; i < queue->size(); ++i) {
 
 #ifdef _DEBUG_TREE_
-        lost_time = omp_get_wtime();
+          lost_time = omp_get_wtime();
 #endif
 
-        key_t khc1 = (*queue)[i].first;
-        key_t khc2 = (*queue)[i].second;
-        hcell_t * hc1 = &(htable_.find(khc1)->second);
-        hcell_t * hc2 = &(htable_.find(khc2)->second);
+          key_t khc1 = (*queue)[i].first;
+          key_t khc2 = (*queue)[i].second;
+          hcell_t * hc1 = &(htable_.find(khc1)->second);
+          hcell_t * hc2 = &(htable_.find(khc2)->second);
 
-        assert(hc1->iam_owner());
+          assert(hc1->iam_owner());
 
-        if(!hc2->is_empty_node()) {
           if(hc1->is_entity() && hc2->is_entity()) {
             // both are entities: append interaction to the p2p list
-            p2p.push_back((*queue)[i]);
+            l.p2p.push_back((*queue)[i]);
           }
           else { // at least one is a node
 
@@ -506,137 +654,116 @@ public:
               // check for the number of subentities
 
               if(get_node(hc1)->sub_entities() < fmm_sub_entities_) {
-                p2p.push_back((*queue)[i]);
+                l.p2p.push_back((*queue)[i]);
               }
               else {
                 // split it for self-interaction
                 daughters_(hc1, daughters, children);
                 for(int k1 = 0; k1 < children; ++k1) {
                   if(daughters[k1]->iam_owner())
-                    new_queue->emplace_back(
+                    l.queue.emplace_back(
                       daughters[k1]->key(), daughters[k1]->key());
                   for(int k2 = k1 + 1; k2 < children; ++k2) {
                     if(daughters[k1]->iam_owner())
-                      new_queue->emplace_back(
+                      l.queue.emplace_back(
                         daughters[k1]->key(), daughters[k2]->key());
                     if(daughters[k2]->iam_owner())
-                      new_queue->emplace_back(
+                      l.queue.emplace_back(
                         daughters[k2]->key(), daughters[k1]->key());
                   }
                 } // for k1
               }
             }
             else { // different nodes
-              point_t coords1 = {};
               element_t radius1 = 0;
               int subent1 = 1;
               if(hc1->is_node()) {
                 cofm_t * n = get_node(hc1);
-                coords1 = n->coordinates();
                 radius1 = n->radius();
                 subent1 = n->sub_entities();
               }
-              else {
-                entity_t * e = get_entity(hc1);
-                coords1 = e->coordinates();
-              }
 
-              point_t coords2 = {};
               element_t radius2 = 0;
               int subent2 = 1;
               if(hc2->is_node()) {
                 cofm_t * n = get_node(hc2);
-                coords2 = n->coordinates();
                 radius2 = n->radius();
                 subent2 = n->sub_entities();
               }
-              else {
-                entity_t * e = get_entity(hc2);
-                coords2 = e->coordinates();
-              }
 
-              if(geometry_t::mac(coords1, radius1, coords2, radius2, MAC)) {
+              bool accepted;
+              if(hc1->is_node())
+                accepted = hc2->is_node()
+                             ? f_mac(get_node(hc1), get_node(hc2))
+                             : f_mac(get_node(hc1), get_entity(hc2));
+              else
+                accepted = f_mac(get_entity(hc1), get_node(hc2));
+              if(accepted) {
                 assert(hc1->is_node() or hc2->is_node());
                 if(hc1->is_node()) {
-                  cofm_t * n1 = get_node(hc1);
-                  if(hc2->is_node()) {
-                    t_c2c(n1, get_node(hc2));
-                  }
-                  else {
-                    entity_t * e = get_entity(hc2);
-                    t_p2c(n1, e);
-                  }
-                  // save this node for later c2c interactions
-                  n1->set_affected(true);
+                  l.c2c.push_back((*queue)[i]);
                 }
                 else { // hc1 is an entity
-                  neighbors.clear();
-                  subs.clear();
-                  subs.push_back(get_entity(hc1));
-                  f_p2p(subs, get_node(hc2), neighbors);
+                  l.m2p.push_back((*queue)[i]);
                 }
               }
               else { // nodes do not satisfy MAC
                 if(subent1 + subent2 < fmm_sub_entities_) {
                   // if not enough subentities, give up with splitting
-                  p2p.push_back((*queue)[i]);
-                  std::vector<std::vector<key_t>> request_keys_subtree(size);
-                  bool rqst_subtree = false;
-                  if(hc2->is_shared()) {
-                    traversal(
-                      hc2,
-                      [&](
-                        hcell_t * cell, std::vector<std::vector<key_t>> & nk) {
-                        if((cell->is_node() && !cell->is_shared()) ||
-                           cell->is_entity()) {
-                          return false;
-                        }
-                        // if(cell->is_node() && cell->is_shared()){
-                        //  return true;
-                        //}
-                        if(cell->is_empty_node() && !cell->requested()) {
-                          rqst_subtree = true;
-                          assert(cell->owner() != rank);
-                          cell->set_requested();
-                          nk[cell->owner()].push_back(cell->key());
-                          return false;
-                        }
-                        return true;
-                      } // lambda
-                      ,
-                      request_keys_subtree);
-                  }
-                  // Send request
-                  if(rqst_subtree)
-                    request_(request_keys_subtree, REQUEST_SUBTREE);
+                  l.p2p.push_back((*queue)[i]);
                   // Retrieve the non local particles of this sub-tree
+                  if(hc2->is_shared())
+                    l.subtree.push_back(hc2->key());
                 }
                 else {
                   if(radius1 > radius2) { // split the bigger node
                     // node that if one of the cells is an entity, then its
-                    // radius will be zero; the other one must be the node with
-                    // nonzero radius
+                    // radius will be zero; the other one must be the node
+                    // with nonzero radius
                     daughters_(hc1, daughters, children);
                     for(int k = 0; k < children; ++k) {
                       if(daughters[k]->iam_owner()) {
-                        new_queue->emplace_back(
+                        l.queue.emplace_back(
                           daughters[k]->key(), hc2->key());
                       }
                     }
                   }
+                  else if(hc2->is_empty_node()) {
+                    // Node to open is empty: retrieve it if needed and try
+                    // again later
+                    l.empty.push_back(hc2->key());
+                    l.queue.emplace_back(hc1->key(), hc2->key());
+#ifdef _DEBUG_TREE_
+#pragma omp atomic
+                    lost_timer_ += omp_get_wtime() - lost_time;
+#endif
+                  }
                   else {
                     daughters_(hc2, daughters, children);
                     for(int k = 0; k < children; ++k) {
-                      new_queue->emplace_back(hc1->key(), daughters[k]->key());
+                      l.queue.emplace_back(hc1->key(), daughters[k]->key());
                     }
                   }
                 } // if enough subentities for splitting
               } // if not MAC
             } // if different nodes
           } // if at least one is a node
-        }
-        else {
-          // Check if node is empty and retrieve if needed
+        } // loop over the queue
+      } // omp parallel
+
+      // Gather the lists of the threads, in the order of the queue, and
+      // send the requests for the missing cells
+      bool rank_request = false;
+      std::vector<std::vector<key_t>> request_keys_subtree(size);
+      bool rqst_subtree = false;
+      new_queue->clear();
+      for(thread_lists_t & l : lists) {
+        new_queue->insert(new_queue->end(), l.queue.begin(), l.queue.end());
+        c2c.insert(c2c.end(), l.c2c.begin(), l.c2c.end());
+        m2p.insert(m2p.end(), l.m2p.begin(), l.m2p.end());
+        p2p.insert(p2p.end(), l.p2p.begin(), l.p2p.end());
+        for(const key_t & k : l.empty) {
+          hcell_t * hc2 = &(htable_.find(k)->second);
           if(!hc2->requested()) {
 #ifdef _DEBUG_TREE_
             assert(hc2->owner() != rank);
@@ -644,13 +771,39 @@ public:
             hc2->set_requested();
             request_keys[hc2->owner()].push_back(hc2->key());
             rank_request = true;
+            ++fmm_requested_;
           }
-          new_queue->emplace_back(hc1->key(), hc2->key());
-#ifdef _DEBUG_TREE_
-          lost_timer_ += omp_get_wtime() - lost_time;
-#endif
-        } // if
-      } // loop over the queue
+        } // for
+        for(const key_t & k : l.subtree) {
+          traversal(
+            &(htable_.find(k)->second),
+            [&](hcell_t * cell, std::vector<std::vector<key_t>> & nk) {
+              if((cell->is_node() && !cell->is_shared()) ||
+                 cell->is_entity()) {
+                return false;
+              }
+              if(cell->is_empty_node() && !cell->requested()) {
+                rqst_subtree = true;
+                assert(cell->owner() != rank);
+                cell->set_requested();
+                nk[cell->owner()].push_back(cell->key());
+                ++fmm_requested_;
+                return false;
+              }
+              return true;
+            } // lambda
+            ,
+            request_keys_subtree);
+        } // for
+        l.queue.clear();
+        l.c2c.clear();
+        l.m2p.clear();
+        l.p2p.clear();
+        l.empty.clear();
+        l.subtree.clear();
+      } // for threads
+      if(rqst_subtree)
+        request_(request_keys_subtree, REQUEST_SUBTREE);
       if(rank_request) {
         request_(request_keys);
         for(int k = 0; k < request_keys.size(); ++k) {
@@ -677,102 +830,117 @@ public:
       MPI_Waitall(size, &done_requests[0], &done_status[0]);
     }
 
+    fmm_interactions_ = {c2c.size(), m2p.size(), p2p.size()};
+
+    // Sort the interactions by sink and source; the range of one sink is
+    // then evaluated by a single thread
+    auto by_sink = [](std::vector<interaction_t> & v) {
+      std::sort(v.begin(), v.end());
+      std::vector<size_t> bounds;
+      for(size_t i = 0; i < v.size(); ++i)
+        if(i == 0 || !(v[i].first == v[i - 1].first))
+          bounds.push_back(i);
+      bounds.push_back(v.size());
+      return bounds;
+    };
+
+    // node-node and particle-node interactions: Taylor expansions
+    std::vector<size_t> bounds = by_sink(c2c);
+#pragma omp parallel for schedule(dynamic)
+    for(size_t g = 0; g < bounds.size() - 1; ++g) {
+      cofm_t * n1 = get_node(&(htable_.find(c2c[bounds[g]].first)->second));
+      for(size_t i = bounds[g]; i < bounds[g + 1]; ++i) {
+        hcell_t * hc2 = &(htable_.find(c2c[i].second)->second);
+        if(hc2->is_node()) {
+          t_c2c(n1, get_node(hc2));
+        }
+        else {
+          t_p2c(n1, get_entity(hc2));
+        }
+      }
+      // save this node for later c2p interactions
+      n1->set_affected(true);
+    }
 
-    // node-node interaction
-    std::vector<hcell_t *> affected_nodes;
+    // node-particle interactions
+    bounds = by_sink(m2p);
+#pragma omp parallel
+    {
+      std::vector<entity_t *> subs(1), neighbors;
+#pragma omp for schedule(dynamic)
+      for(size_t g = 0; g < bounds.size() - 1; ++g) {
+        subs[0] = get_entity(&(htable_.find(m2p[bounds[g]].first)->second));
+        for(size_t i = bounds[g]; i < bounds[g + 1]; ++i)
+          f_p2p(subs, get_node(&(htable_.find(m2p[i].second)->second)),
+            neighbors);
+      }
+    }
+
+    // Taylor expansions of the affected nodes to their local entities. The
+    // nodes are sorted by first entity, parents before their daughters; the
+    // entities are split between the threads, each one applying the nodes
+    // to its part of their range, from the root down to the entity
+    std::vector<cofm_t *> affected_nodes;
     traversal(
       root(),
-      [&](hcell_t * cell, std::vector<hcell_t *> & hc) {
+      [&](hcell_t * cell, std::vector<cofm_t *> & an) {
         if(!cell->iam_owner()) {
           return false; // do not expand others' nodes
         }
         if(cell->is_node() && get_node(cell)->affected()) {
-          hc.push_back(cell);
+          an.push_back(get_node(cell));
         }
         return true;
       } // lambda
       ,
       affected_nodes);
-
-    neighbors.clear();
-    for(int i = 0; i < affected_nodes.size(); ++i) {
-      hcell_t * hc = affected_nodes[i];
-      subs.clear();
-
-      // Find all sub entities
-      traversal(
-        hc,
-        [&](hcell_t * cell, std::vector<entity_t *> & e) {
-          if(cell->is_node()) {
-            return true;
-          }
-          if(cell->is_entity() && !cell->is_shared()) {
-            e.push_back(get_entity(cell));
-          }
-          return false;
-        } // lambda
-        ,
-        subs);
-
-      f_c2p(get_node(hc), subs);
+    std::stable_sort(affected_nodes.begin(), affected_nodes.end(),
+      [](const cofm_t * a, const cofm_t * b) {
+        return a->first_entity() < b->first_entity();
+      });
+#pragma omp parallel
+    {
+      const int nentities = entities_.size();
+      const int thread = omp_get_thread_num(), nthreads = omp_get_num_threads();
+      const int begin = static_cast<long>(nentities) * thread / nthreads;
+      const int end = static_cast<long>(nentities) * (thread + 1) / nthreads;
+      for(cofm_t * n : affected_nodes) {
+        const int first = std::max(n->first_entity(), begin);
+        const int last = std::min(n->last_entity(), end);
+        if(first < last)
+          f_c2p(n, entities_.data() + first, entities_.data() + last);
+      } // for
     }
 
-    for(int i = 0; i < p2p.size(); ++i) {
-      hcell_t * hc1 = &(htable_.find(p2p[i].first)->second);
-      hcell_t * hc2 = &(htable_.find(p2p[i].second)->second);
-
-      // subentities of hc1
-      std::vector<entity_t *> subs;
-      if(hc1->is_node()) {
-        traversal(
-          hc1,
-          [&](hcell_t * cell, std::vector<entity_t *> & e) {
-            if(cell->is_node()) {
-              return true;
-            }
-            if(cell->is_entity() && !cell->is_shared()) {
-              e.push_back(get_entity(cell));
-            }
-            return false;
-          } // lambda
-          ,
-          subs);
-      }
-      else {
-        subs.push_back(get_entity(hc1));
-      }
-
-      // use 'neighbors' vector to store subentities of hc2
-      neighbors.clear();
-      if(hc2->is_node()) {
-        traversal(
-          hc2,
-          [&](hcell_t * cell, std::vector<entity_t *> & e) {
-            if(cell->is_node()) {
-              return true;
+    // particle-particle interactions: the sources of one entity are
+    // gathered in a single call
+    bounds = by_sink(p2p);
+#pragma omp parallel
+    {
+      std::vector<entity_t *> subs(1), neighbors;
+#pragma omp for schedule(dynamic)
+      for(size_t g = 0; g < bounds.size() - 1; ++g) {
+        hcell_t * hc1 = &(htable_.find(p2p[bounds[g]].first)->second);
+        assert(hc1->is_entity());
+        subs[0] = get_entity(hc1);
+        neighbors.clear();
+        for(size_t i = bounds[g]; i < bounds[g + 1]; ++i) {
+          hcell_t * hc2 = &(htable_.find(p2p[i].second)->second);
+          // use 'neighbors' vector to store the local subentities of hc2
+          if(hc2->is_node()) {
+            if(hc2->iam_owner()) {
+              cofm_t * n2 = get_node(hc2);
+              for(int k = n2->first_entity(); k < n2->last_entity(); ++k)
+                neighbors.push_back(&entities_[k]);
             }
-            if(cell->is_entity() && !cell->is_shared()) {
-              e.push_back(get_entity(cell));
-            }
-            return false;
-          } // lambda
-          ,
-          neighbors);
-      }
-      else {
-        neighbors.push_back(get_entity(hc2));
-      }
-
-      if(hc1->is_node()) {
-        f_c2p(get_node(hc1), subs);
-      }
-      else {
-        subs.clear();
-        subs.push_back(get_entity(hc1));
+          }
+          else {
+            neighbors.push_back(get_entity(hc2));
+          }
+        } // for
         f_p2p(subs, nullptr, neighbors);
-      }
-
-    } // for p2p interactions
+      } // for p2p interactions
+    }
 
     clean_comms_();
 
@@ -785,6 +953,10 @@ public:
     double tree_timer = omp_get_wtime() - start;
     log_one(trace) << std::fixed << std::setprecision(3)
                    << "Traversal FMM.done: " << tree_timer << "s"
+                   << " interactions c2c: " << fmm_interactions_[0]
+                   << " m2p: " << fmm_interactions_[1]
+                   << " p2p: " << fmm_interactions_[2]
+                   << " requested: " << fmm_requested_
 #ifdef _DEBUG_TREE_
                    << " comms_: " << comms_timer_ << "s ("
                    << comms_timer_ * 100 / tree_timer << "%) "
@@ -794,6 +966,21 @@ public:
                    << std::endl;
   }
 
+  /**
+   * @brief Local number of interactions of the last FMM traversal: cell or
+   * entity on cell (c2c, p2c), cell on entity (m2p), entity on entity (p2p)
+   */
+  const std::array<size_t, 3> & fmm_interactions() const {
+    return fmm_interactions_;
+  }
+
+  /**
+   * @brief Number of remote cells requested during the last FMM traversal
+   */
+  size_t fmm_requested() const {
+    return fmm_requested_;
+  }
+
   /**
    * @brief return a vector of entities in the specified spheroid
    */
@@ -1476,22 +1663,29 @@ private:
       MPI_COMM_WORLD, MPI_STATUS_IGNORE);
 
     for(int i = 0; i < recv_entities.size(); ++i) {
-      key_t pkey = recv_entities[i].key;
-      pkey.pop();
-      auto parent = htable_.find(pkey);
-      shared_entities_.push_back(recv_entities[i].entity);
+      insert_entity_(recv_entities[i]);
+    } // for
+  }
+
+  /**
+   * @brief Add an entity received from another rank below its parent
+   */
+  void insert_entity_(const share_entity_t & e) {
+    key_t pkey = e.key;
+    pkey.pop();
+    auto parent = htable_.find(pkey);
+    shared_entities_.push_back(e.entity);
 #ifdef _DEBUG_TREE_
-      assert(htable_.find(recv_entities[i].key) == htable_.end());
+    assert(htable_.find(e.key) == htable_.end());
 #endif
-      htable_.emplace(recv_entities[i].key,
-        hcell_t(recv_entities[i].key, shared_entities_.size() - 1));
-      auto it = htable_.find(recv_entities[i].key);
-      it->second.set_shared();
-      it->second.set_owner(recv_entities[i].owner);
-      // Change parent
-      int child = recv_entities[i].key.last_value();
-      parent->second.add_child(child);
-    } // for
+    htable_.emplace(e.key, hcell_t(e.key, shared_entities_.size() - 1));
+    auto it = htable_.find(e.key);
+    it->second.set_shared();
+    it->second.set_owner(e.owner);
+    // Change parent
+    key_t ckey = e.key;
+    int child = ckey.last_value();
+    parent->second.add_child(child);
   }
 
   /**
@@ -1507,30 +1701,7 @@ private:
     MPI_Recv(&recv_nodes[0], nrecv, MPI_BYTE, partner, REPLY_NODE,
       MPI_COMM_WORLD, MPI_STATUS_IGNORE);
     for(int i = 0; i < nnodes; ++i) {
-      key_t pkey = recv_nodes[i].key;
-      pkey.pop();
-      auto parent = htable_.find(pkey);
-#ifdef _DEBUG_TREE_
-      assert(parent != htable_.end());
-#endif
-      shared_nodes_.push_back(recv_nodes[i].node);
-#ifdef _DEBUG_TREE_
-      assert(htable_.find(recv_nodes[i].key) == htable_.end());
-#endif
-      htable_.emplace(recv_nodes[i].key, recv_nodes[i].key);
-      auto it = htable_.find(recv_nodes[i].key);
-      it->second.set_shared();
-      it->second.set_node_idx(shared_nodes_.size() - 1);
-      it->second.set_owner(recv_nodes[i].owner);
-      it->second.set_nchildren_to_receive(recv_nodes[i].nchildren);
-      // Change parent
-      int child = recv_nodes[i].key.last_value();
-#ifdef _DEBUG_TREE_
-      key_t ckey = recv_nodes[i].key;
-      ckey.pop();
-      assert(parent->first == ckey);
-#endif
-      parent->second.add_child(child);
+      insert_node_(recv_nodes[i]);
     } // for
     // Do we need to clean a node after being requested
     // since it should never be requested again.
@@ -1541,6 +1712,61 @@ private:
     //  parent->second.unset_requested();
   }
 
+  /**
+   * @brief Add a node received from another rank below its parent; it
+   * stays empty until its nchildren are received
+   */
+  void insert_node_(const share_node_t & n) {
+    key_t pkey = n.key;
+    pkey.pop();
+    auto parent = htable_.find(pkey);
+#ifdef _DEBUG_TREE_
+    assert(parent != htable_.end());
+#endif
+    shared_nodes_.push_back(n.node);
+#ifdef _DEBUG_TREE_
+    assert(htable_.find(n.key) == htable_.end());
+#endif
+    htable_.emplace(n.key, n.key);
+    auto it = htable_.find(n.key);
+    it->second.set_shared();
+    it->second.set_node_idx(shared_nodes_.size() - 1);
+    it->second.set_owner(n.owner);
+    it->second.set_nchildren_to_receive(n.nchildren);
+    // Change parent
+    key_t ckey = n.key;
+    int child = ckey.last_value();
+    parent->second.add_child(child);
+  }
+
+  /**
+   * @brief Send send[r] to each rank r and receive the cells sent to this
+   * one, in the order of the ranks, in one all-to-all
+   */
+  template<typename T>
+  void alltoallv_(const std::vector<std::vector<T>> & send,
+    std::vector<T> & recv) {
+    int size;
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    std::vector<int> scount(size), sdispl(size, 0), rcount(size),
+      rdispl(size, 0);
+    for(int r = 0; r < size; ++r)
+      scount[r] = send[r].size() * sizeof(T);
+    MPI_Alltoall(
+      scount.data(), 1, MPI_INT, rcount.data(), 1, MPI_INT, MPI_COMM_WORLD);
+    for(int r = 1; r < size; ++r) {
+      sdispl[r] = sdispl[r - 1] + scount[r - 1];
+      rdispl[r] = rdispl[r - 1] + rcount[r - 1];
+    }
+    std::vector<T> buffer((sdispl.back() + scount.back()) / sizeof(T));
+    for(int r = 0; r < size; ++r)
+      std::copy(send[r].begin(), send[r].end(),
+        buffer.begin() + sdispl[r] / sizeof(T));
+    recv.resize((rdispl.back() + rcount.back()) / sizeof(T));
+    MPI_Alltoallv(buffer.data(), scount.data(), sdispl.data(), MPI_BYTE,
+      recv.data(), rcount.data(), rdispl.data(), MPI_BYTE, MPI_COMM_WORLD);
+  }
+
   /**
    * @brief Share the entities/nodes with neighbors
    * Find the branches that are not allocated yet, hey are on the limit
@@ -1951,12 +2177,24 @@ private:
     CCOFM && f_ce) {
     std::vector<entity_t *> v_entities;
     std::vector<cofm_t *> v_nodes;
+    // The local entities are sorted by key: the ones below this node are
+    // the union of the ranges of its local daughters
+    int first = entities_.size(), last = 0;
     for(size_t i = 0; i < daughters.size(); ++i) {
       if(daughters[i]->is_entity()) {
         v_entities.push_back(get_entity(daughters[i]));
+        if(!daughters[i]->is_shared()) {
+          first = std::min(first, daughters[i]->entity_idx());
+          last = std::max(last, daughters[i]->entity_idx() + 1);
+        }
       }
       else if(daughters[i]->is_node()) {
         v_nodes.push_back(get_node(daughters[i]));
+        if(daughters[i]->iam_owner() && v_nodes.back()->first_entity() <
+                                          v_nodes.back()->last_entity()) {
+          first = std::min(first, v_nodes.back()->first_entity());
+          last = std::max(last, v_nodes.back()->last_entity());
+        }
       }
 #ifdef _DEBUG_TREE_
       else {
@@ -1964,6 +2202,10 @@ private:
       }
 #endif
     } // for
+    if(first < last)
+      cofm->set_entity_range(first, last);
+    else
+      cofm->set_entity_range(0, 0);
     // Compute center of mass values
     f_ce(cofm, v_entities, v_nodes);
   }
@@ -2120,6 +2362,8 @@ private:
   // Traversal
   const int sub_entities_ = 128;
   const int fmm_sub_entities_ = 0;
+  std::array<size_t, 3> fmm_interactions_ = {};
+  size_t fmm_requested_ = 0;
 };
 
 } // namespace topology
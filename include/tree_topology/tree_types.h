@@ -60,6 +60,7 @@ public:
     coordinates_ = point_t{};
     mass_ = 0.;
     sub_entities_ = 0;
+    first_entity_ = last_entity_ = 0;
     radius_ = 0.;
   };
 
@@ -67,6 +68,7 @@ public:
     coordinates_ = point_t{};
     mass_ = 0.;
     sub_entities_ = 0;
+    first_entity_ = last_entity_ = 0;
     radius_ = 0.;
     bmin_ = point_t{};
     bmax_ = point_t{};
@@ -77,6 +79,8 @@ public:
     mass_ = c.mass();
     radius_ = c.radius();
     sub_entities_ = c.sub_entities();
+    first_entity_ = c.first_entity();
+    last_entity_ = c.last_entity();
     lap_ = c.lap();
     key_ = c.key();
     bmin_ = c.bmin();
@@ -95,6 +99,14 @@ public:
   int sub_entities() const {
     return sub_entities_;
   }
+  //! Local entities of the node: [first_entity, last_entity) in the
+  //! entities of the tree, only set for the nodes built by this rank
+  int first_entity() const {
+    return first_entity_;
+  }
+  int last_entity() const {
+    return last_entity_;
+  }
   element_t lap() const {
     return lap_;
   }
@@ -120,6 +132,10 @@ public:
   void set_sub_entities(const int & sub_entities) {
     sub_entities_ = sub_entities;
   }
+  void set_entity_range(const int & first, const int & last) {
+    first_entity_ = first;
+    last_entity_ = last;
+  }
   void set_lap(const element_t & lap) {
     lap_ = lap;
   }
@@ -136,6 +152,7 @@ protected:
   element_t radius_;
   point_t bmin_, bmax_;
   int sub_entities_;
+  int first_entity_, last_entity_;
   element_t lap_;
   key_t key_;
 }; // class cofm
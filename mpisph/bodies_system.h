@@ -12,15 +12,21 @@
 
 #pragma once
 
+#include "direct.h"
 #include "fmm.h"
 #include "io.h"
+#include "pair_cache.h"
 #include "params.h"
+#include "pm.h"
+#include "scratch.h"
+#include "sph_pass.h"
 #include "utils.h"
 
 #include <fstream>
 #include <iostream>
 #include <omp.h>
 #include <typeinfo>
+#include <unordered_map>
 
 #include "psort.h"
 
@@ -71,6 +77,17 @@ public:
     macangle_ = macangle;
   };
 
+  /**
+   * @brief      Sets whether the range of the tree is padded by the
+   *             smoothing lengths, which the neighbor searches need. A
+   *             gravity-only run builds the tree on the positions alone.
+   *
+   * @param[in]  padding  Pad the range by the smoothing lengths
+   */
+  void setRangePadding(bool padding) {
+    range_padding_ = padding;
+  };
+
   /**
    * @brief      Read the bodies from H5part file Compute also the total to
    *             check for mass lost
@@ -221,10 +238,22 @@ public:
     assert(max - min <= 1);
 #endif // DEBUG_TREE
 
+    // The ghosts carry their owner, to return them the sums of the
+    // symmetric passes
+    for(auto & b : tree_.entities())
+      b.set_owner(rank);
+
     tree_.build_tree(physics::compute_cofm);
     log_one(trace) << "#particles: " << totalnbodies_ << std::endl;
 
     localnbodies_ = tree_.entities().size();
+    // the particles have moved, and may have changed rank
+    if(param::sph_pair_cache)
+      log_one(trace) << "Pair cache: " << physics::pair_geometry.hits()
+                     << " hits, " << physics::pair_geometry.misses()
+                     << " misses, " << physics::pair_geometry.bytes() / 1024
+                     << " kB" << std::endl;
+    physics::pair_geometry.reset(tree_.entities().data(), localnbodies_);
     log_one(trace) << tree_ << std::endl;
   }
 
@@ -241,11 +270,12 @@ public:
     lrange[0] = bodies.back().coordinates();
 
     for(size_t i = 0; i < bodies.size(); ++i) {
+      const double pad = range_padding_ ? bodies[i].radius() : 0.;
       for(size_t d = 0; d < gdimension; ++d) {
-        if(bodies[i].coordinates()[d] + bodies[i].radius() > lrange[1][d])
-          lrange[1][d] = bodies[i].coordinates()[d] + bodies[i].radius();
-        if(bodies[i].coordinates()[d] - bodies[i].radius() < lrange[0][d])
-          lrange[0][d] = bodies[i].coordinates()[d] - bodies[i].radius();
+        if(bodies[i].coordinates()[d] + pad > lrange[1][d])
+          lrange[1][d] = bodies[i].coordinates()[d] + pad;
+        if(bodies[i].coordinates()[d] - pad < lrange[0][d])
+          lrange[0][d] = bodies[i].coordinates()[d] - pad;
       } // for
     } // for
 
@@ -274,19 +304,126 @@ public:
     tree_.reset_ghosts(physics::compute_cofm);
   }
 
+  /**
+   * @brief      Compute the gravitation with the solver set by
+   *             gravity_solver
+   */
+  void gravitation() {
+    if(param::gravity_solver == param::solver_direct)
+      gravitation_direct();
+    else
+      gravitation_fmm();
+  }
+
+  /**
+   * @brief      Compute the gravitation by direct summation over all the
+   *             particles (see direct.h)
+   */
+  void gravitation_direct() {
+    far_age_ = -1;
+    direct::gravitation(tree_.entities());
+    for(body & b : tree_.entities())
+      fmm::save_acceleration(b);
+  }
+
   /**
    * @brief      Compute the gravition interction between all the particles
    * @details    The function is based on Fast Multipole Method. The functions
-   *             are defined in the file tree_fmm.h
+   *             are defined in the file fmm.h; the cells are accepted by
+   *             the criterion fmm_mac, which keeps the accelerations for
+   *             the relative criterion of the next call. With fmm_let, the
+   *             remote cells are exchanged before the traversal. With
+   *             pm_grid, the mesh (pm.h) adds the long-range part and the
+   *             tree only the short-range one. Otherwise, with
+   *             gravity_far_interval, the long-range part of the same split
+   *             is kept in the far field of the particles, refreshed every
+   *             interval or when its change reaches gravity_far_tolerance,
+   *             and only the short-range part is computed in between.
+   *             The solvers add up their parts: the acceleration and the
+   *             potential of the particles are zeroed first.
    */
   void gravitation_fmm() {
     assert (gdimension == 3);
     if constexpr (gdimension == 3) {
       using namespace fmm;
-      tree_.traversal_fmm(macangle_, taylor_c2c, taylor_p2c, fmm_p2p, fmm_c2p);
+      for(body & b : tree_.entities()) {
+        b.setGAcceleration(0.0);
+        b.setGPotential(0.0);
+      }
+      if(param::pm_grid > 0 or not subcycle_gravity())
+        far_age_ = -1; // subcycling starts again from a refresh
+      if(param::pm_grid > 0) {
+        mesh_.solve(tree_.entities());
+        const mac_criterion mac(macangle_, mesh_.split());
+        const short_range sr(mesh_.split());
+        if(param::fmm_let)
+          tree_.exchange_let(mac);
+        tree_.traversal_fmm(mac, sr, sr, sr, fmm_c2p);
+      }
+      else if(subcycle_gravity()) {
+        far_refreshed_ = refresh_far_field();
+        if(far_refreshed_) {
+          far_split_ = 0.;
+          for(body & b : tree_.entities())
+            far_split_ = std::max(far_split_, b.radius());
+          MPI_Allreduce(
+            MPI_IN_PLACE, &far_split_, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+          far_split_ *= param::gravity_far_split;
+        }
+        const mac_criterion mac(macangle_, far_split_, far_refreshed_);
+        if(param::fmm_let)
+          tree_.exchange_let(mac);
+        if(far_refreshed_) {
+          for(body & b : tree_.entities())
+            reset_far_field(b);
+          const far_field ff(far_split_);
+          tree_.traversal_fmm(mac, ff, ff, ff, ff);
+          far_age_ = 0;
+        }
+        else {
+          const short_range sr(far_split_);
+          tree_.traversal_fmm(mac, sr, sr, sr, fmm_c2p);
+        }
+        ++far_age_;
+        for(body & b : tree_.entities())
+          add_far_field(b);
+      }
+      else {
+        const mac_criterion mac(macangle_);
+        if(param::fmm_let)
+          tree_.exchange_let(mac);
+        tree_.traversal_fmm(mac, taylor_c2c, taylor_p2c, fmm_p2p, fmm_c2p);
+      }
+      for(body & b : tree_.entities())
+        save_acceleration(b);
     }
   }
 
+  /**
+   * @brief      Local number of interactions of the last call to
+   *             gravitation_fmm: on cells (c2c, p2c), cells on particles
+   *             and particles on particles
+   */
+  const std::array<size_t, 3> & getFMMInteractions() const {
+    return tree_.fmm_interactions();
+  }
+
+  /**
+   * @brief      Number of remote cells requested during the last call to
+   *             gravitation_fmm
+   */
+  size_t getFMMRequested() const {
+    return tree_.fmm_requested();
+  }
+
+  /**
+   * @brief      True if the last call to gravitation_fmm recomputed the far
+   *             field (see gravity_far_interval)
+   */
+  bool getGravityFarRefreshed() const {
+    return far_refreshed_;
+  }
+
   /**
    * @brief      Apply the function EF with ARGS in the smoothing length of all
    *             the lcoal particles. This function need a previous call to
@@ -303,7 +440,111 @@ public:
    */
   template<typename EF, typename... ARGS>
   void apply_in_smoothinglength(EF && ef, ARGS &&... args) {
-    tree_.traversal_sph(ef, std::forward<ARGS>(args)...);
+    if(active_ == nullptr)
+      tree_.traversal_sph(ef, std::forward<ARGS>(args)...);
+    else
+      tree_.traversal_sph_if(active_, ef, std::forward<ARGS>(args)...);
+  }
+
+  /**
+   * @brief      Apply a function which solves for the smoothing length of
+   *             each local particle, e.g.
+   *             physics::compute_density_smoothinglength_pressure_soundspeed.
+   *             The candidate neighbors are searched once within
+   *             factor * h; the function gets the search radius as the
+   *             radius of the particle and sets the new h. The particles
+   *             whose new h exceeds their search radius are searched again
+   *             with a larger one, alone.
+   *
+   * @param[in]  ef      The function to apply in the search radius
+   * @param[in]  factor  Ratio of the search radius to h, > 1
+   */
+  template<typename EF>
+  void apply_in_search_radius(EF && ef, const double factor) {
+    std::vector<body> & local = tree_.entities();
+    body * const first = local.data();
+    std::vector<double> search(local.size());
+    std::vector<char> query(local.size());
+    for(size_t i = 0; i < local.size(); ++i)
+      query[i] = active_ == nullptr || active_(local[i]);
+
+    int64_t nquery = 1;
+    for(int round = 0; nquery > 0; ++round) {
+      for(size_t i = 0; i < local.size(); ++i)
+        if(query[i]) {
+          search[i] = factor * local[i].radius();
+          local[i].set_radius(search[i]);
+        }
+      // the tree bounds the nodes with the search radii
+      reset_ghosts();
+      tree_.traversal_sph_if(
+        [&](const body & b) { return query[&b - first]; }, ef);
+
+      nquery = 0;
+      for(size_t i = 0; i < local.size(); ++i) {
+        query[i] = query[i] && local[i].radius() > search[i];
+        nquery += query[i];
+      }
+      MPI_Allreduce(
+        MPI_IN_PLACE, &nquery, 1, MPI_INT64_T, MPI_SUM, MPI_COMM_WORLD);
+      if(nquery > 0)
+        log_one(trace) << "search radius, round " << round << ": " << nquery
+                       << " particles outgrew it" << std::endl;
+    }
+    // the ghosts get the new smoothing lengths
+    reset_ghosts();
+  }
+
+  /**
+   * @brief      Restrict apply_all and the functions applied in the
+   *             smoothing length to the local particles for which active
+   *             is true, e.g. physics::ends_step with block timesteps.
+   *             The other particles are still neighbors.
+   *
+   * @param[in]  active  The predicate, nullptr for all the particles
+   */
+  void set_active(bool (*active)(const body &)) {
+    active_ = active;
+  }
+
+  /**
+   * @brief      Apply several functions in the smoothing length of all the
+   *             local particles, with as few tree traversals as their data
+   *             dependencies allow (see sph_pass.h). Consecutive passes
+   *             share a traversal and a neighbor list; when a pass reads
+   *             from the neighbors a field that an earlier one writes, a
+   *             new traversal starts after reset_ghosts().
+   *
+   * @param[in]  passes  The passes, in the order they must be applied
+   */
+  void apply_in_smoothinglength_fused(
+    const std::vector<physics::sph_pass> & passes) {
+    const auto groups = physics::fuse(passes);
+    for(size_t g = 0; g < groups.size(); ++g) {
+      if(g > 0)
+        reset_ghosts();
+      // a pair owned by an inactive particle would be missed: the
+      // restricted passes gather
+      std::vector<physics::sph_pass> gather, symmetric;
+      for(const physics::sph_pass & p : groups[g])
+        (p.symmetric() and active_ == nullptr ? symmetric : gather)
+          .push_back(p);
+      if(symmetric.empty())
+        apply_in_smoothinglength(
+          [&gather](body & particle, std::vector<body *> & nbs) {
+            for(const physics::sph_pass & p : gather)
+              p.function(particle, nbs);
+          });
+      else
+        apply_symmetric_(gather, symmetric);
+    }
+  }
+
+  template<typename... PASSES>
+  void apply_in_smoothinglength_fused(const physics::sph_pass & first,
+    const PASSES &... rest) {
+    apply_in_smoothinglength_fused(
+      std::vector<physics::sph_pass>{first, rest...});
   }
 
   /**
@@ -319,10 +560,29 @@ public:
   void apply_all(EF && ef, ARGS &&... args) {
     int64_t nelem = tree_.entities().size();
     for(int64_t i = 0; i < nelem; ++i) {
+      if(active_ != nullptr && !active_(tree_.entities()[i]))
+        continue;
       ef(tree_.entities()[i], std::forward<ARGS>(args)...);
     }
   }
 
+  /**
+   * @brief      Apply a batched function once, to the particles apply_all
+   *             would visit, e.g. eos::compute_all
+   *
+   * @tparam     EF         The function, on a vector of particle pointers
+   * @tparam     ARGS       Arguments of the function
+   */
+  template<typename EF, typename... ARGS>
+  void apply_all_batched(EF && ef, ARGS &&... args) {
+    scratch::vectors<body *> lease;
+    std::vector<body *> & particles = lease[0];
+    for(body & b : tree_.entities())
+      if(active_ == nullptr || active_(b))
+        particles.push_back(&b);
+    ef(particles, std::forward<ARGS>(args)...);
+  }
+
   /**
    * @brief      Apply a function on the vector of local bodies
    *
@@ -371,10 +631,130 @@ private:
   double macangle_; // Macangle for FMM
   double maxmasscell_; // Mass criterion for FMM
   range_t range_;
+  bool range_padding_ = true; // see setRangePadding
   tree_topology_t tree_; // The particle tree data structure
+  pm::mesh mesh_; // Long-range gravity of TreePM (pm_grid)
+  int far_age_ = -1; // calls since the far field refresh, -1 before any
+  bool far_refreshed_ = false;
+  double far_split_ = 0.; // split scale of the far field at its refresh
   double epsilon_ = 0.;
+  bool (*active_)(const body &) = nullptr; // see set_active
 
   const int refresh_tree = 0;
   int current_refresh = refresh_tree;
+
+  /**
+   * @brief      True if the far field of the gravity is kept between calls
+   */
+  static bool subcycle_gravity() {
+    return body_fields::has(body_fields::gravity_far) and
+           (param::gravity_far_interval > 1 or
+             param::gravity_far_tolerance > 0.);
+  }
+
+  /**
+   * @brief      True if the far field must be recomputed: at the first
+   *             call, after gravity_far_interval calls, or when the largest
+   *             change of the far field reaches gravity_far_tolerance
+   */
+  bool refresh_far_field() {
+    if(far_age_ < 0 or far_age_ >= param::gravity_far_interval)
+      return true;
+    if(param::gravity_far_tolerance <= 0.)
+      return false;
+    double change = 0.;
+    for(body & b : tree_.entities())
+      change = std::max(change, fmm::far_field_change(b));
+    MPI_Allreduce(
+      MPI_IN_PLACE, &change, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    return change >= param::gravity_far_tolerance;
+  }
+
+  /**
+   * @brief      One traversal applying the gather passes to each local
+   *             particle and the pairwise form of the symmetric passes to
+   *             each pair it owns (physics::owns_pair). The sums of the
+   *             ghosts are then sent back to their owners and each
+   *             symmetric pass finalizes the local particles.
+   *             The traversal is serial: the sums need no locking.
+   */
+  void apply_symmetric_(const std::vector<physics::sph_pass> & gather,
+    const std::vector<physics::sph_pass> & symmetric) {
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    struct ghost_sums {
+      int owner;
+      physics::pair_sums sums;
+    };
+
+    std::vector<body> & local = tree_.entities();
+    body * const first = local.data();
+    std::vector<physics::pair_sums> sums(local.size());
+    std::unordered_map<size_t, ghost_sums> ghosts;
+
+    tree_.traversal_sph([&](body & particle, std::vector<body *> & nbs) {
+      for(const physics::sph_pass & p : gather)
+        p.function(particle, nbs);
+      physics::pair_sums & sa = sums[&particle - first];
+      for(body * nb : nbs) {
+        if(nb == &particle or not physics::owns_pair(particle, *nb))
+          continue;
+        physics::pair_sums * sb;
+        if(nb >= first and nb < first + local.size())
+          sb = &sums[nb - first];
+        else {
+          ghost_sums & gs = ghosts[nb->id()];
+          gs.owner = nb->owner();
+          sb = &gs.sums;
+        }
+        for(const physics::sph_pass & p : symmetric)
+          p.pair(particle, *nb, sa, *sb);
+      }
+    });
+
+    if(size > 1) {
+      struct record {
+        size_t id;
+        physics::pair_sums sums;
+      };
+      std::vector<std::vector<record>> out(size);
+      for(const auto & g : ghosts)
+        out[g.second.owner].push_back({g.first, g.second.sums});
+
+      std::vector<int> scount(size), rcount(size), soff(size), roff(size);
+      std::vector<record> sbuf;
+      for(int i = 0; i < size; ++i) {
+        soff[i] = sbuf.size() * sizeof(record);
+        scount[i] = out[i].size() * sizeof(record);
+        sbuf.insert(sbuf.end(), out[i].begin(), out[i].end());
+      }
+      MPI_Alltoall(
+        &scount[0], 1, MPI_INT, &rcount[0], 1, MPI_INT, MPI_COMM_WORLD);
+      int rtotal = 0;
+      for(int i = 0; i < size; ++i) {
+        roff[i] = rtotal;
+        rtotal += rcount[i];
+      }
+      std::vector<record> rbuf(rtotal / sizeof(record));
+      MPI_Alltoallv(sbuf.data(), &scount[0], &soff[0], MPI_BYTE, rbuf.data(),
+        &rcount[0], &roff[0], MPI_BYTE, MPI_COMM_WORLD);
+
+      if(not rbuf.empty()) {
+        std::unordered_map<size_t, size_t> index;
+        for(size_t i = 0; i < local.size(); ++i)
+          index[local[i].id()] = i;
+        for(const record & r : rbuf) {
+          assert(index.count(r.id));
+          sums[index[r.id]] += r.sums;
+        }
+      }
+    }
+
+    for(size_t i = 0; i < local.size(); ++i)
+      for(const physics::sph_pass & p : symmetric)
+        p.finalize(local[i], sums[i]);
+  }
 };
 
@@ -990,7 +990,8 @@ outputDataHDF5(std::vector<body> & bodies,
   H5P_writeDataset(dataFile, "ax", b1);
   H5P_writeDataset(dataFile, "ay", b2);
   H5P_writeDataset(dataFile, "az", b3);
-  H5P_writeDataset(dataFile, "gradV", b4);
+  if constexpr(body_fields::has(body_fields::cullen))
+    H5P_writeDataset(dataFile, "gradV", b4);
 
   // Smoothing length, Density, Internal Energy
   pos = 0L;
@@ -1023,7 +1024,8 @@ outputDataHDF5(std::vector<body> & bodies,
   H5P_writeDataset(dataFile, "P", b1);
   H5P_writeDataset(dataFile, "m", b2);
   H5P_writeDataset(dataFile, "dt", b3);
-  H5P_writeDataset(dataFile, "traceSS", b4);
+  if constexpr(body_fields::has(body_fields::cullen))
+    H5P_writeDataset(dataFile, "traceSS", b4);
   H5P_writeDataset(dataFile, "id", bi);
   H5P_writeDataset(dataFile, "type", bint);
 
@@ -1037,8 +1039,10 @@ outputDataHDF5(std::vector<body> & bodies,
     pos++;
   }
   H5P_writeDataset(dataFile, "alpha", b1);
-  H5P_writeDataset(dataFile, "divergenceV", b2);
-  H5P_writeDataset(dataFile, "dDivVdt", b3);
+  if constexpr(body_fields::has(body_fields::cullen)) {
+    H5P_writeDataset(dataFile, "divergenceV", b2);
+    H5P_writeDataset(dataFile, "dDivVdt", b3);
+  }
 
   // Pressure, Mass, Id, timestep
   pos = 0L;
@@ -1049,8 +1053,10 @@ outputDataHDF5(std::vector<body> & bodies,
     bint[pos] = bid.state();
     pos++;
   }
-  H5P_writeDataset(dataFile, "trigger", b1);
-  H5P_writeDataset(dataFile, "xi", b2);
+  if constexpr(body_fields::has(body_fields::cullen)) {
+    H5P_writeDataset(dataFile, "trigger", b1);
+    H5P_writeDataset(dataFile, "xi", b2);
+  }
   H5P_writeDataset(dataFile, "state", bint);
 
   // Output the rank for analysis
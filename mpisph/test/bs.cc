@@ -34,6 +34,15 @@ TEST(body_system, write_range_read) {
     ASSERT_TRUE(fabs(range[1][i] - 0.50) < 1.0e-15);
   }
 
+  // without the smoothing length padding (gravity only)
+  bs.setRangePadding(false);
+  range = bs.getRange();
+  for(size_t i = 0; i < gdimension; ++i) {
+    ASSERT_TRUE(range[0][i] == 0.);
+    ASSERT_TRUE(fabs(range[1][i] - 0.45) < 1.0e-15);
+  }
+  bs.setRangePadding(true);
+
   bs.write_bodies(fileprefix, 0, 0);
   MPI_Finalize();
 }
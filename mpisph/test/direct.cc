@@ -0,0 +1,122 @@
+#include "gtest/gtest.h"
+
+#include <cmath>
+#include <iostream>
+#include <log.h>
+#include <map>
+#include <mpi.h>
+#include <omp.h>
+#include <vector>
+
+#include "bodies_system.h"
+#include "default_physics.h"
+
+using namespace std;
+using namespace flecsi;
+using namespace topology;
+
+namespace flecsi {
+namespace execution {
+void
+driver(int, char **) {}
+} // namespace execution
+} // namespace flecsi
+
+// Direct summation (direct.h): the blocks passed around the ranks must
+// add up the gravitation of every pair, as a plain double loop over all
+// the particles, with and without softening, for any number of threads.
+// The solver is selected by gravity_solver.
+
+// largest relative differences of the acceleration and the potential,
+// against the double loop, Plummer-softened by eps
+std::pair<double, double>
+compare(body_system<double, gdimension> & bs, double eps) {
+  int size;
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  std::vector<double> local;
+  for(auto & b : bs.getLocalbodies()) {
+    for(size_t d = 0; d < gdimension; ++d)
+      local.push_back(b.coordinates()[d]);
+    local.push_back(b.mass());
+  }
+  int n_local = local.size();
+  std::vector<int> counts(size), offsets(size, 0);
+  MPI_Allgather(&n_local, 1, MPI_INT, counts.data(), 1, MPI_INT,
+    MPI_COMM_WORLD);
+  for(int r = 1; r < size; ++r)
+    offsets[r] = offsets[r - 1] + counts[r - 1];
+  std::vector<double> all(offsets.back() + counts.back());
+  MPI_Allgatherv(local.data(), n_local, MPI_DOUBLE, all.data(), counts.data(),
+    offsets.data(), MPI_DOUBLE, MPI_COMM_WORLD);
+
+  double e[2] = {0., 0.};
+  for(auto & b : bs.getLocalbodies()) {
+    const point_t & x = b.coordinates();
+    point_t acc = 0.0;
+    double pot = 0.;
+    for(size_t j = 0; j < all.size(); j += gdimension + 1) {
+      point_t y;
+      for(size_t d = 0; d < gdimension; ++d)
+        y[d] = all[j + d];
+      if(y == x)
+        continue;
+      const double m = all[j + gdimension],
+                   r = std::sqrt(flecsi::dot(x - y, x - y) + eps * eps);
+      pot -= fmm::gc * m / r;
+      acc += fmm::gc * m / (r * r * r) * (y - x);
+    }
+    e[0] = std::max(
+      e[0], flecsi::magnitude(b.getGAcceleration() - acc) /
+              flecsi::magnitude(acc));
+    e[1] = std::max(e[1], std::abs(b.getGPotential() - pot) / std::abs(pot));
+  }
+  MPI_Allreduce(MPI_IN_PLACE, e, 2, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+  return {e[0], e[1]};
+}
+
+std::map<size_t, std::pair<point_t, double>>
+gravitation(body_system<double, gdimension> & bs, int threads) {
+  omp_set_num_threads(threads);
+  bs.gravitation();
+  std::map<size_t, std::pair<point_t, double>> r;
+  for(auto & b : bs.getLocalbodies())
+    r[b.id()] = {b.getGAcceleration(), b.getGPotential()};
+  return r;
+}
+
+TEST(direct, gravitation) {
+  MPI_Init(nullptr, nullptr);
+  fmm::gc = 1.;
+  body_system<double, gdimension> bs;
+  bs.read_bodies("io_test", "io_test", 0);
+  bs.update_iteration();
+  param::_gravity_solver = param::solver_direct;
+
+  for(const double eps : {0., .02}) {
+    param::_gravity_softening = eps > 0. ? param::soft_plummer
+                                         : param::soft_none;
+    param::_gravity_softening_length = eps;
+    bs.gravitation();
+    const auto e = compare(bs, eps);
+    std::cout << "softening " << eps << ": acceleration max " << e.first
+              << ", potential max " << e.second << std::endl;
+    EXPECT_LT(e.first, 1e-12);
+    EXPECT_LT(e.second, 1e-12);
+  }
+  param::_gravity_softening = param::soft_none;
+  param::_gravity_softening_length = 0.;
+
+  // each particle sums its sources in the same order on any thread
+  const int threads = std::max(omp_get_max_threads(), 4);
+  const auto serial = gravitation(bs, 1);
+  const auto parallel = gravitation(bs, threads);
+  ASSERT_EQ(parallel.size(), serial.size());
+  for(const auto & s : serial) {
+    for(size_t d = 0; d < gdimension; ++d)
+      EXPECT_EQ(parallel.at(s.first).first[d], s.second.first[d]) << s.first;
+    EXPECT_EQ(parallel.at(s.first).second, s.second.second) << s.first;
+  }
+
+  param::_gravity_solver = param::solver_fmm;
+  MPI_Finalize();
+}
@@ -0,0 +1,265 @@
+#include "gtest/gtest.h"
+
+// the order of the expansions under test, which may differ from the one
+// configured for the build
+#ifdef FMM_TEST_ORDER
+#undef FMM_ORDER
+#define FMM_ORDER FMM_TEST_ORDER
+#endif
+
+#include <cmath>
+#include <iostream>
+#include <log.h>
+#include <map>
+#include <mpi.h>
+#include <omp.h>
+#include <random>
+#include <vector>
+
+#include "bodies_system.h"
+#include "default_physics.h"
+
+using namespace std;
+using namespace flecsi;
+using namespace topology;
+
+namespace flecsi {
+namespace execution {
+void
+driver(int, char **) {}
+} // namespace execution
+} // namespace flecsi
+
+// The FMM gravitational acceleration and potential, at the order of the
+// build (FMM_ORDER), against the direct summation over all the particles
+// (direct.h).
+// Higher orders must reach a smaller error at the same opening angle.
+// The traversal split between threads must give the same results, to the
+// last bit, as a single thread. The acceptance criteria (fmm_mac) are
+// compared by their errors and their numbers of interactions, and give the
+// same results with the locally essential trees exchanged beforehand. With
+// the far field kept between refreshes (gravity_far_interval), the
+// accelerations after a small displacement must be closer to those
+// recomputed than the previous ones. Over successive steps, as in the
+// nbody driver, each call replaces the gravitation of the previous one.
+
+struct errors {
+  double acc_rms, acc_max, pot_max;
+};
+
+// errors against the direct summation (direct.h) on a copy of the
+// particles
+errors
+compare(body_system<double, gdimension> & bs) {
+  std::vector<body> exact = bs.getLocalbodies();
+  direct::gravitation(exact);
+  errors e = {0., 0., 0.};
+
+  double sum[2] = {0., 0.}; // error^2, |a|^2
+  for(size_t i = 0; i < exact.size(); ++i) {
+    const body & b = bs.getLocalbodies()[i];
+    const point_t acc = exact[i].getGAcceleration();
+    const double pot = exact[i].getGPotential();
+    const double err = flecsi::magnitude(b.getGAcceleration() - acc);
+    sum[0] += err * err;
+    sum[1] += flecsi::dot(acc, acc);
+    e.acc_max = std::max(e.acc_max, err / flecsi::magnitude(acc));
+    e.pot_max =
+      std::max(e.pot_max, std::abs(b.getGPotential() - pot) / std::abs(pot));
+  }
+  MPI_Allreduce(MPI_IN_PLACE, sum, 2, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+  MPI_Allreduce(
+    MPI_IN_PLACE, &e.acc_max, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+  MPI_Allreduce(
+    MPI_IN_PLACE, &e.pot_max, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+  e.acc_rms = std::sqrt(sum[0] / sum[1]);
+  return e;
+}
+
+std::map<size_t, std::pair<point_t, double>>
+gravitation(body_system<double, gdimension> & bs, int threads) {
+  omp_set_num_threads(threads);
+  bs.update_iteration();
+  bs.gravitation_fmm();
+  std::map<size_t, std::pair<point_t, double>> r;
+  for(auto & b : bs.getLocalbodies())
+    r[b.id()] = {b.getGAcceleration(), b.getGPotential()};
+  return r;
+}
+
+TEST(body_system, fmm) {
+  MPI_Init(nullptr, nullptr);
+  fmm::gc = 1.;
+
+  body_system<double, gdimension> bs;
+  bs.read_bodies("io_test", "io_test", 0);
+
+  // relative rms errors of the acceleration at each opening angle; the
+  // bounds are those of the order, with a margin of about 2
+  const double macangles[3] = {.2, .4, .6};
+  const double bounds[3][3] = {
+    {5e-2, 1.2e-1, 1.8e-1}, {5e-3, 2.5e-2, 3e-2}, {7e-4, 1.2e-2, 2e-2}};
+  for(int a = 0; a < 3; ++a) {
+    bs.setMacangle(macangles[a]);
+    bs.update_iteration();
+    bs.gravitation_fmm();
+    const errors e = compare(bs);
+    std::cout << "order " << FMM_ORDER << ", macangle " << macangles[a]
+              << ": acceleration rms " << e.acc_rms << " max " << e.acc_max
+              << ", potential max " << e.pot_max << std::endl;
+    EXPECT_LT(e.acc_rms, bounds[FMM_ORDER - 1][a]);
+  }
+
+  const int threads = std::max(omp_get_max_threads(), 4);
+  const auto serial = gravitation(bs, 1);
+  const auto parallel = gravitation(bs, threads);
+  ASSERT_EQ(parallel.size(), serial.size());
+  for(const auto & s : serial) {
+    for(size_t d = 0; d < gdimension; ++d)
+      EXPECT_EQ(parallel.at(s.first).first[d], s.second.first[d]) << s.first;
+    EXPECT_EQ(parallel.at(s.first).second, s.second.second) << s.first;
+  }
+  std::cout << "1 and " << threads << " threads: same results" << std::endl;
+
+  // acceptance criteria: errors and interactions summed over the ranks;
+  // the relative criterion uses the accelerations of the previous call
+  struct criterion {
+    const char * name;
+    param::fmm_mac_keyword mac;
+    double macangle, tolerance, max_cell_mass;
+  };
+  const criterion criteria[] = {{"radius .4", param::mac_radius, .4, 0., 0.},
+    {"bmax .4", param::mac_bmax, .4, 0., 0.},
+    {"relative .02", param::mac_relative, .8, .02, 0.},
+    {"relative .005", param::mac_relative, .8, .005, 0.},
+    {"relative .001", param::mac_relative, .8, .001, 0.},
+    {"cell mass", param::mac_radius, .4, 0., 1e-30}};
+  errors e[6];
+  unsigned long n[6][3];
+  for(int c = 0; c < 6; ++c) {
+    param::_fmm_mac = criteria[c].mac;
+    param::_fmm_mac_tolerance = criteria[c].tolerance;
+    param::_fmm_max_cell_mass = criteria[c].max_cell_mass;
+    bs.setMacangle(criteria[c].macangle);
+    bs.update_iteration();
+    bs.gravitation_fmm();
+    e[c] = compare(bs);
+    for(int k = 0; k < 3; ++k)
+      n[c][k] = bs.getFMMInteractions()[k];
+    MPI_Allreduce(
+      MPI_IN_PLACE, n[c], 3, MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
+    std::cout << "order " << FMM_ORDER << ", " << criteria[c].name
+              << ": acceleration rms " << e[c].acc_rms << " max "
+              << e[c].acc_max << "; interactions c2c " << n[c][0] << " m2p "
+              << n[c][1] << " p2p " << n[c][2] << std::endl;
+  }
+  param::_fmm_mac = param::mac_radius;
+  param::_fmm_max_cell_mass = 0.;
+
+  // the box corners are farther than the particles: more cells opened
+  EXPECT_LE(e[1].acc_rms, e[0].acc_rms);
+  EXPECT_GE(n[1][2], n[0][2]);
+  // a smaller tolerance opens more cells, for a smaller error
+  for(int c = 3; c < 5; ++c) {
+    EXPECT_LT(e[c].acc_rms, e[c - 1].acc_rms);
+    EXPECT_GT(n[c][0], n[c - 1][0]);
+    EXPECT_GT(n[c][2], n[c - 1][2]);
+  }
+  // every cell is heavier than fmm_max_cell_mass: only particles act on
+  // the cells and on the particles
+  EXPECT_EQ(n[5][1], 0u);
+  EXPECT_LT(e[5].acc_rms, e[0].acc_rms);
+
+  // locally essential trees exchanged before the traversal: the same
+  // interactions, without requests for the criteria bounded by the box of
+  // each rank
+  for(int c : {0, 1, 3}) {
+    param::_fmm_mac = criteria[c].mac;
+    param::_fmm_mac_tolerance = criteria[c].tolerance;
+    bs.setMacangle(criteria[c].macangle);
+    // both start from the same accelerations for the relative criterion
+    std::map<size_t, double> old;
+    for(auto & b : bs.getLocalbodies())
+      old[b.id()] = b.getGAccelerationOld();
+    const auto lazy = gravitation(bs, threads);
+    unsigned long requested[2] = {bs.getFMMRequested(), 0};
+    for(auto & b : bs.getLocalbodies())
+      b.setGAccelerationOld(old.at(b.id()));
+    param::_fmm_let = true;
+    const auto let = gravitation(bs, threads);
+    requested[1] = bs.getFMMRequested();
+    param::_fmm_let = false;
+    MPI_Allreduce(
+      MPI_IN_PLACE, requested, 2, MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
+    std::cout << criteria[c].name << ": remote cells requested "
+              << requested[0] << ", with the LET " << requested[1]
+              << std::endl;
+    EXPECT_EQ(requested[1], 0u);
+    ASSERT_EQ(let.size(), lazy.size());
+    for(const auto & s : lazy) {
+      for(size_t d = 0; d < gdimension; ++d)
+        EXPECT_EQ(let.at(s.first).first[d], s.second.first[d]) << s.first;
+      EXPECT_EQ(let.at(s.first).second, s.second.second) << s.first;
+    }
+  }
+  param::_fmm_mac = param::mac_radius;
+
+  // subcycling: the far field is kept between its refreshes, as accurate
+  // as the FMM; after a small displacement of the particles, only the near
+  // field is recomputed, closer to the direct summation than the previous
+  // accelerations
+  bs.setMacangle(.2);
+  param::_gravity_far_interval = 3;
+  const auto refreshed = gravitation(bs, threads);
+  EXPECT_TRUE(bs.getGravityFarRefreshed());
+  const errors e_far = compare(bs);
+  EXPECT_LT(e_far.acc_rms, bounds[FMM_ORDER - 1][0]);
+  std::mt19937 gen(1);
+  std::uniform_real_distribution<double> u(-1., 1.);
+  for(auto & b : bs.getLocalbodies()) {
+    point_t dx;
+    for(size_t d = 0; d < gdimension; ++d)
+      dx[d] = .2 * b.radius() * u(gen);
+    b.set_coordinates(b.coordinates() + dx);
+  }
+  gravitation(bs, threads);
+  EXPECT_FALSE(bs.getGravityFarRefreshed());
+  const errors e_kept = compare(bs);
+  for(auto & b : bs.getLocalbodies()) {
+    const auto it = refreshed.find(b.id());
+    if(it != refreshed.end())
+      b.setGAcceleration(it->second.first);
+  }
+  const errors e_stale = compare(bs);
+  std::cout << "far field refreshed: acceleration rms " << e_far.acc_rms
+            << "; after a displacement, kept " << e_kept.acc_rms
+            << ", previous accelerations " << e_stale.acc_rms << std::endl;
+  EXPECT_LT(e_kept.acc_rms, (FMM_ORDER >= 2 ? .5 : 1.) * e_stale.acc_rms);
+  // the far field has moved by more than the tolerance: refreshed
+  param::_gravity_far_tolerance = 1e-12;
+  gravitation(bs, threads);
+  EXPECT_TRUE(bs.getGravityFarRefreshed());
+  param::_gravity_far_interval = 1;
+  param::_gravity_far_tolerance = 0.;
+
+  // successive steps with the particles moved in between: the same errors
+  // against the direct summation at each step
+  for(int step = 0; step < 3; ++step) {
+    for(auto & b : bs.getLocalbodies()) {
+      point_t dx;
+      for(size_t d = 0; d < gdimension; ++d)
+        dx[d] = .2 * b.radius() * u(gen);
+      b.set_coordinates(b.coordinates() + dx);
+    }
+    bs.update_iteration();
+    bs.gravitation();
+    const errors e_step = compare(bs);
+    std::cout << "step " << step << ": acceleration rms " << e_step.acc_rms
+              << ", potential max " << e_step.pot_max << std::endl;
+    EXPECT_LT(e_step.acc_rms, bounds[FMM_ORDER - 1][0]) << step;
+    // added to that of the previous step, it would be off by about 1
+    EXPECT_LT(e_step.pot_max, .5) << step;
+  }
+
+  MPI_Finalize();
+}
@@ -0,0 +1,113 @@
+#include "gtest/gtest.h"
+
+#include <cmath>
+#include <iostream>
+#include <log.h>
+#include <map>
+#include <mpi.h>
+
+#include "bodies_system.h"
+#include "default_physics.h"
+
+using namespace std;
+using namespace flecsi;
+using namespace topology;
+
+namespace flecsi {
+namespace execution {
+void
+driver(int, char **) {}
+} // namespace execution
+} // namespace flecsi
+
+// The viscosity switch updated in the density pass from the divergence
+// saved at the previous step (sph_viscosity_lagged_switch) must give the
+// same alpha as the separate traversal when the divergence has not
+// changed since.
+
+void
+set_fields(body & b) {
+  const point_t & x = b.coordinates();
+  point_t v = 0.0;
+  double s = 0.;
+  for(size_t d = 0; d < gdimension; ++d) {
+    v[d] = std::sin(7. * x[d] + d);
+    s += x[d];
+  }
+  b.set_radius(.125 + .025 * std::sin(11. * x[0] + 13. * x[gdimension - 1]));
+  b.setVelocity(v);
+  b.setDensity(1. + .3 * std::cos(5. * s));
+  b.setSoundspeed(1. + .1 * std::cos(4. * s));
+  b.setInternalenergy(1. + .2 * std::sin(3. * s));
+  b.setTotalenergy(b.getInternalenergy() + .5 * flecsi::dot(v, v));
+  b.setDivergenceV(std::sin(9. * s));
+  b.setAlpha(.05);
+}
+
+// divergence and alpha of the previous step, as set_fields
+void
+reset_switch(body & b) {
+  double s = 0.;
+  for(size_t d = 0; d < gdimension; ++d)
+    s += b.coordinates()[d];
+  b.setDivergenceV(std::sin(9. * s));
+  b.setAlpha(.05);
+}
+
+std::map<size_t, double>
+alphas(body_system<double, gdimension> & bs) {
+  std::map<size_t, double> r;
+  for(auto & b : bs.getLocalbodies())
+    r[b.id()] = b.getAlpha();
+  return r;
+}
+
+TEST(body_system, lagged_switch) {
+  MPI_Init(nullptr, nullptr);
+  param::_sph_viscosity = param::visc_cullen;
+  kernels::select();
+  viscosity::select();
+  physics::select();
+  physics::iteration = param::initial_iteration + 1;
+  physics::dt = 1e-3;
+
+  body_system<double, gdimension> bs;
+  bs.read_bodies("io_test", "io_test", 0);
+  bs.apply_all(set_fields);
+  bs.update_iteration();
+  bs.reset_ghosts();
+
+  // reference: density pass, then the switch in its own traversal
+  ASSERT_FALSE(viscosity::lagged_switch());
+  bs.apply_in_smoothinglength(physics::compute_density_pressure_soundspeed);
+  bs.reset_ghosts();
+  bs.apply_in_smoothinglength(viscosity::compute_alpha);
+  const auto reference = alphas(bs);
+
+  // same step again, with the switch in the density pass, in the order of
+  // the drivers: the divergence is saved before update_iteration shares
+  // it with the ghosts
+  param::_sph_viscosity_lagged_switch = true;
+  ASSERT_TRUE(viscosity::lagged_switch());
+  bs.apply_all(viscosity::save_divergence);
+  bs.apply_all(reset_switch);
+  bs.update_iteration();
+  bs.apply_in_smoothinglength(physics::compute_density_pressure_soundspeed);
+  const auto lagged = alphas(bs);
+
+  ASSERT_EQ(lagged.size(), reference.size());
+  size_t raised = 0;
+  for(const auto & r : reference) {
+    EXPECT_EQ(lagged.at(r.first), r.second) << r.first;
+    raised += r.second > .05;
+  }
+  std::cout << raised << " of " << reference.size() << " alpha raised"
+            << std::endl;
+
+  // the switch stays in its own traversal for the first iteration
+  physics::iteration = param::initial_iteration;
+  EXPECT_FALSE(viscosity::lagged_switch());
+
+  param::_sph_viscosity_lagged_switch = false;
+  MPI_Finalize();
+}
@@ -0,0 +1,121 @@
+#include "gtest/gtest.h"
+
+#include <cmath>
+#include <iostream>
+#include <log.h>
+#include <map>
+#include <mpi.h>
+
+#include "bodies_system.h"
+#include "default_physics.h"
+
+using namespace std;
+using namespace flecsi;
+using namespace topology;
+
+namespace flecsi {
+namespace execution {
+void
+driver(int, char **) {}
+} // namespace execution
+} // namespace flecsi
+
+// The pair cache (sph_pair_cache) must give the same viscosity switch,
+// accelerations and energy rates as recomputing the kernel gradients,
+// bit for bit, including when its budget only holds some of the particles.
+
+struct rates {
+  double alpha;
+  point_t acc;
+  double dudt, dedt;
+};
+
+void
+set_smoothinglength(body & b) {
+  const point_t & x = b.coordinates();
+  b.set_radius(.125 + .025 * std::sin(11. * x[0] + 13. * x[gdimension - 1]));
+}
+
+void
+set_fields(body & b) {
+  const point_t & x = b.coordinates();
+  point_t v = 0.0;
+  double s = 0.;
+  for(size_t d = 0; d < gdimension; ++d) {
+    v[d] = std::sin(7. * x[d] + d);
+    s += x[d];
+  }
+  b.setVelocity(v);
+  b.setVelocityhalf(v * .9);
+  b.setDensity(1. + .3 * std::cos(5. * s));
+  b.setPressure(1. + .4 * std::sin(3. * s));
+  b.setSoundspeed(1. + .1 * std::cos(4. * s));
+  b.setDivergenceV(std::sin(9. * s));
+  b.setAlpha(.5);
+  b.setGAcceleration(0.0);
+}
+
+// one step of the hydro driver: viscosity switch, acceleration, kick and
+// energy rates
+std::map<size_t, rates>
+step(body_system<double, gdimension> & bs, bool cache, double mb) {
+  param::_sph_pair_cache = cache;
+  param::_sph_pair_cache_mb = mb;
+  bs.apply_all(set_smoothinglength);
+  bs.update_iteration();
+  bs.apply_all(set_fields);
+  bs.reset_ghosts();
+  bs.apply_in_smoothinglength(viscosity::compute_alpha);
+  bs.reset_ghosts();
+  bs.apply_in_smoothinglength_fused(physics::passes::acceleration());
+  bs.apply_all(integration::leapfrog_kick_v);
+  bs.reset_ghosts();
+  bs.apply_in_smoothinglength_fused(physics::passes::dudt());
+  bs.apply_in_smoothinglength_fused(physics::passes::dedt());
+  std::map<size_t, rates> r;
+  for(auto & b : bs.getLocalbodies())
+    r[b.id()] = {b.getAlpha(), b.getAcceleration(), b.getDudt(), b.getDedt()};
+  return r;
+}
+
+TEST(body_system, pair_cache) {
+  MPI_Init(nullptr, nullptr);
+  param::_sph_viscosity = param::visc_cullen;
+  kernels::select();
+  viscosity::select();
+  physics::select();
+  physics::iteration = param::relaxation_steps;
+  physics::dt = 1e-3;
+
+  body_system<double, gdimension> bs;
+  bs.read_bodies("io_test", "io_test", 0);
+
+  const auto reference = step(bs, false, 0.);
+  EXPECT_EQ(physics::pair_geometry.hits() + physics::pair_geometry.misses(),
+    0);
+  for(const double mb : {512., 1e-2}) {
+    const auto cached = step(bs, true, mb);
+    const size_t hits = physics::pair_geometry.hits(),
+                 misses = physics::pair_geometry.misses();
+    std::cout << mb << " MB budget: " << hits << " hits, " << misses
+              << " misses, " << physics::pair_geometry.bytes() << " bytes"
+              << std::endl;
+    EXPECT_LE(physics::pair_geometry.bytes(), mb * (1 << 20));
+    // filled by the switch, read by the three other passes
+    EXPECT_GT(misses, 0);
+    EXPECT_EQ(hits, 3 * misses);
+
+    ASSERT_EQ(cached.size(), reference.size());
+    for(const auto & r : reference) {
+      const rates & c = cached.at(r.first);
+      EXPECT_EQ(c.alpha, r.second.alpha) << r.first;
+      for(size_t d = 0; d < gdimension; ++d)
+        EXPECT_EQ(c.acc[d], r.second.acc[d]) << r.first;
+      EXPECT_EQ(c.dudt, r.second.dudt) << r.first;
+      EXPECT_EQ(c.dedt, r.second.dedt) << r.first;
+    }
+  }
+
+  param::_sph_pair_cache = false;
+  MPI_Finalize();
+}
@@ -0,0 +1,129 @@
+#include "gtest/gtest.h"
+
+#include <cmath>
+#include <iostream>
+#include <log.h>
+#include <map>
+#include <mpi.h>
+
+#include "bodies_system.h"
+#include "default_physics.h"
+
+using namespace std;
+using namespace flecsi;
+using namespace topology;
+
+namespace flecsi {
+namespace execution {
+void
+driver(int, char **) {}
+} // namespace execution
+} // namespace flecsi
+
+// Compares the symmetric pairwise passes (sph_symmetric_pairs) with the
+// gather passes, and checks that the symmetric hydro forces conserve the
+// momentum to round-off. Runs serial or over several ranks, in which case
+// the sums of the ghosts are returned to their owners.
+
+struct rates {
+  point_t acc;
+  double dudt, dedt;
+};
+
+// smoothing lengths of 2 to 3 particle spacings, unequal so that the
+// pairs are owned by either side
+void
+set_smoothinglength(body & b) {
+  const point_t & x = b.coordinates();
+  b.set_radius(.125 + .025 * std::sin(11. * x[0] + 13. * x[gdimension - 1]));
+}
+
+// smooth fields, functions of the position only, so that every rank
+// and every ghost sees the same values
+void
+set_fields(body & b) {
+  const point_t & x = b.coordinates();
+  point_t v = 0.0;
+  double s = 0.;
+  for(size_t d = 0; d < gdimension; ++d) {
+    v[d] = std::sin(7. * x[d] + d);
+    s += x[d];
+  }
+  b.setVelocity(v);
+  b.setVelocityhalf(v * .9);
+  b.setDensity(1. + .3 * std::cos(5. * s));
+  b.setPressure(1. + .4 * std::sin(3. * s));
+  b.setSoundspeed(1. + .1 * std::cos(4. * s));
+  b.setAlpha(1.);
+  b.setGAcceleration(0.0);
+}
+
+std::map<size_t, rates>
+apply(body_system<double, gdimension> & bs, bool symmetric) {
+  param::_sph_symmetric_pairs = symmetric;
+  bs.apply_all(set_fields);
+  bs.reset_ghosts();
+  bs.apply_in_smoothinglength_fused(physics::passes::acceleration(),
+    physics::passes::dudt(), physics::passes::dedt());
+  std::map<size_t, rates> r;
+  for(auto & b : bs.getLocalbodies())
+    r[b.id()] = {b.getAcceleration(), b.getDudt(), b.getDedt()};
+  return r;
+}
+
+TEST(body_system, symmetric_pairs) {
+  MPI_Init(nullptr, nullptr);
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  const char * fileprefix = "io_test";
+  param::_sph_viscosity = param::visc_cullen;
+  kernels::select();
+  physics::select();
+  physics::iteration = param::relaxation_steps;
+
+  body_system<double, gdimension> bs;
+  bs.read_bodies(fileprefix, fileprefix, 0);
+  bs.apply_all(set_smoothinglength);
+  bs.update_iteration();
+
+  const auto gather = apply(bs, false);
+  const auto pairs = apply(bs, true);
+  ASSERT_EQ(gather.size(), pairs.size());
+
+  double scale_acc = 0., scale_dudt = 0., scale_dedt = 0.;
+  for(const auto & g : gather) {
+    scale_acc = std::max(scale_acc, magnitude(g.second.acc));
+    scale_dudt = std::max(scale_dudt, std::abs(g.second.dudt));
+    scale_dedt = std::max(scale_dedt, std::abs(g.second.dedt));
+  }
+
+  // total momentum change, gather and symmetric forms
+  double momentum[2 * gdimension] = {0.};
+  for(auto & b : bs.getLocalbodies()) {
+    const rates & g = gather.at(b.id());
+    const rates & p = pairs.at(b.id());
+    for(size_t d = 0; d < gdimension; ++d) {
+      EXPECT_NEAR(p.acc[d], g.acc[d], 1e-10 * scale_acc) << b.id();
+      momentum[d] += b.mass() * g.acc[d];
+      momentum[gdimension + d] += b.mass() * p.acc[d];
+    }
+    EXPECT_NEAR(p.dudt, g.dudt, 1e-10 * scale_dudt) << b.id();
+    EXPECT_NEAR(p.dedt, g.dedt, 1e-10 * scale_dedt) << b.id();
+  }
+  MPI_Allreduce(MPI_IN_PLACE, momentum, 2 * gdimension, MPI_DOUBLE, MPI_SUM,
+    MPI_COMM_WORLD);
+
+  double mass = 0.;
+  for(auto & b : bs.getLocalbodies())
+    mass += b.mass();
+  MPI_Allreduce(MPI_IN_PLACE, &mass, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+  for(size_t d = 0; d < gdimension; ++d)
+    EXPECT_LT(std::abs(momentum[gdimension + d]), 1e-12 * mass * scale_acc);
+  if(rank == 0)
+    std::cout << "momentum change, gather: " << momentum[0]
+              << ", symmetric: " << momentum[gdimension] << std::endl;
+
+  param::_sph_symmetric_pairs = false;
+  MPI_Finalize();
+}
@@ -84,6 +84,23 @@ TEST(tree_topology, neighbors_sphere_NORMAL) {
 
   ASSERT_TRUE(t.get_node(t.root())->mass() == n * mass);
 
+  // the entities below each node are a contiguous range of entities()
+  EXPECT_EQ(t.get_node(t.root())->first_entity(), 0);
+  EXPECT_EQ(t.get_node(t.root())->last_entity(), n);
+  t.traversal(t.root(), [&](auto * cell) {
+    if(!cell->is_node())
+      return false;
+    auto * node = t.get_node(cell);
+    EXPECT_EQ(node->last_entity() - node->first_entity(),
+      node->sub_entities());
+    for(int k = node->first_entity(); k < node->last_entity(); ++k) {
+      key_type key = t.entities()[k].key();
+      key.truncate(cell->key().depth());
+      EXPECT_EQ(key, cell->key());
+    }
+    return true;
+  });
+
   for(size_t i = 0; i < n; ++i) {
     auto ent = &(t.entities()[i]);
 
@@ -0,0 +1,169 @@
+#include "gtest/gtest.h"
+
+// the order of the expansions under test, which may differ from the one
+// configured for the build
+#ifdef FMM_TEST_ORDER
+#undef FMM_ORDER
+#define FMM_ORDER FMM_TEST_ORDER
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <iostream>
+#include <log.h>
+#include <mpi.h>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "bodies_system.h"
+#include "default_physics.h"
+
+using namespace std;
+using namespace flecsi;
+using namespace topology;
+
+namespace flecsi {
+namespace execution {
+void
+driver(int, char **) {}
+} // namespace execution
+} // namespace flecsi
+
+// TreePM gravity (pm_grid): the mesh for the long range and the tree for
+// the short range must add up to the direct summation over all the
+// particles, to the accuracy of the mesh, for both assignments. The cells
+// within the cutoff need their quadrupoles (FMM_TEST_ORDER 2). The FFT of
+// the mesh, complex and real, are checked against a direct discrete
+// Fourier transform. The grids the FFT cannot handle are rejected.
+
+// relative rms errors of the acceleration and potential
+std::pair<double, double>
+compare(body_system<double, gdimension> & bs) {
+  int size;
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  std::vector<double> local;
+  for(auto & b : bs.getLocalbodies()) {
+    for(size_t d = 0; d < gdimension; ++d)
+      local.push_back(b.coordinates()[d]);
+    local.push_back(b.mass());
+  }
+  int n_local = local.size();
+  std::vector<int> counts(size), offsets(size, 0);
+  MPI_Allgather(&n_local, 1, MPI_INT, counts.data(), 1, MPI_INT,
+    MPI_COMM_WORLD);
+  for(int r = 1; r < size; ++r)
+    offsets[r] = offsets[r - 1] + counts[r - 1];
+  std::vector<double> all(offsets.back() + counts.back());
+  MPI_Allgatherv(local.data(), n_local, MPI_DOUBLE, all.data(), counts.data(),
+    offsets.data(), MPI_DOUBLE, MPI_COMM_WORLD);
+
+  double sum[4] = {0., 0., 0., 0.}; // errors^2 and norms^2
+  for(auto & b : bs.getLocalbodies()) {
+    const point_t & x = b.coordinates();
+    point_t acc = 0.0;
+    double pot = 0.;
+    for(size_t j = 0; j < all.size(); j += gdimension + 1) {
+      point_t y;
+      for(size_t d = 0; d < gdimension; ++d)
+        y[d] = all[j + d];
+      if(y == x)
+        continue;
+      acc += fmm::gravitation_p2p(pot, x, y, all[j + gdimension]);
+    }
+    const double err = flecsi::magnitude(b.getGAcceleration() - acc);
+    sum[0] += err * err;
+    sum[1] += flecsi::dot(acc, acc);
+    sum[2] += (b.getGPotential() - pot) * (b.getGPotential() - pot);
+    sum[3] += pot * pot;
+  }
+  MPI_Allreduce(MPI_IN_PLACE, sum, 4, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+  return {std::sqrt(sum[0] / sum[1]), std::sqrt(sum[2] / sum[3])};
+}
+
+TEST(treepm, fft) {
+  const size_t n = 64;
+  std::mt19937 gen(1);
+  std::uniform_real_distribution<double> u(-1., 1.);
+  std::vector<pm::complex_t> a(n), f;
+  for(auto & v : a)
+    v = {u(gen), u(gen)};
+  f = a;
+  pm::fft(f.data(), n, -1);
+  double err = 0.;
+  for(size_t k = 0; k < n; ++k) {
+    pm::complex_t s = 0.;
+    for(size_t j = 0; j < n; ++j)
+      s += a[j] * std::polar(1., -2. * M_PI * j * k / n);
+    err = std::max(err, std::abs(s - f[k]));
+  }
+  pm::fft(f.data(), n, 1);
+  for(size_t j = 0; j < n; ++j)
+    err = std::max(err, std::abs(f[j] / double(n) - a[j]));
+  EXPECT_LT(err, 1e-12);
+
+  // real values, in the first n/2 complex values, and their n/2 + 1 first
+  // coefficients
+  std::vector<double> x(n);
+  for(auto & v : x)
+    v = u(gen);
+  std::vector<pm::complex_t> r(n / 2 + 1);
+  std::copy(x.begin(), x.end(), reinterpret_cast<double *>(r.data()));
+  pm::rfft(r.data(), n, -1);
+  err = 0.;
+  for(size_t k = 0; k <= n / 2; ++k) {
+    pm::complex_t s = 0.;
+    for(size_t j = 0; j < n; ++j)
+      s += x[j] * std::polar(1., -2. * M_PI * j * k / n);
+    err = std::max(err, std::abs(s - r[k]));
+  }
+  pm::rfft(r.data(), n, 1);
+  const double * y = reinterpret_cast<const double *>(r.data());
+  for(size_t j = 0; j < n; ++j)
+    err = std::max(err, std::abs(y[j] / double(n) - x[j]));
+  EXPECT_LT(err, 1e-12);
+}
+
+TEST(treepm, gravitation) {
+  MPI_Init(nullptr, nullptr);
+  fmm::gc = 1.;
+  body_system<double, gdimension> bs;
+  bs.read_bodies("io_test", "io_test", 0);
+  bs.setMacangle(.4);
+
+  struct run {
+    int grid;
+    param::pm_assignment_keyword assignment;
+    double bound;
+  };
+  for(const run & r : {run{32, param::pm_cic, 1e-2},
+        run{32, param::pm_tsc, 6e-3}, run{64, param::pm_tsc, 1e-3}}) {
+    param::_pm_grid = r.grid;
+    param::_pm_assignment = r.assignment;
+    bs.update_iteration();
+    bs.gravitation_fmm();
+    const auto e = compare(bs);
+    unsigned long n[3];
+    for(int k = 0; k < 3; ++k)
+      n[k] = bs.getFMMInteractions()[k];
+    MPI_Allreduce(MPI_IN_PLACE, n, 3, MPI_UNSIGNED_LONG, MPI_SUM,
+      MPI_COMM_WORLD);
+    std::cout << "mesh " << r.grid << "^3, "
+              << (r.assignment == param::pm_cic ? "CIC" : "TSC")
+              << ": acceleration rms " << e.first << ", potential rms "
+              << e.second << "; interactions c2c " << n[0] << " m2p " << n[1]
+              << " p2p " << n[2] << std::endl;
+    EXPECT_LT(e.first, r.bound);
+    EXPECT_LT(e.second, r.bound);
+  }
+
+  // not a power of 2, or too small for the ghost points of the mesh
+  for(const int grid : {48, 7, 4}) {
+    param::_pm_grid = grid;
+    bs.update_iteration();
+    EXPECT_THROW(bs.gravitation_fmm(), std::runtime_error) << grid;
+  }
+  param::_pm_grid = 0;
+  MPI_Finalize();
+}
@@ -28,7 +28,11 @@
 
 #define OUTPUT
 
+#ifdef EXT_GDIMENSION
+static const size_t gdimension = EXT_GDIMENSION;
+#else
 static const size_t gdimension = 3;
+#endif
 using type_t = double;
 
 #endif // _user_h_